@@ -4,12 +4,23 @@
 #include <stdint.h>
 #include "lvgl.h"
 
+#include "memory_map.h"
+
 
 class BasePageWindow
 {
 public:
+    virtual ~BasePageWindow() {}
+    
+    // Pages are created and destroyed on every switch: UI pools, no heap fragmentation
+    static void * operator new(size_t size) { return ui_pool_alloc(size); }
+    static void operator delete(void * ptr) { ui_pool_free(ptr); }
+    
     virtual void Create(lv_obj_t * parent) = 0;
     virtual void Destroy() = 0;
+    
+    // Periodic refresh of page contents, called from UI scheduler
+    virtual void Update() {}
 
 protected:
     lv_obj_t * m_page_handle;
@@ -12,6 +12,7 @@
 
 #include "StepTicker.h"
 #include "GCodeParser.h"
+#include "MotionAxes.h"
 
 #pragma anon_unions
 
@@ -25,6 +26,7 @@ typedef struct
     int64_t acceleration_change; // 2.62 fixed point signed
     int64_t deceleration_change; // 2.62 fixed point
     int64_t plateau_rate; // 2.62 fixed point
+    int64_t hold_deceleration_change; // 2.62 fixed point, full block acceleration (used by feed hold)
     uint32_t steps_to_move;
     uint32_t step_count;
     uint32_t next_accel_event;
@@ -35,7 +37,7 @@ class Block
     public:
         Block();
 
-        void calculate_trapezoid( float entry_speed, float exit_speed );
+        bool calculate_trapezoid( float entry_speed, float exit_speed );     // false: block already ticking, left untouched
 
         float reverse_pass(float exit_speed);
         float forward_pass(float next_entry_speed);
@@ -43,6 +45,7 @@ class Block
         void ready() { is_ready= true; }
         void clear();
         float get_trapezoid_rate(int i) const;
+        void trim_executed_steps(uint32_t * executed_steps);
 
     private:
         float max_allowable_speed( float acceleration, float target_velocity, float distance);
@@ -62,14 +65,23 @@ class Block
 
         float max_entry_speed;
 
+        // Kept to replan the block when overrides change
+        float programmed_speed;   // Requested speed in mm per second, before overrides
+        float speed_limit;        // Maximum speed allowed by the axes in this direction
+        float max_junction_speed; // Entry speed limit from junction deviation only
+
         // this is tick info needed for this block. applies to all motors
         uint32_t accelerate_until;
         uint32_t decelerate_after;
         uint32_t total_move_ticks;
         uint8_t  direction_bits;     // Direction for each axis in bit form, relative to the direction port's mask
 
-        // need info for each active motor
-        tickinfo_t *tick_info;
+        // Output changes applied by the step ticker when this block starts [CoolantController output bits]
+        uint8_t  output_mask;
+        uint8_t  output_values;
+
+        // need info for each active motor [driven axes only]
+        tickinfo_t tick_info[MOTION_AXES_COUNT];
 
         struct 
         {
@@ -80,7 +92,7 @@ class Block
             bool is_g123:1;                      // set if this is a G1, G2 or G3
             volatile bool is_ticking:1;          // set when this block is being actively ticked by the stepticker
             volatile bool locked:1;              // set to true when the critical data is being updated, stepticker will have to skip if this is set
-            //uint16_t s_value:12;                 // for laser 1.11 Fixed point
+            uint16_t s_value:12;                 // for laser 1.11 Fixed point, relative to maximum spindle speed
         };
 };
 
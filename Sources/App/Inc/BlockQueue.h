@@ -46,6 +46,13 @@ public:
      */
     bool resize(unsigned int new_size);
 
+    /*
+     * use a statically allocated ring instead (see memory_map.h)
+     *
+     * returns true on success, or false if queue is not empty or already has a ring
+     */
+    bool assign(Block* storage, unsigned int size);
+
 protected:
     /*
      * these functions are protected as they should only be used internally
@@ -69,6 +76,7 @@ protected:
 
 private:
     Block* ring;
+    bool static_ring;   // assigned storage, never deleted
 };
 
 #endif
@@ -12,6 +12,12 @@
 #include <stdint.h>
 #include "BlockQueue.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Fallback poll while waiting for the motion service to free blocks (halt requests are not notified)
+#define CONVEYOR_WAIT_POLL_MS       100
+
 #pragma anon_unions
 
 class Block;
@@ -26,19 +32,24 @@ public:
     Conveyor();
     void start();
 
-    void on_idle();
+    void on_service();  // Motion service task, see MachineCore::motion_task_entry
     void on_halt(void *);
 
     void wait_for_idle(bool wait_for_motors=true);
     bool is_queue_empty() { return queue.is_empty(); };
     bool is_queue_full() { return queue.is_full(); };
     bool is_idle() const;
+    
+    uint32_t get_queue_size() const { return queue_size; }
+    uint32_t get_queued_blocks_count() const;
 
     // returns next available block writes it to block and returns true
     bool get_next_block(Block **block);
     void block_finished();
 
     void flush_queue(void);
+    void trim_held_block(void);
+    void discard_held_blocks(void);
     float get_current_feedrate() const { return current_feedrate; }
     void force_queue() { check_queue(true); }
 
@@ -47,11 +58,13 @@ public:
 private:
     void check_queue(bool force= false);
     void queue_head_block(void);
+    void wait_for_free_blocks(void);
 
     BlockQueue queue;  // Queue of Blocks
 
     uint32_t queue_delay_time_ms;
     size_t queue_size;
+    volatile TaskHandle_t waiting_task;  // Producer waiting for the garbage collector
     float current_feedrate; // actual nominal feedrate that current block is running at in mm/sec
 
     struct 
@@ -16,6 +16,16 @@
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// Output bits, as carried by the blocks [Block::output_mask, Block::output_values]
+#define OUTPUT_COOLANT_FLOOD_BIT        (1 << 0)
+#define OUTPUT_COOLANT_MIST_BIT         (1 << 1)    // Same pin as flood on this board
+#define OUTPUT_AUX_FIRST_BIT_POS        2
+
+#define OUTPUT_COOLANT_MASK             (OUTPUT_COOLANT_FLOOD_BIT | OUTPUT_COOLANT_MIST_BIT)
+
+// M62-M65 P<index>. P0: PWM3 output [PB7] driven fully on/off
+#define AUX_OUTPUTS_COUNT               1
+
 ///////////////////////////////////////////////////////////////////////////////
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -47,13 +57,27 @@ public:
     CoolantController();
     ~CoolantController();
 
+    void Start();
+    
     void EnableMist();
     void EnableFlood();
     void Stop();
+    
+    // Changes the outputs selected by mask. Called from task context or from the step ticker ISR
+    void ApplyOutputs(uint8_t mask, uint8_t values);
+    
+    inline uint8_t GetOutputs() { return m_outputs; }
+    
+    static CoolantController *getInstance() { return instance; }
         
 protected:
+    static CoolantController *instance;
+    
+    volatile uint8_t            m_outputs;
+    
     ///////////////////////////////////////////////////////////////////////////////////////////
     
+    void update_pins(uint8_t outputs);
 };
 
 #endif
@@ -129,6 +129,24 @@ enum GCODE_STATUS_RESULTS
 	GCODE_ERROR_MISSING_FEEDRATE_INVERSE_TIME_MODE,
     
     GCODE_ERROR_TARGET_OUTSIDE_LIMIT_VALUES,
+    
+    GCODE_ERROR_SETTINGS_WRITE,
+    
+    GCODE_ERROR_INVALID_OVERRIDE_VALUE,
+    
+    GCODE_ERROR_PROBE_INITIAL_STATE,
+    GCODE_ERROR_PROBE_NO_CONTACT,
+    
+    GCODE_ERROR_HOMING_SWITCH_NOT_FOUND,
+    GCODE_ERROR_HOMING_PULL_OFF,
+    GCODE_ERROR_HOMING_ABORTED,
+    
+    GCODE_ERROR_MACHINE_ALARM_LOCKED,
+    GCODE_ERROR_STEPPER_FAULT_ACTIVE,
+    GCODE_ERROR_SPINDLE_NOT_AT_SPEED,
+    GCODE_ERROR_INVALID_AUX_OUTPUT,
+    GCODE_ERROR_FILE_WRITE,
+    GCODE_ERROR_DISK_UNAVAILABLE,
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -140,6 +158,9 @@ typedef enum GCODE_MODAL_MOTION_MODES
     MODAL_MOTION_MODE_HELICAL_CW = 20,      // G2
     MODAL_MOTION_MODE_HELICAL_CCW = 30,     // G3        
     MODAL_MOTION_MODE_PROBE = 382,          // G38.2
+    MODAL_MOTION_MODE_PROBE_NO_ERROR = 383, // G38.3
+    MODAL_MOTION_MODE_PROBE_AWAY = 384,     // G38.4
+    MODAL_MOTION_MODE_PROBE_AWAY_NO_ERROR = 385, // G38.5
     MODAL_MOTION_MODE_CANCEL_MOTION = 800,  // G80
 
     MODAL_MOTION_MODE_CANNED_DRILL_G81 = 810,   // G81
@@ -223,6 +244,33 @@ typedef enum GCODE_MODAL_SPINDLE_MODES
 
 ///////////////////////////////////////////////////////////////////////////////
 
+typedef enum GCODE_OVERRIDE_CODES
+{
+    OVERRIDE_CODE_NONE = 0,
+    OVERRIDE_ENABLE = 48,                       // M48
+    OVERRIDE_DISABLE = 49,                      // M49
+    OVERRIDE_SET_FEED = 50,                     // M50 P<percent>
+    OVERRIDE_SET_RAPID = 56,                    // M56 P<percent>
+}GCODE_OVERRIDE_CODES;
+
+typedef enum GCODE_AUX_OUTPUT_CODES
+{
+    AUX_OUTPUT_CODE_NONE = 0,
+    AUX_OUTPUT_SYNC_ON = 62,                    // M62 P<index> [with the next move]
+    AUX_OUTPUT_SYNC_OFF = 63,                   // M63 P<index> [with the next move]
+    AUX_OUTPUT_ON = 64,                         // M64 P<index> [immediate]
+    AUX_OUTPUT_OFF = 65,                        // M65 P<index> [immediate]
+}GCODE_AUX_OUTPUT_CODES;
+
+///////////////////////////////////////////////////////////////////////////////
+
+#define OVERRIDE_FEED_MIN_PERCENT       10
+#define OVERRIDE_FEED_MAX_PERCENT       200
+#define OVERRIDE_RAPID_MIN_PERCENT      1
+#define OVERRIDE_RAPID_MAX_PERCENT      100
+
+///////////////////////////////////////////////////////////////////////////////
+
 typedef enum GCODE_MODAL_CUTTER_RAD_COMP_MODES
 {
     MODAL_CUTTER_RAD_COMP_OFF = 400,            // G40
@@ -323,6 +371,7 @@ typedef enum GCODE_MODAL_TOOL_LEN_OFS_MODES
 #define MODAL_GROUP_M7_BIT (1 << 14)  // [M3,M4,M5] Spindle turning
 #define MODAL_GROUP_M8_BIT (1 << 15)  // [M7,M8,M9] Coolant control
 #define MODAL_GROUP_M9_BIT (1 << 16)  // [M56] Override control
+#define MODAL_GROUP_M5_BIT (1 << 17)  // [M62,M63,M64,M65] Digital output control
 
 #define MODAL_GROUP_UNKNOWN 0
 
@@ -411,6 +460,12 @@ typedef struct GCodeBlockData
     // Block Non-modal Code
     int16_t non_modal_code;
     
+    // Override control code [M48, M49, M50, M56]
+    int16_t override_code;
+    
+    // Digital output control code [M62, M63, M64, M65]
+    int16_t aux_output_code;
+    
     // Block Modal State
     GCodeModalData  block_modal_state;
     
@@ -457,6 +512,8 @@ public:
         inline void EnableCheckMode() { m_check_mode = true; }
         inline void DisableCheckMode() { m_check_mode = false; } 
         inline bool IsCheckModeActive() { return m_check_mode; } 
+        
+        void SyncMachinePosition();
 
         static const char*  GetErrorText(uint32_t error_code);
 
@@ -523,6 +580,7 @@ public:
         int     handle_motion_commands();
         
         int     motion_append_line(const float * target_pos);
+        int     check_soft_limits(const float * target_pos);
         
         void    canned_cycle_reset_stycky();
         void    canned_cycle_update_sticky();
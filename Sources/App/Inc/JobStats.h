@@ -0,0 +1,87 @@
+#ifndef JOB_STATS_H
+#define JOB_STATS_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define JOB_STATS_FILE_NAME         "/jobstats.csv"     // One line appended per job
+
+class Block;
+
+typedef struct JOB_STATS
+{
+    uint32_t duration_ms;           // First planned block to M2/M30
+    uint32_t blocks;                // Started by the step ticker
+    uint32_t nominal_blocks;        // Planned to reach their nominal speed
+    uint32_t fill_sum;              // Blocks queued when each block started
+    uint32_t fill_min;
+    uint32_t dry_stops;             // Blocks started as the last one queued: decelerated to zero
+    uint32_t starvation_count;      // Step ticker found the queue empty in the middle of the job
+    uint32_t starvation_total_us;
+    uint32_t starvation_max_us;
+    uint32_t append_count;
+    uint64_t append_total_cycles;   // Planning time, wait for room in the queue excluded
+    uint32_t append_max_cycles;
+    uint32_t queue_full_ms;         // Producer blocked on a full queue
+}JOB_STATS;
+
+typedef void (*JOB_STATS_WRITE_FUNC)(void * context, const char * text);
+
+/*
+ * Planner health statistics of a job. A job starts with the first block planned after the previous one
+ * ended, and ends with M2/M30 (statistics reported and appended to the SD card) or an alarm (discarded).
+ * Intentional stops (queue drained for a dwell, tool change, M0...) are not counted as starvation.
+ */
+class JobStats
+{
+public:
+    // Planner [task context]
+    static void OnAppendLine(uint32_t cycles);
+    static void OnQueueFullWait(uint32_t ms);
+    
+    // Step ticker ISR [above the kernel: tick counts are taken by the soft IRQ]
+    static void OnBlockStart(const Block * block, uint32_t queued_blocks);
+    static void OnQueueEmpty();
+    
+    // Soft IRQ, right after the step ticker ISR that posted them
+    static void OnStarvationStart();
+    static void OnStarvationEnd();
+    
+    // Conveyor, the queue was drained on purpose
+    static void OnQueueDrained();
+    
+    static void EndJob();
+    static void AbortJob();
+    
+    static inline bool IsJobActive() { return m_active; }
+    
+    // Changes each time a job is completed
+    static inline uint32_t GetJobSequence() { return m_job_seq; }
+    static inline const JOB_STATS& GetLastJob() { return m_last; }
+    
+    // Last completed job [serial report after M2/M30 and $J command], one call to write per line
+    static void Report(JOB_STATS_WRITE_FUNC write, void * context);
+
+protected:
+    static void start_job();
+    static bool save(const JOB_STATS& stats);
+    
+    static JOB_STATS m_current;
+    static JOB_STATS m_last;
+    static TickType_t m_start_tick;
+    static volatile bool m_active;
+    static volatile uint32_t m_job_seq;
+    
+    // Queue found empty, waiting for the next block [ISR]
+    static volatile bool m_starved;
+    static uint32_t m_starved_cycles;
+    static uint32_t m_starved_end_cycles;
+    static TickType_t m_starved_tick;
+    static bool m_last_start_dry;
+};
+
+#endif
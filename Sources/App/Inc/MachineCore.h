@@ -26,17 +26,53 @@ typedef enum GCODE_SOURCE_OPTIONS
 
 ///////////////////////////////////////////////////////////////////////////////
 
+typedef enum MACHINE_ALARM_CODES
+{
+    ALARM_NONE,
+    ALARM_HARD_LIMIT,           // Limit switch hit out of a homing cycle
+    ALARM_SOFT_LIMIT,           // Target outside of the machine travel
+    ALARM_STEPPER_FAULT,        // Global stepper driver fault input
+    ALARM_ABORT,                // Any other halt request
+    
+}MACHINE_ALARM_CODES;
+
+// Event bits that raise an alarm [m_input_events_group]
+#define ALARM_EVENTS_MASK       (LIMIT_X_MIN_EVENT | LIMIT_Y_MIN_EVENT | LIMIT_Z_MIN_EVENT | STEPPER_FAULT_EVENT)
+
+///////////////////////////////////////////////////////////////////////////////
+
 typedef enum HOMING_STATE_VALUES
 {
     HOMING_IDLE,
+    HOMING_SEEK,                // Fast move towards the switches, each axis stops at its own switch
+    HOMING_PULL_OFF,            // Moving away until every switch is released
+    HOMING_LOCATE,              // Slow re-approach, latches the final position
     
 }HOMING_STATE_VALUES;
 
+// Feed override potentiometer [percent]
+#define FEED_KNOB_HYSTERESIS            2
+#define FEED_KNOB_CENTER_DETENT         3
+
+// Motion service task wake-up period when no block finishes [queue preload timer, overrides, feed hold]
+#define MOTION_SERVICE_PERIOD_MS        10
+
+// Adaptive feed [percent of the overridden feed], evaluated every ADAPTIVE_FEED_PERIOD_MS
+#define ADAPTIVE_FEED_PERIOD_MS         100
+#define ADAPTIVE_FEED_STEP_DOWN         10
+#define ADAPTIVE_FEED_STEP_UP           5
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Seek move length, relative to the maximum travel of the axis
+#define HOMING_SEEK_TRAVEL_FACTOR       1.5f
+
 ///////////////////////////////////////////////////////////////////////////////
 
 typedef enum PROBING_STATE_VALUES
 {
     PROBING_IDLE,
+    PROBING_ACTIVE,             // Probing move queued, probe input armed in the step ticker
     
 }PROBING_STATE_VALUES;
 
@@ -76,47 +112,99 @@ public:
     ~MachineCore();
 
     bool Initialize();    
-    void OnIdle();
+    
+    // Called from the soft IRQ [SoftIrq.h], posted by the step ticker when a block is finished
+    void NotifyMotionServiceFromISR();
+    void NotifyAlarmTaskFromISR(uint32_t events);
     
     bool StartStepperIdleTimer();
     void StopStepperIdleTimer();
-    void Halt();
+    void Halt(MACHINE_ALARM_CODES reason = ALARM_ABORT);
+    int Unlock();
+    
+    // Called from EXTI interrupt context [step level, no FreeRTOS call]
+    void NotifyOfEvent(uint32_t it_evt_src);
     
-    // Called from EXTI interrupt context
-    BaseType_t NotifyOfEvent(uint32_t it_evt_src);
+    inline bool IsAlarmActive() { return (m_alarm_code != ALARM_NONE) ? true : false; }
+    inline MACHINE_ALARM_CODES GetAlarmCode() { return m_alarm_code; }
     
-    inline void EnterFeedHold() { m_feed_hold = true; }
-    inline void ExitFeedHold() { m_feed_hold = false; }
+    // Last hard limit/fault: from the EXTI interrupt to step generation stopped, and to Halt() completed
+    void GetAlarmReactionTimes_us(uint32_t& stop_us, uint32_t& halt_us);
+    
+    void EnterFeedHold();
+    void ExitFeedHold();
     
     inline bool IsFeedHoldActive() { return m_feed_hold; }
     
+    // Overrides [percent]. Task or kernel aware interrupt context, applied by the motion service task
+    void EnableOverrides(bool enable);
+    void SetFeedOverride(uint32_t percent);
+    void SetRapidOverride(uint32_t percent);
+    void AdjustFeedOverride(int32_t delta_percent);
+    void SetSpindleOverride(uint32_t percent);
+    void AdjustSpindleOverride(int32_t delta_percent);
+    
+    inline bool AreOverridesEnabled() { return m_overrides_enabled; }
+    inline uint32_t GetFeedOverride() { return m_feed_override; }
+    inline uint32_t GetRapidOverride() { return m_rapid_override; }
+    inline uint32_t GetSpindleOverride() { return m_spindle_override; }
+    
+    // From the analog input or the VFD output current [percent of full scale load]
+    float GetSpindleLoad_pct();
+    
+    // Feed reduction on high spindle load, applied on top of the feed override
+    inline uint32_t GetAdaptiveFeed() { return m_adaptive_feed; }
+    
     
     inline bool IsHalted() { return m_system_halted; }
     inline bool IsDwelling() { return m_dwell_active; } 
     
     inline void EnableSteppers() { m_step_ticker->EnableStepperDrivers(true); }
+    inline bool IsLaserModeEnabled() { return m_step_ticker->IsLaserModeEnabled(); }
     
     inline bool IsHomingNow() { return (m_axes_homing_now != 0) ? true : false; }
     inline bool IsAxisHomingNow(uint8_t axis) { return (((1 << axis) & m_axes_homing_now) != 0) ? true : false; }
     inline bool IsAxisHomed(uint8_t axis) { return (((1 << axis) & m_axes_already_homed) != 0) ? true : false; }
+    inline HOMING_STATE_VALUES GetHomingState() { return m_homing_state; }
     
     inline bool AreMotorsStillMoving() { return m_step_ticker->AreMotorsStillMoving(); }
     
-    int ParseGCodeLine(char* line) { return m_gcode_parser->ParseLine(line); }
+    inline uint32_t GetQueuedBlocksCount() { return m_conveyor->get_queued_blocks_count(); }
+    inline uint32_t GetQueueSize() { return m_conveyor->get_queue_size(); }
+    
+    void GetCurrentPosition_mm(float * position);   // COORDINATE_LINEAR_AXES_COUNT values
+    void GetPlannedPosition_mm(float * position);   // COORDINATE_LINEAR_AXES_COUNT values
+    void GetProbePosition_mm(float * position);     // COORDINATE_LINEAR_AXES_COUNT values
+    
+    inline bool WasLastProbeSuccessful() { return m_probe_succeeded; }
+    
+    int ParseGCodeLine(char* line);
     const char* GetGCodeErrorText(uint32_t code) { return GCodeParser::GetErrorText(code); } 
     
+    int HomeAxes();
     int GoHome(float* target, bool isG28);
-    int DoProbe(float* target);
+    int DoProbe(float* target, float rate_mm_s, GCODE_MODAL_MOTION_MODES mode);
     int SendSpindleCommand(GCODE_MODAL_SPINDLE_MODES mode, float spindle_rpm);
     int SendCoolantCommand(GCODE_MODAL_COOLANT_MODES mode);
+    int SetAuxOutput(uint32_t index, bool on, bool synchronized);
     int Dwell(float p_time_secs);
     int WaitForIdleCondition();
+    void EndJob();
         
 protected:
     
     bool                        m_startup_finished;    
-    bool                        m_system_halted;
+    volatile bool               m_system_halted;
     bool                        m_feed_hold;
+    bool                        m_hold_replanned;
+    
+    volatile bool               m_overrides_enabled;
+    volatile bool               m_overrides_changed;
+    volatile uint32_t           m_feed_override;
+    volatile uint32_t           m_rapid_override;
+    volatile uint32_t           m_spindle_override;
+    uint32_t                    m_feed_knob_percent;    // Last override applied from the knob
+    volatile uint32_t           m_adaptive_feed;
 
     bool                        m_dwell_active;
 
@@ -137,21 +225,46 @@ protected:
     // Probing Control
     PROBING_STATE_VALUES        m_probe_state;
     float                       m_probe_position[COORDINATE_LINEAR_AXES_COUNT];
+    bool                        m_probe_succeeded;
+
+    // Alarm Control
+    volatile MACHINE_ALARM_CODES m_alarm_code;
+    uint32_t                    m_alarm_event_cycles;       // DWT cycle counter at the EXTI interrupt
+    uint32_t                    m_alarm_stop_cycles;
+    uint32_t                    m_alarm_halt_cycles;
 
     // FreeRTOS objects
+    TaskHandle_t                m_alarm_task;
+    TaskHandle_t                m_motion_task;
     TimerHandle_t               m_stepper_idle_timer;
     TimerHandle_t               m_user_btn_read_timer;
 
     EventGroupHandle_t          m_input_events_group;
-    uint32_t                    m_fault_event_conditions;
+    volatile uint32_t           m_fault_event_conditions;
     
     ///////////////////////////////////////////////////////////////////////////////////////////
+    
+    void service_motion();
+    void handle_feed_hold();
+    void handle_overrides();
+    void read_feed_override_knob();
+    void update_adaptive_feed();
+    void handle_alarm(uint32_t events);
+    void stop_machine();
+    void queue_output_change(uint8_t mask, uint8_t values);
+    void flush_pending_outputs();
+    
+    int home_axes_cycle(uint8_t axes);
+    uint8_t homing_move(uint8_t axes, float distance_mm, float rate_mm_s, bool stop_on_switch);
 
     // Static callbacks to associate to software timers. The pvTimerId parameter contains the 
     // 'this' pointer referring to the current instance (only one allowed)
     static void steppers_idle_timeout_callback(TimerHandle_t xTimer);
     static void delayed_startup_callback(TimerHandle_t xTimer);
     static void read_user_buttons_callback(TimerHandle_t xTimer);
+    
+    static void alarm_task_entry(void * pvParam);
+    static void motion_task_entry(void * pvParam);
 };
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+#include <stdint.h>
+
+#include "memory_map.h"
+
+typedef enum MEMORY_POOL_IDS
+{
+    MEMORY_POOL_LINE,
+    MEMORY_POOL_FAT_SECTOR,
+    MEMORY_POOL_UI_SMALL,
+    MEMORY_POOL_UI_MEDIUM,
+    MEMORY_POOL_UI_LARGE,
+    MEMORY_POOL_UI_HUGE,
+    
+    MEMORY_POOL_COUNT
+}MEMORY_POOL_IDS;
+
+typedef void (*MEMORY_WRITE_FUNC)(void * context, const char * text);
+
+/*
+ * Fixed-block pool over static storage. Free blocks are chained through their first word, so allocation
+ * and release are O(1) and never fragment. Task context only (short critical sections)
+ */
+class MemoryPool
+{
+public:
+    MemoryPool(const char * name, void * storage, uint32_t block_size, uint32_t block_count);
+    
+    void * Alloc();
+    void Free(void * ptr);
+    
+    inline bool Owns(const void * ptr) const { return ((uint8_t*)ptr >= m_storage && (uint8_t*)ptr < m_storage_end); }
+    inline uint32_t GetBlockSize() const { return m_block_size; }
+    
+    inline const char * GetName() const { return m_name; }
+    inline uint32_t GetBlockCount() const { return m_block_count; }
+    inline uint32_t GetUsed() const { return m_used; }
+    inline uint32_t GetHighWater() const { return m_high_water; }
+    
+    // Requests served by the heap instead, pool exhausted or block too small
+    inline uint32_t GetFallbacks() const { return m_fallbacks; }
+    inline void CountFallback() { m_fallbacks++; }
+
+protected:
+    const char * m_name;
+    uint8_t * m_storage;
+    uint8_t * m_storage_end;
+    uint32_t m_block_size;
+    uint32_t m_block_count;
+    
+    void * m_free_list;
+    uint32_t m_used;
+    uint32_t m_high_water;
+    uint32_t m_fallbacks;
+};
+
+class MemoryPools
+{
+public:
+    static MemoryPool& Get(uint32_t pool_id);
+    
+    // Pools and heap usage [serial $M command, diagnostics page], one call to write per line
+    static void Report(MEMORY_WRITE_FUNC write, void * context);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef MOTION_AXES_H
+#define MOTION_AXES_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+#include "pins.h"
+#include "GCodeParser.h"
+#include "compile_check.h"
+
+// Axes driven by a step/dir pair [STEP_PINS_GPIO_PORT], from COORD_X. The others are parsed and planned
+// but have no motor: the step generation and the per motor block data only cover these
+#define MOTION_AXES_COUNT           3
+
+/*
+ * Step/dir pins of each driven axis, known at compile time. Only the driven axes are specialized, so
+ * a motor index past MOTION_AXES_COUNT does not compile. The inversion settings use the same bits
+ * [SIGNAL_INVERT_STEP_ / SIGNAL_INVERT_DIR_], since all the pins are in the same port.
+ */
+template<uint8_t AXIS>
+struct MotionAxis;
+
+template<>
+struct MotionAxis<COORD_X>
+{
+    enum { STEP_PIN = STEP_X_Pin, DIR_PIN = DIR_X_Pin };
+};
+
+template<>
+struct MotionAxis<COORD_Y>
+{
+    enum { STEP_PIN = STEP_Y_Pin, DIR_PIN = DIR_Y_Pin };
+};
+
+template<>
+struct MotionAxis<COORD_Z>
+{
+    enum { STEP_PIN = STEP_Z_Pin, DIR_PIN = DIR_Z_Pin };
+};
+
+/*
+ * Loop over the driven axes unrolled at compile time: FUNC::Apply<AXIS>() is instantiated and inlined
+ * once per axis, so the axis index, its bit masks and its pins are constants in the body.
+ */
+template<uint8_t AXIS, uint8_t END>
+struct MotionAxesLoop
+{
+    template<typename FUNC>
+    static inline void Run(FUNC& func)
+    {
+        func.template Apply<AXIS>();
+        MotionAxesLoop<AXIS + 1, END>::Run(func);
+    }
+};
+
+template<uint8_t END>
+struct MotionAxesLoop<END, END>
+{
+    template<typename FUNC>
+    static inline void Run(FUNC& func) {}
+};
+
+template<typename FUNC>
+inline void ForEachMotionAxis(FUNC& func)
+{
+    MotionAxesLoop<0, MOTION_AXES_COUNT>::Run(func);
+}
+
+COMPILE_CHECK(MOTION_AXES_COUNT <= TOTAL_AXES_COUNT, "More driven axes than coordinates");
+COMPILE_CHECK(MOTION_AXES_COUNT <= 8, "Motor bit masks are 8 bit wide");
+
+#endif
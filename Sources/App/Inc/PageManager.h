@@ -6,15 +6,28 @@
 
 #include "BasePage.h"
 
+typedef enum
+{
+    PAGE_INDEX_MAIN,
+    PAGE_INDEX_FILE_MANAGER,
+    PAGE_INDEX_TOOLPATH,
+    PAGE_INDEX_DIAGNOSTICS,
+    
+    PAGE_INDEX_COUNT
+}PAGE_INDEX;
+
 class PageManager
 {
 public:
     static void Initialize(lv_obj_t * parent);    
     static void SwitchToPage(uint32_t page_index);
     
+    static void UpdateActivePage();
     
 protected:
     static lv_obj_t * m_page_manager_surface;
+    static BasePageWindow * m_active_page;
+    static uint32_t m_active_page_index;
 };
 
 #endif
@@ -8,6 +8,9 @@
 #include "Block.h"
 #include "Conveyor.h"
 
+#include "FreeRTOS.h"
+#include "semphr.h"
+
 ///////////////////////////////////////////////////////////////////////////////
 
 enum PLANNER_STATUS_RESULTS 
@@ -74,9 +77,23 @@ public:
 
         void AssociateConveyor(Conveyor * conv) { m_conveyor = conv; }
 
-        int AppendLine(const float* target_mm, float spindle_speed, float rate_mm_s, bool inverseTimeRate = false);
+        int AppendLine(const float* target_mm, float spindle_speed, float rate_mm_s, bool inverseTimeRate = false, bool isRapid = false);
+        
+        // Motion service task. Serialised with AppendLine (parser task) through m_plan_mutex
+        void ReplanFromRest();
+        void ApplyOverrides(float feed_factor, float rapid_factor);
+        
+        // Output changes carried by the next queued move [CoolantController output bits]. Task context
+        void QueueOutputChange(uint8_t mask, uint8_t values);
+        bool TakePendingOutputs(uint8_t& mask, uint8_t& values);
         
         float max_allowable_speed( float acceleration, float target_velocity, float distance);
+        
+        // Position at the end of the last queued move
+        const int32_t * GetPosition_steps() const { return m_position_steps; }
+        
+        // Continue planning from the given position (motion stopped before reaching the last target)
+        void SetPosition_steps(const int32_t * position);
     
         static const char*  GetErrorText(uint32_t error_code);
 
@@ -85,15 +102,28 @@ public:
         float m_previous_unit_vector[TOTAL_AXES_COUNT];
         float m_junction_deviation;
     
+        float m_feed_override;      // Factors applied to programmed speeds (1.0 = 100%)
+        float m_rapid_override;
+    
         int32_t m_position_steps[TOTAL_AXES_COUNT];
+        
+        volatile uint8_t m_pending_output_mask;
+        volatile uint8_t m_pending_output_values;
     
         Conveyor * m_conveyor;
+        
+        SemaphoreHandle_t m_plan_mutex;     // Held while the queued blocks are being planned
 
         ///////////////////////////////////////////////////////////////////////////////////////////
         
         float limit_value_by_axis_maximum(float limit_value, const float * max_values, const float * unit_vector);
     
         void recalculate();
+        void replan_from_rest();
+        void apply_overrides(float feed_factor, float rapid_factor);
+    
+        float override_speed(const Block* block) const;
+        void raise_nominal_speed(Block* block, float speed);
 };
 
 #endif
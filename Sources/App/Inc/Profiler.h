@@ -0,0 +1,181 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+
+#include "task_settings.h"
+
+#define PROFILER_WINDOW_MS              1000    // Task/ISR load and queue depth averaging window
+#define PROFILER_MAX_TASKS              16
+#define PROFILER_HISTOGRAM_BUCKETS      8       // ISR duration [us]: <1, <2, <4, <8, <16, <32, <64, >=64
+#define PROFILER_QUEUE_HISTORY          60      // Windows of queue depth kept for the diagnostics page
+#define PROFILER_STARVATION_WINDOW_MS   500     // Queue refilled this soon after running dry: starvation
+#define PROFILER_STEP_TIMER_MHZ         84      // TIM2 counter clock, step ISR latency unit
+#define PROFILER_LATENCY_BUCKET_TICKS   21      // Step ISR entry latency: <0.25, <0.5, <1, <2, <4, <8, <16, >=16 us
+
+typedef enum PROFILER_ISR_IDS
+{
+    PROFILER_ISR_STEP_TICK,         // TIM2
+    PROFILER_ISR_STEP_COMMAND,      // TIM2 pended by software for posted requests only [StepTicker::post_command]
+    PROFILER_ISR_UNSTEP,            // TIM6
+    PROFILER_ISR_SERIAL,            // USART1
+    PROFILER_ISR_SPINDLE_UART,      // USART3
+    PROFILER_ISR_SOFT,              // Notifications deferred by the step level [SoftIrq.h]
+    
+    PROFILER_ISR_COUNT
+}PROFILER_ISR_IDS;
+
+typedef struct PROFILER_ISR_STATS
+{
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+}PROFILER_ISR_STATS;
+
+typedef struct PROFILER_TASK_LOAD
+{
+    char name[configMAX_TASK_NAME_LEN];
+    uint16_t load_permille;         // Last window, ISR time included in the interrupted task
+    uint16_t stack_free_words;      // Lowest ever
+}PROFILER_TASK_LOAD;
+
+typedef void (*PROFILER_WRITE_FUNC)(void * context, const char * text);
+
+/*
+ * Always-on runtime profiling, DWT cycle counter timebase (also used by FreeRTOS run-time stats).
+ * ISRs are measured from entry to exit, totals since the last Reset(). Task and ISR loads, and the
+ * queue depth average, are computed once per window by a low priority software timer.
+ */
+class Profiler
+{
+public:
+    static void Initialize();
+    static void Reset();
+    
+    // Interrupt context. Tasks copy and clear the stats with the step level masked [mask_step_level]
+    static inline uint32_t IsrEnter() { return DWT->CYCCNT; }
+    
+    static inline void IsrExit(uint32_t isr_id, uint32_t start_cycles)
+    {
+        uint32_t cycles = DWT->CYCCNT - start_cycles;
+        uint32_t us = cycles / m_cycles_per_us;
+        PROFILER_ISR_STATS& stats = m_isr_stats[isr_id];
+        
+        stats.count++;
+        stats.total_cycles += cycles;
+        
+        if (cycles < stats.min_cycles)
+            stats.min_cycles = cycles;
+        
+        if (cycles > stats.max_cycles)
+            stats.max_cycles = cycles;
+        
+        stats.histogram[(us == 0) ? 0 : ((32 - __CLZ(us)) < PROFILER_HISTOGRAM_BUCKETS) ? (32 - __CLZ(us)) : (PROFILER_HISTOGRAM_BUCKETS - 1)]++;
+    }
+    
+    // Step timer counter at ISR entry: time since the update event [timer ticks]. Its spread is the jitter of
+    // the step pulses, only other step level interrupts add to it
+    static inline void RecordStepLatency(uint32_t timer_ticks)
+    {
+        uint32_t quarters = timer_ticks / PROFILER_LATENCY_BUCKET_TICKS;
+        
+        if (timer_ticks < m_step_latency_min)
+            m_step_latency_min = timer_ticks;
+        
+        if (timer_ticks > m_step_latency_max)
+            m_step_latency_max = timer_ticks;
+        
+        m_step_latency_histogram[(quarters == 0) ? 0 : ((32 - __CLZ(quarters)) < PROFILER_HISTOGRAM_BUCKETS) ? (32 - __CLZ(quarters)) : (PROFILER_HISTOGRAM_BUCKETS - 1)]++;
+    }
+    
+    // Blocks walked by the planner to insert a new one
+    static void OnRecalculate(uint32_t blocks);
+    
+    // Motion service task, every wake-up
+    static void SampleQueueDepth(uint32_t depth);
+    
+    static bool GetIsrStats(uint32_t isr_id, PROFILER_ISR_STATS& stats);
+    static const char * GetIsrName(uint32_t isr_id);
+    static inline uint32_t GetIsrLoad_permille(uint32_t isr_id) { return m_isr_load_permille[isr_id]; }
+    
+    static inline uint32_t GetTaskCount() { return m_task_count; }
+    static inline const PROFILER_TASK_LOAD& GetTaskLoad(uint32_t index) { return m_task_loads[index]; }
+    
+    // Queue depth history, oldest first. Returns the number of windows available
+    static uint32_t GetQueueHistory(uint8_t * depths, uint32_t max_count);
+    
+    // Changes at the end of every window
+    static inline uint32_t GetWindowSequence() { return m_window_seq; }
+    
+    // Text report [serial $P command, diagnostics page], one call to write per line
+    static void Report(PROFILER_WRITE_FUNC write, void * context);
+
+protected:
+    // The step level [STEP_IRQ_PRIORITY] is above the kernel critical sections. Short copies only
+    static inline uint32_t mask_step_level()
+    {
+        uint32_t basepri = __get_BASEPRI();
+        
+        __set_BASEPRI(STEP_IRQ_PRIORITY << (8 - configPRIO_BITS));
+        __DSB();
+        __ISB();
+        
+        return basepri;
+    }
+    
+    static inline void unmask_step_level(uint32_t basepri) { __set_BASEPRI(basepri); }
+    
+    static void close_window();
+    static void window_timer_callback(TimerHandle_t xTimer);
+    
+    static uint32_t m_cycles_per_us;
+    
+    // ISRs
+    static PROFILER_ISR_STATS m_isr_stats[PROFILER_ISR_COUNT];
+    static uint64_t m_isr_window_start_cycles[PROFILER_ISR_COUNT];
+    static uint16_t m_isr_load_permille[PROFILER_ISR_COUNT];
+    static volatile uint32_t m_step_latency_min;
+    static volatile uint32_t m_step_latency_max;
+    static uint32_t m_step_latency_histogram[PROFILER_HISTOGRAM_BUCKETS];
+    
+    // Tasks [run-time counters at the start of the window]
+    static TaskStatus_t m_task_status[PROFILER_MAX_TASKS];
+    static TaskHandle_t m_prev_handles[PROFILER_MAX_TASKS];
+    static uint32_t m_prev_run_time[PROFILER_MAX_TASKS];
+    static uint32_t m_prev_count;
+    static uint32_t m_prev_total_run_time;
+    static PROFILER_TASK_LOAD m_task_loads[PROFILER_MAX_TASKS];
+    static uint32_t m_task_count;
+    
+    // Planner
+    static uint32_t m_recalc_count;
+    static uint32_t m_recalc_total_blocks;
+    static uint32_t m_recalc_max_blocks;
+    
+    // Queue depth [current window and history of averages]
+    static uint32_t m_depth_sum;
+    static uint32_t m_depth_samples;
+    static uint32_t m_depth_min;
+    static uint32_t m_depth_max;
+    static uint32_t m_depth_last;
+    static uint32_t m_window_depth_min;     // Last complete window
+    static uint32_t m_window_depth_max;
+    static uint8_t m_depth_history[PROFILER_QUEUE_HISTORY];
+    static uint32_t m_depth_history_count;
+    static TickType_t m_drained_tick;
+    static bool m_drained;
+    static uint32_t m_starvation_count;
+    
+    static volatile uint32_t m_window_seq;
+    static TimerHandle_t m_window_timer;
+};
+
+#endif
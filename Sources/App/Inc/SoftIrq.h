@@ -0,0 +1,73 @@
+#ifndef SOFT_IRQ_H
+#define SOFT_IRQ_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+// Spare vector [CAN2 is not used on this board], only ever pended by software
+#define SOFT_IRQn                   CAN2_SCE_IRQn
+#define SOFT_IRQHandler             CAN2_SCE_IRQHandler
+
+// Requests posted from the step level
+#define SOFT_IRQ_BLOCK_FINISHED     (1 << 0)    // Motion service task: recycle the block
+#define SOFT_IRQ_ALARM              (1 << 1)    // Alarm task: limit/fault event bits
+#define SOFT_IRQ_STARVATION_START   (1 << 2)    // Job statistics: tick count when the queue ran dry
+#define SOFT_IRQ_STARVATION_END     (1 << 3)
+
+/*
+ * Bridge between the step level and the kernel. The step timer and limit interrupts run above the RTOS
+ * syscall priority and cannot call FreeRTOS: they post requests here (exclusive access OR of a bit word,
+ * then the vector is pended) and this handler, at SOFT_IRQ_PRIORITY, makes the FromISR calls as soon as
+ * they exit.
+ */
+class SoftIrq
+{
+public:
+    static void Initialize();
+    
+    // Step level [any priority]
+    static inline void Post(uint32_t requests)
+    {
+        set_bits(&m_pending, requests);
+        NVIC_SetPendingIRQ(SOFT_IRQn);
+    }
+    
+    static inline void PostAlarm(uint32_t events)
+    {
+        set_bits(&m_alarm_events, events);
+        Post(SOFT_IRQ_ALARM);
+    }
+    
+    static void Handler();
+
+protected:
+    static inline void set_bits(volatile uint32_t * word, uint32_t bits)
+    {
+        uint32_t value;
+        
+        do
+        {
+            value = __LDREXW(word);
+        }
+        while (__STREXW(value | bits, word) != 0);
+    }
+    
+    static inline uint32_t take_bits(volatile uint32_t * word)
+    {
+        uint32_t value;
+        
+        do
+        {
+            value = __LDREXW(word);
+        }
+        while (__STREXW(0, word) != 0);
+        
+        return value;
+    }
+    
+    static volatile uint32_t m_pending;
+    static volatile uint32_t m_alarm_events;
+};
+
+#endif
@@ -9,29 +9,37 @@
 #include "queue.h"
 #include "event_groups.h"
 #include "timers.h"
+#include "semphr.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#define SPINDLE_POLL_PERIOD_MS          100     // Speed feedback/at-speed update period
 
-///////////////////////////////////////////////////////////////////////////////
-
-///////////////////////////////////////////////////////////////////////////////
+#define SPINDLE_OVERRIDE_MIN_PERCENT    10
+#define SPINDLE_OVERRIDE_MAX_PERCENT    200
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// Modbus RTU master
+#define MODBUS_MAX_FRAME_SIZE           16
+#define MODBUS_RESPONSE_TIMEOUT_MS      50
+#define MODBUS_INTERFRAME_DELAY_MS      2       // > 3.5 characters at 19200 bps
+#define MODBUS_MAX_LINK_ERRORS          3       // Consecutive failed transactions before the link is down
 
-///////////////////////////////////////////////////////////////////////////////
-
+#define MODBUS_FUNC_READ_HOLDING_REGS   0x03
+#define MODBUS_FUNC_WRITE_SINGLE_REG    0x06
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// VFD communication registers [Delta VFD-E/EL/M protocol]
+#define VFD_REG_CONTROL                 0x2000
+#define VFD_REG_FREQUENCY_CMD           0x2001  // 0.01 Hz
+#define VFD_REG_OUTPUT_FREQUENCY        0x2103  // 0.01 Hz
+#define VFD_REG_OUTPUT_CURRENT          0x2104  // 0.1 A
 
-
-///////////////////////////////////////////////////////////////////////////////
-
-
-
-
+#define VFD_CONTROL_STOP                0x0001
+#define VFD_CONTROL_RUN_FWD             0x0012
+#define VFD_CONTROL_RUN_REV             0x0022
 
 ///////////////////////////////////////////////////////////////////////////////
 #include "GCodeParser.h"
@@ -46,11 +54,72 @@ public:
     SpindleController();
     ~SpindleController();
 
+    void Start();
+
     bool InmediateStop();   // For halt cases
-        
+
+    // Applied by the spindle task. At-speed is cleared until the new speed is reached
+    void SetSpeed(GCODE_MODAL_SPINDLE_MODES mode, float rpm);
+    void SetOverride(float factor);
+
+    // Only valid once the task has applied the last request
+    inline bool IsAtSpeed() { return (m_at_speed && m_feedback_seq == m_request_seq) ? true : false; }
+    inline bool IsLinkOk() { return m_link_ok; }
+    inline bool IsRunning() { return (m_mode != MODAL_SPINDLE_OFF) ? true : false; }
+
+    inline float GetTargetRPM() { return m_target_rpm; }
+    inline float GetActualRPM() { return m_actual_rpm; }
+    inline float GetOutputCurrent_A() { return m_output_current; }
+
+    // Called from USART3 interrupt
+    BaseType_t NotifyFrameReceived();
+
+    static SpindleController *getInstance() { return instance; }
+
 protected:
+    static SpindleController *instance;
+
+    // Requested state [any task]
+    volatile uint8_t            m_mode;
+    volatile float              m_programmed_rpm;
+    volatile float              m_override;
+    volatile bool               m_stop_request;
+    volatile uint32_t           m_request_seq;
+
+    // Applied state [spindle task]
+    uint8_t                     m_applied_mode;
+    float                       m_applied_rpm;
+    TickType_t                  m_change_time;
+    uint32_t                    m_applied_seq;
+    volatile uint32_t           m_feedback_seq;
+
+    volatile float              m_target_rpm;
+    volatile float              m_actual_rpm;
+    volatile float              m_output_current;       // A, Modbus only
+    volatile bool               m_at_speed;
+    volatile bool               m_link_ok;
+    uint32_t                    m_link_errors;
+
+    uint8_t                     m_tx_frame[MODBUS_MAX_FRAME_SIZE];
+    uint8_t                     m_rx_frame[MODBUS_MAX_FRAME_SIZE];
+
+    TaskHandle_t                m_task;
+    SemaphoreHandle_t           m_frame_received;
+
     ///////////////////////////////////////////////////////////////////////////////////////////
 
+    void apply_request();
+    void update_feedback();
+    void set_pwm_output(uint8_t mode, float rpm);
+    bool send_vfd_command(uint8_t mode, float rpm);
+
+    bool modbus_write_register(uint16_t reg, uint16_t value);
+    bool modbus_read_register(uint16_t reg, uint16_t& value);
+    uint32_t modbus_transaction(uint32_t request_len, uint32_t response_len);
+
+    static uint16_t modbus_crc(const uint8_t * data, uint32_t len);
+
+    static void task_entry(void * pvParam);
 };
 
 #endif
@@ -5,6 +5,8 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+#include "GCodeParser.h"
+#include "MotionAxes.h"
 #include "Block.h"
 #include "Conveyor.h"
 
@@ -14,6 +16,31 @@
 #define STEPTICKER_FPSCALE (1LL<<62)
 #define STEPTICKER_FROMFP(x) ((float)(x)/STEPTICKER_FPSCALE)
 
+typedef enum FEED_HOLD_STATES
+{
+    FEED_HOLD_OFF,
+    FEED_HOLD_DECELERATING,     // Braking at block acceleration, across blocks if needed
+    FEED_HOLD_STOPPED,          // Motion stopped, current block keeps the steps not executed
+    
+}FEED_HOLD_STATES;
+
+typedef enum RATE_CHANGE_PHASES
+{
+    RATE_CHANGE_NONE,           // Current block follows its planned trapezoid
+    RATE_CHANGE_RAMP,           // Accelerating/decelerating towards the overridden rate
+    RATE_CHANGE_CRUISE,         // Overridden rate reached
+    RATE_CHANGE_DECEL,          // Braking towards the planned exit rate of the block
+    
+}RATE_CHANGE_PHASES;
+
+typedef enum PROBE_STATES
+{
+    PROBE_OFF,
+    PROBE_ARMED,                // Probe input sampled on every tick
+    PROBE_TRIGGERED,            // Position latched, motion decelerating (same as feed hold)
+    
+}PROBE_STATES;
+
 class StepTicker
 {
 public:
@@ -31,6 +58,9 @@ public:
     void step_tick (void);
     void start();
     
+    // Step ISR only, before the tick. Requests posted from task context
+    void run_commands();
+    
     void Associate_Conveyor(Conveyor* conv) { m_conveyor = conv; }
     inline void EnableMotor(uint8_t axis) { this->motor_enable_bits |= (1 << axis); }
     inline void DisableMotor(uint8_t axis) { this->motor_enable_bits &= (~(1 << axis)); }
@@ -38,6 +68,51 @@ public:
     
     inline bool AreMotorsStillMoving() { return (this->motor_enable_bits != 0) ? true : false; }
     
+    void GetCurrentPosition_steps(int32_t * position) const;
+    
+    // Control requests [task context, or any interrupt below the step level]. Executed by the step ISR, pended
+    // on purpose: it preempts the caller, so the request is complete on return and never splits a tick
+    
+    // Feed hold control
+    void RequestFeedHold();
+    void ResumeFromFeedHold();
+    void CancelFeedHold();
+    
+    inline bool IsFeedHoldStopped() const { return (hold_state == FEED_HOLD_STOPPED) ? true : false; }
+    
+    // Probing control. Contact is the logical state (inversion applied)
+    void ArmProbe(bool stop_on_contact);
+    void DisarmProbe();
+    bool IsProbeInContact() const;
+    void GetProbePosition_steps(int32_t * position) const;
+    
+    inline bool IsProbeTriggered() const { return (probe_state == PROBE_TRIGGERED) ? true : false; }
+    
+    // Homing control. Each armed axis stops on its own when its limit switch
+    // becomes active, the rest of the block goes on for the other axes
+    void ArmHomingSwitches(uint8_t axes_mask);
+    uint8_t DisarmHomingSwitches();             // Returns the axes whose switch was latched
+    uint8_t GetActiveLimitSwitches() const;     // Axes with the switch active (inversion applied)
+    void GetHomingPosition_steps(int32_t * position) const;
+    
+    // Only while no block is being ticked
+    void SetCurrentPosition_steps(const int32_t * position);
+    
+    // Limit switch/driver fault. Called from EXTI interrupt context (same priority as the step timer)
+    void EmergencyStop();
+    void ClearEmergencyStop();      // Queue already discarded
+    
+    inline bool IsEmergencyStopped() const { return emergency_stop; }
+    
+    // Laser mode: spindle PWM [TIM9 CH1] follows the S value of each block, scaled by the current rate
+    // against the nominal rate, so the energy per mm stays constant through acceleration
+    void SetLaserMode(bool enable);
+    
+    inline bool IsLaserModeEnabled() const { return laser_mode; }
+    
+    // Override changed while ticking a block. Rate of the steps_event_count axis in steps/sec
+    void RequestRateChange(const Block* block, float rate);
+    
     void ApplyUpdatedInversionMasks();
     void ResetStepperDrivers(bool reset);
     void EnableStepperDrivers(bool enable);
@@ -47,7 +122,47 @@ public:
 private:
     static StepTicker *instance;
 
+    // Per motor parts of the tick and of the block start, unrolled over the driven axes [ForEachMotionAxis]
+    struct TickMotors
+    {
+        StepTicker * ticker;
+        uint8_t step_bits;          // STEP_PINS_GPIO_PORT pins to pulse on this tick
+        bool still_moving;
+        bool hold_reached_zero;
+        
+        template<uint8_t MOTOR> inline void Apply() { ticker->tick_motor<MOTOR>(*this); }
+    };
+    
+    struct StartMotors
+    {
+        StepTicker * ticker;
+        uint8_t direction_bits;     // STEP_PINS_GPIO_PORT direction pins of the backward moving motors
+        uint32_t primary_steps;
+        bool any_moving;
+        
+        template<uint8_t MOTOR> inline void Apply() { ticker->start_motor<MOTOR>(*this); }
+    };
+    
+    friend struct TickMotors;
+    friend struct StartMotors;
+    
+    void post_command(uint32_t command);
+    
     bool start_next_block();
+    
+    template<uint8_t MOTOR> inline void tick_motor(TickMotors& tick);
+    template<uint8_t MOTOR> inline void start_motor(StartMotors& start);
+    
+    void start_hold_deceleration();
+    void continue_hold_deceleration();
+    
+    inline void latch_homing_switches();
+    
+    void start_rate_change();
+    inline void limit_rate_change(uint8_t motor_idx);
+    
+    inline void update_laser_power();
+    inline void laser_off();
 
     float frequency;
     uint32_t period;
@@ -59,12 +174,59 @@ private:
 
     uint8_t motor_enable_bits;
 
+    // Real machine position, updated on every issued step
+    volatile int32_t current_position_steps[TOTAL_AXES_COUNT];
+
     Block *current_block;
     uint32_t current_tick;
+    uint8_t primary_motor;      // Driven motor with the most steps in current block
+
+    // Feed hold
+    volatile uint8_t hold_state;
+    bool hold_ramp_active;      // Hold deceleration already applied to current block
+    float hold_speed;           // mm per tick, carried to the next block while decelerating
+
+    // Probing
+    volatile uint8_t probe_state;
+    uint32_t probe_trigger_level;       // Probe pin IDR value that stops the probing move
+    volatile int32_t probe_position_steps[TOTAL_AXES_COUNT];
+
+    // Set by a limit switch/driver fault, no steps are issued until cleared
+    volatile bool emergency_stop;
+
+    // Homing. Limit switches are all in the same port (LIM_X_GPIO_Port)
+    volatile uint8_t homing_armed_axes;
+    volatile uint8_t homing_latched_axes;
+    uint32_t limit_invert_bits;             // IDR bits of the switches that are active low
+    volatile int32_t homing_position_steps[COORDINATE_LINEAR_AXES_COUNT];
+
+    // Rate change of the current block (overrides)
+    bool rate_change_pending;
+    const Block* rate_change_block;
+    float rate_change_request;              // steps/sec, steps_event_count axis
+    uint8_t rate_change_phase;
+    uint32_t rate_change_decel_step;        // Primary axis step count where braking to the exit rate starts
+    int64_t rate_change_target[MOTION_AXES_COUNT];  // 2.62 fixed point
+    int64_t rate_change_exit[MOTION_AXES_COUNT];    // 2.62 fixed point
+
+    // Laser power of the current block
+    volatile bool laser_mode;
+    uint32_t laser_power;                   // PWM counts at nominal rate
+    float laser_power_per_rate;             // PWM counts per step/sec of the primary axis
+    int64_t laser_last_rate;                // steps_per_tick of the primary axis when last updated
 
     Conveyor* m_conveyor;
 
     volatile bool running;
+    
+    // Control requests waiting for the step ISR [STEP_COMMAND_ bits] and their arguments
+    volatile uint32_t pending_commands;
+    uint32_t request_probe_trigger_level;
+    uint8_t request_homing_axes;
+    uint32_t request_limit_invert_bits;
+    int32_t request_position_steps[TOTAL_AXES_COUNT];
+    const Block* request_rate_block;
+    float request_rate;
 };
 
 
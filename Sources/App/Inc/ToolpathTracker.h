@@ -0,0 +1,59 @@
+#ifndef TOOLPATHTRACKER_H
+#define TOOLPATHTRACKER_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+class Block;
+
+#define TOOLPATH_CACHE_POINTS           512     // Must be a power of two
+#define TOOLPATH_MIN_SEGMENT_MM         0.25f   // Shorter moves are merged with the next ones
+
+typedef struct TOOLPATH_POINT
+{
+    float x;
+    float y;
+}TOOLPATH_POINT;
+
+/*
+ * Keeps a decimated XY polyline of the moves already executed, fed from the
+ * blocks the Conveyor releases. Single producer (Conveyor GC) and any number of
+ * readers, each one keeping its own sequence number, so drawing can be incremental.
+ */
+class ToolpathTracker
+{
+public:
+    static void Initialize();
+    static void Reset();
+    
+    // Called from the Conveyor when a block is released, after being executed
+    static void OnBlockFinished(const Block * block);
+    
+    // Part of a block executed before a feed hold stopped it
+    static void OnStepsExecuted(const uint32_t * steps, uint8_t direction_bits);
+    
+    // Sequence number of the next point to be written
+    static inline uint32_t GetWriteSequence() { return m_write_seq; }
+    
+    // Oldest point still available in the cache
+    static uint32_t GetFirstAvailableSequence();
+    static bool GetPoint(uint32_t seq, TOOLPATH_POINT& point);
+    
+    // Changes every time the cache is reset, so readers know they have to start over
+    static inline uint32_t GetResetCount() { return m_reset_count; }
+    
+protected:
+    static void append_point(float x, float y);
+    
+    static TOOLPATH_POINT * m_points;
+    static volatile uint32_t m_write_seq;
+    static volatile uint32_t m_reset_count;
+    
+    // Executed position [steps] and last stored point [mm]
+    static int32_t m_position_steps[2];
+    static TOOLPATH_POINT m_last_point;
+};
+
+#endif
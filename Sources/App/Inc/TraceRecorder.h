@@ -0,0 +1,111 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+#define TRACE_BUFFER_EVENTS         1024        // Must be a power of two, 8 bytes each
+#define TRACE_FILE_MAGIC            0x4352544F  // "OTRC"
+#define TRACE_FILE_VERSION          1
+#define TRACE_DUMP_FILE_NAME        "/trace.bin"
+
+typedef enum TRACE_EVENT_IDS
+{
+    TRACE_EVENT_NONE,
+    
+    // Step ticker ISR
+    TRACE_EVENT_BLOCK_START,        // arg16: queue index, arg8: blocks queued
+    TRACE_EVENT_BLOCK_FINISH,       // arg16: queue index
+    TRACE_EVENT_BLOCK_LOCKED,       // arg16: queue index. Next block being replanned, not started
+    TRACE_EVENT_QUEUE_EMPTY,        // Nothing left to start: motion stops
+    TRACE_EVENT_ISR_OVERRUN,        // arg16: step timer counter. Next update already pending on exit
+    
+    // Conveyor
+    TRACE_EVENT_QUEUE_RELEASE,      // arg8: blocks queued. Queue handed over to the step ticker
+    TRACE_EVENT_QUEUE_FULL,         // Producer blocked
+    TRACE_EVENT_QUEUE_SPACE,        // Producer released
+    
+    // Planner
+    TRACE_EVENT_APPEND_ENTER,
+    TRACE_EVENT_APPEND_EXIT,        // arg8: 1 if a block was added
+    TRACE_EVENT_REPLAN_BEGIN,       // arg8: 0 feed hold, 1 overrides
+    TRACE_EVENT_REPLAN_END,
+    
+    // Machine
+    TRACE_EVENT_FEED_HOLD,          // arg8: 0 requested, 1 stopped and replanned, 2 resumed
+    TRACE_EVENT_ALARM,              // arg16: event bits
+    TRACE_EVENT_FLASH_WRITE_BEGIN,  // Settings written to the SPI flash
+    TRACE_EVENT_FLASH_WRITE_END,    // arg8: 1 if verified
+    
+    TRACE_EVENT_COUNT
+}TRACE_EVENT_IDS;
+
+typedef struct TRACE_EVENT
+{
+    uint32_t timestamp;             // DWT cycle counter
+    uint8_t event;
+    uint8_t arg8;
+    uint16_t arg16;
+}TRACE_EVENT;
+
+// SD card dump header, followed by 'count' TRACE_EVENT records, oldest first
+typedef struct TRACE_FILE_HEADER
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cpu_hz;
+    uint32_t total_events;          // Recorded since the last Clear(), the oldest ones were overwritten
+    uint32_t count;
+}TRACE_FILE_HEADER;
+
+typedef void (*TRACE_WRITE_FUNC)(void * context, const char * text);
+
+/*
+ * Always-on binary event trace. Events are written to a ring of fixed size records from any context
+ * (tasks and ISRs up to any priority): the slot is reserved with an exclusive access increment of the
+ * write index, no interrupt masking. The oldest events are overwritten. Recording is paused while the
+ * ring is dumped. Tools/trace_decode.py renders a timeline from either dump format.
+ */
+class TraceRecorder
+{
+public:
+    static void Initialize();
+    static void Clear();
+    
+    static inline void Record(uint8_t event, uint16_t arg16 = 0, uint8_t arg8 = 0)
+    {
+        uint32_t index;
+        
+        if (m_enabled == false)
+            return;
+        
+        do
+        {
+            index = __LDREXW(&m_write_index);
+        }
+        while (__STREXW(index + 1, &m_write_index) != 0);
+        
+        TRACE_EVENT& slot = m_events[index & (TRACE_BUFFER_EVENTS - 1)];
+        
+        slot.timestamp = DWT->CYCCNT;
+        slot.event = event;
+        slot.arg8 = arg8;
+        slot.arg16 = arg16;
+    }
+    
+    // Text dump [serial $T command], one call to write per line
+    static void DumpText(TRACE_WRITE_FUNC write, void * context);
+    
+    // Binary dump to the SD card [serial $TS command]
+    static bool DumpToFile(const char * file_name);
+
+protected:
+    static void pause(uint32_t& first, uint32_t& count);
+    
+    static TRACE_EVENT m_events[TRACE_BUFFER_EVENTS];
+    static volatile uint32_t m_write_index;
+    static volatile bool m_enabled;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef UISCHEDULER_H
+#define UISCHEDULER_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+// Refresh periods while motion is fed normally
+#define UI_REFRESH_PERIOD_MS            30
+#define UI_DRO_SAMPLE_PERIOD_MS         100
+
+// Refresh periods while moving with few blocks left in the queue
+#define UI_REFRESH_PERIOD_SLOW_MS       200
+#define UI_DRO_SAMPLE_PERIOD_SLOW_MS    500
+
+#define UI_QUEUE_LOW_WATERMARK          8       // Blocks
+#define UI_CPU_BUDGET_MS_PER_SEC        150     // Max CPU time used by the UI each second
+
+
+class UIScheduler
+{
+public:
+    static void Initialize();
+    
+    // Runs one UI cycle (if allowed) and returns the time to wait before the next one [ms]
+    static uint32_t RunCycle();
+    
+    static void SetDROSamplePeriod(uint32_t period_ms) { m_dro_sample_period_ms = period_ms; }
+    static bool IsThrottled() { return m_throttled; }
+    
+protected:
+    static bool is_motion_starving();
+
+    static uint32_t m_dro_sample_period_ms;
+    static TickType_t m_last_dro_sample;
+    
+    // CPU budget accounting [DWT cycles used in current one second window]
+    static TickType_t m_budget_window_start;
+    static uint32_t m_budget_used_cycles;
+    static uint32_t m_cycles_per_ms;
+    
+    static bool m_throttled;
+};
+
+#endif
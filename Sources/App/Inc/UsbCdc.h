@@ -0,0 +1,79 @@
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include <stdint.h>
+
+#include "UsbDevice.h"
+
+#define CDC_DATA_OUT_EP             0x01
+#define CDC_DATA_IN_EP              0x81
+#define CDC_CMD_EP                  0x82
+#define CDC_DATA_PACKET_SIZE        64
+#define CDC_CMD_PACKET_SIZE         8
+
+// Rings [power of 2]. Lines are parsed in place by the serial task, the OUT endpoint is only re-armed
+// while a whole packet fits: the host is held off with NAKs instead of losing data
+#define CDC_RX_BUFFER_SIZE          1024
+#define CDC_TX_BUFFER_SIZE          1024
+
+#define CDC_TX_WAIT_POLL_MS         10      // Tx ring full: recheck period
+
+/*
+ * CDC-ACM virtual COM port, a second host link next to USART1. Received data goes to the serial task line
+ * pipeline, real-time override commands are handled as soon as the packet arrives.
+ */
+class UsbCdc : public UsbFunction
+{
+public:
+    UsbCdc();
+    
+    virtual const uint8_t * GetDeviceDescriptor();
+    virtual const uint8_t * GetConfigDescriptor(uint16_t * length);
+    virtual const char * GetProductString();
+    
+    virtual void Configure(PCD_HandleTypeDef * pcd);
+    virtual void Unconfigure(PCD_HandleTypeDef * pcd);
+    
+    virtual bool ClassRequest(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup, uint8_t ** data, uint16_t * length);
+    virtual void ControlOut(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup);
+    
+    virtual void DataIn(PCD_HandleTypeDef * pcd, uint8_t epnum);
+    virtual void DataOut(PCD_HandleTypeDef * pcd, uint8_t epnum);
+    
+    virtual void Service(PCD_HandleTypeDef * pcd, uint32_t events);
+    
+    // Serial task side. Positions are running byte counts, the ring index is the count modulo the size
+    inline uint8_t * GetRxRing() { return m_rx_ring; }
+    inline volatile uint32_t * GetRxReceived() { return &m_rx_received; }
+    inline volatile uint32_t * GetRxDiscard() { return &m_rx_discard; }
+    void RxRelease(uint32_t consumed);
+    
+    // Copies to the Tx ring, waits while it is full. Dropped if no terminal has the port open
+    void Write(const char * data, uint32_t len);
+
+protected:
+    void arm_rx(PCD_HandleTypeDef * pcd);
+    void start_tx(PCD_HandleTypeDef * pcd);
+    
+    volatile bool m_configured;
+    volatile bool m_dtr;                    // Terminal has the port open
+    uint8_t m_line_coding[7];               // Kept for GET_LINE_CODING, the baud rate has no effect
+    
+    uint8_t m_rx_ring[CDC_RX_BUFFER_SIZE];
+    uint8_t m_rx_packet[CDC_DATA_PACKET_SIZE];
+    volatile uint32_t m_rx_received;
+    volatile uint32_t m_rx_consumed;
+    volatile uint32_t m_rx_discard;         // Input up to here belongs to a closed session
+    volatile bool m_rx_armed;
+    
+    uint8_t m_tx_ring[CDC_TX_BUFFER_SIZE];
+    volatile uint32_t m_tx_written;
+    volatile uint32_t m_tx_sent;
+    uint32_t m_tx_transfer_len;
+    bool m_tx_busy;
+    bool m_tx_zlp;
+};
+
+extern UsbCdc usb_cdc;
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef USB_DEVICE_H
+#define USB_DEVICE_H
+
+#include <stdint.h>
+
+#include <stm32f4xx_hal.h>
+
+#define USB_EP0_MAX_PACKET_SIZE     64
+#define USB_STRING_MAX_LENGTH       32      // Characters, descriptor built on request
+
+// String descriptor indexes, shared by all the functions
+#define USB_STRING_MANUFACTURER     1
+#define USB_STRING_PRODUCT          2
+#define USB_STRING_SERIAL           3
+
+#define USB_MANUFACTURER_STRING     "OrionPlus"
+
+#define USB_REATTACH_DELAY_MS       200     // Function switch: disconnect long enough for the host to notice
+
+typedef struct USB_SETUP_PACKET
+{
+    uint8_t  bmRequestType;
+    uint8_t  bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+}USB_SETUP_PACKET;
+
+/*
+ * Device class implemented on top of the core: descriptors, class requests on EP0 and its own endpoints.
+ * Every call is made from the USB task.
+ */
+class UsbFunction
+{
+public:
+    virtual ~UsbFunction() {}
+    
+    virtual const uint8_t * GetDeviceDescriptor() = 0;
+    virtual const uint8_t * GetConfigDescriptor(uint16_t * length) = 0;
+    virtual const char * GetProductString() = 0;
+    
+    // SET_CONFIGURATION 1: open and arm the endpoints. Bus reset, unplug or configuration 0: close them
+    virtual void Configure(PCD_HandleTypeDef * pcd) = 0;
+    virtual void Unconfigure(PCD_HandleTypeDef * pcd) = 0;
+    
+    // Class request [interface or endpoint recipient]. Returns the data to send (IN) or the buffer for the data
+    // stage (OUT, ControlOut called once received). false: not supported, EP0 stalled
+    virtual bool ClassRequest(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup, uint8_t ** data, uint16_t * length) = 0;
+    virtual void ControlOut(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup) {}
+    
+    // Transfer completed on one of the function endpoints
+    virtual void DataIn(PCD_HandleTypeDef * pcd, uint8_t epnum) = 0;
+    virtual void DataOut(PCD_HandleTypeDef * pcd, uint8_t epnum) = 0;
+    
+    // Host cleared the halt of one of the function endpoints [CLEAR_FEATURE]
+    virtual void EndpointCleared(PCD_HandleTypeDef * pcd, uint8_t ep_addr) {}
+    
+    // Cable removed, after Unconfigure
+    virtual void Detached(PCD_HandleTypeDef * pcd) {}
+    
+    // USB task notification bits other than the interrupt, configured device only
+    virtual void Service(PCD_HandleTypeDef * pcd, uint32_t events) = 0;
+};
+
+/*
+ * Minimal full-speed device core over the HAL PCD driver: standard requests and control transfers on EP0,
+ * everything else forwarded to the active function. The OTG interrupt is serviced from the USB task, so the
+ * HAL callbacks (and the functions) run in task context and may use any FreeRTOS call.
+ */
+class UsbDevice
+{
+public:
+    static void Initialize(PCD_HandleTypeDef * pcd, UsbFunction * function);
+    
+    // OTG_FS interrupt deferred to the USB task
+    static void HandleInterrupt();
+    static void Service(uint32_t events);
+    
+    // Cable detect [PD3]: pull-up on D+ enabled while attached
+    static void SetAttached(bool attached);
+    
+    static inline bool IsAttached() { return m_attached; }
+    static inline bool IsConfigured() { return m_configured; }
+    
+    // Any task. The device disconnects and enumerates again as the new function
+    static void RequestFunction(UsbFunction * function);
+    static inline UsbFunction * GetFunction() { return m_function; }
+    
+    // HAL callbacks
+    static void OnSetup();
+    static void OnReset();
+    static void OnDataIn(uint8_t epnum);
+    static void OnDataOut(uint8_t epnum);
+
+protected:
+    typedef enum EP0_STATES
+    {
+        EP0_IDLE,
+        EP0_DATA_IN,
+        EP0_DATA_OUT,
+        EP0_STATUS_IN,
+        EP0_STATUS_OUT,
+    }EP0_STATES;
+    
+    static void standard_request();
+    static void get_descriptor();
+    static void set_configuration(uint8_t config);
+    static void switch_function();
+    
+    static void control_send(const uint8_t * data, uint16_t length);
+    static void control_receive(uint8_t * data, uint16_t length);
+    static void control_status();
+    static void control_stall();
+    
+    static const uint8_t * string_descriptor(const char * text);
+    static const uint8_t * serial_number_descriptor();
+    
+    static PCD_HandleTypeDef * m_pcd;
+    static UsbFunction * volatile m_function;
+    static UsbFunction * volatile m_requested_function;
+    static volatile bool m_configured;
+    static volatile bool m_attached;
+    
+    static USB_SETUP_PACKET m_setup;
+    static EP0_STATES m_ep0_state;
+    static const uint8_t * m_ep0_data;
+    static uint16_t m_ep0_remaining;
+    static bool m_ep0_zlp;
+    
+    static uint8_t m_ep0_buffer[2 + (USB_STRING_MAX_LENGTH * 2)];
+};
+
+#endif
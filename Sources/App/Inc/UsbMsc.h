@@ -0,0 +1,93 @@
+#ifndef USB_MSC_H
+#define USB_MSC_H
+
+#include <stdint.h>
+
+#include "UsbDevice.h"
+#include "spi_ports.h"
+
+#define MSC_DATA_OUT_EP             0x01
+#define MSC_DATA_IN_EP              0x81
+#define MSC_DATA_PACKET_SIZE        64
+
+// Sectors moved per card command and per USB transfer [CCM, the OTG FS core has no DMA]
+#define MSC_MEDIA_BUFFER_SECTORS    8
+#define MSC_MEDIA_BUFFER_SIZE       (MSC_MEDIA_BUFFER_SECTORS * SDCARD_SECTOR_SIZE)
+
+#define MSC_CBW_SIZE                31
+#define MSC_CSW_SIZE                13
+
+/*
+ * USB mass storage [bulk-only transport, SCSI transparent command set] exposing the SD card. Only active
+ * while the disk task has released the card from the FAT mount. READ(10) / WRITE(10) runs go to the card
+ * as multiple block commands, up to MSC_MEDIA_BUFFER_SECTORS at a time.
+ */
+class UsbMsc : public UsbFunction
+{
+public:
+    UsbMsc();
+    
+    virtual const uint8_t * GetDeviceDescriptor();
+    virtual const uint8_t * GetConfigDescriptor(uint16_t * length);
+    virtual const char * GetProductString();
+    
+    virtual void Configure(PCD_HandleTypeDef * pcd);
+    virtual void Unconfigure(PCD_HandleTypeDef * pcd);
+    
+    virtual bool ClassRequest(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup, uint8_t ** data, uint16_t * length);
+    
+    virtual void DataIn(PCD_HandleTypeDef * pcd, uint8_t epnum);
+    virtual void DataOut(PCD_HandleTypeDef * pcd, uint8_t epnum);
+    virtual void EndpointCleared(PCD_HandleTypeDef * pcd, uint8_t ep_addr);
+    virtual void Detached(PCD_HandleTypeDef * pcd);
+    
+    virtual void Service(PCD_HandleTypeDef * pcd, uint32_t events) {}
+
+protected:
+    typedef enum MSC_STATES
+    {
+        MSC_IDLE,                   // Waiting for a command block
+        MSC_DATA_IN,                // Short response being sent
+        MSC_READ,
+        MSC_WRITE,
+        MSC_STATUS_PENDING,         // IN endpoint halted, status sent once the host clears it
+        MSC_STATUS,                 // Status being sent
+        MSC_INVALID_COMMAND,        // Both endpoints halted until a mass storage reset
+    }MSC_STATES;
+    
+    void receive_command(PCD_HandleTypeDef * pcd);
+    void process_command(PCD_HandleTypeDef * pcd);
+    void send_data(PCD_HandleTypeDef * pcd, const uint8_t * data, uint32_t length);
+    void send_status(PCD_HandleTypeDef * pcd, uint8_t status);
+    void fail_command(PCD_HandleTypeDef * pcd, uint8_t sense_key, uint8_t asc);
+    
+    void start_read(PCD_HandleTypeDef * pcd);
+    void continue_read(PCD_HandleTypeDef * pcd);
+    void start_write(PCD_HandleTypeDef * pcd);
+    void continue_write(PCD_HandleTypeDef * pcd);
+    
+    MSC_STATES m_state;
+    bool m_medium_ready;                    // Cleared by an eject from the host
+    uint8_t m_max_lun;
+    
+    // Current command
+    uint8_t m_cbw[MSC_DATA_PACKET_SIZE];
+    uint32_t m_tag;
+    uint32_t m_data_length;                 // Expected by the host
+    uint32_t m_residue;
+    bool m_data_in;
+    
+    uint32_t m_lba;
+    uint32_t m_blocks;                      // Left to transfer
+    uint32_t m_chunk_blocks;                // In the current transfer
+    
+    uint8_t m_sense_key;
+    uint8_t m_sense_asc;
+    
+    uint8_t m_response[36];
+    uint8_t m_csw[MSC_CSW_SIZE];
+};
+
+extern UsbMsc usb_msc;
+
+#endif
@@ -3,10 +3,29 @@
 
 #include <stm32f4xx_hal.h>
 
+#define ANALOG_CHANNELS_COUNT           8       // PA0..PA7 [ADC1_IN0..ADC1_IN7]
+#define ANALOG_OVERSAMPLING             16      // Scans kept in the DMA buffer and added per value
+#define ANALOG_SCAN_RATE_HZ             1000    // TIM4 CC4 trigger
+
+// Values are the sum of the last ANALOG_OVERSAMPLING conversions
+#define ANALOG_FULL_SCALE               (4095 * ANALOG_OVERSAMPLING)
+#define ANALOG_VREF_mV                  3300
+
+// Channel assignment
+#define ANALOG_CHANNEL_SPINDLE_LOAD     0       // PA0  [VFD analog load/current output]
+#define ANALOG_CHANNEL_FEED_OVERRIDE    1       // PA1  [Feed override potentiometer]
+#define ANALOG_CHANNEL_PROBE            2       // PA2  [Probe voltage]
+
 extern ADC_HandleTypeDef hadc1;
 
 
 void Init_ADC(void);
+void Start_ADC_Scan(void);
 
-#endif
+// Lock-free, callable from tasks and interrupts. Each value adds the whole circular buffer, which
+// the DMA keeps updating: at most one conversion per channel is newer than the rest
+uint32_t ADC_GetValue(uint32_t channel);
+uint32_t ADC_GetValue_mV(uint32_t channel);
+void ADC_GetSnapshot(uint32_t * values);     // ANALOG_CHANNELS_COUNT values
 
+#endif
@@ -0,0 +1,15 @@
+#ifndef COMPILE_CHECK_H
+#define COMPILE_CHECK_H
+
+#define COMPILE_CHECK_CONCAT_(a, b)     a##b
+#define COMPILE_CHECK_CONCAT(a, b)      COMPILE_CHECK_CONCAT_(a, b)
+
+/*
+ * Compile-time check for the C++03 compiler [ARMCC 5, no static_assert]. A false condition declares an
+ * array of negative size, so the build stops at that line. The message is only there for the reader.
+ * Namespace scope only, one check per line.
+ */
+#define COMPILE_CHECK(condition, message) \
+    typedef char COMPILE_CHECK_CONCAT(compile_check_line_, __LINE__)[(condition) ? 1 : -1]
+
+#endif
@@ -4,8 +4,34 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+// Disk task notification bits
+#define DISK_NOTIFY_USB_STORAGE     0x01    // Hand the card over to the USB host
+#define DISK_NOTIFY_LOCAL           0x02    // Take it back and mount the FAT volume again
+
+#define DISK_MOUNT_RETRY_MS         2000    // No card (or no FAT volume) at the last attempt
+#define DISK_REQUEST_POLL_MS        10      // Requester waiting for the disk task, notifications may be shared
+
+/*
+ * The SD card is either mounted by FreeRTOS+FAT ("/") or exported to the USB host as a mass storage device,
+ * never both: the host would corrupt the volume behind the FAT cache and the other way around.
+ */
+typedef enum DISK_MODES
+{
+    DISK_MODE_NO_CARD,
+    DISK_MODE_LOCAL,
+    DISK_MODE_USB_STORAGE,
+}DISK_MODES;
+
 extern TaskHandle_t disk_task_handle;
 
 void DiskTask_Entry(void * pvParam);
 
+// Task context, waits for the switch. Refused (false) while a file is open, without a card or USB host
+bool DiskTask_SetUsbStorage(bool enable);
+
+// USB task [eject, cable removed], does not wait
+void DiskTask_ReleaseUsbStorage(void);
+
+DISK_MODES DiskTask_GetMode(void);
+
 #endif
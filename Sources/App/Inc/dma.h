@@ -4,6 +4,11 @@
 #include <stm32f4xx_hal.h>
 
 extern DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+extern DMA_HandleTypeDef hdma_spindle_uart_tx;
+extern DMA_HandleTypeDef hdma_spindle_uart_rx;
+extern DMA_HandleTypeDef hdma_adc1;
+extern DMA_HandleTypeDef hdma_debug_uart_rx;
+extern DMA_HandleTypeDef hdma_debug_uart_tx;
 
 void Init_DMA_Controller(void);
 
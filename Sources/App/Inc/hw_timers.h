@@ -3,6 +3,9 @@
 
 #include <stm32f4xx_hal.h>
 
+#define PWM3_TIMER_PERIOD       1000    // Counts per PWM period [TIM4], CC4 also triggers the ADC scan
+#define PWM12_TIMER_PERIOD      1000    // Counts per PWM period [TIM9]
+
 extern TIM_HandleTypeDef step_timer_handle;
 extern TIM_HandleTypeDef unstep_timer_handle;
 extern TIM_HandleTypeDef pwm3_timer_handle;
@@ -0,0 +1,72 @@
+#ifndef MEMORY_MAP_H
+#define MEMORY_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Static memory plan [regions placed by Configs/OrionPlus.sct]
+ *
+ * SRAM  0x20000000  128 KB  Everything a DMA may access, and whatever is not placed in CCM:
+ *
+ *     FreeRTOS heap    configTOTAL_HEAP_SIZE            44 KB   task stacks, toolpath canvas, pool fallbacks
+ *     Display buffers  2 x LV_HOR_RES_MAX x 10 lines    31 KB   NT35510 flush DMA, static
+ *     Main stack       startup Stack_Size                1 KB
+ *     FAT sector pool                                    2 KB
+ *     USB CDC rings    Rx + Tx                           2 KB
+ *     Serial rings     Rx + Tx                           1 KB
+ *
+ * CCM   0x10000000   64 KB  CPU only. Data touched by the step ISR and the pools that never see a DMA:
+ *
+ *     Block ring       CONVEYOR_QUEUE_SIZE x ~300 B     19 KB
+ *     Trace ring       TRACE_BUFFER_EVENTS x 8 B         8 KB
+ *     Line pool                                          1 KB
+ *     UI pools                                          14 KB
+ *     USB mass storage buffer                            4 KB
+ *
+ * The linker fails if the CCM region overflows.
+ *
+ * The Debug_RAM target [Configs/OrionPlus_RAM.sct] is not supported by this plan: it leaves 48 KB of SRAM
+ * for data, less than the heap and the display buffers alone.
+ */
+#define CCM_RAM                         __attribute__((section(".bss.ccm")))
+
+// Look-ahead depth [blocks]
+#define CONVEYOR_QUEUE_SIZE             64
+
+// Fixed-block pools. Sizes are multiples of 8, so every block keeps the 8 byte alignment
+#define LINE_POOL_BLOCK_SIZE            264     // Text lines (serial, G-code files) [CCM]
+#define LINE_POOL_BLOCK_COUNT           4
+
+#define FAT_SECTOR_POOL_BLOCK_SIZE      512     // File sector buffers [SRAM, SD card DMA]
+#define FAT_SECTOR_POOL_BLOCK_COUNT     4
+
+#define UI_POOL_SMALL_BLOCK_SIZE        32      // LVGL objects and attributes [CCM]
+#define UI_POOL_SMALL_BLOCK_COUNT       128
+#define UI_POOL_MEDIUM_BLOCK_SIZE       64
+#define UI_POOL_MEDIUM_BLOCK_COUNT      64
+#define UI_POOL_LARGE_BLOCK_SIZE        128
+#define UI_POOL_LARGE_BLOCK_COUNT       32
+#define UI_POOL_HUGE_BLOCK_SIZE         256
+#define UI_POOL_HUGE_BLOCK_COUNT        8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// O(1) allocation from the fixed-block pools, task context. Requests that do not fit a pool (or with the
+// pool exhausted) fall back to the FreeRTOS heap, counted in the pool statistics
+void * line_pool_alloc(void);
+void line_pool_free(void * ptr);
+
+void * fat_pool_alloc(size_t size);
+void fat_pool_free(void * ptr);
+
+void * ui_pool_alloc(size_t size);
+void ui_pool_free(void * ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef DIAGNOSTICSPAGE_H
+#define DIAGNOSTICSPAGE_H
+
+#include <stdint.h>
+#include "lvgl.h"
+#include "BasePage.h"
+
+#include "Profiler.h"
+
+#define DIAG_REPORT_TEXT_SIZE           2048    // Profiler and memory reports shown in the scrollable page
+
+
+class DiagnosticsPage : public BasePageWindow
+{
+public:
+    virtual void Create(lv_obj_t * parent);
+    virtual void Destroy();
+    virtual void Update();
+    
+protected:
+
+    lv_obj_t * m_report_page;
+    lv_obj_t * m_report_label;
+    lv_obj_t * m_queue_chart;
+    lv_chart_series_t * m_queue_series;
+    
+    char * m_report_text;
+    uint32_t m_report_len;
+    
+    // Profiler window already shown. Contents only change once per window
+    uint32_t m_shown_window_seq;
+    
+    static void append_report_line(void * context, const char * text);
+};
+
+#endif
@@ -5,17 +5,27 @@
 #include "lvgl.h"
 #include "BasePage.h"
 
+#define DRO_AXES_COUNT          3
+#define DRO_TEXT_MAX_LEN        16
+
 
 class MainPage : public BasePageWindow
 {
 public:
     virtual void Create(lv_obj_t * parent);
     virtual void Destroy();
+    virtual void Update();
     
 protected:
 
     lv_obj_t ** m_xyz_curr_labels;
     lv_obj_t ** m_xyz_next_labels;    
+    
+    // Last text shown in each label, to only invalidate labels that really changed
+    char m_curr_label_text[DRO_AXES_COUNT][DRO_TEXT_MAX_LEN];
+    char m_next_label_text[DRO_AXES_COUNT][DRO_TEXT_MAX_LEN];
+    
+    static void update_label(lv_obj_t * label, char * shown_text, const char * new_text);
 };
 
 #endif
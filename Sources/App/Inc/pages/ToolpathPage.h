@@ -0,0 +1,42 @@
+#ifndef TOOLPATHPAGE_H
+#define TOOLPATHPAGE_H
+
+#include <stdint.h>
+#include "lvgl.h"
+#include "BasePage.h"
+
+#define TOOLPATH_CANVAS_SIZE            320     // Square canvas [pixels]
+#define TOOLPATH_MAX_SEGMENTS_PER_UPDATE 64     // Limits drawing time per UI cycle
+
+
+class ToolpathPage : public BasePageWindow
+{
+public:
+    virtual void Create(lv_obj_t * parent);
+    virtual void Destroy();
+    virtual void Update();
+    
+protected:
+
+    lv_obj_t * m_canvas_handle;
+    lv_obj_t * m_position_marker;
+    uint8_t * m_canvas_buffer;
+    
+    // Tracker state already drawn
+    uint32_t m_drawn_seq;
+    uint32_t m_tracker_reset_count;
+    bool m_has_last_px;
+    lv_point_t m_last_px;
+    
+    // mm -> pixel transformation
+    float m_origin_x;
+    float m_origin_y;
+    float m_scale;
+    
+    void setup_scale();
+    void clear_canvas();
+    void map_point(float x, float y, lv_point_t& px);
+    void draw_segment(const lv_point_t& p0, const lv_point_t& p1, lv_area_t& dirty);
+};
+
+#endif
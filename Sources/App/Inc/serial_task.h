@@ -4,11 +4,39 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
-#define RX_BUFFER_SIZE  256
-#define TX_BUFFER_SIZE  256
+// DMA rings [SRAM, power of 2]. Lines are parsed in place, so the Rx ring must hold the line being executed
+// plus what the host streams meanwhile (Grbl character counting: 128 bytes unacknowledged)
+#define RX_BUFFER_SIZE  512
+#define TX_BUFFER_SIZE  512
+
+#define SERIAL_LINE_MAX_LENGTH      256     // Longer lines are cut and executed 'as is'
+#define SERIAL_TX_WAIT_POLL_MS      10      // Tx ring full: recheck period, notifications may be shared
+
+// Real-time override commands [Grbl 1.1 extended ASCII], handled as soon as received (UART Rx interrupts,
+// USB task), never queued behind a line
+#define RT_CMD_FEED_OVR_RESET       0x90
+#define RT_CMD_FEED_OVR_COARSE_PLUS 0x91
+#define RT_CMD_FEED_OVR_COARSE_MINUS 0x92
+#define RT_CMD_FEED_OVR_FINE_PLUS   0x93
+#define RT_CMD_FEED_OVR_FINE_MINUS  0x94
+#define RT_CMD_RAPID_OVR_RESET      0x95
+#define RT_CMD_RAPID_OVR_MEDIUM     0x96
+#define RT_CMD_RAPID_OVR_LOW        0x97
+#define RT_CMD_SPINDLE_OVR_RESET    0x99
+#define RT_CMD_SPINDLE_OVR_COARSE_PLUS  0x9A
+#define RT_CMD_SPINDLE_OVR_COARSE_MINUS 0x9B
+#define RT_CMD_SPINDLE_OVR_FINE_PLUS    0x9C
+#define RT_CMD_SPINDLE_OVR_FINE_MINUS   0x9D
 
 extern TaskHandle_t serial_task_handle;
 
 void SerialTask_Entry(void * pvParam);
 
+static inline bool SerialTask_IsRealtimeCommand(uint8_t ch)
+{
+    return (ch >= RT_CMD_FEED_OVR_RESET && ch <= RT_CMD_SPINDLE_OVR_FINE_MINUS) ? true : false;
+}
+
+void SerialTask_HandleRealtimeCommand(uint8_t cmd);
+
 #endif
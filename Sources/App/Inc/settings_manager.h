@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+
 /*
  * signal_invert_mask has one bit for every stepper motor control signal
  * 
@@ -33,6 +37,8 @@
 
 #define SIGNAL_INVERT_LIMIT_PINS_MASK   ((1 << 8) | (1 << 7) | (1 << 6))
 
+#define SIGNAL_INVERT_PROBE             (1 << 9)
+
 #define SIGNAL_INVERT_GLB_FLT           (1 << 13)
 #define SIGNAL_INVERT_STP_RST           (1 << 14)
 #define SIGNAL_INVERT_STP_ENA           (1 << 15)
@@ -72,8 +78,38 @@ typedef struct HOMING_SETUP_DATA
     float       home_feed_rate_mm_sec;
     uint32_t    home_debounce_ms;
     float       home_pull_off_distance_mm;
+    uint32_t    home_cycle_axes;        // Axes homed in parallel, one byte per cycle starting at the LSB
 }HOMING_SETUP_DATA;
 
+#define HOMING_CYCLES_COUNT             4
+
+#define SPINDLE_INTERFACE_PWM           0   // TIM9 CH1 speed, CH2 direction
+#define SPINDLE_INTERFACE_MODBUS        1   // VFD on USART3 [Modbus RTU]
+
+typedef struct SPINDLE_SETUP_DATA
+{
+    uint8_t     interface;                  // SPINDLE_INTERFACE_PWM / SPINDLE_INTERFACE_MODBUS
+    uint8_t     modbus_address;             // VFD slave address
+    uint8_t     at_speed_tolerance_pct;     // Measured speed within this percentage of the target
+    uint8_t     use_aux_at_speed_input;     // PWM: SPIN_AUX input is the at-speed output of the VFD
+    uint8_t     laser_mode;                 // PWM output driven by the step ticker, power follows the feed rate
+    uint32_t    spin_up_delay_ms;           // PWM without at-speed input: fixed wait after a speed change
+    uint32_t    at_speed_timeout_ms;        // M3/M4 fail if the spindle is not at speed by then
+    float       rpm_per_hz;                 // Modbus: spindle speed per VFD output frequency
+    float       rated_current_A;            // Modbus: VFD output current at 100% spindle load
+}SPINDLE_SETUP_DATA;
+
+typedef struct ANALOG_INPUTS_SETUP_DATA
+{
+    uint8_t     feed_override_knob;         // Feed override follows the potentiometer input
+    uint8_t     spindle_load_input;         // Spindle load from the VFD analog output
+    uint16_t    spindle_load_full_scale_mV; // Spindle load input voltage at 100% load
+    uint8_t     adaptive_feed;              // Feed reduced automatically on high spindle load
+    uint8_t     adaptive_load_high_pct;     // Feed is reduced above this load
+    uint8_t     adaptive_load_low_pct;      // Feed is restored below this load
+    uint8_t     adaptive_min_feed_pct;      // Lowest feed reached by the adaptive reduction
+}ANALOG_INPUTS_SETUP_DATA;
+
 typedef union DISPLAY_SETTINGS
 {
     uint32_t AsWord32;
@@ -112,6 +148,9 @@ typedef struct SETTINGS_DATA
     float       spindle_min_rpm;
     float       spindle_max_rpm;
     
+    struct SPINDLE_SETUP_DATA spindle_data;
+    struct ANALOG_INPUTS_SETUP_DATA analog_data;
+    
     uint32_t    active_coord_system;
     float       aux_coord_systems[9][6];
     
@@ -137,6 +176,15 @@ typedef struct SETTINGS_DATA
 #define SETTINGS_DATA_START_ADDRESS     0x00000000
 #define SETTINGS_HEADER_VALUE           0x7A534859  // YHSz
 
+#define SETTINGS_FLASH_PAGE_SIZE        256
+#define SETTINGS_FLASH_PAGE_COUNT       ((SETTINGS_DATA_SIZE_BYTES + SETTINGS_FLASH_PAGE_SIZE - 1) / SETTINGS_FLASH_PAGE_SIZE)
+
+// Writer task event bits
+#define SETTINGS_WRITER_IDLE_BIT        (1 << 0)    // Every requested save has reached flash
+#define SETTINGS_WRITER_ERROR_BIT       (1 << 1)    // Last write failed verification
+
+#define SETTINGS_FLUSH_TIMEOUT_MS       1000        // Sector erase is 400ms worst case
+
 
 
 class Settings_Manager
@@ -144,8 +192,11 @@ class Settings_Manager
 public:
 
     static void Initialize();
+    static void StartWriterTask();
+    
 	static int Load();
 	static void Save();
+    static bool Flush(uint32_t timeout_ms);
 
 	static void ResetToDefaults();
 
@@ -197,11 +248,32 @@ public:
     static inline void GetSpindleSpeeds(float& min_rpm, float& max_rpm) { min_rpm = m_data->spindle_min_rpm; max_rpm = m_data->spindle_max_rpm; }
     static inline void SetSpindleSpeeds(const float& mins, const float& maxs) { m_data->spindle_min_rpm = mins; m_data->spindle_max_rpm = maxs; }
     
+    static inline const SPINDLE_SETUP_DATA& GetSpindleData() { return m_data->spindle_data; };
+    static void SetSpindleData(const SPINDLE_SETUP_DATA& updated_data);
+    
+    static inline const ANALOG_INPUTS_SETUP_DATA& GetAnalogInputsData() { return m_data->analog_data; };
+    static void SetAnalogInputsData(const ANALOG_INPUTS_SETUP_DATA& updated_data);
+    
 protected:
     
     static void Internal_AllocMemory(void);
+    static bool Internal_WriteImage(SETTINGS_DATA * image);
+    
+    static void WriterTask_Entry(void * pvParam);
 
 	static SETTINGS_DATA * m_data;
+    
+    // RAM shadow of what is currently stored in flash and scratch copy being written
+    static SETTINGS_DATA * m_flash_shadow;
+    static SETTINGS_DATA * m_write_image;
+    
+    static TaskHandle_t m_writer_task;
+    static EventGroupHandle_t m_writer_events;
+    
+    // Save requests are coalesced: the writer always stores the latest data and
+    // then marks every request up to that generation as completed
+    static volatile uint32_t m_requested_gen;
+    static volatile uint32_t m_completed_gen;
 };
 
 #endif
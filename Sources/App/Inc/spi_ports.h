@@ -23,6 +23,31 @@ void W25QXX_Erase_Sector(uint32_t Dst_Addr);
 void W25QXX_PowerDown(void);
 void W25QXX_WakeUp(void);
 
+// SD card in SPI mode [SPI3]. Also used by the FreeRTOS+FAT disk driver (C)
+#define SDCARD_SECTOR_SIZE      512
+
+typedef enum SDCARD_RESULTS
+{
+    SDCARD_OK = 0,
+    SDCARD_ERROR_NO_CARD,
+    SDCARD_ERROR_TIMEOUT,
+    SDCARD_ERROR_COMMAND,
+    SDCARD_ERROR_DATA,
+    SDCARD_ERROR_RANGE,
+}SDCARD_RESULTS;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SDCARD_RESULTS SDCARD_Init(void);
+uint32_t SDCARD_GetSectorCount(void);
+SDCARD_RESULTS SDCARD_ReadBlocks(uint8_t * pBuffer, uint32_t sector, uint32_t count);
+SDCARD_RESULTS SDCARD_WriteBlocks(const uint8_t * pBuffer, uint32_t sector, uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
 
 
 #endif
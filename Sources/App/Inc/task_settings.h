@@ -3,14 +3,28 @@
 
 #include "FreeRTOSConfig.h"
 
+// Interrupt priorities [lower value preempts]. Step level: above configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY,
+// never masked by the kernel critical sections, so it must not call any FreeRTOS function
+#define STEP_IRQ_PRIORITY           (configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY - 1)   // TIM2 step, TIM6 unstep, EXTI9_5 limits/fault
+#define SOFT_IRQ_PRIORITY           configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY         // Task notifications deferred by the step level
+
+#define ALARM_TASK_PRIORITY         (configMAX_PRIORITIES - 1)     // Limit switch/driver fault reaction
+#define ALARM_TASK_STACK_SIZE       (configMINIMAL_STACK_SIZE * 1)
+
+#define MOTION_TASK_PRIORITY        (configMAX_PRIORITIES - 2)     // Block recycling, look-ahead release, replans
+#define MOTION_TASK_STACK_SIZE      (configMINIMAL_STACK_SIZE * 2)
+
+#define SPINDLE_TASK_PRIORITY       (configMAX_PRIORITIES - 3)     // VFD link, at-speed feedback
+#define SPINDLE_TASK_STACK_SIZE     (configMINIMAL_STACK_SIZE * 2)
+
 #define UI_BOOT_TASK_PRIORITY       (configMAX_PRIORITIES - 3)
 #define UI_BOOT_TASK_STACK_SIZE     (configMINIMAL_STACK_SIZE * 3)
 
-#define UI_TASK_PRIORITY            (configMAX_PRIORITIES - 4)
+#define UI_TASK_PRIORITY            (configMAX_PRIORITIES - 5)     // Below parser & serial tasks
 #define UI_TASK_STACK_SIZE          (configMINIMAL_STACK_SIZE * 8)
 
-#define USB_TASK_PRIORITY           (configMAX_PRIORITIES - 2)
-#define USB_TASK_STACK_SIZE         (configMINIMAL_STACK_SIZE * 1)
+#define USB_TASK_PRIORITY           (configMAX_PRIORITIES - 2)     // OTG interrupt deferred here, EP0 timing
+#define USB_TASK_STACK_SIZE         (configMINIMAL_STACK_SIZE * 2)
 
 #define GCODE_TASK_PRIORITY         (configMAX_PRIORITIES - 4)
 #define GCODE_TASK_STACK_SIZE       (configMINIMAL_STACK_SIZE * 2)
@@ -18,10 +32,13 @@
 #define LISTENER_TASK_PRIORITY      (configMAX_PRIORITIES - 4)
 #define LISTENER_TASK_STACK_SIZE    (configMINIMAL_STACK_SIZE * 1)
 
-#define DISK_TASK_PRIORITY          (configMAX_PRIORITIES - 4)
-#define DISK_TASK_STACK_SIZE        (configMINIMAL_STACK_SIZE * 1)
+#define DISK_TASK_PRIORITY          (configMAX_PRIORITIES - 4)     // SD card owner: FAT mount / USB mass storage
+#define DISK_TASK_STACK_SIZE        (configMINIMAL_STACK_SIZE * 2)
 
 #define SERIAL_TASK_PRIORITY        (configMAX_PRIORITIES - 4)
 #define SERIAL_TASK_STACK_SIZE      (configMINIMAL_STACK_SIZE * 2)
 
+#define SETTINGS_TASK_PRIORITY      (configMAX_PRIORITIES - 6)
+#define SETTINGS_TASK_STACK_SIZE    (configMINIMAL_STACK_SIZE * 1)
+
 #endif
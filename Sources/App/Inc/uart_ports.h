@@ -3,6 +3,9 @@
 
 #include <stm32f4xx_hal.h>
 
+#define DEBUG_UART_BAUDRATE     921600  // Host link, Rx & Tx by DMA
+#define SPINDLE_UART_BAUDRATE   19200   // Modbus RTU, 8E1 [most VFDs default]
+
 
 extern UART_HandleTypeDef debug_uart_handle;
 extern UART_HandleTypeDef spindle_uart_handle;
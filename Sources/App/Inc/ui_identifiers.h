@@ -14,7 +14,9 @@ typedef enum UI_Identifier_Values
     ControlBar_MenuBtn_Home,
     ControlBar_MenuBtn_Settings,
     ControlBar_MenuBtn_FileManager,
+    ControlBar_MenuBtn_Toolpath,
     ControlBar_MenuBtn_Messages,
+    ControlBar_MenuBtn_Diagnostics,
     ControlBar_MenuBtn_AboutCNC,
     
     
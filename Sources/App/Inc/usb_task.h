@@ -4,6 +4,14 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+// USB task notification bits
+#define USB_NOTIFY_IRQ          0x01    // OTG_FS interrupt, masked until serviced by the task
+#define USB_NOTIFY_TX           0x02    // Data queued for an IN endpoint
+#define USB_NOTIFY_RX_SPACE     0x04    // Room made behind an OUT endpoint, may be re-armed
+#define USB_NOTIFY_FUNCTION     0x08    // Device function switch requested [CDC / mass storage]
+
+#define USB_CABLE_POLL_MS       100     // Connection detect [PD3] sampling
+
 extern TaskHandle_t usb_task_handle;
 
 void USBTask_Entry(void * pvParam);
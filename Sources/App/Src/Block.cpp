@@ -24,7 +24,6 @@
 
 Block::Block()
 {
-    tick_info = NULL;
     clear();
 }
 
@@ -45,23 +44,22 @@ void Block::clear()
     accelerate_until    = 0;
     decelerate_after    = 0;
     direction_bits      = 0;
+    output_mask         = 0;
+    output_values       = 0;
     recalculate_flag    = false;
     nominal_length_flag = false;
     max_entry_speed     = 0.0F;
+    programmed_speed    = 0.0F;
+    speed_limit         = 0.0F;
+    max_junction_speed  = 0.0F;
     is_ticking          = false;
     is_g123             = false;
     locked              = false;
-    //s_value             = 0.0F;
+    s_value             = 0;
 
     total_move_ticks = 0;
     
-    if (tick_info == NULL) 
-    {
-        // we create this once for this block
-        tick_info= new tickinfo_t[TOTAL_AXES_COUNT]; //(tickinfo_t *)malloc(sizeof(tickinfo_t) * n_actuators);
-    }
-    
-    memset(tick_info, 0, sizeof(tickinfo_t) * TOTAL_AXES_COUNT);
+    memset(tick_info, 0, sizeof(tick_info));
 }
 
 
@@ -74,11 +72,11 @@ void Block::clear()
 //                              +-------------+
 //                                  time -->
 */
-void Block::calculate_trapezoid(float entryspeed, float exitspeed)
+bool Block::calculate_trapezoid(float entryspeed, float exitspeed)
 {
     // if block is currently executing, don't touch anything!
     if (is_ticking) 
-        return;
+        return false;
 
     float initial_rate = this->nominal_rate * (entryspeed / this->nominal_speed); // steps/sec
     float final_rate = this->nominal_rate * (exitspeed / this->nominal_speed);
@@ -149,6 +147,13 @@ void Block::calculate_trapezoid(float entryspeed, float exitspeed)
     // the updates to the blocks to get around it
     this->locked= true;
     
+    // Started by the step ticker while the values above were computed
+    if (this->is_ticking)
+    {
+        this->locked= false;
+        return false;
+    }
+    
     // Now figure out the two acceleration ramp change events in ticks
     this->accelerate_until = acceleration_ticks;
     this->decelerate_after = total_move_ticks - deceleration_ticks;
@@ -164,6 +169,8 @@ void Block::calculate_trapezoid(float entryspeed, float exitspeed)
     this->prepare(acceleration_in_steps, deceleration_in_steps);
 
     this->locked= false;
+    
+    return true;
 }
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the
@@ -261,8 +268,11 @@ void Block::prepare(float acceleration_in_steps, float deceleration_in_steps)
     // float deceleration_per_tick = deceleration_in_steps / STEP_TICKER_FREQUENCY_2;
     double acceleration_per_tick = acceleration_in_steps * fp_scale; // this is now scaled to fit a 2.30 fixed point number
     double deceleration_per_tick = deceleration_in_steps * fp_scale;
+    
+    // Feed hold can start anywhere in the block, so it always brakes with the block acceleration
+    double hold_deceleration_per_tick = ((this->acceleration * this->steps_event_count) / this->millimeters) * fp_scale;
 
-    for (uint8_t m = 0; m < TOTAL_AXES_COUNT; m++) 
+    for (uint8_t m = 0; m < MOTION_AXES_COUNT; m++) 
     {
         uint32_t steps = this->steps[m];
         
@@ -303,9 +313,54 @@ void Block::prepare(float acceleration_in_steps, float deceleration_in_steps)
         this->tick_info[m].acceleration_change= (int64_t)round(acceleration_change * aratio);
         this->tick_info[m].deceleration_change= -(int64_t)round(deceleration_per_tick * aratio);
         this->tick_info[m].plateau_rate= (int64_t)round(((this->maximum_rate * aratio) / STEP_TICKER_FREQUENCY) * STEPTICKER_FPSCALE);
+        this->tick_info[m].hold_deceleration_change= -(int64_t)round(hold_deceleration_per_tick * aratio);
     }
 }
 
+// Called when a feed hold stopped the step ticker inside this block. Keep only the steps not
+// executed yet, so the block can be replanned from rest and resumed from the stop point
+void Block::trim_executed_steps(uint32_t * executed_steps)
+{
+    uint32_t remaining_event_count = 0;
+    uint32_t primary_steps = 0;
+    uint32_t primary_remaining = 0;
+    
+    for (uint8_t m = 0; m < TOTAL_AXES_COUNT; m++) 
+    {
+        // steps_to_move is cleared once a motor has issued all of its steps. Axes without a motor are done
+        uint32_t remaining = 0;
+        
+        if (m < MOTION_AXES_COUNT && this->tick_info[m].steps_to_move != 0)
+            remaining = this->tick_info[m].steps_to_move - this->tick_info[m].step_count;
+        
+        // Primary motor as chosen by the step ticker: first driven motor with the most steps
+        if (m < MOTION_AXES_COUNT && this->steps[m] > primary_steps)
+        {
+            primary_steps = this->steps[m];
+            primary_remaining = remaining;
+        }
+        
+        executed_steps[m] = this->steps[m] - remaining;
+        this->steps[m] = remaining;
+        
+        remaining_event_count = std::max(remaining_event_count, remaining);
+    }
+    
+    // The steps_event_count axis may be one without a motor: the distance left follows the primary motor
+    this->millimeters *= (primary_steps > 0) ? ((float)primary_remaining / primary_steps) : 0.0F;
+    this->steps_event_count = remaining_event_count;
+    
+    if (this->millimeters > 0.0F)
+        this->nominal_rate = this->steps_event_count * this->nominal_speed / this->millimeters;
+    
+    // Starts from rest
+    this->entry_speed = 0.0F;
+    this->max_entry_speed = 0.0F;
+    this->nominal_length_flag = (this->nominal_speed <= sqrtf(2.0F * this->acceleration * this->millimeters));
+    this->recalculate_flag = true;
+    this->is_ticking = false;
+}
+
 // returns current rate (steps/sec) for the given actuator
 float Block::get_trapezoid_rate(int i) const
 {
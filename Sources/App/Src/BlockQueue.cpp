@@ -7,6 +7,7 @@ BlockQueue::BlockQueue()
     head_i = tail_i = length = 0;
     isr_tail_i = tail_i;
     ring = NULL;
+    static_ring = false;
 }
 
 BlockQueue::BlockQueue(unsigned int length)
@@ -17,6 +18,7 @@ BlockQueue::BlockQueue(unsigned int length)
     ring = new Block[length];
     // TODO: handle allocation failure
     this->length = length;
+    static_ring = false;
 }
 
 /* Destructor */
@@ -25,7 +27,7 @@ BlockQueue::~BlockQueue()
     head_i = tail_i = length = 0;
     isr_tail_i = tail_i;
 
-    if(ring != NULL)
+    if(ring != NULL && !static_ring)
         delete [] ring; // delete [] ring;
 
     ring = NULL;
@@ -136,7 +138,7 @@ bool BlockQueue::is_full(void) const
  */
 bool BlockQueue::resize(unsigned int new_size)
 {
-    if (is_empty())
+    if (is_empty() && !static_ring)
     {
         if (new_size == 0)
         {
@@ -193,3 +195,17 @@ bool BlockQueue::resize(unsigned int new_size)
     return false;
 }
 
+bool BlockQueue::assign(Block* storage, unsigned int size)
+{
+    if (ring != NULL || !is_empty())
+        return false;
+
+    ring = storage;
+    static_ring = true;
+    length = size;
+    head_i = tail_i = 0;
+    isr_tail_i = tail_i;
+
+    return true;
+}
+
@@ -1,9 +1,15 @@
 #include "ControlBar.h"
 #include "UI_Identifiers.h"
+#include "PageManager.h"
+
+#include "user_tasks.h"
+#include "MachineCore.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
 
+#include "memory_map.h"
+
 const void * ControlBarWindow::m_icon_symbols[9] = 
 { 
     LV_SYMBOL_POWER, LV_SYMBOL_LIST, LV_SYMBOL_STOP, LV_SYMBOL_PAUSE, LV_SYMBOL_PLAY,
@@ -18,8 +24,8 @@ void ControlBarWindow::Create(lv_obj_t * parent)
     uint32_t xpos, ypos, index;
     custom_user_data_t myud;
     
-    // Set specific buttons enabled [Home, Settings, 0, 0, About]
-    m_enabled_flag = 0x13;
+    // Set specific buttons enabled [Home, Settings, 0, Toolpath, 0, Diagnostics, About]
+    m_enabled_flag = 0x6B;
     
     lv_obj_t * base_bar = lv_cont_create(lv_scr_act(), NULL);
     
@@ -31,7 +37,7 @@ void ControlBarWindow::Create(lv_obj_t * parent)
     xpos = 800 - 64 + 2;
     ypos =  64 - 60 - 2;
     
-    m_control_btn_handle_array = (lv_obj_t**)pvPortMalloc(sizeof(lv_obj_t*) * 5);
+    m_control_btn_handle_array = (lv_obj_t**)ui_pool_alloc(sizeof(lv_obj_t*) * 5);
     
     // Loop to create buttons
     for (index = 0; index < 5; index++)
@@ -63,8 +69,8 @@ void ControlBarWindow::Create(lv_obj_t * parent)
     ypos = 2;    
     
     // First, allocate memory for handle arrays
-    m_status_icon_handle_array = (lv_obj_t**)pvPortMalloc(sizeof(lv_obj_t*) * 4);
-    m_status_label_handle_array = (lv_obj_t**)pvPortMalloc(sizeof(lv_obj_t*) * 8);
+    m_status_icon_handle_array = (lv_obj_t**)ui_pool_alloc(sizeof(lv_obj_t*) * 4);
+    m_status_label_handle_array = (lv_obj_t**)ui_pool_alloc(sizeof(lv_obj_t*) * 8);
     
     for (index = 0; index < 4; index++)
     {
@@ -114,12 +120,16 @@ void ControlBarWindow::display_main_menu()
         LV_SYMBOL_HOME " Inicio", 
         LV_SYMBOL_SETTINGS " Ajustes",  
         LV_SYMBOL_DRIVE " Archivos",
+        LV_SYMBOL_EYE_OPEN " Trayectoria",
         LV_SYMBOL_BELL " Mensajes",
+        LV_SYMBOL_CHARGE " Diagnostico",
         "Acerca de ..."
     };
     
+    const uint32_t MENU_ITEMS = sizeof(menu_labels) / sizeof(menu_labels[0]);
+    const uint32_t MENU_ITEM_HEIGHT = 46;   // 7 items below the control bar
     const uint32_t MENU_WIDTH = 200;
-    const uint32_t MENU_HEIGHT = (5 * 64 + 6 * 10);
+    const uint32_t MENU_HEIGHT = (MENU_ITEMS * MENU_ITEM_HEIGHT + (MENU_ITEMS + 1) * 10);
     
     if (current_menu_state == 0)
     {
@@ -133,7 +143,7 @@ void ControlBarWindow::display_main_menu()
         lv_obj_set_size(menu_handle, MENU_WIDTH, MENU_HEIGHT);
         lv_obj_set_pos(menu_handle, 800 - 200 - 64, 66);
         
-        for (index = 0; index < 5; index++)
+        for (index = 0; index < MENU_ITEMS; index++)
         {
             // Create first button inside menu
             child1 = lv_btn_create(menu_handle, NULL);
@@ -141,7 +151,7 @@ void ControlBarWindow::display_main_menu()
             myud.control_id = (UI_Identifier_Values)(index + ControlBar_MenuBtn_Home);
             myud.control_data = (void*)this;
             
-            lv_obj_set_size(child1, MENU_WIDTH - 20, 64);
+            lv_obj_set_size(child1, MENU_WIDTH - 20, MENU_ITEM_HEIGHT);
             lv_obj_set_pos(child1, 10, ypos);
             lv_obj_set_user_data(child1, myud);
             lv_obj_set_event_cb(child1, ControlBarWindow::control_bar_button_click);
@@ -157,7 +167,7 @@ void ControlBarWindow::display_main_menu()
                 lv_obj_set_click(child1, false);
             }
             
-            ypos += (10 + 64);
+            ypos += (10 + MENU_ITEM_HEIGHT);
         } 
             
         current_menu_state = 1;
@@ -219,11 +229,34 @@ void ControlBarWindow::control_bar_button_click(lv_obj_t * btn, lv_event_t event
             
             case ControlBar_MenuBtn_Home:
             {
+                self_instance->display_main_menu();     // Close menu
+                PageManager::SwitchToPage(PAGE_INDEX_MAIN);
+            }
+            break;
+            
+            case ControlBar_MenuBtn_Toolpath:
+            {
+                self_instance->display_main_menu();     // Close menu
+                PageManager::SwitchToPage(PAGE_INDEX_TOOLPATH);
+            }
+            break;
+            
+            case ControlBar_MenuBtn_Diagnostics:
+            {
+                self_instance->display_main_menu();     // Close menu
+                PageManager::SwitchToPage(PAGE_INDEX_DIAGNOSTICS);
             }
             break;
             
             case ControlBar_Button_Start:
             {
+                machine->ExitFeedHold();
+            }
+            break;
+            
+            case ControlBar_Button_Pause:
+            {
+                machine->EnterFeedHold();
             }
             break;
             
@@ -20,6 +20,11 @@
 
 #include "user_tasks.h"
 #include "MachineCore.h"
+#include "ToolpathTracker.h"
+#include "TraceRecorder.h"
+#include "JobStats.h"
+#include "SoftIrq.h"
+#include "memory_map.h"
 
 /*
  * The conveyor holds the queue of blocks, takes care of creating them, and starting the executing chain of blocks
@@ -35,58 +40,83 @@
  *
  * also, as in regular ringbuffers, we can 'use' the TAIL block, and increment tail pointer when we're finished with it
  *
- * Both of these are implemented here- see queue_head_block() (where head is pushed) and on_idle() (where tail is consumed)
+ * Both of these are implemented here- see queue_head_block() (where head is pushed) and on_service() (where tail is consumed)
  *
  * The double ring is implemented by adding a third index pointer that lives in between head and tail. We call it isr_tail_i.
  *
  * in ISR context, we use HEAD as the head pointer, and isr_tail_i as the tail pointer.
  * As HEAD increments, ISR context can consume the new blocks which appear, and when we're finished with a block, we increment isr_tail_i to signal that they're finished, and ready to be cleaned
  *
- * in IDLE context, we use isr_tail_i as the head pointer, and TAIL as the tail pointer.
+ * in SERVICE context (motion service task), we use isr_tail_i as the head pointer, and TAIL as the tail pointer.
  * When isr_tail_i != tail, we clean up the tail block (performing ISR-unsafe delete operations) and consume it (increment tail pointer), returning it to the pool of clean, unused blocks which HEAD is allowed to prepare for queueing
  *
- * Thus, our two ringbuffers exist sharing the one ring of blocks, and we safely marshall used blocks from ISR context to IDLE context for safe cleanup.
+ * Thus, our two ringbuffers exist sharing the one ring of blocks, and we safely marshall used blocks from ISR context to SERVICE context for safe cleanup.
+ *
+ * The step ISR wakes the motion service task (through the soft IRQ) each time it finishes a block, so they are
+ * recycled right away.
  */
  
 
+// Touched by the step ISR on every tick: CCM, no wait states and no contention with the DMAs
+static Block block_ring[CONVEYOR_QUEUE_SIZE] CCM_RAM;
+
 Conveyor::Conveyor()
 {
     running = false;
     allow_fetch = false;
     flush= false;
+    waiting_task = NULL;
     current_feedrate = 0;
 }
 
 // we allocate the queue here after config is completed so we do not run out of memory during config
 void Conveyor::start()
 {
-    queue.resize(32);
+    queue_size = CONVEYOR_QUEUE_SIZE;
+    queue.assign(block_ring, queue_size);
     queue_delay_time_ms = (100);
     running = true;
 }
 
-void Conveyor::on_idle()
+void Conveyor::on_service()
 {
-    if (running)
-        check_queue();
-
-    // we can garbage collect the block queue here
-    if (queue.tail_i != queue.isr_tail_i) 
+    bool released = false;
+    
+    // we can garbage collect the block queue here, every block the ISR finished since the last call
+    while (queue.tail_i != queue.isr_tail_i) 
     {
         if (queue.is_empty()) 
         {
             // This should not happen
             configASSERT(0);
+            break;
         } 
-        else 
-        {
-            // Cleanly delete block
-            Block* block = queue.tail_ref();
         
-            block->clear();
-            queue.consume_tail();
-        }
+        // Cleanly delete block
+        Block* block = queue.tail_ref();
+        
+        // Blocks discarded by a flush were never ticked
+        if (block->is_ticking)
+            ToolpathTracker::OnBlockFinished(block);
+    
+        block->clear();
+        queue.consume_tail();
+        released = true;
     }
+    
+    // Wake up the producer blocked on a full queue (or waiting for it to empty)
+    if (released && waiting_task != NULL)
+        xTaskNotifyGive(waiting_task);
+    
+    if (running)
+        check_queue();
+}
+
+// Blocks until the motion service releases a block, or the poll period expires. The caller registers
+// in waiting_task before checking the queue, so a release in between is not missed
+void Conveyor::wait_for_free_blocks()
+{
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONVEYOR_WAIT_POLL_MS));
 }
 
 // see if we are idle
@@ -100,18 +130,36 @@ bool Conveyor::is_idle() const
     return true;
 }
 
+// Blocks still pending to be executed (including the one being ticked)
+uint32_t Conveyor::get_queued_blocks_count() const
+{
+    unsigned int head = queue.head_i;
+    unsigned int isr_tail = queue.isr_tail_i;
+    
+    if (head >= isr_tail)
+        return (head - isr_tail);
+    
+    return (queue.length - isr_tail + head);
+}
+
 // Wait for the queue to be empty and for all the jobs to finish in step ticker
 void Conveyor::wait_for_idle(bool wait_for_motors)
 {
     // wait for the job queue to empty, this means cycling everything on the block queue into the job queue
     // forcing them to be jobs
-    running = false; // stops on_idle calling check_queue
+    running = false; // stops on_service calling check_queue
+    waiting_task = xTaskGetCurrentTaskHandle();
     
     while (!queue.is_empty()) 
     {
         check_queue(true); // forces queue to be made available to stepticker
-        vTaskDelay(pdMS_TO_TICKS(100));
+        wait_for_free_blocks();
     }
+    
+    waiting_task = NULL;
+    
+    // Not a look-ahead starvation, the queue was emptied on purpose
+    JobStats::OnQueueDrained();
 
     if (wait_for_motors) 
     {
@@ -132,10 +180,24 @@ void Conveyor::wait_for_idle(bool wait_for_motors)
 void Conveyor::queue_head_block()
 {
     // upstream caller will block on this until there is room in the queue
-    while (queue.is_full() && machine->IsHalted() == false) 
+    waiting_task = xTaskGetCurrentTaskHandle();
+    
+    if (queue.is_full())
     {
-        vTaskDelay(pdMS_TO_TICKS(500));
+        TickType_t wait_start = xTaskGetTickCount();
+        
+        TraceRecorder::Record(TRACE_EVENT_QUEUE_FULL);
+        
+        while (queue.is_full() && machine->IsHalted() == false) 
+        {
+            wait_for_free_blocks();
+        }
+        
+        TraceRecorder::Record(TRACE_EVENT_QUEUE_SPACE);
+        JobStats::OnQueueFullWait((xTaskGetTickCount() - wait_start) * portTICK_PERIOD_MS);
     }
+    
+    waiting_task = NULL;
 
     if (machine->IsHalted())
     {
@@ -179,6 +241,9 @@ void Conveyor::check_queue(bool force)
         
         if (!flush) 
         {
+            if (!allow_fetch)
+                TraceRecorder::Record(TRACE_EVENT_QUEUE_RELEASE, 0, (uint8_t)get_queued_blocks_count());
+            
             allow_fetch = true;
             __HAL_TIM_ENABLE(&step_timer_handle);
             
@@ -213,7 +278,11 @@ bool Conveyor::get_next_block(Block **block)
     this->current_feedrate = 0;
 
     if (machine->IsHalted() == true || queue.isr_tail_i == queue.head_i) 
+    {
+        TraceRecorder::Record(TRACE_EVENT_QUEUE_EMPTY);
+        JobStats::OnQueueEmpty();
         return false; // we do not have anything to give
+    }
 
     // wait for queue to fill up, optimizes planning
     if (!allow_fetch) 
@@ -233,17 +302,55 @@ bool Conveyor::get_next_block(Block **block)
         b->recalculate_flag = false;
         this->current_feedrate = b->nominal_speed;
         *block = b;
+        
+        uint32_t queued_blocks = get_queued_blocks_count();
+        
+        TraceRecorder::Record(TRACE_EVENT_BLOCK_START, (uint16_t)queue.isr_tail_i, (uint8_t)queued_blocks);
+        JobStats::OnBlockStart(b, queued_blocks);
         return true;
     }
-
+    
+    TraceRecorder::Record(TRACE_EVENT_BLOCK_LOCKED, (uint16_t)queue.isr_tail_i);
     return false;
 }
 
 // called from step ticker ISR when block is finished, do not do anything slow here
 void Conveyor::block_finished()
 {
+    TraceRecorder::Record(TRACE_EVENT_BLOCK_FINISH, (uint16_t)queue.isr_tail_i);
+    
     // we increment the isr_tail_i so we can get the next block
     queue.isr_tail_i = queue.next(queue.isr_tail_i);
+    
+    // Recycled by the motion service task [woken from the soft IRQ, no FreeRTOS call at step level]
+    SoftIrq::Post(SOFT_IRQ_BLOCK_FINISHED);
+}
+
+// Called once the step ticker stopped inside a block because of a feed hold (ISR not ticking).
+// The block keeps only the steps not executed yet, the executed ones are reported to the tracker
+void Conveyor::trim_held_block()
+{
+    uint32_t executed_steps[TOTAL_AXES_COUNT];
+    Block* block;
+    
+    if (queue.isr_tail_i == queue.head_i)
+        return;
+    
+    block = queue.item_ref(queue.isr_tail_i);
+    
+    // Hold completed between two blocks: nothing executed from this one
+    if (block->is_ticking == false)
+        return;
+    
+    block->trim_executed_steps(executed_steps);
+    ToolpathTracker::OnStepsExecuted(executed_steps, block->direction_bits);
+}
+
+// Called while the step ticker is stopped by a feed hold (ISR not using the queue). Every pending
+// block is handed to the garbage collector. Step ticker must then forget its block (CancelFeedHold)
+void Conveyor::discard_held_blocks()
+{
+    queue.isr_tail_i = queue.head_i;
 }
 
 /*
@@ -5,10 +5,16 @@
 #include <string.h>
 
 #include "settings_manager.h"
+#include "hw_timers.h"
 #include "pins.h"
 
+CoolantController *CoolantController::instance;
+
 CoolantController::CoolantController()
-{    
+{
+    instance = this;
+
+    m_outputs = 0;
 }
 
 
@@ -16,22 +22,62 @@ CoolantController::~CoolantController()
 {
 }
 
+void CoolantController::Start()
+{
+    // Aux output 0 is the PWM3 channel at 0% or 100% duty
+    pwm3_timer_handle.Instance->CCR2 = 0;
+    HAL_TIM_PWM_Start(&pwm3_timer_handle, TIM_CHANNEL_2);
+
+    update_pins(m_outputs);
+}
 
 void CoolantController::Stop()
 {
     // Coolant Stop -> COOLANT_ENABLE_PIN = 0
-    COOLANT_ENABLE_GPIO_Port->BSRR = (COOLANT_ENABLE_Pin << 16);
+    ApplyOutputs(OUTPUT_COOLANT_MASK, 0);
 }
 
 void CoolantController::EnableMist()
 {
     // Coolant Mist -> COOLANT_ENABLE_PIN = 1
-    COOLANT_ENABLE_GPIO_Port->BSRR = (COOLANT_ENABLE_Pin);
+    ApplyOutputs(OUTPUT_COOLANT_MIST_BIT, OUTPUT_COOLANT_MIST_BIT);
 }
 
 void CoolantController::EnableFlood()
 {
     // Coolant Flood -> COOLANT_ENABLE_PIN = 1
-    COOLANT_ENABLE_GPIO_Port->BSRR = (COOLANT_ENABLE_Pin);
+    ApplyOutputs(OUTPUT_COOLANT_FLOOD_BIT, OUTPUT_COOLANT_FLOOD_BIT);
+}
+
+// No masking, the step ISR runs above the kernel: exclusive access update of the outputs, then the pins
+// are written again if the ISR changed them in between
+void CoolantController::ApplyOutputs(uint8_t mask, uint8_t values)
+{
+    uint8_t outputs;
+
+    do
+    {
+        outputs = __LDREXB(&m_outputs);
+    }
+    while (__STREXB((uint8_t)((outputs & ~mask) | (values & mask)), &m_outputs) != 0);
+
+    do
+    {
+        outputs = m_outputs;
+        update_pins(outputs);
+    }
+    while (outputs != m_outputs);
 }
 
+void CoolantController::update_pins(uint8_t outputs)
+{
+    if ((outputs & OUTPUT_COOLANT_MASK) != 0)
+        COOLANT_ENABLE_GPIO_Port->BSRR = (COOLANT_ENABLE_Pin);
+    else
+        COOLANT_ENABLE_GPIO_Port->BSRR = (COOLANT_ENABLE_Pin << 16);
+
+    if ((outputs & (1 << OUTPUT_AUX_FIRST_BIT_POS)) != 0)
+        pwm3_timer_handle.Instance->CCR2 = PWM3_TIMER_PERIOD + 1;     // Always high
+    else
+        pwm3_timer_handle.Instance->CCR2 = 0;
+}
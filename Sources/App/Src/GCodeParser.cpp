@@ -73,6 +73,12 @@ void GCodeParser::ResetParser()
     canned_cycle_reset_stycky();
 }
 
+// Machine moved outside of the parser (homing). Linear axes continue from the real position
+void GCodeParser::SyncMachinePosition()
+{
+    machine->GetCurrentPosition_mm(&m_gcode_machine_pos[0]);
+}
+
 int GCodeParser::ParseLine(char * line)
 {
     uint32_t line_len = 0;
@@ -388,6 +394,22 @@ int GCodeParser::ParseLine(char * line)
                         success_bits = MODAL_GROUP_M8_BIT;
                         break;
                     
+                    case OVERRIDE_ENABLE:       // M48, M49, M50, M56 Override control
+                    case OVERRIDE_DISABLE:
+                    case OVERRIDE_SET_FEED:
+                    case OVERRIDE_SET_RAPID:
+                        m_block_data.override_code = work_var;
+                        success_bits = MODAL_GROUP_M9_BIT;
+                        break;
+                    
+                    case AUX_OUTPUT_SYNC_ON:    // M62, M63, M64, M65 Digital output control
+                    case AUX_OUTPUT_SYNC_OFF:
+                    case AUX_OUTPUT_ON:
+                    case AUX_OUTPUT_OFF:
+                        m_block_data.aux_output_code = work_var;
+                        success_bits = MODAL_GROUP_M5_BIT;
+                        break;
+                    
                     // Testing [Values must be specified before M32 & M36]
                     case 32:    // M32 update speeds [max rate mm/min]
                     {
@@ -442,7 +464,9 @@ int GCodeParser::ParseLine(char * line)
                     
                     case 38:   // M38 Save settings to flash
                     {
-                        Settings_Manager::Save();
+                        // Explicit save: wait until data is really stored
+                        if (!Settings_Manager::Flush(SETTINGS_FLUSH_TIMEOUT_MS))
+                            return GCODE_ERROR_SETTINGS_WRITE;
                     }
                     break;
                     
@@ -524,6 +548,9 @@ int GCodeParser::ParseLine(char * line)
                     case MODAL_MOTION_MODE_HELICAL_CW:      // G2
                     case MODAL_MOTION_MODE_HELICAL_CCW:     // G3
                     case MODAL_MOTION_MODE_PROBE:           // G38.2
+                    case MODAL_MOTION_MODE_PROBE_NO_ERROR:  // G38.3
+                    case MODAL_MOTION_MODE_PROBE_AWAY:      // G38.4
+                    case MODAL_MOTION_MODE_PROBE_AWAY_NO_ERROR: // G38.5
                     {
                         if (m_axis_command_type != AXIS_COMMAND_TYPE_NONE)
                             return GCODE_ERROR_MODAL_AXIS_CONFLICT;
@@ -728,6 +755,7 @@ int GCodeParser::ParseLine(char * line)
         m_feed_rate = m_block_data.feed_rate;
 
     /// 3 - Update Spindle Speed Value ///
+    bool spindle_speed_changed = (m_spindle_speed != m_block_data.spindle_speed) ? true : false;
     m_spindle_speed = m_block_data.spindle_speed;
 
     /// 4 - Select Active Tool Number ///
@@ -749,16 +777,21 @@ int GCodeParser::ParseLine(char * line)
             return work_var;
     }
 
-    /// 6 - Handle Spindle Control Commands [M3, M4, M5] ///
-    if (m_parser_modal_state.spindle_mode != m_block_data.block_modal_state.spindle_mode)
+    /// 6 - Handle Spindle Control Commands [M3, M4, M5] or a new S value while running ///
+    if ((m_parser_modal_state.spindle_mode != m_block_data.block_modal_state.spindle_mode) ||
+        (spindle_speed_changed && m_parser_modal_state.spindle_mode != MODAL_SPINDLE_OFF))
     {
         m_parser_modal_state.spindle_mode = m_block_data.block_modal_state.spindle_mode;
 
-        // Wait for idle condition before attempt to change spindle operation
-        work_var = machine->WaitForIdleCondition();
-        
-        if (work_var != GCODE_OK)
-            return work_var;
+        // Wait for idle condition before attempt to change spindle operation. Not in laser mode,
+        // where each queued block carries its own power
+        if (machine->IsLaserModeEnabled() == false)
+        {
+            work_var = machine->WaitForIdleCondition();
+            
+            if (work_var != GCODE_OK)
+                return work_var;
+        }
         
         // Notify of spindle changes
         work_var = machine->SendSpindleCommand(m_parser_modal_state.spindle_mode, m_spindle_speed);
@@ -772,20 +805,48 @@ int GCodeParser::ParseLine(char * line)
     {
         m_parser_modal_state.coolant_mode = m_block_data.block_modal_state.coolant_mode;
 
-        // Wait for idle condition before attempt to change coolant operation
-        work_var = machine->WaitForIdleCondition();
+        // No need to wait for idle condition, the change is applied when the next queued move starts
+        work_var = machine->SendCoolantCommand(m_parser_modal_state.coolant_mode);
         
         if (work_var != GCODE_OK)
             return work_var;
+    }
+
+    /// 7.1 - Handle Digital Output Commands [M62, M63, M64, M65] ///
+    if (m_block_data.aux_output_code != AUX_OUTPUT_CODE_NONE)
+    {
+        bool on = ((m_block_data.aux_output_code == AUX_OUTPUT_SYNC_ON) || (m_block_data.aux_output_code == AUX_OUTPUT_ON));
+        bool synchronized = ((m_block_data.aux_output_code == AUX_OUTPUT_SYNC_ON) || (m_block_data.aux_output_code == AUX_OUTPUT_SYNC_OFF));
         
-        // Notify of coolant changes
-        work_var = machine->SendCoolantCommand(m_parser_modal_state.coolant_mode);
+        work_var = machine->SetAuxOutput((uint32_t)m_block_data.P_value, on, synchronized);
         
         if (work_var != GCODE_OK)
             return work_var;
     }
 
-    /// 8 - Handle Speed/Feed Overrides [M48, M49] ///
+    /// 8 - Handle Speed/Feed Overrides [M48, M49, M50, M56] ///
+    // Applied right away to the queued moves, no need to wait for idle condition
+    switch (m_block_data.override_code)
+    {
+        case OVERRIDE_ENABLE:       // M48
+            machine->EnableOverrides(true);
+            break;
+        
+        case OVERRIDE_DISABLE:      // M49
+            machine->EnableOverrides(false);
+            break;
+        
+        case OVERRIDE_SET_FEED:     // M50
+            machine->SetFeedOverride((uint32_t)m_block_data.P_value);
+            break;
+        
+        case OVERRIDE_SET_RAPID:    // M56
+            machine->SetRapidOverride((uint32_t)m_block_data.P_value);
+            break;
+        
+        default:
+            break;
+    }
 
 
     /// 9 - Handle Dwell Command [G4] ///
@@ -968,6 +1029,8 @@ int GCodeParser::ParseLine(char * line)
                 
                 if (work_var != GCODE_OK)
                     return work_var;
+                
+                machine->EndJob();
             }
         }
     }
@@ -1287,10 +1350,37 @@ int GCodeParser::check_unused_codes()
         return GCODE_ERROR_UNUSED_L_VALUE_WORD;
     }
 
-    // Check the use of P word outside G4, G10 or canned cycles [G82, G86, G88, G89]
+    // M50, M56 require the override percentage in the P word
+    if ((m_block_data.override_code == OVERRIDE_SET_FEED) || (m_block_data.override_code == OVERRIDE_SET_RAPID))
+    {
+        float min_percent = (m_block_data.override_code == OVERRIDE_SET_FEED) ? OVERRIDE_FEED_MIN_PERCENT : OVERRIDE_RAPID_MIN_PERCENT;
+        float max_percent = (m_block_data.override_code == OVERRIDE_SET_FEED) ? OVERRIDE_FEED_MAX_PERCENT : OVERRIDE_RAPID_MAX_PERCENT;
+        
+        if (((m_value_group_flags & VALUE_SET_P_BIT) == 0) ||
+            (m_block_data.P_value < min_percent) || (m_block_data.P_value > max_percent))
+        {
+            return GCODE_ERROR_INVALID_OVERRIDE_VALUE;
+        }
+    }
+
+    // M62..M65 require the output index in the P word
+    if (m_block_data.aux_output_code != AUX_OUTPUT_CODE_NONE)
+    {
+        if (((m_value_group_flags & VALUE_SET_P_BIT) == 0) ||
+            (m_block_data.P_value < 0) || (m_block_data.P_value >= AUX_OUTPUTS_COUNT) ||
+            (m_block_data.P_value != truncf(m_block_data.P_value)))
+        {
+            return GCODE_ERROR_INVALID_AUX_OUTPUT;
+        }
+    }
+
+    // Check the use of P word outside G4, G10, M50, M56, M62..M65 or canned cycles [G82, G86, G88, G89]
     if (((m_value_group_flags & VALUE_SET_P_BIT) != 0) &&
         (m_block_data.non_modal_code != NON_MODAL_DWELL) &&                 // Not G4
         (m_block_data.non_modal_code != NON_MODAL_SET_COORDINATE_DATA) &&   // Not G10
+        (m_block_data.override_code != OVERRIDE_SET_FEED) &&                // Not M50
+        (m_block_data.override_code != OVERRIDE_SET_RAPID) &&               // Not M56
+        (m_block_data.aux_output_code == AUX_OUTPUT_CODE_NONE) &&           // Not M62..M65
         
         (m_block_data.block_modal_state.motion_mode != MODAL_MOTION_MODE_CANNED_DRILL_DWELL_G82)) // Not [G82, G86, G88, G89]
     {
@@ -1857,22 +1947,49 @@ int GCodeParser::handle_motion_commands()
 		}
         break;
 
-        case MODAL_MOTION_MODE_PROBE:   // TODO: Implement probing
+        case MODAL_MOTION_MODE_PROBE:               // G38.2
+        case MODAL_MOTION_MODE_PROBE_NO_ERROR:      // G38.3
+        case MODAL_MOTION_MODE_PROBE_AWAY:          // G38.4
+        case MODAL_MOTION_MODE_PROBE_AWAY_NO_ERROR: // G38.5
 		{
 			// Check if current feedrate mode is units/min. Flag error otherwise
 			if (m_parser_modal_state.feedrate_mode != MODAL_FEEDRATE_MODE_UNITS_PER_MIN)
 				return GCODE_ERROR_PROBE_CANNOT_USE_INVERSE_TIME_FEEDRATE_MODE;
 
-			// TODO: Check the distance to move is < 0.254mm
-
 			// Check if any of the rotary axes moves
-			if ((m_block_data.coordinate_data[COORD_A] != m_gcode_machine_pos[COORD_A]) ||
-				(m_block_data.coordinate_data[COORD_B] != m_gcode_machine_pos[COORD_B]) ||
-				(m_block_data.coordinate_data[COORD_C] != m_gcode_machine_pos[COORD_C]))
+			if ((target[COORD_A] != m_gcode_machine_pos[COORD_A]) ||
+				(target[COORD_B] != m_gcode_machine_pos[COORD_B]) ||
+				(target[COORD_C] != m_gcode_machine_pos[COORD_C]))
 			{
 				// Rotary axes cannot move during probe cycle
 				return GCODE_ERROR_PROBE_CANNOT_MOVE_ROTATY_AXES;
-			}			
+			}
+            
+            // There must be some distance to probe
+            if (memcmp((const void*)&target[0], (const void*)&m_gcode_machine_pos[0], sizeof(target)) == 0)
+                return GCODE_ERROR_INVALID_TARGET_FOR_PROBE;
+            
+            work_var = check_soft_limits(&target[0]);
+            
+            if (work_var != GCODE_OK)
+                return work_var;
+            
+            // Execute the probing move. It stops at the contact (or at the target if not found)
+            work_var = machine->DoProbe(&target[0], m_block_data.feed_rate / 60.0f, m_parser_modal_state.motion_mode);
+            
+            // Rotary axes did not move. Update global machine position with the real one
+            memcpy(&m_gcode_machine_pos[0], &target[0], sizeof(m_gcode_machine_pos));
+            
+            if (m_check_mode == false)
+            {
+                machine->GetCurrentPosition_mm(&m_gcode_machine_pos[0]);
+                
+                memcpy(&m_last_probe_position[0], &m_gcode_machine_pos[0], sizeof(m_last_probe_position));
+                machine->GetProbePosition_mm(&m_last_probe_position[0]);
+            }
+            
+            if (work_var != GCODE_OK)
+                return work_var;
 		}
         break;
 
@@ -1945,12 +2062,11 @@ int GCodeParser::handle_motion_commands()
     return GCODE_OK;
 }
 
-// TODO: Check this code for redundancy
-int GCodeParser::motion_append_line(const float * target_pos)
+// Check soft limits only for homed axis that are enabled. Halts the machine on violation
+int GCodeParser::check_soft_limits(const float * target_pos)
 {
     uint32_t index;
     
-    // check soft limits only for homed axis that are enabled
     if (Settings_Manager::AreSoftLimitsEnabled() == true)
     {
         for (index = COORD_X; index < COORDINATE_LINEAR_AXES_COUNT; index++)
@@ -1967,7 +2083,7 @@ int GCodeParser::motion_append_line(const float * target_pos)
                         (target_pos[index] > this->m_soft_limit_max_values[index]))
                     {
                         // Report violation of limit values. Stop the execution of commands.
-                        machine->Halt();
+                        machine->Halt(ALARM_SOFT_LIMIT);
                         return GCODE_ERROR_TARGET_OUTSIDE_LIMIT_VALUES;
                     }
                 }
@@ -1975,6 +2091,17 @@ int GCodeParser::motion_append_line(const float * target_pos)
         }
     }
     
+    return GCODE_OK;
+}
+
+// TODO: Check this code for redundancy
+int GCodeParser::motion_append_line(const float * target_pos)
+{
+    int work_var = check_soft_limits(target_pos);
+    
+    if (work_var != GCODE_OK)
+        return work_var;
+    
     // If currently in check mode then stop processing here.
     if (m_check_mode != false)
         return GCODE_OK;
@@ -1999,7 +2126,11 @@ int GCodeParser::motion_append_line(const float * target_pos)
         if (m_parser_modal_state.motion_mode == MODAL_MOTION_MODE_SEEK)
             inverse_time_rate = false;
         
-        return m_planner_ref->AppendLine(target_pos, m_spindle_speed, move_rate, inverse_time_rate);
+        // Spindle speed is the laser power of the block in laser mode, none while M5 is active
+        float spindle_speed = (m_parser_modal_state.spindle_mode != MODAL_SPINDLE_OFF) ? m_spindle_speed : 0.0f;
+        
+        return m_planner_ref->AppendLine(target_pos, spindle_speed, move_rate, inverse_time_rate, 
+                                         (m_parser_modal_state.motion_mode == MODAL_MOTION_MODE_SEEK));
     }
     
     return GCODE_ERROR_MISSING_PLANNER;    
@@ -2255,6 +2386,45 @@ const char* GCodeParser::GetErrorText(uint32_t error_code)
     case GCODE_ERROR_TARGET_OUTSIDE_LIMIT_VALUES:
         return("The specified target is outside of the limit values");
     
+    case GCODE_ERROR_SETTINGS_WRITE:
+        return("Settings could not be written to flash");
+    
+    case GCODE_ERROR_INVALID_OVERRIDE_VALUE:
+        return("Missing or out of range override percentage");
+    
+    case GCODE_ERROR_PROBE_INITIAL_STATE:
+        return("Probe already in the state expected at the end of the probe cycle");
+    
+    case GCODE_ERROR_PROBE_NO_CONTACT:
+        return("Probe cycle completed without contact change");
+    
+    case GCODE_ERROR_HOMING_SWITCH_NOT_FOUND:
+        return("Homing cycle did not find the limit switch");
+    
+    case GCODE_ERROR_HOMING_PULL_OFF:
+        return("Limit switch still active after homing pull-off");
+    
+    case GCODE_ERROR_HOMING_ABORTED:
+        return("Homing cycle aborted");
+    
+    case GCODE_ERROR_MACHINE_ALARM_LOCKED:
+        return("Machine in alarm state, unlock with $X or home with $H");
+    
+    case GCODE_ERROR_STEPPER_FAULT_ACTIVE:
+        return("Stepper driver fault still active");
+    
+    case GCODE_ERROR_SPINDLE_NOT_AT_SPEED:
+        return("Spindle did not reach the programmed speed");
+    
+    case GCODE_ERROR_INVALID_AUX_OUTPUT:
+        return("Missing or out of range digital output index");
+    
+    case GCODE_ERROR_FILE_WRITE:
+        return("File could not be written to the SD card");
+    
+    case GCODE_ERROR_DISK_UNAVAILABLE:
+        return("SD card busy (open file), missing or no USB host connected");
+    
     default:
         return("Unknown error code");
     }
@@ -0,0 +1,239 @@
+#include "JobStats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ff_stdio.h"
+
+#include "Block.h"
+#include "SoftIrq.h"
+
+#define JOB_STATS_LONG_STARVATION_MS    10000   // DWT counter wraps after 25 s at 168 MHz, ticks used above this
+
+JOB_STATS JobStats::m_current;
+JOB_STATS JobStats::m_last;
+TickType_t JobStats::m_start_tick;
+volatile bool JobStats::m_active;
+volatile uint32_t JobStats::m_job_seq;
+
+volatile bool JobStats::m_starved;
+uint32_t JobStats::m_starved_cycles;
+uint32_t JobStats::m_starved_end_cycles;
+TickType_t JobStats::m_starved_tick;
+bool JobStats::m_last_start_dry;
+
+static const char * csv_header = "duration_ms,blocks,blocks_per_s,nominal_pct,fill_avg,fill_min,dry_stops,"
+                                 "starvations,starved_total_us,starved_max_us,append_avg_us,append_max_us,queue_full_pct";
+
+void JobStats::start_job()
+{
+    memset(&m_current, 0, sizeof(m_current));
+    m_current.fill_min = 0xFFFFFFFF;
+    
+    m_starved = false;
+    m_last_start_dry = false;
+    m_start_tick = xTaskGetTickCount();
+    
+    m_active = true;
+}
+
+// Called for every block added to the queue, before waiting for room
+void JobStats::OnAppendLine(uint32_t cycles)
+{
+    if (m_active == false)
+        start_job();
+    
+    m_current.append_count++;
+    m_current.append_total_cycles += cycles;
+    
+    if (cycles > m_current.append_max_cycles)
+        m_current.append_max_cycles = cycles;
+}
+
+void JobStats::OnQueueFullWait(uint32_t ms)
+{
+    if (m_active)
+        m_current.queue_full_ms += ms;
+}
+
+void JobStats::OnBlockStart(const Block * block, uint32_t queued_blocks)
+{
+    if (m_active == false)
+        return;
+    
+    if (m_starved)
+    {
+        m_starved_end_cycles = DWT->CYCCNT;
+        m_starved = false;
+        
+        SoftIrq::Post(SOFT_IRQ_STARVATION_END);
+    }
+    
+    m_current.blocks++;
+    m_current.fill_sum += queued_blocks;
+    
+    if (queued_blocks < m_current.fill_min)
+        m_current.fill_min = queued_blocks;
+    
+    if (block->maximum_rate >= block->nominal_rate)
+        m_current.nominal_blocks++;
+    
+    // Nothing behind it when it was started: the trapezoid ends at rest, whatever comes next
+    m_last_start_dry = (queued_blocks <= 1) ? true : false;
+    
+    if (m_last_start_dry)
+        m_current.dry_stops++;
+}
+
+void JobStats::OnQueueEmpty()
+{
+    if (m_active == false || m_starved)
+        return;
+    
+    m_starved_cycles = DWT->CYCCNT;
+    m_starved = true;
+    
+    SoftIrq::Post(SOFT_IRQ_STARVATION_START);
+}
+
+void JobStats::OnStarvationStart()
+{
+    m_starved_tick = xTaskGetTickCountFromISR();
+}
+
+// Cycle counter for the usual short gaps, ticks once it may have wrapped
+void JobStats::OnStarvationEnd()
+{
+    TickType_t ticks = xTaskGetTickCountFromISR() - m_starved_tick;
+    uint32_t us;
+    
+    if (m_active == false)
+        return;
+    
+    if (ticks < pdMS_TO_TICKS(JOB_STATS_LONG_STARVATION_MS))
+        us = (m_starved_end_cycles - m_starved_cycles) / (SystemCoreClock / 1000000);
+    else
+        us = ticks * portTICK_PERIOD_MS * 1000;
+    
+    m_current.starvation_count++;
+    m_current.starvation_total_us += us;
+    
+    if (us > m_current.starvation_max_us)
+        m_current.starvation_max_us = us;
+}
+
+// Queue emptied on purpose, the step ticker is not running: the stop is not caused by the look-ahead
+void JobStats::OnQueueDrained()
+{
+    if (m_active == false)
+        return;
+    
+    m_starved = false;
+    
+    if (m_last_start_dry)
+    {
+        m_current.dry_stops--;
+        m_last_start_dry = false;
+    }
+}
+
+// M2/M30, after the queue was drained
+void JobStats::EndJob()
+{
+    if (m_active == false)
+        return;
+    
+    m_active = false;
+    
+    m_current.duration_ms = (xTaskGetTickCount() - m_start_tick) * portTICK_PERIOD_MS;
+    
+    if (m_current.blocks == 0)
+        m_current.fill_min = 0;
+    
+    m_last = m_current;
+    m_job_seq++;
+    
+    // No card or not mounted: report still available over serial
+    save(m_last);
+}
+
+void JobStats::AbortJob()
+{
+    m_active = false;
+}
+
+bool JobStats::save(const JOB_STATS& stats)
+{
+    FF_FILE * file;
+    char line[160];
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    bool success;
+    
+    file = ff_fopen(JOB_STATS_FILE_NAME, "a");
+    
+    if (file == NULL)
+        return false;
+    
+    success = true;
+    
+    if (ff_ftell(file) == 0)
+    {
+        success = (ff_fwrite(csv_header, strlen(csv_header), 1, file) == 1) && (ff_fwrite("\r\n", 2, 1, file) == 1);
+    }
+    
+    snprintf(line, sizeof(line), "%lu,%lu,%.1f,%.1f,%.1f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f\r\n",
+             (unsigned long)stats.duration_ms, (unsigned long)stats.blocks,
+             (stats.duration_ms != 0) ? (stats.blocks * 1000.0f / stats.duration_ms) : 0.0f,
+             (stats.blocks != 0) ? (stats.nominal_blocks * 100.0f / stats.blocks) : 0.0f,
+             (stats.blocks != 0) ? ((float)stats.fill_sum / stats.blocks) : 0.0f,
+             (unsigned long)stats.fill_min, (unsigned long)stats.dry_stops,
+             (unsigned long)stats.starvation_count, (unsigned long)stats.starvation_total_us, (unsigned long)stats.starvation_max_us,
+             (unsigned long)((stats.append_count != 0) ? (stats.append_total_cycles / stats.append_count / cycles_per_us) : 0),
+             (unsigned long)(stats.append_max_cycles / cycles_per_us),
+             (stats.duration_ms != 0) ? (stats.queue_full_ms * 100.0f / stats.duration_ms) : 0.0f);
+    
+    if (success)
+        success = (ff_fwrite(line, strlen(line), 1, file) == 1) ? true : false;
+    
+    if (ff_fclose(file) != 0)
+        success = false;
+    
+    return success;
+}
+
+void JobStats::Report(JOB_STATS_WRITE_FUNC write, void * context)
+{
+    const JOB_STATS& stats = m_last;
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    char line[96];
+    
+    if (m_job_seq == 0)
+    {
+        write(context, "[JOB] no job completed");
+        return;
+    }
+    
+    snprintf(line, sizeof(line), "[JOB] %lu.%lu s, %lu blocks, %.1f blocks/s", (unsigned long)(stats.duration_ms / 1000),
+             (unsigned long)((stats.duration_ms % 1000) / 100), (unsigned long)stats.blocks,
+             (stats.duration_ms != 0) ? (stats.blocks * 1000.0f / stats.duration_ms) : 0.0f);
+    write(context, line);
+    
+    snprintf(line, sizeof(line), "  nominal speed reached %.1f%%, look-ahead stops %lu",
+             (stats.blocks != 0) ? (stats.nominal_blocks * 100.0f / stats.blocks) : 0.0f, (unsigned long)stats.dry_stops);
+    write(context, line);
+    
+    snprintf(line, sizeof(line), "  queue fill avg %.1f min %lu, producer blocked on full queue %.1f%%",
+             (stats.blocks != 0) ? ((float)stats.fill_sum / stats.blocks) : 0.0f, (unsigned long)stats.fill_min,
+             (stats.duration_ms != 0) ? (stats.queue_full_ms * 100.0f / stats.duration_ms) : 0.0f);
+    write(context, line);
+    
+    snprintf(line, sizeof(line), "  starvation %lu, total %lu.%03lu ms, max %lu.%03lu ms", (unsigned long)stats.starvation_count,
+             (unsigned long)(stats.starvation_total_us / 1000), (unsigned long)(stats.starvation_total_us % 1000),
+             (unsigned long)(stats.starvation_max_us / 1000), (unsigned long)(stats.starvation_max_us % 1000));
+    write(context, line);
+    
+    snprintf(line, sizeof(line), "  AppendLine avg %lu us, max %lu us",
+             (unsigned long)((stats.append_count != 0) ? (stats.append_total_cycles / stats.append_count / cycles_per_us) : 0),
+             (unsigned long)(stats.append_max_cycles / cycles_per_us));
+    write(context, line);
+}
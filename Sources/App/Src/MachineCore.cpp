@@ -4,14 +4,24 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
+
+#include <algorithm>
 
 #include "settings_manager.h"
+#include "ToolpathTracker.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "JobStats.h"
+#include "SoftIrq.h"
 
 #include "FreeRTOS.h"
 #include "timers.h"
 
 #include "pins.h"
 #include "gpio.h"
+#include "adc.h"
+#include "task_settings.h"
 
 MachineCore::MachineCore(void)
 {
@@ -20,8 +30,17 @@ MachineCore::MachineCore(void)
     m_startup_finished = false;
     m_system_halted = false;
     m_feed_hold = false;
+    m_hold_replanned = false;
     m_dwell_active = false;
     
+    m_overrides_enabled = true;
+    m_overrides_changed = false;
+    m_feed_override = 100;
+    m_rapid_override = 100;
+    m_spindle_override = 100;
+    m_feed_knob_percent = 0;
+    m_adaptive_feed = 100;
+    
     m_gcode_source = GCODE_SOURCE_SERIAL_CONSOLE;
     
     m_homing_state = HOMING_IDLE;
@@ -30,6 +49,18 @@ MachineCore::MachineCore(void)
     
     m_probe_state = PROBING_IDLE;
     memset((void*)this->m_probe_position, 0, sizeof(this->m_probe_position));
+    m_probe_succeeded = false;
+    
+    m_alarm_code = ALARM_NONE;
+    m_alarm_task = NULL;
+    m_motion_task = NULL;
+    m_alarm_event_cycles = 0;
+    m_alarm_stop_cycles = 0;
+    m_alarm_halt_cycles = 0;
+    
+    // Enable DWT cycle counter, used to measure the alarm reaction times
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
     
     // Create objects
     m_gcode_parser = new GCodeParser();
@@ -88,18 +119,186 @@ bool MachineCore::Initialize()
 {
     m_conveyor->start();
     m_step_ticker->start();
+    m_step_ticker->SetLaserMode(Settings_Manager::GetSpindleData().laser_mode != 0);
+    m_spindle->Start();
+    m_coolant->Start();
+    
+    ToolpathTracker::Initialize();
+    Profiler::Initialize();
+    TraceRecorder::Initialize();
+    SoftIrq::Initialize();
+    
+    // Highest priority task, runs the part of the limit/fault reaction that cannot be done in the ISR
+    xTaskCreate(MachineCore::alarm_task_entry, "ALARM", ALARM_TASK_STACK_SIZE, (void*)this, ALARM_TASK_PRIORITY, &m_alarm_task);
+    
+    // Block recycling, queue release to the step ticker and replans. Above the parser, which waits on it
+    xTaskCreate(MachineCore::motion_task_entry, "MOTION", MOTION_TASK_STACK_SIZE, (void*)this, MOTION_TASK_PRIORITY, &m_motion_task);
     
     // Reset stepper drivers [reset removed after expiration of startup timer]
     m_step_ticker->ResetStepperDrivers(true);
     return true;
 }
 
-void MachineCore::OnIdle()
+// Motion service task context
+void MachineCore::service_motion()
 {
     if (this->m_startup_finished == false)
         return;
     
-    m_conveyor->on_idle();
+    handle_feed_hold();
+    handle_overrides();
+    flush_pending_outputs();
+    
+    m_conveyor->on_service();
+    
+    Profiler::SampleQueueDepth(m_conveyor->get_queued_blocks_count());
+}
+
+void MachineCore::NotifyMotionServiceFromISR()
+{
+    BaseType_t high_prio_woken = pdFALSE;
+    
+    if (m_motion_task == NULL)
+        return;
+    
+    vTaskNotifyGiveFromISR(m_motion_task, &high_prio_woken);
+    portYIELD_FROM_ISR(high_prio_woken);
+}
+
+void MachineCore::NotifyAlarmTaskFromISR(uint32_t events)
+{
+    BaseType_t high_prio_woken = pdFALSE;
+    
+    if (m_alarm_task == NULL || events == 0)
+        return;
+    
+    xTaskNotifyFromISR(m_alarm_task, events, eSetBits, &high_prio_woken);
+    portYIELD_FROM_ISR(high_prio_woken);
+}
+
+// Motion decelerates to a stop at the configured acceleration, it does not stop in place
+void MachineCore::EnterFeedHold() 
+{ 
+    m_feed_hold = true;
+    m_step_ticker->RequestFeedHold();
+    
+    TraceRecorder::Record(TRACE_EVENT_FEED_HOLD, 0, 0);
+}
+
+// Motion resumes once the hold is complete and the queue replanned (see handle_feed_hold)
+void MachineCore::ExitFeedHold() 
+{ 
+    m_feed_hold = false; 
+}
+
+void MachineCore::handle_feed_hold()
+{
+    EventBits_t events = xEventGroupGetBits(m_input_events_group) & (BTN_HOLD_EVENT | BTN_START_EVENT);
+    
+    // Hardware buttons
+    if (events != 0)
+    {
+        xEventGroupClearBits(m_input_events_group, events);
+        
+        if ((events & BTN_HOLD_EVENT) != 0)
+            EnterFeedHold();
+        else
+            ExitFeedHold();
+    }
+    
+    if (m_step_ticker->IsFeedHoldStopped() == false)
+        return;
+    
+    // Stopped by probe contact: the probing cycle (DoProbe) takes care of the queue
+    if (m_step_ticker->IsProbeTriggered())
+        return;
+    
+    if (m_hold_replanned == false)
+    {
+        // Machine at rest, possibly inside a block. Plan what is left from zero speed
+        m_conveyor->trim_held_block();
+        m_planner->ReplanFromRest();
+        
+        m_hold_replanned = true;
+        TraceRecorder::Record(TRACE_EVENT_FEED_HOLD, 0, 1);
+    }
+    
+    if (m_feed_hold == false)
+    {
+        m_hold_replanned = false;
+        m_step_ticker->ResumeFromFeedHold();
+        
+        TraceRecorder::Record(TRACE_EVENT_FEED_HOLD, 0, 2);
+    }
+}
+
+// M48/M49. Disabled overrides run everything at 100% but keep the selected values
+void MachineCore::EnableOverrides(bool enable)
+{
+    m_overrides_enabled = enable;
+    m_overrides_changed = true;
+}
+
+void MachineCore::SetFeedOverride(uint32_t percent)
+{
+    m_feed_override = std::min(std::max(percent, (uint32_t)OVERRIDE_FEED_MIN_PERCENT), (uint32_t)OVERRIDE_FEED_MAX_PERCENT);
+    m_overrides_changed = true;
+}
+
+void MachineCore::SetRapidOverride(uint32_t percent)
+{
+    m_rapid_override = std::min(std::max(percent, (uint32_t)OVERRIDE_RAPID_MIN_PERCENT), (uint32_t)OVERRIDE_RAPID_MAX_PERCENT);
+    m_overrides_changed = true;
+}
+
+// Also called from the serial Rx interrupts and the USB task (real-time override commands). The knob
+// timer and the parser write the same value: kernel aware interrupts are masked around the update. The
+// FROM_ISR form only saves and restores BASEPRI, so it is also valid in task context
+void MachineCore::AdjustFeedOverride(int32_t delta_percent)
+{
+    UBaseType_t saved_mask = taskENTER_CRITICAL_FROM_ISR();
+    int32_t percent = (int32_t)m_feed_override + delta_percent;
+    
+    SetFeedOverride((percent > 0) ? (uint32_t)percent : 0);
+    taskEXIT_CRITICAL_FROM_ISR(saved_mask);
+}
+
+void MachineCore::SetSpindleOverride(uint32_t percent)
+{
+    m_spindle_override = std::min(std::max(percent, (uint32_t)SPINDLE_OVERRIDE_MIN_PERCENT), (uint32_t)SPINDLE_OVERRIDE_MAX_PERCENT);
+    m_overrides_changed = true;
+}
+
+// Same contexts as AdjustFeedOverride
+void MachineCore::AdjustSpindleOverride(int32_t delta_percent)
+{
+    UBaseType_t saved_mask = taskENTER_CRITICAL_FROM_ISR();
+    int32_t percent = (int32_t)m_spindle_override + delta_percent;
+    
+    SetSpindleOverride((percent > 0) ? (uint32_t)percent : 0);
+    taskEXIT_CRITICAL_FROM_ISR(saved_mask);
+}
+
+// Replan the queue with the new values. Motion is not stopped, the current block changes speed
+// using its acceleration and the pending ones get new trapezoids
+void MachineCore::handle_overrides()
+{
+    if (m_overrides_changed == false)
+        return;
+    
+    m_overrides_changed = false;
+    
+    // Adaptive feed protects the tool, it is kept while overrides are disabled
+    if (m_overrides_enabled)
+    {
+        m_planner->ApplyOverrides((m_feed_override * m_adaptive_feed) / 10000.0f, m_rapid_override / 100.0f);
+        m_spindle->SetOverride(m_spindle_override / 100.0f);
+    }
+    else
+    {
+        m_planner->ApplyOverrides(m_adaptive_feed / 100.0f, 1.0f);
+        m_spindle->SetOverride(1.0f);
+    }
 }
 
 bool MachineCore::StartStepperIdleTimer()
@@ -120,22 +319,98 @@ void MachineCore::StopStepperIdleTimer()
     xTimerStop(m_stepper_idle_timer, 0);
 }
 
-void MachineCore::Halt() 
+void MachineCore::Halt(MACHINE_ALARM_CODES reason) 
 { 
+    if (m_alarm_code == ALARM_NONE)
+        m_alarm_code = reason;
+    
     m_system_halted = true;
     
+    stop_machine();
+    
+    m_conveyor->flush_queue();
+}
+
+// Spindle, coolant and motion off. The queue is flushed by the caller
+void MachineCore::stop_machine()
+{
+    uint8_t mask, values;
+    
+    m_feed_hold = false;
+    m_hold_replanned = false;
+    m_step_ticker->CancelFeedHold();
+    
     m_spindle->InmediateStop();
     m_coolant->Stop();
     
+    // Coolant programmed for moves that will not run
+    m_planner->TakePendingOutputs(mask, values);
+    
     m_step_ticker->EnableStepperDrivers(false);
     m_step_ticker->DisableAllMotors();
+}
+
+// $X. Leave the alarm state, next moves start from the position where the machine stopped
+int MachineCore::Unlock()
+{
+    int32_t steps[TOTAL_AXES_COUNT];
     
-    m_conveyor->flush_queue();
+    if (m_system_halted == false)
+        return GCODE_OK;
+    
+    if (HAL_GPIO_ReadPin(GLOBAL_FAULT_GPIO_Port, GLOBAL_FAULT_Pin) != GPIO_PIN_SET)
+        return GCODE_ERROR_STEPPER_FAULT_ACTIVE;
+    
+    if (m_step_ticker->IsEmergencyStopped())
+    {
+        // Blocks queued while the alarm was being handled are not executed
+        m_conveyor->discard_held_blocks();
+        m_step_ticker->ClearEmergencyStop();
+    }
+    
+    m_step_ticker->GetCurrentPosition_steps(steps);
+    m_planner->SetPosition_steps(steps);
+    
+    m_fault_event_conditions = 0;
+    xEventGroupClearBits(m_input_events_group, ALARM_EVENTS_MASK);
+    
+    m_alarm_code = ALARM_NONE;
+    m_system_halted = false;
+    
+    m_gcode_parser->SyncMachinePosition();
+    
+    return GCODE_OK;
+}
+
+// Lines are rejected while in alarm state
+int MachineCore::ParseGCodeLine(char* line)
+{
+    if (m_system_halted)
+        return GCODE_ERROR_MACHINE_ALARM_LOCKED;
+    
+    return m_gcode_parser->ParseLine(line);
+}
+
+void MachineCore::GetAlarmReactionTimes_us(uint32_t& stop_us, uint32_t& halt_us)
+{
+    uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    
+    stop_us = m_alarm_stop_cycles / cycles_per_us;
+    halt_us = m_alarm_halt_cycles / cycles_per_us;
 }
 
-// Called from EXTI interrupt context
-BaseType_t MachineCore::NotifyOfEvent(uint32_t it_evt_src)
+// Called from EXTI interrupt context. Limit switches (out of homing) and driver faults stop the steps
+// right here, the rest of the reaction is done by the alarm task (woken through the soft IRQ)
+void MachineCore::NotifyOfEvent(uint32_t it_evt_src)
 {
+    uint32_t entry_cycles = DWT->CYCCNT;
+    uint32_t events = 0;
+    uint8_t limits;
+    
+    // Both edges interrupt, so the inversion setting can be honoured. Switches of the axes being homed
+    // are expected to trigger, the step ticker latches them
+    limits = m_step_ticker->GetActiveLimitSwitches() & ~((uint8_t)m_axes_homing_now);
+    
     // Check each bit [EXTI6, EXTI7, EXTI8]
     // EXTI6
     if ((it_evt_src & (1 << 6)) != 0)
@@ -144,30 +419,257 @@ BaseType_t MachineCore::NotifyOfEvent(uint32_t it_evt_src)
         if (HAL_GPIO_ReadPin(GLOBAL_FAULT_GPIO_Port, GLOBAL_FAULT_Pin) != GPIO_PIN_SET)
         {
             // Global Fault = 0. Stepper motors fault condition
-            m_fault_event_conditions |= STEPPER_FAULT_EVENT;
+            events |= STEPPER_FAULT_EVENT;
         }
-        else if (HAL_GPIO_ReadPin(LIM_X_GPIO_Port, LIM_X_Pin) != GPIO_PIN_RESET)
+        else if ((limits & (1 << COORD_X)) != 0)
         {
-            // Limit X = 1
-            m_fault_event_conditions |= LIMIT_X_MIN_EVENT;
+            // Limit X active
+            events |= LIMIT_X_MIN_EVENT;
         }
     }
     
     // EXTI7
-    if ((it_evt_src & (1 << 7)) != 0)
+    if ((it_evt_src & (1 << 7)) != 0 && (limits & (1 << COORD_Y)) != 0)
     {
         // Limit Y
-        m_fault_event_conditions |= LIMIT_Y_MIN_EVENT;
+        events |= LIMIT_Y_MIN_EVENT;
     }
     
     // EXTI8
-    if ((it_evt_src & (1 << 8)) != 0)
+    if ((it_evt_src & (1 << 8)) != 0 && (limits & (1 << COORD_Z)) != 0)
     {
         // Limit Z
-        m_fault_event_conditions |= LIMIT_Z_MIN_EVENT;
+        events |= LIMIT_Z_MIN_EVENT;
+    }
+    
+    if (events == 0)
+        return;
+    
+    // Only the first event of an alarm is measured
+    if (m_step_ticker->IsEmergencyStopped() == false)
+    {
+        m_step_ticker->EmergencyStop();
+        
+        m_alarm_event_cycles = entry_cycles;
+        m_alarm_stop_cycles = DWT->CYCCNT - entry_cycles;
+    }
+    
+    m_fault_event_conditions |= events;
+    
+    TraceRecorder::Record(TRACE_EVENT_ALARM, (uint16_t)events);
+    
+    SoftIrq::PostAlarm(events);
+}
+
+// Alarm task context. Motion already stopped by the ISR: drop what is left of the queue (the step
+// ticker is not using it) and turn everything off
+void MachineCore::handle_alarm(uint32_t events)
+{
+    if (m_alarm_code == ALARM_NONE)
+        m_alarm_code = ((events & STEPPER_FAULT_EVENT) != 0) ? ALARM_STEPPER_FAULT : ALARM_HARD_LIMIT;
+    
+    // No more blocks accepted from now on
+    m_system_halted = true;
+    
+    JobStats::AbortJob();
+    
+    m_conveyor->trim_held_block();
+    m_conveyor->discard_held_blocks();
+    
+    stop_machine();
+    
+    // Steps may have been lost in the abrupt stop
+    m_axes_already_homed = 0;
+    
+    m_alarm_halt_cycles = DWT->CYCCNT - m_alarm_event_cycles;
+    
+    xEventGroupSetBits(m_input_events_group, events);
+}
+
+void MachineCore::GetCurrentPosition_mm(float * position)
+{
+    int32_t steps[TOTAL_AXES_COUNT];
+    
+    m_step_ticker->GetCurrentPosition_steps(steps);
+    
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+        position[axis] = steps[axis] / Settings_Manager::GetStepsPer_mm_Axis(axis);
+}
+
+void MachineCore::GetPlannedPosition_mm(float * position)
+{
+    const int32_t * steps = m_planner->GetPosition_steps();
+    
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+        position[axis] = steps[axis] / Settings_Manager::GetStepsPer_mm_Axis(axis);
+}
+
+// Homing cycles ($H), in the configured order. Switches are at the minimum of travel and become machine
+// zero. Axes of the same cycle move together and the step ticker stops each one at its own switch
+int MachineCore::HomeAxes()
+{
+    uint32_t cycle_axes = Settings_Manager::GetHomingData().home_cycle_axes;
+    int result = GCODE_OK;
+    
+    // During check mode this method does nothing
+    if (m_gcode_parser->IsCheckModeActive())
+        return GCODE_OK;
+    
+    // Homing is allowed in alarm state, and clears it
+    if (m_system_halted)
+    {
+        result = Unlock();
+        
+        if (result != GCODE_OK)
+            return result;
+    }
+    
+    // Start from rest, with all the previous moves completed
+    WaitForIdleCondition();
+    
+    for (uint32_t cycle = 0; cycle < HOMING_CYCLES_COUNT; cycle++)
+    {
+        uint8_t axes = (uint8_t)(cycle_axes >> (cycle * 8)) & ((1 << COORDINATE_LINEAR_AXES_COUNT) - 1);
+        
+        if (axes == 0)
+            continue;
+        
+        m_axes_already_homed &= ~axes;
+        m_axes_homing_now = axes;
+        
+        result = home_axes_cycle(axes);
+        
+        m_axes_homing_now = 0;
+        m_homing_state = HOMING_IDLE;
+        
+        if (result != GCODE_OK)
+            break;
+        
+        m_axes_already_homed |= axes;
+    }
+    
+    m_gcode_parser->SyncMachinePosition();
+    
+    return result;
+}
+
+// Seek at seek rate, pull-off, re-approach at feed rate for the final position and pull-off again
+int MachineCore::home_axes_cycle(uint8_t axes)
+{
+    const HOMING_SETUP_DATA& homing = Settings_Manager::GetHomingData();
+    uint32_t debounce_ticks = pdMS_TO_TICKS(homing.home_debounce_ms);
+    float seek_distance = 0.0f;
+    int32_t latched_steps[COORDINATE_LINEAR_AXES_COUNT];
+    int32_t steps[TOTAL_AXES_COUNT];
+    uint8_t active;
+    
+    // Same distance for every axis, so all of them seek at the same speed
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+    {
+        if ((axes & (1 << axis)) != 0)
+            seek_distance = std::max(seek_distance, HOMING_SEEK_TRAVEL_FACTOR * Settings_Manager::GetMaxTravel_mm_Axis(axis));
+    }
+    
+    // Already on a switch: move away before seeking
+    active = m_step_ticker->GetActiveLimitSwitches() & axes;
+    
+    if (active != 0)
+    {
+        m_homing_state = HOMING_PULL_OFF;
+        homing_move(active, homing.home_pull_off_distance_mm, homing.home_feed_rate_mm_sec, false);
+        vTaskDelay(debounce_ticks);
+        
+        if (m_system_halted)
+            return GCODE_ERROR_HOMING_ABORTED;
+        
+        if ((m_step_ticker->GetActiveLimitSwitches() & axes) != 0)
+            return GCODE_ERROR_HOMING_PULL_OFF;
     }
     
-    return pdFALSE;
+    m_homing_state = HOMING_SEEK;
+    
+    if (homing_move(axes, -seek_distance, homing.home_seek_rate_mm_sec, true) != axes)
+        return (m_system_halted) ? GCODE_ERROR_HOMING_ABORTED : GCODE_ERROR_HOMING_SWITCH_NOT_FOUND;
+    
+    vTaskDelay(debounce_ticks);
+    
+    m_homing_state = HOMING_PULL_OFF;
+    homing_move(axes, homing.home_pull_off_distance_mm, homing.home_seek_rate_mm_sec, false);
+    vTaskDelay(debounce_ticks);
+    
+    if (m_system_halted)
+        return GCODE_ERROR_HOMING_ABORTED;
+    
+    if ((m_step_ticker->GetActiveLimitSwitches() & axes) != 0)
+        return GCODE_ERROR_HOMING_PULL_OFF;
+    
+    m_homing_state = HOMING_LOCATE;
+    
+    if (homing_move(axes, -2.0f * homing.home_pull_off_distance_mm, homing.home_feed_rate_mm_sec, true) != axes)
+        return (m_system_halted) ? GCODE_ERROR_HOMING_ABORTED : GCODE_ERROR_HOMING_SWITCH_NOT_FOUND;
+    
+    // Switch positions become zero. The machine is at rest, the step ticker is not using its position
+    m_step_ticker->GetHomingPosition_steps(latched_steps);
+    m_step_ticker->GetCurrentPosition_steps(steps);
+    
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+    {
+        if ((axes & (1 << axis)) != 0)
+            steps[axis] -= latched_steps[axis];
+    }
+    
+    m_step_ticker->SetCurrentPosition_steps(steps);
+    m_planner->SetPosition_steps(steps);
+    
+    vTaskDelay(debounce_ticks);
+    
+    m_homing_state = HOMING_PULL_OFF;
+    homing_move(axes, homing.home_pull_off_distance_mm, homing.home_seek_rate_mm_sec, false);
+    
+    if (m_system_halted)
+        return GCODE_ERROR_HOMING_ABORTED;
+    
+    return GCODE_OK;
+}
+
+// Move the given axes the same distance, each at rate_mm_s. When stopping on the switches, returns the axes
+// that reached them (the move ends once all of them are latched)
+uint8_t MachineCore::homing_move(uint8_t axes, float distance_mm, float rate_mm_s, bool stop_on_switch)
+{
+    const int32_t * planned_steps = m_planner->GetPosition_steps();
+    float target[TOTAL_AXES_COUNT];
+    int32_t steps[TOTAL_AXES_COUNT];
+    uint32_t axes_count = 0;
+    uint8_t latched = 0;
+    
+    for (uint32_t axis = COORD_X; axis < TOTAL_AXES_COUNT; axis++)
+    {
+        target[axis] = planned_steps[axis] / Settings_Manager::GetStepsPer_mm_Axis(axis);
+        
+        if ((axes & (1 << axis)) != 0)
+        {
+            target[axis] += distance_mm;
+            axes_count++;
+        }
+    }
+    
+    if (stop_on_switch)
+        m_step_ticker->ArmHomingSwitches(axes);
+    
+    m_planner->AppendLine(target, 0.0f, rate_mm_s * sqrtf((float)axes_count));
+    m_conveyor->force_queue();
+    
+    while (m_conveyor->is_idle() == false && m_system_halted == false)
+        vTaskDelay(pdMS_TO_TICKS(1));
+    
+    if (stop_on_switch)
+        latched = m_step_ticker->DisarmHomingSwitches();
+    
+    // Next moves start where the machine stopped
+    m_step_ticker->GetCurrentPosition_steps(steps);
+    m_planner->SetPosition_steps(steps);
+    
+    return latched;
 }
 
 int MachineCore::GoHome(float* target, bool isG28) 
@@ -175,34 +677,176 @@ int MachineCore::GoHome(float* target, bool isG28)
     return 0; 
 }
 
-int MachineCore::DoProbe(float* target)
+void MachineCore::GetProbePosition_mm(float * position)
 {
-    return 0;
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+        position[axis] = m_probe_position[axis];
+}
+
+// G38.2 - G38.5. The step ticker samples the probe input on every tick, latches the position at the
+// contact and brakes at block acceleration. What is left of the probing move is discarded and the
+// planner continues from the position where the machine stopped
+int MachineCore::DoProbe(float* target, float rate_mm_s, GCODE_MODAL_MOTION_MODES mode)
+{
+    bool stop_on_contact = (mode == MODAL_MOTION_MODE_PROBE) || (mode == MODAL_MOTION_MODE_PROBE_NO_ERROR);
+    bool report_failure = (mode == MODAL_MOTION_MODE_PROBE) || (mode == MODAL_MOTION_MODE_PROBE_AWAY);
+    int32_t steps[TOTAL_AXES_COUNT];
+    
+    // During check mode this method does nothing
+    if (m_gcode_parser->IsCheckModeActive())
+        return GCODE_OK;
+    
+    // Start from rest, with all the previous moves completed
+    WaitForIdleCondition();
+    
+    if (m_step_ticker->IsProbeInContact() == stop_on_contact)
+        return GCODE_ERROR_PROBE_INITIAL_STATE;
+    
+    m_probe_state = PROBING_ACTIVE;
+    m_probe_succeeded = false;
+    
+    m_step_ticker->ArmProbe(stop_on_contact);
+    m_planner->AppendLine(target, 0.0f, rate_mm_s);
+    m_conveyor->force_queue();
+    
+    // Wait for the contact (motion stopped) or for the end of the move
+    for ( ; ; )
+    {
+        if (m_system_halted)
+            break;
+        
+        if (m_step_ticker->IsProbeTriggered())
+        {
+            if (m_step_ticker->IsFeedHoldStopped())
+            {
+                m_probe_succeeded = true;
+                break;
+            }
+        }
+        else if (m_conveyor->is_idle())
+            break;
+        
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    
+    if (m_probe_succeeded)
+    {
+        m_conveyor->trim_held_block();
+        m_conveyor->discard_held_blocks();
+        m_step_ticker->CancelFeedHold();
+        
+        m_step_ticker->GetProbePosition_steps(steps);
+    }
+    else
+        m_step_ticker->GetCurrentPosition_steps(steps);
+    
+    m_step_ticker->DisarmProbe();
+    m_probe_state = PROBING_IDLE;
+    
+    for (uint32_t axis = COORD_X; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+        m_probe_position[axis] = steps[axis] / Settings_Manager::GetStepsPer_mm_Axis(axis);
+    
+    // Next moves start where the machine stopped
+    m_step_ticker->GetCurrentPosition_steps(steps);
+    m_planner->SetPosition_steps(steps);
+    
+    if (m_probe_succeeded == false && report_failure)
+        return GCODE_ERROR_PROBE_NO_CONTACT;
+    
+    return GCODE_OK;
 }
     
+// M3/M4 return once the spindle reports the programmed speed, instead of relying on a G4 dwell
 int MachineCore::SendSpindleCommand(GCODE_MODAL_SPINDLE_MODES mode, float spindle_rpm) 
 { 
-    return 0; 
+    uint32_t timeout_ms = Settings_Manager::GetSpindleData().at_speed_timeout_ms;
+    
+    // During check mode this method does nothing
+    if (m_gcode_parser->IsCheckModeActive())
+        return GCODE_OK;
+    
+    m_spindle->SetSpeed(mode, spindle_rpm);
+    
+    if (mode != MODAL_SPINDLE_CW && mode != MODAL_SPINDLE_CCW)
+        return GCODE_OK;
+    
+    while (m_spindle->IsAtSpeed() == false)
+    {
+        if (this->m_system_halted != false)
+            return GCODE_ERROR_MACHINE_ALARM_LOCKED;
+        
+        if (timeout_ms < 10)
+            return GCODE_ERROR_SPINDLE_NOT_AT_SPEED;
+        
+        vTaskDelay(pdMS_TO_TICKS(10));
+        timeout_ms -= 10;
+    }
+    
+    return GCODE_OK;
 }
 
+// Synchronised with motion: applied when the next queued move starts, or right away if nothing is queued
 int MachineCore::SendCoolantCommand(GCODE_MODAL_COOLANT_MODES mode) 
 { 
+    // During check mode this method does nothing
+    if (m_gcode_parser->IsCheckModeActive())
+        return GCODE_OK;
+    
     switch (mode)
     {
         case MODAL_COOLANT_FLOOD:
-            m_coolant->EnableFlood();
+            queue_output_change(OUTPUT_COOLANT_FLOOD_BIT, OUTPUT_COOLANT_FLOOD_BIT);
             break;
         
         case MODAL_COOLANT_MIST:
-            m_coolant->EnableMist();
+            queue_output_change(OUTPUT_COOLANT_MIST_BIT, OUTPUT_COOLANT_MIST_BIT);
             break;
         
         default:
-            m_coolant->Stop();
+            queue_output_change(OUTPUT_COOLANT_MASK, 0);
             break;
     }
 
-    return 0;
+    return GCODE_OK;
+}
+
+// M62/M63 wait for the next queued move like the coolant, M64/M65 act immediately
+int MachineCore::SetAuxOutput(uint32_t index, bool on, bool synchronized)
+{
+    uint8_t bit = (uint8_t)(1 << (OUTPUT_AUX_FIRST_BIT_POS + index));
+    
+    if (index >= AUX_OUTPUTS_COUNT)
+        return GCODE_ERROR_INVALID_AUX_OUTPUT;
+    
+    // During check mode this method does nothing
+    if (m_gcode_parser->IsCheckModeActive())
+        return GCODE_OK;
+    
+    if (synchronized)
+        queue_output_change(bit, on ? bit : 0);
+    else
+        m_coolant->ApplyOutputs(bit, on ? bit : 0);
+    
+    return GCODE_OK;
+}
+
+void MachineCore::queue_output_change(uint8_t mask, uint8_t values)
+{
+    m_planner->QueueOutputChange(mask, values);
+    flush_pending_outputs();
+}
+
+// No move left to carry the pending output changes: motion finished, apply them now. A move queued
+// in between takes them first (Planner::AppendLine), so they are never applied twice
+void MachineCore::flush_pending_outputs()
+{
+    uint8_t mask, values;
+    
+    if (m_conveyor->get_queued_blocks_count() != 0)
+        return;
+    
+    if (m_planner->TakePendingOutputs(mask, values))
+        m_coolant->ApplyOutputs(mask, values);
 }
     
 int MachineCore::Dwell(float p_time_secs) 
@@ -235,9 +879,41 @@ int MachineCore::Dwell(float p_time_secs)
 int MachineCore::WaitForIdleCondition() 
 { 
     m_conveyor->wait_for_idle(); 
+    flush_pending_outputs();
     return 0; 
 }
 
+// M2/M30, queue already drained. Planner statistics are closed and saved to the SD card
+void MachineCore::EndJob()
+{
+    JobStats::EndJob();
+}
+
+void MachineCore::alarm_task_entry(void * pvParam)
+{
+    MachineCore* instance = (MachineCore*)pvParam;
+    uint32_t events;
+    
+    for ( ; ; )
+    {
+        // Event bits from NotifyOfEvent
+        if (xTaskNotifyWait(0, 0xFFFFFFFF, &events, portMAX_DELAY) == pdTRUE)
+            instance->handle_alarm(events);
+    }
+}
+
+void MachineCore::motion_task_entry(void * pvParam)
+{
+    MachineCore* instance = (MachineCore*)pvParam;
+    
+    for ( ; ; )
+    {
+        // Woken up by the step ticker on each finished block, periodically otherwise
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MOTION_SERVICE_PERIOD_MS));
+        instance->service_motion();
+    }
+}
+
 // Static timer callback functions
 void MachineCore::steppers_idle_timeout_callback(TimerHandle_t xTimer)
 {
@@ -266,6 +942,7 @@ void MachineCore::read_user_buttons_callback(TimerHandle_t xTimer)
     MachineCore* instance = (MachineCore*)pvTimerGetTimerID(xTimer);
     
     static uint32_t debounce_cntrs[3];
+    static uint32_t adaptive_feed_cntr;
     
     if (instance->m_startup_finished == false)
         return;
@@ -306,4 +983,76 @@ void MachineCore::read_user_buttons_callback(TimerHandle_t xTimer)
             debounce_cntrs[2] = 0;
         }
     }
+    
+    if (Settings_Manager::GetAnalogInputsData().feed_override_knob != 0)
+        instance->read_feed_override_knob();
+    
+    if (++adaptive_feed_cntr >= (ADAPTIVE_FEED_PERIOD_MS / 20))
+    {
+        adaptive_feed_cntr = 0;
+        instance->update_adaptive_feed();
+    }
+}
+
+// Only applied when the knob is moved, so the serial override commands keep working in between
+void MachineCore::read_feed_override_knob()
+{
+    uint32_t percent = OVERRIDE_FEED_MIN_PERCENT + 
+                       (ADC_GetValue(ANALOG_CHANNEL_FEED_OVERRIDE) * (OVERRIDE_FEED_MAX_PERCENT - OVERRIDE_FEED_MIN_PERCENT)) / ANALOG_FULL_SCALE;
+    
+    // Easy to set the programmed feed back
+    if (percent >= (100 - FEED_KNOB_CENTER_DETENT) && percent <= (100 + FEED_KNOB_CENTER_DETENT))
+        percent = 100;
+    
+    if ((percent + FEED_KNOB_HYSTERESIS) <= m_feed_knob_percent || percent >= (m_feed_knob_percent + FEED_KNOB_HYSTERESIS) ||
+        (percent == 100 && m_feed_knob_percent != 100))
+    {
+        m_feed_knob_percent = percent;
+        SetFeedOverride(percent);
+    }
+}
+
+// Analog input first, then VFD output current. Zero when no load feedback is configured
+float MachineCore::GetSpindleLoad_pct()
+{
+    const ANALOG_INPUTS_SETUP_DATA& analog = Settings_Manager::GetAnalogInputsData();
+    const SPINDLE_SETUP_DATA& spindle = Settings_Manager::GetSpindleData();
+    
+    if (analog.spindle_load_input != 0 && analog.spindle_load_full_scale_mV != 0)
+        return (ADC_GetValue_mV(ANALOG_CHANNEL_SPINDLE_LOAD) * 100.0f) / analog.spindle_load_full_scale_mV;
+    
+    if (spindle.interface == SPINDLE_INTERFACE_MODBUS && spindle.rated_current_A > 0.0f && m_spindle->IsLinkOk())
+        return (m_spindle->GetOutputCurrent_A() * 100.0f) / spindle.rated_current_A;
+    
+    return 0.0f;
+}
+
+// Timer task context. Quick reduction above the high threshold, slow recovery below the low one. Each
+// change is replanned by the motion service task like any override, the queue is never flushed
+void MachineCore::update_adaptive_feed()
+{
+    const ANALOG_INPUTS_SETUP_DATA& analog = Settings_Manager::GetAnalogInputsData();
+    int32_t percent = (int32_t)m_adaptive_feed;
+    int32_t min_percent = std::max((int32_t)analog.adaptive_min_feed_pct, (int32_t)OVERRIDE_FEED_MIN_PERCENT);
+    float load;
+    
+    if (analog.adaptive_feed == 0 || m_spindle->IsRunning() == false)
+    {
+        percent = 100;
+    }
+    else
+    {
+        load = GetSpindleLoad_pct();
+        
+        if (load > analog.adaptive_load_high_pct)
+            percent = std::max(percent - ADAPTIVE_FEED_STEP_DOWN, min_percent);
+        else if (load < analog.adaptive_load_low_pct)
+            percent = std::min(percent + ADAPTIVE_FEED_STEP_UP, (int32_t)100);
+    }
+    
+    if ((uint32_t)percent != m_adaptive_feed)
+    {
+        m_adaptive_feed = (uint32_t)percent;
+        m_overrides_changed = true;
+    }
 }
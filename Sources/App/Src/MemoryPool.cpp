@@ -0,0 +1,206 @@
+#include "MemoryPool.h"
+
+#include <stdio.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "compile_check.h"
+
+COMPILE_CHECK((LINE_POOL_BLOCK_SIZE % 8) == 0 && (FAT_SECTOR_POOL_BLOCK_SIZE % 8) == 0 &&
+              (UI_POOL_SMALL_BLOCK_SIZE % 8) == 0 && (UI_POOL_MEDIUM_BLOCK_SIZE % 8) == 0 &&
+              (UI_POOL_LARGE_BLOCK_SIZE % 8) == 0 && (UI_POOL_HUGE_BLOCK_SIZE % 8) == 0, "Pool block sizes must keep 8 byte alignment");
+
+COMPILE_CHECK(UI_POOL_SMALL_BLOCK_SIZE < UI_POOL_MEDIUM_BLOCK_SIZE && UI_POOL_MEDIUM_BLOCK_SIZE < UI_POOL_LARGE_BLOCK_SIZE &&
+              UI_POOL_LARGE_BLOCK_SIZE < UI_POOL_HUGE_BLOCK_SIZE, "UI pools must be sorted by block size");
+
+// Storage [uint64_t: 8 byte alignment]
+static uint64_t line_storage[LINE_POOL_BLOCK_SIZE * LINE_POOL_BLOCK_COUNT / 8] CCM_RAM;
+static uint64_t fat_sector_storage[FAT_SECTOR_POOL_BLOCK_SIZE * FAT_SECTOR_POOL_BLOCK_COUNT / 8];
+static uint64_t ui_small_storage[UI_POOL_SMALL_BLOCK_SIZE * UI_POOL_SMALL_BLOCK_COUNT / 8] CCM_RAM;
+static uint64_t ui_medium_storage[UI_POOL_MEDIUM_BLOCK_SIZE * UI_POOL_MEDIUM_BLOCK_COUNT / 8] CCM_RAM;
+static uint64_t ui_large_storage[UI_POOL_LARGE_BLOCK_SIZE * UI_POOL_LARGE_BLOCK_COUNT / 8] CCM_RAM;
+static uint64_t ui_huge_storage[UI_POOL_HUGE_BLOCK_SIZE * UI_POOL_HUGE_BLOCK_COUNT / 8] CCM_RAM;
+
+static MemoryPool pools[MEMORY_POOL_COUNT] =
+{
+    MemoryPool("LINE",    line_storage,       LINE_POOL_BLOCK_SIZE,       LINE_POOL_BLOCK_COUNT),
+    MemoryPool("FAT",     fat_sector_storage, FAT_SECTOR_POOL_BLOCK_SIZE, FAT_SECTOR_POOL_BLOCK_COUNT),
+    MemoryPool("UI32",    ui_small_storage,   UI_POOL_SMALL_BLOCK_SIZE,   UI_POOL_SMALL_BLOCK_COUNT),
+    MemoryPool("UI64",    ui_medium_storage,  UI_POOL_MEDIUM_BLOCK_SIZE,  UI_POOL_MEDIUM_BLOCK_COUNT),
+    MemoryPool("UI128",   ui_large_storage,   UI_POOL_LARGE_BLOCK_SIZE,   UI_POOL_LARGE_BLOCK_COUNT),
+    MemoryPool("UI256",   ui_huge_storage,    UI_POOL_HUGE_BLOCK_SIZE,    UI_POOL_HUGE_BLOCK_COUNT),
+};
+
+MemoryPool::MemoryPool(const char * name, void * storage, uint32_t block_size, uint32_t block_count)
+{
+    uint32_t index;
+    
+    m_name = name;
+    m_storage = (uint8_t*)storage;
+    m_storage_end = m_storage + (block_size * block_count);
+    m_block_size = block_size;
+    m_block_count = block_count;
+    
+    m_used = 0;
+    m_high_water = 0;
+    m_fallbacks = 0;
+    
+    // Chain every block, first one at the head
+    m_free_list = NULL;
+    
+    for (index = block_count; index > 0; index--)
+    {
+        void ** block = (void**)(m_storage + ((index - 1) * block_size));
+        
+        *block = m_free_list;
+        m_free_list = block;
+    }
+}
+
+void * MemoryPool::Alloc()
+{
+    void ** block;
+    
+    taskENTER_CRITICAL();
+    
+    block = (void**)m_free_list;
+    
+    if (block != NULL)
+    {
+        m_free_list = *block;
+        m_used++;
+        
+        if (m_used > m_high_water)
+            m_high_water = m_used;
+    }
+    
+    taskEXIT_CRITICAL();
+    
+    return block;
+}
+
+void MemoryPool::Free(void * ptr)
+{
+    if (ptr == NULL)
+        return;
+    
+    configASSERT(Owns(ptr));
+    
+    taskENTER_CRITICAL();
+    
+    *(void**)ptr = m_free_list;
+    m_free_list = ptr;
+    m_used--;
+    
+    taskEXIT_CRITICAL();
+}
+
+MemoryPool& MemoryPools::Get(uint32_t pool_id)
+{
+    return pools[pool_id];
+}
+
+void MemoryPools::Report(MEMORY_WRITE_FUNC write, void * context)
+{
+    char line[64];
+    uint32_t index;
+    
+    write(context, "[MEMORY] pool block used/peak/total heap_fallbacks");
+    
+    for (index = 0; index < MEMORY_POOL_COUNT; index++)
+    {
+        const MemoryPool& pool = pools[index];
+        
+        snprintf(line, sizeof(line), "%-8s %4lu %3lu/%3lu/%3lu %lu", pool.GetName(), (unsigned long)pool.GetBlockSize(),
+                 (unsigned long)pool.GetUsed(), (unsigned long)pool.GetHighWater(), (unsigned long)pool.GetBlockCount(),
+                 (unsigned long)pool.GetFallbacks());
+        write(context, line);
+    }
+    
+    snprintf(line, sizeof(line), "HEAP free %lu, min ever %lu of %lu", (unsigned long)xPortGetFreeHeapSize(),
+             (unsigned long)xPortGetMinimumEverFreeHeapSize(), (unsigned long)configTOTAL_HEAP_SIZE);
+    write(context, line);
+}
+
+// Pool block if the request fits and the pool is not exhausted, heap otherwise
+static void * pool_or_heap_alloc(MemoryPool& pool, size_t size)
+{
+    void * ptr = NULL;
+    
+    if (size <= pool.GetBlockSize())
+        ptr = pool.Alloc();
+    
+    if (ptr == NULL)
+    {
+        pool.CountFallback();
+        ptr = pvPortMalloc(size);
+    }
+    
+    return ptr;
+}
+
+static void pool_or_heap_free(MemoryPool& pool, void * ptr)
+{
+    if (pool.Owns(ptr))
+        pool.Free(ptr);
+    else
+        vPortFree(ptr);
+}
+
+extern "C" void * line_pool_alloc(void)
+{
+    return pool_or_heap_alloc(pools[MEMORY_POOL_LINE], LINE_POOL_BLOCK_SIZE);
+}
+
+extern "C" void line_pool_free(void * ptr)
+{
+    pool_or_heap_free(pools[MEMORY_POOL_LINE], ptr);
+}
+
+// Only sector buffers are pooled, the cache and the descriptors are allocated once at mount
+extern "C" void * fat_pool_alloc(size_t size)
+{
+    if (size != FAT_SECTOR_POOL_BLOCK_SIZE)
+        return pvPortMalloc(size);
+    
+    return pool_or_heap_alloc(pools[MEMORY_POOL_FAT_SECTOR], size);
+}
+
+extern "C" void fat_pool_free(void * ptr)
+{
+    pool_or_heap_free(pools[MEMORY_POOL_FAT_SECTOR], ptr);
+}
+
+// Smallest pool the request fits in. Larger requests (images, big labels) go to the heap
+extern "C" void * ui_pool_alloc(size_t size)
+{
+    uint32_t index;
+    
+    for (index = MEMORY_POOL_UI_SMALL; index < MEMORY_POOL_UI_HUGE; index++)
+    {
+        if (size <= pools[index].GetBlockSize())
+            break;
+    }
+    
+    return pool_or_heap_alloc(pools[index], size);
+}
+
+extern "C" void ui_pool_free(void * ptr)
+{
+    uint32_t index;
+    
+    if (ptr == NULL)
+        return;
+    
+    for (index = MEMORY_POOL_UI_SMALL; index <= MEMORY_POOL_UI_HUGE; index++)
+    {
+        if (pools[index].Owns(ptr))
+        {
+            pools[index].Free(ptr);
+            return;
+        }
+    }
+    
+    vPortFree(ptr);
+}
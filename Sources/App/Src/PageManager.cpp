@@ -2,8 +2,12 @@
 
 #include "MainPage.h"
 #include "FileManagerPage.h"
+#include "ToolpathPage.h"
+#include "DiagnosticsPage.h"
 
 lv_obj_t* PageManager::m_page_manager_surface;
+BasePageWindow* PageManager::m_active_page;
+uint32_t PageManager::m_active_page_index;
 
 void PageManager::Initialize(lv_obj_t * parent)
 {
@@ -12,10 +16,40 @@ void PageManager::Initialize(lv_obj_t * parent)
     lv_obj_set_pos(m_page_manager_surface, 0, 64);  // Position below ControlBar
     lv_obj_set_size(m_page_manager_surface, 800, 480 - 64); // Cover remaining screen
     lv_obj_set_style(m_page_manager_surface, &lv_style_plain_color);
+    
+    // Main page is shown at startup
+    m_active_page = new MainPage();
+    m_active_page->Create(m_page_manager_surface);
+    m_active_page_index = PAGE_INDEX_MAIN;
 }
 
 void PageManager::SwitchToPage(uint32_t page_index)
 {
+    if ((page_index >= PAGE_INDEX_COUNT) || (page_index == m_active_page_index))
+        return;
+    
+    // Only one page alive at a time, to keep heap usage low
+    if (m_active_page != NULL)
+    {
+        m_active_page->Destroy();
+        delete m_active_page;
+        m_active_page = NULL;
+    }
+    
+    switch (page_index)
+    {
+        case PAGE_INDEX_MAIN:           m_active_page = new MainPage(); break;
+        case PAGE_INDEX_FILE_MANAGER:   m_active_page = new FileManagerPage(); break;
+        case PAGE_INDEX_TOOLPATH:       m_active_page = new ToolpathPage(); break;
+        case PAGE_INDEX_DIAGNOSTICS:    m_active_page = new DiagnosticsPage(); break;
+    }
     
+    m_active_page->Create(m_page_manager_surface);
+    m_active_page_index = page_index;
 }
 
+void PageManager::UpdateActivePage()
+{
+    if (m_active_page != NULL)
+        m_active_page->Update();
+}
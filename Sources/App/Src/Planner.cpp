@@ -8,6 +8,9 @@
 
 #include "settings_manager.h"
 #include "Conveyor.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "JobStats.h"
 
 
 Planner::Planner(void)
@@ -18,6 +21,14 @@ Planner::Planner(void)
     memset((void*)&this->m_position_steps[0], 0, sizeof(this->m_position_steps));
     
     m_conveyor = NULL;
+    
+    m_feed_override = 1.0f;
+    m_rapid_override = 1.0f;
+    
+    m_pending_output_mask = 0;
+    m_pending_output_values = 0;
+    
+    m_plan_mutex = xSemaphoreCreateMutex();
 }
 
 
@@ -25,7 +36,7 @@ Planner::~Planner(void)
 {
 }
 
-int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_mm_s, bool inverseTimeRate)
+int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_mm_s, bool inverseTimeRate, bool isRapid)
 {
     uint32_t index;
     int32_t target_steps[TOTAL_AXES_COUNT];
@@ -35,9 +46,17 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
     float delta_mm = 0.0f;
     
     float vmax_junction = 0.0f;
+    float junction_limit = 0.0f;
     
     Block* block = m_conveyor->queue.head_ref();
     
+    uint32_t start_cycles = DWT->CYCCNT;
+    
+    TraceRecorder::Record(TRACE_EVENT_APPEND_ENTER);
+    
+    // The motion service task must not replan the queue while this block is being planned
+    xSemaphoreTake(m_plan_mutex, portMAX_DELAY);
+    
     for (index = COORD_X; index < TOTAL_AXES_COUNT; index++)
     {
         // Calculate how many steps from mm and steps per mm settings
@@ -65,7 +84,18 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
     
     // Check if any move 
     if (distance == 0.0f)
+    {
+        xSemaphoreGive(m_plan_mutex);
+        TraceRecorder::Record(TRACE_EVENT_APPEND_EXIT, 0, 0);
         return PLANNER_OK;  // Nothing to do
+    }
+    
+    // Output changes programmed since the previous move are applied when this one starts
+    taskENTER_CRITICAL();
+    block->output_mask = m_pending_output_mask;
+    block->output_values = m_pending_output_values;
+    m_pending_output_mask = 0;
+    taskEXIT_CRITICAL();
     
     // Calculate square root of the sum of squares obtained previously
     distance = sqrtf(distance);
@@ -85,11 +115,27 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
     // Limit acceleration value to maximum allowed
     block->acceleration = limit_value_by_axis_maximum(SOME_LARGE_VALUE, Settings_Manager::GetAcceleration_mm_sec2_all_axes(), unit_vec);
     
+    // Keep what is needed to apply overrides later on
+    block->is_g123 = !isRapid;
+    
+    // Laser power at nominal rate, relative to maximum spindle speed [1.11 fixed point]. Off on rapids
+    if (Settings_Manager::GetSpindleData().laser_mode != 0 && !isRapid && spindle_speed > 0.0f)
+    {
+        float min_rpm, max_rpm;
+        
+        Settings_Manager::GetSpindleSpeeds(min_rpm, max_rpm);
+        
+        if (max_rpm > 0.0f)
+            block->s_value = (uint16_t)std::min(lroundf((spindle_speed / max_rpm) * 2048.0f), 4095L);
+    }
+    block->programmed_speed = rate_mm_s;
+    block->speed_limit = limit_value_by_axis_maximum(SOME_LARGE_VALUE, Settings_Manager::GetMaxSpeed_mm_sec_all_axes(), unit_vec);
+    
     // Determine nominal speeds/rates
     if (distance > 0.0f)
     {
-        block->nominal_speed = rate_mm_s;
-        block->nominal_rate = block->steps_event_count * rate_mm_s / distance; // steps/sec
+        block->nominal_speed = override_speed(block);
+        block->nominal_rate = block->steps_event_count * block->nominal_speed / distance; // steps/sec
     }
     else
     {
@@ -116,7 +162,7 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
             // Skip and use default max junction speed for 0 degree acute junction.
             if (cos_theta <= 0.9999f) 
             {
-                vmax_junction = std::min(previous_nominal_speed, block->nominal_speed);
+                junction_limit = SOME_LARGE_VALUE;
                 
                 // Skip and avoid divide by zero for straight junctions at 180 degrees. Limit to min() of nominal speeds.
                 if (cos_theta >= -0.9999f) 
@@ -124,12 +170,15 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
                     // Compute maximum junction velocity based on maximum acceleration and junction deviation
                     float sin_theta_d2 = sqrtf(0.5f * (1.0f - cos_theta)); // Trig half angle identity. Always positive.
                     
-                    vmax_junction = std::min(vmax_junction, sqrtf(block->acceleration * m_junction_deviation * sin_theta_d2 / (1.0f - sin_theta_d2)));
+                    junction_limit = sqrtf(block->acceleration * m_junction_deviation * sin_theta_d2 / (1.0f - sin_theta_d2));
                 }
+                
+                vmax_junction = std::min(junction_limit, std::min(previous_nominal_speed, block->nominal_speed));
             }
         }
     }
     
+    block->max_junction_speed = junction_limit;
     block->max_entry_speed = vmax_junction;
     
     // Initialize block entry speed. Compute based on deceleration to user-defined minimum_planner_speed.
@@ -163,12 +212,44 @@ int Planner::AppendLine(const float* target_mm, float spindle_speed, float rate_
 
     // The block can now be used
     block->ready();
+    
+    // Released before waiting for room in the queue: a feed hold must still be able to replan
+    xSemaphoreGive(m_plan_mutex);
+    
+    JobStats::OnAppendLine(DWT->CYCCNT - start_cycles);
 
     m_conveyor->queue_head_block();
     
+    TraceRecorder::Record(TRACE_EVENT_APPEND_EXIT, 0, 1);
     return PLANNER_OK;
 }
 
+void Planner::SetPosition_steps(const int32_t * position)
+{
+    memcpy(m_position_steps, position, sizeof(m_position_steps));
+}
+
+// Later changes of the same outputs replace the earlier ones
+void Planner::QueueOutputChange(uint8_t mask, uint8_t values)
+{
+    taskENTER_CRITICAL();
+    m_pending_output_values = (m_pending_output_values & ~mask) | (values & mask);
+    m_pending_output_mask |= mask;
+    taskEXIT_CRITICAL();
+}
+
+// Changes no queued move will carry. Returns false if there are none
+bool Planner::TakePendingOutputs(uint8_t& mask, uint8_t& values)
+{
+    taskENTER_CRITICAL();
+    mask = m_pending_output_mask;
+    values = m_pending_output_values;
+    m_pending_output_mask = 0;
+    taskEXIT_CRITICAL();
+    
+    return (mask != 0) ? true : false;
+}
+
 float Planner::limit_value_by_axis_maximum(float limit_value, const float * max_values, const float * unit_vector)
 {
     uint32_t idx;
@@ -224,6 +305,7 @@ void Planner::recalculate()
      */
 
     float entry_speed = 0.0f;
+    uint32_t walked_blocks = 0;
 
     block_index = m_conveyor->queue.head_i;
     current     = m_conveyor->queue.item_ref(block_index);
@@ -233,6 +315,7 @@ void Planner::recalculate()
         while ((block_index != m_conveyor->queue.tail_i) && current->recalculate_flag) 
         {
             entry_speed = current->reverse_pass(entry_speed);
+            walked_blocks++;
 
             block_index = m_conveyor->queue.prev(block_index);
             current     = m_conveyor->queue.item_ref(block_index);
@@ -271,8 +354,242 @@ void Planner::recalculate()
     // now current points to the head item
     // which has not had calculate_trapezoid run yet
     current->calculate_trapezoid(current->entry_speed, 0.0f);
+    
+    Profiler::OnRecalculate(walked_blocks);
+}
+
+
+/*
+ * Called after a feed hold stopped the machine. The first pending block (trimmed to its remaining
+ * steps) now starts from rest, everything else in the queue is unchanged.
+ *
+ * Entry speeds are already limited by the reverse pass towards the end of the queue, so only a
+ * forward pass is needed: it can only lower entry speeds, starting with 0 on the first block.
+ *
+ * Runs with m_plan_mutex held, so never concurrently with AppendLine. A head block waiting for room
+ * in the queue is already planned, so it is included.
+ */
+void Planner::ReplanFromRest()
+{
+    xSemaphoreTake(m_plan_mutex, portMAX_DELAY);
+    TraceRecorder::Record(TRACE_EVENT_REPLAN_BEGIN, 0, 0);
+    
+    replan_from_rest();
+    
+    TraceRecorder::Record(TRACE_EVENT_REPLAN_END, 0, 0);
+    xSemaphoreGive(m_plan_mutex);
+}
+
+void Planner::replan_from_rest()
+{
+    unsigned int block_index;
+    unsigned int last_index;
+
+    Block* previous;
+    Block* current;
+    
+    block_index = m_conveyor->queue.isr_tail_i;
+    
+    if (m_conveyor->queue.head_ref()->is_ready)
+        last_index = m_conveyor->queue.head_i;
+    else if (block_index != m_conveyor->queue.head_i)
+        last_index = m_conveyor->queue.prev(m_conveyor->queue.head_i);
+    else
+        return;     // Nothing pending
+    
+    current = m_conveyor->queue.item_ref(block_index);
+    current->entry_speed = 0.0f;
+    
+    float exit_speed = current->max_exit_speed();
+    
+    while (block_index != last_index) 
+    {
+        previous    = current;
+        block_index = m_conveyor->queue.next(block_index);
+        current     = m_conveyor->queue.item_ref(block_index);
+        
+        exit_speed = current->forward_pass(exit_speed);
+        
+        previous->calculate_trapezoid(previous->entry_speed, current->entry_speed);
+    }
+    
+    // Last block always ends at rest
+    current->calculate_trapezoid(current->entry_speed, 0.0f);
+}
+
+/*
+ * Called when the feed or rapid override changed. Nominal speeds of every block not started yet are
+ * recomputed from the programmed speed, and the queue is fully replanned without flushing it. The block
+ * being ticked keeps its trapezoid, the step ticker ramps it to the new rate on its own.
+ *
+ * The step ticker keeps running meanwhile, blocks are only locked while calculate_trapezoid() writes them.
+ * The entry speed of the first pending block is pinned to the exit speed of the ticked block (or its
+ * current one if nothing is ticked). A block started while replanning keeps its previous trapezoid, so
+ * the next one is pinned to its planned exit speed the same way. As the new speeds may be lower than that,
+ * entries are also limited by the minimum speed that can be reached braking from the previous block, and
+ * nominal speeds raised if needed.
+ *
+ * Runs with m_plan_mutex held, same as ReplanFromRest
+ */
+void Planner::ApplyOverrides(float feed_factor, float rapid_factor)
+{
+    xSemaphoreTake(m_plan_mutex, portMAX_DELAY);
+    TraceRecorder::Record(TRACE_EVENT_REPLAN_BEGIN, 0, 1);
+    
+    apply_overrides(feed_factor, rapid_factor);
+    
+    TraceRecorder::Record(TRACE_EVENT_REPLAN_END, 0, 1);
+    xSemaphoreGive(m_plan_mutex);
 }
 
+void Planner::apply_overrides(float feed_factor, float rapid_factor)
+{
+    unsigned int first_index;
+    unsigned int last_index;
+    unsigned int block_index;
+    
+    Block* ticking = NULL;
+    Block* first = NULL;
+    Block* current;
+    Block* next;
+    
+    float entry_speed;
+    float exit_speed;
+    float prev_nominal_speed = 0.0f;
+    
+    m_feed_override = feed_factor;
+    m_rapid_override = rapid_factor;
+    
+    // Find the first block the step ticker did not start
+    first_index = m_conveyor->queue.isr_tail_i;
+    
+    while (first_index != m_conveyor->queue.head_i)
+    {
+        current = m_conveyor->queue.item_ref(first_index);
+        
+        if (current->is_ticking == false)
+        {
+            first = current;
+            break;
+        }
+        
+        ticking = current;
+        first_index = m_conveyor->queue.next(first_index);
+    }
+    
+    if (ticking != NULL)
+    {
+        prev_nominal_speed = override_speed(ticking);
+        StepTicker::getInstance()->RequestRateChange(ticking, ticking->steps_event_count * prev_nominal_speed / ticking->millimeters);
+    }
+    
+    // A head block waiting for room in the queue is already planned, so it is included
+    if (m_conveyor->queue.head_ref()->is_ready)
+    {
+        last_index = m_conveyor->queue.head_i;
+        
+        if (first == NULL)
+            first = m_conveyor->queue.head_ref();
+    }
+    else if (first != NULL)
+        last_index = m_conveyor->queue.prev(m_conveyor->queue.head_i);
+    else
+        return;     // Nothing pending
+    
+    entry_speed = (ticking != NULL) ? ticking->exit_speed : first->entry_speed;
+    
+    // Step 1: new nominal speeds and entry limits
+    block_index = first_index;
+    
+    for ( ; ; )
+    {
+        current = m_conveyor->queue.item_ref(block_index);
+        
+        current->nominal_speed = override_speed(current);
+        current->nominal_rate = current->steps_event_count * current->nominal_speed / current->millimeters;
+        current->max_entry_speed = std::min(current->max_junction_speed, std::min(prev_nominal_speed, current->nominal_speed));
+        current->nominal_length_flag = (current->nominal_speed <= max_allowable_speed(-current->acceleration, 0.0f, current->millimeters));
+        current->recalculate_flag = true;
+        
+        prev_nominal_speed = current->nominal_speed;
+        
+        if (block_index == last_index)
+            break;
+        
+        block_index = m_conveyor->queue.next(block_index);
+    }
+    
+    // Step 2: reverse pass, highest entry speeds still able to stop at the end of the queue
+    exit_speed = 0.0f;
+    block_index = last_index;
+    
+    while (block_index != first_index)
+    {
+        current = m_conveyor->queue.item_ref(block_index);
+        current->entry_speed = std::min(current->max_entry_speed, max_allowable_speed(-current->acceleration, exit_speed, current->millimeters));
+        exit_speed = current->entry_speed;
+        
+        block_index = m_conveyor->queue.prev(block_index);
+    }
+    
+    // Step 3: forward pass from the pinned entry speed. Each trapezoid is written as soon as the entry
+    // speed of the next block is known, so the blocks about to be executed are ready first
+    current = first;
+    current->entry_speed = entry_speed;
+    current->max_entry_speed = std::max(current->max_entry_speed, entry_speed);
+    raise_nominal_speed(current, entry_speed);
+    
+    block_index = first_index;
+    
+    while (block_index != last_index)
+    {
+        block_index = m_conveyor->queue.next(block_index);
+        next = m_conveyor->queue.item_ref(block_index);
+        
+        float v_max = max_allowable_speed(-current->acceleration, current->entry_speed, current->millimeters);
+        float v_min_squared = (current->entry_speed * current->entry_speed) - (2.0f * current->acceleration * current->millimeters);
+        float v_min = (v_min_squared > 0.0f) ? sqrtf(v_min_squared) : 0.0f;
+        
+        entry_speed = std::max(std::min(next->entry_speed, v_max), v_min);
+        raise_nominal_speed(current, entry_speed);
+        
+        if (current->calculate_trapezoid(current->entry_speed, entry_speed) == false)
+        {
+            // Started meanwhile with its previous trapezoid: the next block enters at its planned exit speed
+            current->recalculate_flag = false;
+            entry_speed = current->exit_speed;
+        }
+        
+        next->entry_speed = entry_speed;
+        next->max_entry_speed = std::max(next->max_entry_speed, entry_speed);
+        raise_nominal_speed(next, entry_speed);
+        
+        current = next;
+    }
+    
+    // Last block always ends at rest
+    if (current->calculate_trapezoid(current->entry_speed, 0.0f) == false)
+        current->recalculate_flag = false;
+}
+
+// Programmed speed of the block with the current override applied, limited by the axes maximum speed
+float Planner::override_speed(const Block* block) const
+{
+    float factor = (block->is_g123) ? m_feed_override : m_rapid_override;
+    
+    return std::min(block->programmed_speed * factor, block->speed_limit);
+}
+
+// An entry or exit speed above the overridden nominal speed is only possible while braking from the
+// previous (faster) plan. Let the block run at that speed rather than stepping down at once
+void Planner::raise_nominal_speed(Block* block, float speed)
+{
+    if (block->nominal_speed < speed)
+    {
+        block->nominal_speed = speed;
+        block->nominal_rate = block->steps_event_count * speed / block->millimeters;
+    }
+}
 
 // Calculates the maximum allowable speed at this point when you must be able to reach target_velocity using the
 // acceleration within the allotted distance.
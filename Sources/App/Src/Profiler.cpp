@@ -0,0 +1,329 @@
+#include "Profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "user_tasks.h"
+#include "MachineCore.h"
+
+uint32_t Profiler::m_cycles_per_us;
+
+PROFILER_ISR_STATS Profiler::m_isr_stats[PROFILER_ISR_COUNT];
+uint64_t Profiler::m_isr_window_start_cycles[PROFILER_ISR_COUNT];
+uint16_t Profiler::m_isr_load_permille[PROFILER_ISR_COUNT];
+volatile uint32_t Profiler::m_step_latency_min;
+volatile uint32_t Profiler::m_step_latency_max;
+uint32_t Profiler::m_step_latency_histogram[PROFILER_HISTOGRAM_BUCKETS];
+
+TaskStatus_t Profiler::m_task_status[PROFILER_MAX_TASKS];
+TaskHandle_t Profiler::m_prev_handles[PROFILER_MAX_TASKS];
+uint32_t Profiler::m_prev_run_time[PROFILER_MAX_TASKS];
+uint32_t Profiler::m_prev_count;
+uint32_t Profiler::m_prev_total_run_time;
+PROFILER_TASK_LOAD Profiler::m_task_loads[PROFILER_MAX_TASKS];
+uint32_t Profiler::m_task_count;
+
+uint32_t Profiler::m_recalc_count;
+uint32_t Profiler::m_recalc_total_blocks;
+uint32_t Profiler::m_recalc_max_blocks;
+
+uint32_t Profiler::m_depth_sum;
+uint32_t Profiler::m_depth_samples;
+uint32_t Profiler::m_depth_min;
+uint32_t Profiler::m_depth_max;
+uint32_t Profiler::m_depth_last;
+uint32_t Profiler::m_window_depth_min;
+uint32_t Profiler::m_window_depth_max;
+uint8_t Profiler::m_depth_history[PROFILER_QUEUE_HISTORY];
+uint32_t Profiler::m_depth_history_count;
+TickType_t Profiler::m_drained_tick;
+bool Profiler::m_drained;
+uint32_t Profiler::m_starvation_count;
+
+volatile uint32_t Profiler::m_window_seq;
+TimerHandle_t Profiler::m_window_timer;
+
+static const char * isr_names[PROFILER_ISR_COUNT] = { "STEP", "STEPCMD", "UNSTEP", "SERIAL", "SPINDLE", "SOFTIRQ" };
+
+void Profiler::Initialize()
+{
+    m_cycles_per_us = SystemCoreClock / 1000000;
+    
+    // Already running if the scheduler configured the run-time stats counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    
+    Reset();
+    
+    // Timer task priority: task list walk and stack checks never delay motion
+    m_window_timer = xTimerCreate(NULL, pdMS_TO_TICKS(PROFILER_WINDOW_MS), pdTRUE, NULL,
+                                  (TimerCallbackFunction_t)Profiler::window_timer_callback);
+    xTimerStart(m_window_timer, 0);
+}
+
+void Profiler::Reset()
+{
+    uint32_t index, basepri;
+    
+    basepri = mask_step_level();
+    
+    memset((void*)m_isr_stats, 0, sizeof(m_isr_stats));
+    
+    for (index = 0; index < PROFILER_ISR_COUNT; index++)
+    {
+        m_isr_stats[index].min_cycles = 0xFFFFFFFF;
+        m_isr_window_start_cycles[index] = 0;
+    }
+    
+    m_step_latency_min = 0xFFFFFFFF;
+    m_step_latency_max = 0;
+    memset(m_step_latency_histogram, 0, sizeof(m_step_latency_histogram));
+    
+    unmask_step_level(basepri);
+    
+    m_recalc_count = 0;
+    m_recalc_total_blocks = 0;
+    m_recalc_max_blocks = 0;
+    
+    m_starvation_count = 0;
+}
+
+// Parser task [Planner::recalculate]
+void Profiler::OnRecalculate(uint32_t blocks)
+{
+    m_recalc_count++;
+    m_recalc_total_blocks += blocks;
+    m_recalc_max_blocks = std::max(m_recalc_max_blocks, blocks);
+}
+
+// The queue ran dry and got new blocks shortly after: motion stopped between moves of the same stream
+void Profiler::SampleQueueDepth(uint32_t depth)
+{
+    TickType_t now = xTaskGetTickCount();
+    
+    vTaskSuspendAll();
+    
+    m_depth_sum += depth;
+    m_depth_samples++;
+    m_depth_min = std::min(m_depth_min, depth);
+    m_depth_max = std::max(m_depth_max, depth);
+    
+    xTaskResumeAll();
+    
+    if (depth == 0 && m_depth_last != 0)
+    {
+        m_drained = true;
+        m_drained_tick = now;
+    }
+    else if (depth != 0 && m_drained)
+    {
+        if (((now - m_drained_tick) * portTICK_PERIOD_MS) <= PROFILER_STARVATION_WINDOW_MS)
+            m_starvation_count++;
+        
+        m_drained = false;
+    }
+    
+    m_depth_last = depth;
+}
+
+bool Profiler::GetIsrStats(uint32_t isr_id, PROFILER_ISR_STATS& stats)
+{
+    uint32_t basepri;
+    
+    if (isr_id >= PROFILER_ISR_COUNT)
+        return false;
+    
+    basepri = mask_step_level();
+    memcpy((void*)&stats, (const void*)&m_isr_stats[isr_id], sizeof(stats));
+    unmask_step_level(basepri);
+    
+    return true;
+}
+
+const char * Profiler::GetIsrName(uint32_t isr_id)
+{
+    return (isr_id < PROFILER_ISR_COUNT) ? isr_names[isr_id] : "?";
+}
+
+uint32_t Profiler::GetQueueHistory(uint8_t * depths, uint32_t max_count)
+{
+    uint32_t count, first, index;
+    
+    vTaskSuspendAll();
+    
+    count = std::min(std::min(m_depth_history_count, (uint32_t)PROFILER_QUEUE_HISTORY), max_count);
+    first = m_depth_history_count - count;
+    
+    for (index = 0; index < count; index++)
+        depths[index] = m_depth_history[(first + index) % PROFILER_QUEUE_HISTORY];
+    
+    xTaskResumeAll();
+    
+    return count;
+}
+
+void Profiler::Report(PROFILER_WRITE_FUNC write, void * context)
+{
+    PROFILER_ISR_STATS stats;
+    uint32_t latency_min, latency_max, latency_histogram[PROFILER_HISTOGRAM_BUCKETS];
+    char line[96];
+    uint32_t index, bucket, stop_us, halt_us, basepri;
+    
+    write(context, "[TASKS] load% stack_free");
+    
+    for (index = 0; index < m_task_count; index++)
+    {
+        const PROFILER_TASK_LOAD& task = m_task_loads[index];
+        
+        snprintf(line, sizeof(line), "%-8s %3u.%u %5u", task.name, task.load_permille / 10, task.load_permille % 10, task.stack_free_words);
+        write(context, line);
+    }
+    
+    write(context, "[ISR] count min/avg/max us load% hist[<1,2,4,8,16,32,64,>]");
+    
+    for (index = 0; index < PROFILER_ISR_COUNT; index++)
+    {
+        GetIsrStats(index, stats);
+        
+        if (stats.count == 0)
+        {
+            snprintf(line, sizeof(line), "%-8s 0", isr_names[index]);
+            write(context, line);
+            continue;
+        }
+        
+        snprintf(line, sizeof(line), "%-8s %lu %.2f/%.2f/%.2f %u.%u", isr_names[index], (unsigned long)stats.count,
+                 (float)stats.min_cycles / m_cycles_per_us, (float)(stats.total_cycles / stats.count) / m_cycles_per_us,
+                 (float)stats.max_cycles / m_cycles_per_us, m_isr_load_permille[index] / 10, m_isr_load_permille[index] % 10);
+        write(context, line);
+        
+        strcpy(line, "  hist");
+        
+        for (bucket = 0; bucket < PROFILER_HISTOGRAM_BUCKETS; bucket++)
+            snprintf(line + strlen(line), sizeof(line) - strlen(line), " %lu", (unsigned long)stats.histogram[bucket]);
+        
+        write(context, line);
+    }
+    
+    // Jitter of the step pulses with respect to the timer period
+    basepri = mask_step_level();
+    latency_min = m_step_latency_min;
+    latency_max = m_step_latency_max;
+    memcpy(latency_histogram, m_step_latency_histogram, sizeof(latency_histogram));
+    unmask_step_level(basepri);
+    
+    if (latency_max >= latency_min)
+    {
+        snprintf(line, sizeof(line), "STEP latency %.2f..%.2f us, jitter %.2f us",
+                 (float)latency_min / PROFILER_STEP_TIMER_MHZ, (float)latency_max / PROFILER_STEP_TIMER_MHZ,
+                 (float)(latency_max - latency_min) / PROFILER_STEP_TIMER_MHZ);
+        write(context, line);
+        
+        strcpy(line, "  hist[<0.25,0.5,1,2,4,8,16,>]");
+        
+        for (bucket = 0; bucket < PROFILER_HISTOGRAM_BUCKETS; bucket++)
+            snprintf(line + strlen(line), sizeof(line) - strlen(line), " %lu", (unsigned long)latency_histogram[bucket]);
+        
+        write(context, line);
+    }
+    
+    snprintf(line, sizeof(line), "[PLANNER] recalcs %lu, blocks avg %.1f max %lu", (unsigned long)m_recalc_count,
+             (m_recalc_count != 0) ? (float)m_recalc_total_blocks / m_recalc_count : 0.0f, (unsigned long)m_recalc_max_blocks);
+    write(context, line);
+    
+    snprintf(line, sizeof(line), "[QUEUE] depth %lu/%lu, last window min %lu avg %u max %lu, starvations %lu",
+             (unsigned long)machine->GetQueuedBlocksCount(), (unsigned long)machine->GetQueueSize(),
+             (unsigned long)m_window_depth_min, (m_depth_history_count != 0) ? m_depth_history[(m_depth_history_count - 1) % PROFILER_QUEUE_HISTORY] : 0,
+             (unsigned long)m_window_depth_max, (unsigned long)m_starvation_count);
+    write(context, line);
+    
+    machine->GetAlarmReactionTimes_us(stop_us, halt_us);
+    
+    snprintf(line, sizeof(line), "[ALARM] last reaction: stop %lu us, halt %lu us", (unsigned long)stop_us, (unsigned long)halt_us);
+    write(context, line);
+}
+
+// Timer task context
+void Profiler::close_window()
+{
+    UBaseType_t count, index, prev;
+    uint32_t total_run_time, window_cycles, window_run_time, basepri;
+    uint64_t isr_cycles;
+    
+    // Tasks. Counters are DWT cycles, differences are right as long as the window is below 25 s
+    count = uxTaskGetSystemState(m_task_status, PROFILER_MAX_TASKS, &total_run_time);
+    window_run_time = total_run_time - m_prev_total_run_time;
+    
+    for (index = 0; index < count; index++)
+    {
+        TaskStatus_t& status = m_task_status[index];
+        uint32_t task_run_time = status.ulRunTimeCounter;
+        
+        // Counter at the start of the window, zero for tasks created since
+        for (prev = 0; prev < m_prev_count; prev++)
+        {
+            if (m_prev_handles[prev] == status.xHandle)
+            {
+                task_run_time -= m_prev_run_time[prev];
+                break;
+            }
+        }
+        
+        strncpy(m_task_loads[index].name, status.pcTaskName, configMAX_TASK_NAME_LEN - 1);
+        m_task_loads[index].name[configMAX_TASK_NAME_LEN - 1] = 0;
+        m_task_loads[index].load_permille = (window_run_time != 0) ? (uint16_t)(((uint64_t)task_run_time * 1000) / window_run_time) : 0;
+        m_task_loads[index].stack_free_words = (uint16_t)status.usStackHighWaterMark;
+    }
+    
+    for (index = 0; index < count; index++)
+    {
+        m_prev_handles[index] = m_task_status[index].xHandle;
+        m_prev_run_time[index] = m_task_status[index].ulRunTimeCounter;
+    }
+    
+    m_prev_count = count;
+    m_prev_total_run_time = total_run_time;
+    m_task_count = count;
+    
+    // ISRs [time spent also counted in the task they interrupted]
+    window_cycles = (PROFILER_WINDOW_MS * 1000) * m_cycles_per_us;
+    
+    for (index = 0; index < PROFILER_ISR_COUNT; index++)
+    {
+        basepri = mask_step_level();
+        isr_cycles = m_isr_stats[index].total_cycles;
+        unmask_step_level(basepri);
+        
+        // Reset in between: start over
+        if (isr_cycles < m_isr_window_start_cycles[index])
+            m_isr_window_start_cycles[index] = 0;
+        
+        m_isr_load_permille[index] = (uint16_t)std::min<uint64_t>(((isr_cycles - m_isr_window_start_cycles[index]) * 1000) / window_cycles, 1000);
+        m_isr_window_start_cycles[index] = isr_cycles;
+    }
+    
+    // Queue depth
+    vTaskSuspendAll();
+    
+    m_depth_history[m_depth_history_count % PROFILER_QUEUE_HISTORY] = (m_depth_samples != 0) ? (uint8_t)(m_depth_sum / m_depth_samples) : 0;
+    m_depth_history_count++;
+    
+    m_window_depth_min = (m_depth_samples != 0) ? m_depth_min : m_depth_last;
+    m_window_depth_max = (m_depth_samples != 0) ? m_depth_max : m_depth_last;
+    
+    m_depth_sum = 0;
+    m_depth_samples = 0;
+    m_depth_min = m_depth_last;
+    m_depth_max = m_depth_last;
+    
+    xTaskResumeAll();
+    
+    m_window_seq++;
+}
+
+void Profiler::window_timer_callback(TimerHandle_t xTimer)
+{
+    close_window();
+}
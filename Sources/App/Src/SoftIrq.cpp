@@ -0,0 +1,49 @@
+#include "SoftIrq.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "task_settings.h"
+#include "user_tasks.h"
+#include "MachineCore.h"
+#include "JobStats.h"
+#include "Profiler.h"
+
+volatile uint32_t SoftIrq::m_pending;
+volatile uint32_t SoftIrq::m_alarm_events;
+
+void SoftIrq::Initialize()
+{
+    m_pending = 0;
+    m_alarm_events = 0;
+    
+    HAL_NVIC_SetPriority(SOFT_IRQn, SOFT_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(SOFT_IRQn);
+}
+
+// Starvation start handled first: both may be pending when the queue ran dry for less than a tick
+void SoftIrq::Handler()
+{
+    uint32_t requests = take_bits(&m_pending);
+    
+    if ((requests & SOFT_IRQ_STARVATION_START) != 0)
+        JobStats::OnStarvationStart();
+    
+    if ((requests & SOFT_IRQ_STARVATION_END) != 0)
+        JobStats::OnStarvationEnd();
+    
+    if ((requests & SOFT_IRQ_ALARM) != 0)
+        machine->NotifyAlarmTaskFromISR(take_bits(&m_alarm_events));
+    
+    if ((requests & SOFT_IRQ_BLOCK_FINISHED) != 0)
+        machine->NotifyMotionServiceFromISR();
+}
+
+extern "C" void SOFT_IRQHandler(void)
+{
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
+    SoftIrq::Handler();
+    
+    Profiler::IsrExit(PROFILER_ISR_SOFT, start_cycles);
+}
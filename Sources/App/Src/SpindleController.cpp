@@ -1,13 +1,45 @@
 #include "SpindleController.h"
 
+#include <stm32f4xx_hal.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
 
 #include "settings_manager.h"
+#include "task_settings.h"
+#include "hw_timers.h"
+#include "uart_ports.h"
+#include "dma.h"
+#include "pins.h"
+#include "Profiler.h"
+
+SpindleController *SpindleController::instance;
 
 SpindleController::SpindleController()
 {
-    
+    instance = this;
+
+    m_mode = MODAL_SPINDLE_OFF;
+    m_programmed_rpm = 0;
+    m_override = 1.0f;
+    m_stop_request = false;
+    m_request_seq = 0;
+
+    m_applied_mode = MODAL_SPINDLE_OFF;
+    m_applied_rpm = 0;
+    m_change_time = 0;
+    m_applied_seq = 0;
+    m_feedback_seq = 0;
+
+    m_target_rpm = 0;
+    m_actual_rpm = 0;
+    m_output_current = 0;
+    m_at_speed = true;
+    m_link_ok = false;
+    m_link_errors = 0;
+
+    m_task = NULL;
+    m_frame_received = NULL;
 }
 
 
@@ -15,8 +47,392 @@ SpindleController::~SpindleController()
 {
 }
 
+void SpindleController::Start()
+{
+    // Output stopped before enabling the PWM channels
+    pwm12_timer_handle.Instance->CCR1 = 0;
+    pwm12_timer_handle.Instance->CCR2 = 0;
+
+    HAL_TIM_PWM_Start(&pwm12_timer_handle, TIM_CHANNEL_1);
+    HAL_TIM_PWM_Start(&pwm12_timer_handle, TIM_CHANNEL_2);
+
+    m_frame_received = xSemaphoreCreateBinary();
+
+    xTaskCreate(SpindleController::task_entry, "SPINDLE", SPINDLE_TASK_STACK_SIZE, (void*)this, SPINDLE_TASK_PRIORITY, &m_task);
+}
+
 bool SpindleController::InmediateStop()
 {
+    // PWM output is cut here, the VFD stop command is sent by the spindle task
+    pwm12_timer_handle.Instance->CCR1 = 0;
+
+    m_mode = MODAL_SPINDLE_OFF;
+    m_programmed_rpm = 0;
+    m_stop_request = true;
+    m_request_seq++;
+
+    if (m_task != NULL)
+        xTaskNotifyGive(m_task);
+
+    return true;
+}
+
+void SpindleController::SetSpeed(GCODE_MODAL_SPINDLE_MODES mode, float rpm)
+{
+    if (mode != MODAL_SPINDLE_CW && mode != MODAL_SPINDLE_CCW)
+    {
+        mode = MODAL_SPINDLE_OFF;
+        rpm = 0;
+    }
+
+    m_mode = mode;
+    m_programmed_rpm = rpm;
+    m_request_seq++;
+
+    if (m_task != NULL)
+        xTaskNotifyGive(m_task);
+}
+
+void SpindleController::SetOverride(float factor)
+{
+    if (factor == m_override)
+        return;
+
+    m_override = factor;
+    m_request_seq++;
+
+    if (m_task != NULL)
+        xTaskNotifyGive(m_task);
+}
+
+// Called from USART3 interrupt
+BaseType_t SpindleController::NotifyFrameReceived()
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    if (m_frame_received != NULL)
+        xSemaphoreGiveFromISR(m_frame_received, &xHigherPriorityTaskWoken);
+
+    return xHigherPriorityTaskWoken;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SpindleController::apply_request()
+{
+    float min_rpm, max_rpm;
+    uint8_t mode = m_mode;
+    float rpm = m_programmed_rpm * m_override;
+    bool force = m_stop_request;
+
+    m_applied_seq = m_request_seq;
+    m_stop_request = false;
+
+    Settings_Manager::GetSpindleSpeeds(min_rpm, max_rpm);
+
+    if (mode == MODAL_SPINDLE_OFF || rpm <= 0)
+    {
+        mode = MODAL_SPINDLE_OFF;
+        rpm = 0;
+    }
+    else if (rpm < min_rpm)
+        rpm = min_rpm;
+    else if (rpm > max_rpm)
+        rpm = max_rpm;
+
+    if (force == false && mode == m_applied_mode && rpm == m_applied_rpm)
+    {
+        // Nothing changed, but a new M3/M4 may be waiting for the at-speed condition
+        return;
+    }
+
+    m_target_rpm = rpm;
+    m_applied_mode = mode;
+    m_applied_rpm = rpm;
+    m_change_time = xTaskGetTickCount();
+
+    if (Settings_Manager::GetSpindleData().interface == SPINDLE_INTERFACE_MODBUS)
+    {
+        // Resent on next poll if the drive did not answer
+        if (send_vfd_command(mode, rpm) == false)
+            m_stop_request = true;
+    }
+    else if (Settings_Manager::GetSpindleData().laser_mode == 0)
+    {
+        set_pwm_output(mode, rpm);
+    }
+}
+
+void SpindleController::update_feedback()
+{
+    const SPINDLE_SETUP_DATA& setup = Settings_Manager::GetSpindleData();
+    bool at_speed;
+
+    if (setup.interface == SPINDLE_INTERFACE_MODBUS)
+    {
+        uint16_t freq;
+
+        if (modbus_read_register(VFD_REG_OUTPUT_FREQUENCY, freq))
+            m_actual_rpm = ((float)freq / 100.0f) * setup.rpm_per_hz;
+        
+        // Only needed as spindle load feedback
+        if (setup.rated_current_A > 0.0f)
+        {
+            uint16_t current;
+            
+            if (modbus_read_register(VFD_REG_OUTPUT_CURRENT, current))
+                m_output_current = (float)current / 10.0f;
+        }
+    }
+
+    // Laser power is set block by block from the step ticker, nothing to wait for
+    if (m_applied_mode == MODAL_SPINDLE_OFF || (setup.laser_mode != 0 && setup.interface != SPINDLE_INTERFACE_MODBUS))
+    {
+        at_speed = true;
+    }
+    else if (setup.interface == SPINDLE_INTERFACE_MODBUS)
+    {
+        float tolerance = m_target_rpm * (float)setup.at_speed_tolerance_pct / 100.0f;
+
+        at_speed = (m_link_ok && fabsf(m_actual_rpm - m_target_rpm) <= tolerance) ? true : false;
+    }
+    else if (setup.use_aux_at_speed_input != 0)
+    {
+        at_speed = ((SPIN_AUX_GPIO_Port->IDR & SPIN_AUX_Pin) != 0) ? true : false;
+    }
+    else
+    {
+        at_speed = ((xTaskGetTickCount() - m_change_time) >= pdMS_TO_TICKS(setup.spin_up_delay_ms)) ? true : false;
+    }
+
+    // Without feedback the PWM output reports the commanded speed
+    if (setup.interface != SPINDLE_INTERFACE_MODBUS)
+        m_actual_rpm = at_speed ? m_target_rpm : 0;
+
+    m_at_speed = at_speed;
+    m_feedback_seq = m_applied_seq;
+}
+
+// CH1: speed [min_rpm..max_rpm -> 0..100%], CH2: direction [low CW, high CCW]
+void SpindleController::set_pwm_output(uint8_t mode, float rpm)
+{
+    float min_rpm, max_rpm;
+    uint32_t duty = 0;
+
+    Settings_Manager::GetSpindleSpeeds(min_rpm, max_rpm);
+
+    if (mode != MODAL_SPINDLE_OFF)
+    {
+        if (max_rpm > min_rpm)
+            duty = (uint32_t)(((rpm - min_rpm) / (max_rpm - min_rpm)) * PWM12_TIMER_PERIOD);
+        else
+            duty = PWM12_TIMER_PERIOD;
+
+        // Minimum speed must still produce some output
+        if (duty == 0)
+            duty = 1;
+    }
+
+    if (duty > PWM12_TIMER_PERIOD)
+        duty = PWM12_TIMER_PERIOD;
+
+    if (mode == MODAL_SPINDLE_CCW)
+        pwm12_timer_handle.Instance->CCR2 = PWM12_TIMER_PERIOD + 1;     // Always high
+    else if (mode == MODAL_SPINDLE_CW)
+        pwm12_timer_handle.Instance->CCR2 = 0;
+
+    pwm12_timer_handle.Instance->CCR1 = duty;
+}
+
+bool SpindleController::send_vfd_command(uint8_t mode, float rpm)
+{
+    const SPINDLE_SETUP_DATA& setup = Settings_Manager::GetSpindleData();
+    uint16_t control;
+
+    if (mode == MODAL_SPINDLE_OFF)
+        return modbus_write_register(VFD_REG_CONTROL, VFD_CONTROL_STOP);
+
+    control = (mode == MODAL_SPINDLE_CCW) ? VFD_CONTROL_RUN_REV : VFD_CONTROL_RUN_FWD;
+
+    // Frequency first, so the drive never starts at the previous speed
+    if (modbus_write_register(VFD_REG_FREQUENCY_CMD, (uint16_t)((rpm / setup.rpm_per_hz) * 100.0f + 0.5f)) == false)
+        return false;
+
+    return modbus_write_register(VFD_REG_CONTROL, control);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool SpindleController::modbus_write_register(uint16_t reg, uint16_t value)
+{
+    uint16_t crc;
+
+    m_tx_frame[0] = Settings_Manager::GetSpindleData().modbus_address;
+    m_tx_frame[1] = MODBUS_FUNC_WRITE_SINGLE_REG;
+    m_tx_frame[2] = (uint8_t)(reg >> 8);
+    m_tx_frame[3] = (uint8_t)(reg);
+    m_tx_frame[4] = (uint8_t)(value >> 8);
+    m_tx_frame[5] = (uint8_t)(value);
+
+    crc = modbus_crc(m_tx_frame, 6);
+    m_tx_frame[6] = (uint8_t)(crc);
+    m_tx_frame[7] = (uint8_t)(crc >> 8);
+
+    // Response echoes the request
+    if (modbus_transaction(8, 8) != 8)
+        return false;
+
+    return (memcmp(m_rx_frame, m_tx_frame, 8) == 0) ? true : false;
+}
+
+bool SpindleController::modbus_read_register(uint16_t reg, uint16_t& value)
+{
+    uint16_t crc;
+
+    m_tx_frame[0] = Settings_Manager::GetSpindleData().modbus_address;
+    m_tx_frame[1] = MODBUS_FUNC_READ_HOLDING_REGS;
+    m_tx_frame[2] = (uint8_t)(reg >> 8);
+    m_tx_frame[3] = (uint8_t)(reg);
+    m_tx_frame[4] = 0;
+    m_tx_frame[5] = 1;      // Registers count
+
+    crc = modbus_crc(m_tx_frame, 6);
+    m_tx_frame[6] = (uint8_t)(crc);
+    m_tx_frame[7] = (uint8_t)(crc >> 8);
+
+    // Address, function, byte count, value [2], crc [2]
+    if (modbus_transaction(8, 7) != 7)
+        return false;
+
+    if (m_rx_frame[2] != 2)
+        return false;
+
+    value = ((uint16_t)m_rx_frame[3] << 8) | m_rx_frame[4];
     return true;
 }
 
+// Sends the request and waits for the response frame, whose end is detected by the
+// USART3 IDLE interrupt. Returns the received length when it is a valid response
+uint32_t SpindleController::modbus_transaction(uint32_t request_len, uint32_t response_len)
+{
+    uint32_t received;
+    uint16_t crc;
+    volatile uint32_t tmp;
+
+    vTaskDelay(pdMS_TO_TICKS(MODBUS_INTERFRAME_DELAY_MS));
+
+    // Leave both streams ready, drop any stale byte/error and semaphore give
+    CLEAR_BIT(USART3->CR3, USART_CR3_DMAR | USART_CR3_DMAT);
+    HAL_DMA_Abort(&hdma_spindle_uart_rx);
+    HAL_DMA_Abort(&hdma_spindle_uart_tx);
+
+    tmp = USART3->SR;
+    tmp = USART3->DR;
+    (void)tmp;
+
+    xSemaphoreTake(m_frame_received, 0);
+
+    // Response
+    HAL_DMA_Start(&hdma_spindle_uart_rx, (uint32_t)&USART3->DR, (uint32_t)m_rx_frame, MODBUS_MAX_FRAME_SIZE);
+    SET_BIT(USART3->CR3, USART_CR3_DMAR);
+    __HAL_UART_ENABLE_IT(&spindle_uart_handle, UART_IT_IDLE);
+
+    // Request
+    __HAL_UART_CLEAR_FLAG(&spindle_uart_handle, UART_FLAG_TC);
+    SET_BIT(USART3->CR3, USART_CR3_DMAT);
+    HAL_DMA_Start(&hdma_spindle_uart_tx, (uint32_t)m_tx_frame, (uint32_t)&USART3->DR, request_len);
+
+    if (xSemaphoreTake(m_frame_received, pdMS_TO_TICKS(MODBUS_RESPONSE_TIMEOUT_MS)) == pdFALSE)
+        received = 0;
+    else
+        received = MODBUS_MAX_FRAME_SIZE - __HAL_DMA_GET_COUNTER(&hdma_spindle_uart_rx);
+
+    __HAL_UART_DISABLE_IT(&spindle_uart_handle, UART_IT_IDLE);
+    CLEAR_BIT(USART3->CR3, USART_CR3_DMAR | USART_CR3_DMAT);
+
+    // Exception responses [function | 0x80] are 5 bytes long and fail the length check
+    if (received == response_len)
+    {
+        crc = modbus_crc(m_rx_frame, received - 2);
+
+        if (m_rx_frame[received - 2] != (uint8_t)(crc) || m_rx_frame[received - 1] != (uint8_t)(crc >> 8) ||
+            m_rx_frame[0] != m_tx_frame[0] || m_rx_frame[1] != m_tx_frame[1])
+        {
+            received = 0;
+        }
+    }
+    else
+    {
+        received = 0;
+    }
+
+    if (received != 0)
+    {
+        m_link_errors = 0;
+        m_link_ok = true;
+    }
+    else if (++m_link_errors >= MODBUS_MAX_LINK_ERRORS)
+    {
+        m_link_errors = MODBUS_MAX_LINK_ERRORS;
+        m_link_ok = false;
+    }
+
+    return received;
+}
+
+// CRC-16/MODBUS [poly 0xA001 reflected, init 0xFFFF]
+uint16_t SpindleController::modbus_crc(const uint8_t * data, uint32_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
+    {
+        crc ^= *data++;
+
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            if (crc & 0x0001)
+                crc = (crc >> 1) ^ 0xA001;
+            else
+                crc >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SpindleController::task_entry(void * pvParam)
+{
+    SpindleController* instance = (SpindleController*)pvParam;
+
+    for ( ; ; )
+    {
+        // Woken on every new command, polled otherwise
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SPINDLE_POLL_PERIOD_MS));
+
+        instance->apply_request();
+        instance->update_feedback();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+extern "C" void USART3_IRQHandler(void)
+{
+    uint32_t start_cycles = Profiler::IsrEnter();
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+    // End of the response frame
+    if (__HAL_UART_GET_FLAG(&spindle_uart_handle, UART_FLAG_IDLE))
+    {
+        __HAL_UART_CLEAR_IDLEFLAG(&spindle_uart_handle);
+
+        if (SpindleController::getInstance() != NULL)
+            xHigherPriorityTaskWoken = SpindleController::getInstance()->NotifyFrameReceived();
+    }
+
+    Profiler::IsrExit(PROFILER_ISR_SPINDLE_UART, start_cycles);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
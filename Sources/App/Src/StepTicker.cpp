@@ -3,16 +3,33 @@
 #include <stm32f4xx_hal.h>
 #include <math.h>
 
+#include <algorithm>
+
 #include "settings_manager.h"
 #include "hw_timers.h"
 #include "pins.h"
 
 #include "user_tasks.h"
 #include "MachineCore.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+
 
+// Control requests executed by the step ISR [pending_commands]
+#define STEP_COMMAND_FEED_HOLD      (1 << 0)
+#define STEP_COMMAND_RESUME         (1 << 1)
+#define STEP_COMMAND_CANCEL_HOLD    (1 << 2)
+#define STEP_COMMAND_ARM_PROBE      (1 << 3)
+#define STEP_COMMAND_ARM_HOMING     (1 << 4)
+#define STEP_COMMAND_SET_POSITION   (1 << 5)
+#define STEP_COMMAND_CLEAR_ESTOP    (1 << 6)
+#define STEP_COMMAND_RATE_CHANGE    (1 << 7)
 
 StepTicker *StepTicker::instance;
 
+// Limit switch of each linear axis [all of them in LIM_X_GPIO_Port]
+static const uint16_t limit_switch_pins[COORDINATE_LINEAR_AXES_COUNT] = { LIM_X_Pin, LIM_Y_Pin, LIM_Z_Pin };
+
 StepTicker::StepTicker()
 {
     uint8_t pulse_us;
@@ -33,8 +50,45 @@ StepTicker::StepTicker()
     this->running = false;
     this->current_block = NULL;    
     this->current_tick = 0;
+    this->primary_motor = 0;
+    
+    this->hold_state = FEED_HOLD_OFF;
+    this->hold_ramp_active = false;
+    this->hold_speed = 0.0f;
+    
+    this->probe_state = PROBE_OFF;
+    this->probe_trigger_level = 0;
+    memset((void*)this->probe_position_steps, 0, sizeof(this->probe_position_steps));
+    
+    this->emergency_stop = false;
+    
+    this->homing_armed_axes = 0;
+    this->homing_latched_axes = 0;
+    this->limit_invert_bits = 0;
+    memset((void*)this->homing_position_steps, 0, sizeof(this->homing_position_steps));
+    
+    this->rate_change_pending = false;
+    this->rate_change_block = NULL;
+    this->rate_change_request = 0.0f;
+    this->rate_change_phase = RATE_CHANGE_NONE;
+    this->rate_change_decel_step = 0;
+    
+    this->laser_mode = false;
+    this->laser_power = 0;
+    this->laser_power_per_rate = 0.0f;
+    this->laser_last_rate = 0;
     
     this->motor_enable_bits = 0;
+    memset((void*)this->current_position_steps, 0, sizeof(this->current_position_steps));
+    
+    this->pending_commands = 0;
+    this->request_probe_trigger_level = 0;
+    this->request_homing_axes = 0;
+    this->request_limit_invert_bits = 0;
+    memset(this->request_position_steps, 0, sizeof(this->request_position_steps));
+    this->request_rate_block = NULL;
+    this->request_rate = 0.0f;
+    
     this->inversion_mask_bits_steps = ((uint8_t)(Settings_Manager::GetSignalInversionMasks() & SIGNAL_INVERT_STEP_PINS_MASK));  
     this->inversion_mask_bits_dirs =  ((uint8_t)(Settings_Manager::GetSignalInversionMasks() & SIGNAL_INVERT_DIR_PINS_MASK));  
 }
@@ -122,6 +176,252 @@ void StepTicker::EnableStepperDrivers(bool enable)
     STEP_ENABLE_GPIO_Port->BSRR = bsrr_val;
 }
 
+// Copy of current position for every axis. Each value is read atomically, but axes may
+// belong to different ticks if called while moving (fine for display/reporting purposes)
+void StepTicker::GetCurrentPosition_steps(int32_t * position) const
+{
+    for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
+        position[motor_idx] = this->current_position_steps[motor_idx];
+}
+
+// Start a controlled stop. If nothing is being ticked the hold is immediate
+void StepTicker::RequestFeedHold()
+{
+    post_command(STEP_COMMAND_FEED_HOLD);
+}
+
+// Continue from the stop point. Held block must have been trimmed and replanned before
+void StepTicker::ResumeFromFeedHold()
+{
+    post_command(STEP_COMMAND_RESUME);
+}
+
+// Forget about the hold (halt/flush)
+void StepTicker::CancelFeedHold()
+{
+    post_command(STEP_COMMAND_CANCEL_HOLD);
+}
+
+// Start sampling the probe input. Motion stops when the probe touches (G38.2, G38.3) or when it loses
+// contact (G38.4, G38.5)
+void StepTicker::ArmProbe(bool stop_on_contact)
+{
+    bool pin_high_on_contact = ((Settings_Manager::GetSignalInversionMasks() & SIGNAL_INVERT_PROBE) == 0);
+    
+    this->request_probe_trigger_level = (stop_on_contact == pin_high_on_contact) ? PROBE_INPUT_Pin : 0;
+    post_command(STEP_COMMAND_ARM_PROBE);
+}
+
+void StepTicker::DisarmProbe()
+{
+    this->probe_state = PROBE_OFF;
+}
+
+bool StepTicker::IsProbeInContact() const
+{
+    bool pin_high = ((PROBE_INPUT_GPIO_Port->IDR & PROBE_INPUT_Pin) != 0);
+    bool inverted = ((Settings_Manager::GetSignalInversionMasks() & SIGNAL_INVERT_PROBE) != 0);
+    
+    return (pin_high != inverted);
+}
+
+// Machine position when the probe triggered, only valid if IsProbeTriggered()
+void StepTicker::GetProbePosition_steps(int32_t * position) const
+{
+    for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
+        position[motor_idx] = this->probe_position_steps[motor_idx];
+}
+
+// Start sampling the limit switches of the given axes on every tick
+void StepTicker::ArmHomingSwitches(uint8_t axes_mask)
+{
+    uint16_t invert_mask = Settings_Manager::GetSignalInversionMasks();
+    uint32_t invert_bits = 0;
+    
+    for (uint8_t axis = 0; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+    {
+        if ((invert_mask & (SIGNAL_INVERT_LIM_X << axis)) != 0)
+            invert_bits |= limit_switch_pins[axis];
+    }
+    
+    this->request_limit_invert_bits = invert_bits;
+    this->request_homing_axes = axes_mask;
+    post_command(STEP_COMMAND_ARM_HOMING);
+}
+
+uint8_t StepTicker::DisarmHomingSwitches()
+{
+    this->homing_armed_axes = 0;
+    return this->homing_latched_axes;
+}
+
+uint8_t StepTicker::GetActiveLimitSwitches() const
+{
+    uint16_t invert_mask = Settings_Manager::GetSignalInversionMasks();
+    uint32_t idr = LIM_X_GPIO_Port->IDR;
+    uint8_t active = 0;
+    
+    for (uint8_t axis = 0; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+    {
+        bool pin_high = ((idr & limit_switch_pins[axis]) != 0);
+        bool inverted = ((invert_mask & (SIGNAL_INVERT_LIM_X << axis)) != 0);
+        
+        if (pin_high != inverted)
+            active |= (1 << axis);
+    }
+    
+    return active;
+}
+
+// Machine position of each axis when its switch was latched, only valid for latched axes
+void StepTicker::GetHomingPosition_steps(int32_t * position) const
+{
+    for (uint8_t axis = 0; axis < COORDINATE_LINEAR_AXES_COUNT; axis++) 
+        position[axis] = this->homing_position_steps[axis];
+}
+
+void StepTicker::SetCurrentPosition_steps(const int32_t * position)
+{
+    memcpy(this->request_position_steps, position, sizeof(this->request_position_steps));
+    post_command(STEP_COMMAND_SET_POSITION);
+}
+
+// Stop issuing steps right now, without deceleration. Called from the EXTI handler, which has the same
+// priority as the step timer: it cannot run in the middle of a tick and no other tick runs after it
+void StepTicker::EmergencyStop()
+{
+    __HAL_TIM_DISABLE(&step_timer_handle);
+    
+    this->emergency_stop = true;
+    this->motor_enable_bits = 0;
+}
+
+// The block being ticked was discarded with the rest of the queue. Start clean on the next block
+void StepTicker::ClearEmergencyStop()
+{
+    post_command(STEP_COMMAND_CLEAR_ESTOP);
+}
+
+// Only while no block is being ticked. Spindle PWM output belongs to the step ticker from now on
+void StepTicker::SetLaserMode(bool enable)
+{
+    this->laser_mode = enable;
+    
+    if (enable)
+        pwm12_timer_handle.Instance->CCR1 = 0;
+}
+
+// The new rate is taken by the ISR on next tick, only if the block is still being ticked
+void StepTicker::RequestRateChange(const Block* block, float rate)
+{
+    this->request_rate_block = block;
+    this->request_rate = rate;
+    post_command(STEP_COMMAND_RATE_CHANGE);
+}
+
+// Arguments are written before, and only read by the ISR run pended here: no lock needed. The exclusive
+// access OR keeps the requests of a caller preempted by another one
+void StepTicker::post_command(uint32_t command)
+{
+    uint32_t commands;
+    
+    do
+    {
+        commands = __LDREXW(&this->pending_commands);
+    }
+    while (__STREXW(commands | command, &this->pending_commands) != 0);
+    
+    NVIC_SetPendingIRQ(TIM2_IRQn);
+    __DSB();
+    __ISB();
+}
+
+// Step ISR, never in the middle of a tick
+void StepTicker::run_commands()
+{
+    uint32_t commands;
+    
+    if (this->pending_commands == 0)
+        return;
+    
+    do
+    {
+        commands = __LDREXW(&this->pending_commands);
+    }
+    while (__STREXW(0, &this->pending_commands) != 0);
+    
+    if ((commands & STEP_COMMAND_CLEAR_ESTOP) != 0)
+    {
+        this->running = false;
+        this->current_block = NULL;
+        this->current_tick = 0;
+        
+        this->hold_state = FEED_HOLD_OFF;
+        this->hold_ramp_active = false;
+        this->rate_change_pending = false;
+        this->rate_change_phase = RATE_CHANGE_NONE;
+        this->probe_state = PROBE_OFF;
+        this->homing_armed_axes = 0;
+        
+        this->emergency_stop = false;
+    }
+    
+    if ((commands & STEP_COMMAND_SET_POSITION) != 0)
+    {
+        for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
+            this->current_position_steps[motor_idx] = this->request_position_steps[motor_idx];
+    }
+    
+    if ((commands & STEP_COMMAND_FEED_HOLD) != 0 && this->hold_state == FEED_HOLD_OFF)
+    {
+        this->hold_ramp_active = false;
+        this->hold_speed = 0.0f;
+        this->hold_state = (this->running) ? FEED_HOLD_DECELERATING : FEED_HOLD_STOPPED;
+    }
+    
+    if ((commands & STEP_COMMAND_RESUME) != 0 && this->hold_state == FEED_HOLD_STOPPED)
+    {
+        this->hold_state = FEED_HOLD_OFF;
+        this->current_block = NULL;
+        this->current_tick = 0;
+        this->running = false;
+        
+        // Fetch the held block again on next tick
+        __HAL_TIM_ENABLE(&step_timer_handle);
+    }
+    
+    if ((commands & STEP_COMMAND_CANCEL_HOLD) != 0 && this->hold_state != FEED_HOLD_OFF)
+    {
+        this->hold_state = FEED_HOLD_OFF;
+        this->hold_ramp_active = false;
+        this->current_block = NULL;
+        this->running = false;
+        
+        // Let the ISR process the queue flush
+        __HAL_TIM_ENABLE(&step_timer_handle);
+    }
+    
+    if ((commands & STEP_COMMAND_ARM_PROBE) != 0)
+    {
+        this->probe_trigger_level = this->request_probe_trigger_level;
+        this->probe_state = PROBE_ARMED;
+    }
+    
+    if ((commands & STEP_COMMAND_ARM_HOMING) != 0)
+    {
+        this->limit_invert_bits = this->request_limit_invert_bits;
+        this->homing_latched_axes = 0;
+        this->homing_armed_axes = this->request_homing_axes;
+    }
+    
+    if ((commands & STEP_COMMAND_RATE_CHANGE) != 0)
+    {
+        this->rate_change_block = this->request_rate_block;
+        this->rate_change_request = this->request_rate;
+        this->rate_change_pending = true;
+    }
+}
+
 // Set the base stepping frequency
 void StepTicker::set_frequency( float frequency )
 {
@@ -173,14 +473,134 @@ void StepTicker::unstep_tick()
     this->unstep_bits = 0;
 }
 
+// Only called from the step tick ISR, once per driven motor [ForEachMotionAxis]. If it is active
+// see if it is time to issue a step to it
+template<uint8_t MOTOR>
+inline void StepTicker::tick_motor(TickMotors& tick)
+{
+    tickinfo_t * ti = &current_block->tick_info[MOTOR];
+    
+    if (ti->steps_to_move == 0) 
+        return; // not active
+    
+    ti->steps_per_tick += ti->acceleration_change;
+    
+    if (rate_change_phase != RATE_CHANGE_NONE)
+        limit_rate_change(MOTOR);
+    
+    // Speed curve state management [Acceleration, Plateau, Deceleration]
+    if (current_tick == ti->next_accel_event) 
+    {
+        if (current_tick == current_block->accelerate_until) 
+        {
+            // We are done accelerating, acceleration becomes 0 : plateau
+            ti->acceleration_change = 0;
+            
+            if (current_block->decelerate_after < current_block->total_move_ticks)
+            {
+                ti->next_accel_event = current_block->decelerate_after;
+                
+                if (current_tick != current_block->decelerate_after) 
+                { 
+                    // We are plateauing
+                    // steps/sec / tick frequency to get steps per tick
+                    ti->steps_per_tick = ti->plateau_rate;
+                }
+            }
+        }
+        
+        if (current_tick == current_block->decelerate_after) 
+        {
+            // We start decelerating
+            ti->acceleration_change = ti->deceleration_change;
+        }
+    }
+    
+    // protect against rounding errors and such
+    if (ti->steps_per_tick <= 0)
+    {
+        if (hold_state == FEED_HOLD_DECELERATING)
+        {
+            // Rate reached zero: the hold is complete, do not force the pending step
+            ti->steps_per_tick = 0;
+            ti->acceleration_change = 0;
+            tick.hold_reached_zero = true;
+            return;
+        }
+        
+        ti->counter = STEPTICKER_FPSCALE; // we force completion of this step by setting to 1.0
+        ti->steps_per_tick = 0;
+    }
+    
+    ti->counter += ti->steps_per_tick;
+    
+    if (ti->counter >= STEPTICKER_FPSCALE) 
+    {
+        // >= 1.0 step time
+        ti->counter -= STEPTICKER_FPSCALE; // -= 1.0F;
+        ++ti->step_count;
+        
+        
+        bool ismoving = false;
+        
+        // Check if current motor is allowed to move
+        if (((1 << MOTOR) & this->motor_enable_bits) != 0)
+        {
+            tick.step_bits |= MotionAxis<MOTOR>::STEP_PIN;
+            ismoving = true;
+            
+            if ((current_block->direction_bits & (1 << MOTOR)) != 0)
+                this->current_position_steps[MOTOR]--;
+            else
+                this->current_position_steps[MOTOR]++;
+        }
+        
+        if (!ismoving || ti->step_count == ti->steps_to_move) 
+        {
+            // done
+            ti->steps_to_move = 0;
+            this->motor_enable_bits &= ~(1 << MOTOR); // let motor know it is no longer moving
+        }
+    }
+    
+    // see if any motors are still moving after this tick
+    if (((1 << MOTOR) & this->motor_enable_bits) != 0)
+        tick.still_moving = true;
+}
+
 // step clock
 void StepTicker::step_tick (void)
 {
-    uint8_t execute_this_steps = 0;
+    TickMotors tick;
+    
+    // Stopped by a limit switch/driver fault. The timer may be enabled again by the conveyor
+    if (emergency_stop)
+    {
+        __HAL_TIM_DISABLE(&step_timer_handle);
+        laser_off();
+        return;
+    }
+    
+    // Stopped by feed hold: held block stays untouched until resumed
+    if (hold_state == FEED_HOLD_STOPPED)
+    {
+        __HAL_TIM_DISABLE(&step_timer_handle);
+        laser_off();
+        return;
+    }
     
     // if nothing has been setup we ignore the ticks
     if (!running)
     {
+        // Feed hold with no block in progress: already at rest
+        if (hold_state == FEED_HOLD_DECELERATING)
+        {
+            hold_state = FEED_HOLD_STOPPED;
+            __HAL_TIM_DISABLE(&step_timer_handle);
+            laser_off();
+            return;
+        }
+        
         // check if anything new available
         if(m_conveyor->get_next_block(&current_block)) 
         {
@@ -190,6 +610,7 @@ void StepTicker::step_tick (void)
             if (!running) 
             {
                 __HAL_TIM_DISABLE(&step_timer_handle);
+                laser_off();
                 
                 // Turn Off Activity LED [Write 1]
                 HAL_GPIO_WritePin(LED_0_GPIO_Port, LED_0_Pin, GPIO_PIN_SET);
@@ -199,6 +620,7 @@ void StepTicker::step_tick (void)
         else
         {
             __HAL_TIM_DISABLE(&step_timer_handle);
+            laser_off();
             
             // Turn Off Activity LED [Write 1]
             HAL_GPIO_WritePin(LED_0_GPIO_Port, LED_0_Pin, GPIO_PIN_SET);
@@ -208,103 +630,70 @@ void StepTicker::step_tick (void)
 
     if (machine->IsHalted())
     {
+        laser_off();
         running = false;
         current_tick = 0;
         current_block = NULL;
         return;
     }
-
-    bool still_moving = false;
     
-    // foreach motor, if it is active see if time to issue a step to that motor
-    for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
+    tick.ticker = this;
+    tick.step_bits = 0;
+    tick.still_moving = false;
+    tick.hold_reached_zero = false;
+    
+    // Probe input is sampled before issuing the steps of this tick, so the latched position is the
+    // one where the contact was seen (one tick of latency at most). Then brake as in a feed hold
+    if (probe_state == PROBE_ARMED && (PROBE_INPUT_GPIO_Port->IDR & PROBE_INPUT_Pin) == probe_trigger_level)
     {
-        if (current_block->tick_info[motor_idx].steps_to_move == 0) 
-            continue; // not active
-
-        current_block->tick_info[motor_idx].steps_per_tick += current_block->tick_info[motor_idx].acceleration_change;
-
-        // Speed curve state management [Acceleration, Plateau, Deceleration]
-        if (current_tick == current_block->tick_info[motor_idx].next_accel_event) 
-        {
-            if (current_tick == current_block->accelerate_until) 
-            {
-                // We are done accelerating, acceleration becomes 0 : plateau
-                current_block->tick_info[motor_idx].acceleration_change = 0;
-                
-                if (current_block->decelerate_after < current_block->total_move_ticks)
-                {
-                    current_block->tick_info[motor_idx].next_accel_event = current_block->decelerate_after;
-                    
-                    if (current_tick != current_block->decelerate_after) 
-                    { 
-                        // We are plateauing
-                        // steps/sec / tick frequency to get steps per tick
-                        current_block->tick_info[motor_idx].steps_per_tick = current_block->tick_info[motor_idx].plateau_rate;
-                    }
-                }
-            }
-
-            if (current_tick == current_block->decelerate_after) 
-            {
-                // We start decelerating
-                current_block->tick_info[motor_idx].acceleration_change = current_block->tick_info[motor_idx].deceleration_change;
-            }
-        }
-
-        // protect against rounding errors and such
-        if (current_block->tick_info[motor_idx].steps_per_tick <= 0)
-        {
-            current_block->tick_info[motor_idx].counter = STEPTICKER_FPSCALE; // we force completion of this step by setting to 1.0
-            current_block->tick_info[motor_idx].steps_per_tick = 0;
-        }
-
-        current_block->tick_info[motor_idx].counter += current_block->tick_info[motor_idx].steps_per_tick;
-
-        if (current_block->tick_info[motor_idx].counter >= STEPTICKER_FPSCALE) 
+        for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
+            probe_position_steps[motor_idx] = current_position_steps[motor_idx];
+        
+        probe_state = PROBE_TRIGGERED;
+        
+        if (hold_state == FEED_HOLD_OFF)
         {
-            // >= 1.0 step time
-            current_block->tick_info[motor_idx].counter -= STEPTICKER_FPSCALE; // -= 1.0F;
-            ++current_block->tick_info[motor_idx].step_count;
-
-            
-            bool ismoving = false;
-            
-            // Check if current motor is allowed to move
-            if (((1 << motor_idx) & this->motor_enable_bits) != 0)
-            {
-                execute_this_steps |= (1 << (4 - (motor_idx * 2)));     // Swap/Move bits ZYX -> 0X0Y0Z
-                ismoving = true;
-            }
-
-            if (!ismoving || current_block->tick_info[motor_idx].step_count == current_block->tick_info[motor_idx].steps_to_move) 
-            {
-                // done
-                current_block->tick_info[motor_idx].steps_to_move = 0;
-                this->motor_enable_bits &= ~(1 << motor_idx); // let motor know it is no longer moving
-            }
+            hold_ramp_active = false;
+            hold_speed = 0.0f;
+            hold_state = FEED_HOLD_DECELERATING;
         }
-
-        // see if any motors are still moving after this tick
-        if (((1 << motor_idx) & this->motor_enable_bits) != 0)
-            still_moving = true;
-    }   // end for    
+    }
+    
+    if (homing_armed_axes != 0)
+        latch_homing_switches();
+    
+    // Feed hold requested while ticking this block: switch to deceleration from current rate
+    if (hold_state == FEED_HOLD_DECELERATING && !hold_ramp_active)
+        start_hold_deceleration();
+    
+    // Override changed while ticking this block. Ignored once braking to the exit speed has started
+    if (rate_change_pending)
+    {
+        rate_change_pending = false;
+        
+        if (hold_state == FEED_HOLD_OFF && rate_change_block == current_block && rate_change_phase != RATE_CHANGE_DECEL &&
+            (rate_change_phase != RATE_CHANGE_NONE || current_tick < current_block->decelerate_after))
+            start_rate_change();
+    }
+    
+    // foreach motor, if it is active see if time to issue a step to that motor
+    ForEachMotionAxis(tick);
     
-    if (execute_this_steps != 0)
+    if (tick.step_bits != 0)
     {
         uint32_t bits_to_update_bsrr;
         uint32_t mask32;
         uint32_t move32;
         
         // Update which bits need to be restored
-        this->unstep_bits = execute_this_steps;
-                
+        this->unstep_bits = tick.step_bits;
+        
         // Generate mask
         mask32 = ((this->inversion_mask_bits_steps ^ SIGNAL_INVERT_STEP_PINS_MASK));  // Invert polarity selection bits
         mask32 |= ((uint32_t)(this->inversion_mask_bits_steps << 16));
         
         // Generate move bits
-        move32 = ((uint32_t)(execute_this_steps << 16)) | (execute_this_steps);
+        move32 = ((uint32_t)(tick.step_bits << 16)) | (tick.step_bits);
         
         // Finally combine desired bits to change with polarity selection mask
         bits_to_update_bsrr = mask32 & move32;
@@ -314,17 +703,51 @@ void StepTicker::step_tick (void)
         // If activated any step signal then start unstep timer
         __HAL_TIM_ENABLE(&unstep_timer_handle);
     }
+    
+    // After the step pulses, so they are not delayed by the power calculation
+    if (laser_mode)
+        update_laser_power();
 
     // do this after so we start at tick 0
     current_tick++; // count number of ticks
+    
+    // Overridden rate: brake in time to leave the block at its planned exit speed
+    if ((rate_change_phase == RATE_CHANGE_RAMP || rate_change_phase == RATE_CHANGE_CRUISE) && 
+        current_block->tick_info[primary_motor].step_count >= rate_change_decel_step)
+    {
+        for (uint8_t motor_idx = 0; motor_idx < MOTION_AXES_COUNT; motor_idx++) 
+            current_block->tick_info[motor_idx].acceleration_change = current_block->tick_info[motor_idx].hold_deceleration_change;
+        
+        rate_change_phase = RATE_CHANGE_DECEL;
+    }
+
+    if (tick.hold_reached_zero)
+    {
+        // Stopped inside the block. It is trimmed and replanned from rest in task context
+        hold_state = FEED_HOLD_STOPPED;
+        running = false;
+        this->motor_enable_bits = 0;
+        
+        __HAL_TIM_DISABLE(&step_timer_handle);
+        laser_off();
+        
+        // Turn Off Activity LED [Write 1]
+        HAL_GPIO_WritePin(LED_0_GPIO_Port, LED_0_Pin, GPIO_PIN_SET);
+        return;
+    }
 
     // see if any motors are still moving
-    if(!still_moving) 
+    if(!tick.still_moving) 
     {
         //SET_STEPTICKER_DEBUG_PIN(0);
 
         // all moves finished
         current_tick = 0;
+        
+        // Block finished while braking for a feed hold. Keep the speed reached for the next one [mm/tick]
+        if (hold_state == FEED_HOLD_DECELERATING)
+            hold_speed = STEPTICKER_FROMFP(current_block->tick_info[primary_motor].steps_per_tick) * 
+                         (current_block->millimeters / current_block->steps[primary_motor]);
 
         // get next block
         // do it here so there is no delay in ticks
@@ -334,50 +757,87 @@ void StepTicker::step_tick (void)
         { 
             // returns false if no new block is available
             running = start_next_block(); // returns true if there is at least one motor with steps to issue
+            
+            if (running && hold_state == FEED_HOLD_DECELERATING)
+                continue_hold_deceleration();
         }
         else
         {
             current_block = NULL;
             running = false;
+            laser_off();
         }
     }
 }
 
+// Only called from the step tick ISR, once per driven motor [ForEachMotionAxis]. Prepare it if active
+template<uint8_t MOTOR>
+inline void StepTicker::start_motor(StartMotors& start)
+{
+    if (current_block->tick_info[MOTOR].steps_to_move == 0)
+        return;
+    
+    start.any_moving = true; // mark at least one motor is moving
+    
+    // Axes without a motor may have more steps: the first driven motor with the most steps leads
+    if (current_block->steps[MOTOR] > start.primary_steps)
+    {
+        start.primary_steps = current_block->steps[MOTOR];
+        primary_motor = MOTOR;
+    }
+    
+    // Only set direction bits for backward movements 
+    if ((current_block->direction_bits & (1 << MOTOR)) != 0)
+        start.direction_bits |= MotionAxis<MOTOR>::DIR_PIN;
+    
+    this->motor_enable_bits |= (1 << MOTOR);
+}
+
 // only called from the step tick ISR (single consumer)
 bool StepTicker::start_next_block()
 {
-    bool ok = false;
-    uint8_t direction_bits_value;
+    StartMotors start;
     uint8_t mask;
     uint32_t bits_to_update_bsrr;
+    float primary_nominal_rate;
     
     if (current_block == NULL) 
         return false;    
     
-    direction_bits_value = 0;
+    start.ticker = this;
+    start.direction_bits = 0;
+    start.primary_steps = 0;
+    start.any_moving = false;
     
     // need to prepare each active motor
-    for (uint8_t motor_idx = 0; motor_idx < TOTAL_AXES_COUNT; motor_idx++) 
-    {
-        if (current_block->tick_info[motor_idx].steps_to_move == 0)
-            continue;
-
-        ok = true; // mark at least one motor is moving
-        
-        // Only set direction bits for backward movements 
-        if ((current_block->direction_bits & (1 << motor_idx)) != 0)
-            direction_bits_value |= (1 << (5 - (motor_idx * 2)));
-        
-        this->motor_enable_bits |= (1 << motor_idx);
-    }
+    ForEachMotionAxis(start);
     
     // Generate mask
-    mask = this->inversion_mask_bits_dirs ^ direction_bits_value;
+    mask = this->inversion_mask_bits_dirs ^ start.direction_bits;
     bits_to_update_bsrr = ((mask ^ SIGNAL_INVERT_DIR_PINS_MASK) << 16) | (mask);
     
     current_tick = 0;
-
-    if (ok == true) 
+    rate_change_phase = RATE_CHANGE_NONE;
+    
+    // Coolant/aux outputs programmed before this move [M7, M8, M9, M62, M63]
+    if (current_block->output_mask != 0)
+        CoolantController::getInstance()->ApplyOutputs(current_block->output_mask, current_block->output_values);
+    
+    // Power at nominal rate [s_value is 1.11 fixed point]. Updated on first tick
+    if (laser_mode)
+    {
+        laser_power = ((uint32_t)current_block->s_value * PWM12_TIMER_PERIOD) >> 11;
+        
+        if (laser_power > PWM12_TIMER_PERIOD)
+            laser_power = PWM12_TIMER_PERIOD;
+        
+        // nominal_rate is for the steps_event_count axis, the power follows the rate of the primary motor
+        primary_nominal_rate = current_block->nominal_rate * current_block->steps[primary_motor] / current_block->steps_event_count;
+        laser_power_per_rate = (primary_nominal_rate > 0.0f) ? (laser_power / primary_nominal_rate) : 0.0f;
+        laser_last_rate = -1;
+    }
+    
+    if (start.any_moving == true) 
     {   
         STEP_PINS_GPIO_PORT->BSRR = bits_to_update_bsrr;
         return true;
@@ -393,16 +853,201 @@ bool StepTicker::start_next_block()
 }
 
 
+// Only called from the step tick ISR. Replace the trapezoid of the current block by a deceleration
+// at block acceleration, starting from the current rate. Runs once per block, a few operations per motor
+void StepTicker::start_hold_deceleration()
+{
+    for (uint8_t motor_idx = 0; motor_idx < MOTION_AXES_COUNT; motor_idx++) 
+    {
+        if (current_block->tick_info[motor_idx].steps_to_move == 0)
+            continue;
+        
+        current_block->tick_info[motor_idx].acceleration_change = current_block->tick_info[motor_idx].hold_deceleration_change;
+        current_block->tick_info[motor_idx].next_accel_event = 0xFFFFFFFF;     // No more trapezoid events
+    }
+    
+    hold_ramp_active = true;
+    rate_change_phase = RATE_CHANGE_NONE;
+}
+
+// Only called from the step tick ISR. Block started during a feed hold: enter it at the speed
+// reached by the previous one instead of its planned entry speed, and keep braking
+void StepTicker::continue_hold_deceleration()
+{
+    float steps_per_mm;
+    
+    for (uint8_t motor_idx = 0; motor_idx < MOTION_AXES_COUNT; motor_idx++) 
+    {
+        if (current_block->tick_info[motor_idx].steps_to_move == 0)
+            continue;
+        
+        steps_per_mm = current_block->steps[motor_idx] / current_block->millimeters;
+        current_block->tick_info[motor_idx].steps_per_tick = (int64_t)(hold_speed * steps_per_mm * (float)STEPTICKER_FPSCALE);
+    }
+    
+    start_hold_deceleration();
+}
+
+// Only called from the step tick ISR. Switches are sampled before issuing the steps of this tick. The
+// motor of a latched axis is masked at once: its remaining steps in the block are dropped on its next
+// step event, and the block finishes when every moving axis is done or latched
+inline void StepTicker::latch_homing_switches()
+{
+    uint32_t active_bits = LIM_X_GPIO_Port->IDR ^ limit_invert_bits;
+    
+    for (uint8_t axis = 0; axis < COORDINATE_LINEAR_AXES_COUNT; axis++)
+    {
+        if ((homing_armed_axes & (1 << axis)) == 0 || (active_bits & limit_switch_pins[axis]) == 0)
+            continue;
+        
+        homing_position_steps[axis] = current_position_steps[axis];
+        
+        homing_armed_axes &= ~(1 << axis);
+        homing_latched_axes |= (1 << axis);
+        this->motor_enable_bits &= ~(1 << axis);
+    }
+}
+
+// Only called from the step tick ISR. Replace the rest of the trapezoid of the current block by a ramp
+// at block acceleration from the current rate to the requested one, then a deceleration to the planned
+// exit rate. The requested rate is lowered if the remaining steps are not enough to reach it. Rates are
+// those of the primary motor: it is not the steps_event_count axis when an axis without a motor has more steps
+void StepTicker::start_rate_change()
+{
+    tickinfo_t * primary = &current_block->tick_info[primary_motor];
+    float primary_steps = (float)current_block->steps[primary_motor];
+    
+    if (primary->steps_to_move == 0)
+        return;
+    
+    float steps_per_mm = primary_steps / current_block->millimeters;
+    float accel = current_block->acceleration * steps_per_mm;                   // steps/sec^2
+    float rate = STEPTICKER_FROMFP(primary->steps_per_tick) * this->frequency;  // steps/sec
+    float remaining = (float)(primary->steps_to_move - primary->step_count);
+    
+    // Never crawl to a full stop inside the block when it is the last one
+    float exit_rate = std::max(current_block->exit_speed * steps_per_mm, sqrtf(2.0f * accel));
+    
+    float request = this->rate_change_request * primary_steps / current_block->steps_event_count;
+    float target = std::min(request, sqrtf(accel * remaining + ((rate * rate) + (exit_rate * exit_rate)) / 2.0f));
+    target = std::max(target, exit_rate);
+    
+    float decel_steps = ((target * target) - (exit_rate * exit_rate)) / (2.0f * accel);
+    
+    this->rate_change_decel_step = (decel_steps < remaining) ? (primary->steps_to_move - (uint32_t)decel_steps) : primary->step_count;
+    
+    for (uint8_t motor_idx = 0; motor_idx < MOTION_AXES_COUNT; motor_idx++) 
+    {
+        tickinfo_t * ti = &current_block->tick_info[motor_idx];
+        
+        if (ti->steps_to_move == 0)
+            continue;
+        
+        float aratio = (float)current_block->steps[motor_idx] / primary_steps;
+        
+        this->rate_change_target[motor_idx] = (int64_t)(((target * aratio) / this->frequency) * (float)STEPTICKER_FPSCALE);
+        this->rate_change_exit[motor_idx] = (int64_t)(((exit_rate * aratio) / this->frequency) * (float)STEPTICKER_FPSCALE);
+        
+        // hold_deceleration_change is the (negative) block acceleration
+        if (ti->steps_per_tick < this->rate_change_target[motor_idx])
+            ti->acceleration_change = -ti->hold_deceleration_change;
+        else
+            ti->acceleration_change = ti->hold_deceleration_change;
+        
+        ti->next_accel_event = 0xFFFFFFFF;     // No more trapezoid events
+    }
+    
+    this->rate_change_phase = RATE_CHANGE_RAMP;
+}
+
+// Only called from the step tick ISR. Stop the ramp of one motor once its target rate is reached
+inline void StepTicker::limit_rate_change(uint8_t motor_idx)
+{
+    tickinfo_t * ti = &current_block->tick_info[motor_idx];
+    
+    if (this->rate_change_phase == RATE_CHANGE_DECEL)
+    {
+        if (ti->steps_per_tick <= this->rate_change_exit[motor_idx])
+        {
+            ti->steps_per_tick = this->rate_change_exit[motor_idx];
+            ti->acceleration_change = 0;
+        }
+    }
+    else if (ti->acceleration_change != 0)
+    {
+        if ((ti->acceleration_change > 0 && ti->steps_per_tick >= this->rate_change_target[motor_idx]) ||
+            (ti->acceleration_change < 0 && ti->steps_per_tick <= this->rate_change_target[motor_idx]))
+        {
+            ti->steps_per_tick = this->rate_change_target[motor_idx];
+            ti->acceleration_change = 0;
+            
+            if (motor_idx == this->primary_motor)
+                this->rate_change_phase = RATE_CHANGE_CRUISE;
+        }
+    }
+}
+
+// Only called from the step tick ISR. Recalculated only when the rate of the primary axis changed
+// (acceleration, deceleration, overrides and feed hold), never above the programmed power
+inline void StepTicker::update_laser_power()
+{
+    uint32_t duty;
+    
+    if (current_block == NULL || current_block->tick_info[primary_motor].steps_per_tick == laser_last_rate)
+        return;
+    
+    laser_last_rate = current_block->tick_info[primary_motor].steps_per_tick;
+    
+    duty = (uint32_t)(current_block->get_trapezoid_rate(primary_motor) * laser_power_per_rate);
+    
+    if (duty > laser_power)
+        duty = laser_power;
+    
+    pwm12_timer_handle.Instance->CCR1 = duty;
+}
+
+inline void StepTicker::laser_off()
+{
+    if (laser_mode)
+        pwm12_timer_handle.Instance->CCR1 = 0;
+}
+
 extern "C" void TIM6_DAC_IRQHandler(void)
 {
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
     __HAL_TIM_CLEAR_IT(&unstep_timer_handle, TIM_IT_UPDATE);
     StepTicker::getInstance()->unstep_tick();
+    
+    Profiler::IsrExit(PROFILER_ISR_UNSTEP, start_cycles);
 }
 
-// The actual interrupt handler where we do all the work
+// The actual interrupt handler where we do all the work. Above the kernel [STEP_IRQ_PRIORITY]: no
+// FreeRTOS call from here down, task notifications go through the soft IRQ
 extern "C" void TIM2_IRQHandler(void)
 {
+    // Counter value = time elapsed since the update event [entry latency]
+    uint32_t entry_count = step_timer_handle.Instance->CNT;
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
+    StepTicker::getInstance()->run_commands();
+    
+    // Pended for the requests only
+    if (__HAL_TIM_GET_FLAG(&step_timer_handle, TIM_FLAG_UPDATE) == RESET)
+    {
+        Profiler::IsrExit(PROFILER_ISR_STEP_COMMAND, start_cycles);
+        return;
+    }
+    
+    Profiler::RecordStepLatency(entry_count);
+    
     // Reset interrupt register
     __HAL_TIM_CLEAR_IT(&step_timer_handle, TIM_IT_UPDATE);
     StepTicker::getInstance()->step_tick();
+    
+    // Took longer than a tick period: the next update is already pending, one tick was delayed
+    if (__HAL_TIM_GET_FLAG(&step_timer_handle, TIM_FLAG_UPDATE) != RESET)
+        TraceRecorder::Record(TRACE_EVENT_ISR_OVERRUN, (uint16_t)step_timer_handle.Instance->CNT);
+    
+    Profiler::IsrExit(PROFILER_ISR_STEP_TICK, start_cycles);
 }
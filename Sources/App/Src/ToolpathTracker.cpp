@@ -0,0 +1,117 @@
+#include "ToolpathTracker.h"
+
+#include <math.h>
+
+#include "settings_manager.h"
+
+#include "Block.h"
+#include "user_tasks.h"
+#include "MachineCore.h"
+
+TOOLPATH_POINT * ToolpathTracker::m_points;
+volatile uint32_t ToolpathTracker::m_write_seq;
+volatile uint32_t ToolpathTracker::m_reset_count;
+
+int32_t ToolpathTracker::m_position_steps[2];
+TOOLPATH_POINT ToolpathTracker::m_last_point;
+
+void ToolpathTracker::Initialize()
+{
+    if (NULL == m_points)
+        m_points = (TOOLPATH_POINT*)pvPortMalloc(sizeof(TOOLPATH_POINT) * TOOLPATH_CACHE_POINTS);
+    
+    Reset();
+}
+
+// Start a new path from the current machine position
+void ToolpathTracker::Reset()
+{
+    float position[COORDINATE_LINEAR_AXES_COUNT];
+    
+    machine->GetCurrentPosition_mm(position);
+    
+    vTaskSuspendAll();
+    
+    m_position_steps[COORD_X] = lroundf(position[COORD_X] * Settings_Manager::GetStepsPer_mm_Axis(COORD_X));
+    m_position_steps[COORD_Y] = lroundf(position[COORD_Y] * Settings_Manager::GetStepsPer_mm_Axis(COORD_Y));
+    
+    m_write_seq = 0;
+    m_reset_count++;
+    
+    append_point(position[COORD_X], position[COORD_Y]);
+    
+    xTaskResumeAll();
+}
+
+void ToolpathTracker::OnBlockFinished(const Block * block)
+{
+    OnStepsExecuted(block->steps, block->direction_bits);
+}
+
+void ToolpathTracker::OnStepsExecuted(const uint32_t * steps, uint8_t direction_bits)
+{
+    float x, y, dx, dy;
+    
+    if (NULL == m_points)
+        return;
+    
+    // Only XY moves are shown
+    if (steps[COORD_X] == 0 && steps[COORD_Y] == 0)
+        return;
+    
+    if ((direction_bits & (1 << COORD_X)) != 0)
+        m_position_steps[COORD_X] -= steps[COORD_X];
+    else
+        m_position_steps[COORD_X] += steps[COORD_X];
+    
+    if ((direction_bits & (1 << COORD_Y)) != 0)
+        m_position_steps[COORD_Y] -= steps[COORD_Y];
+    else
+        m_position_steps[COORD_Y] += steps[COORD_Y];
+    
+    x = m_position_steps[COORD_X] / Settings_Manager::GetStepsPer_mm_Axis(COORD_X);
+    y = m_position_steps[COORD_Y] / Settings_Manager::GetStepsPer_mm_Axis(COORD_Y);
+    
+    // Decimation: skip points too close to the last stored one (arcs, small segments)
+    dx = x - m_last_point.x;
+    dy = y - m_last_point.y;
+    
+    if ((dx * dx + dy * dy) < (TOOLPATH_MIN_SEGMENT_MM * TOOLPATH_MIN_SEGMENT_MM))
+        return;
+    
+    append_point(x, y);
+}
+
+uint32_t ToolpathTracker::GetFirstAvailableSequence()
+{
+    uint32_t write_seq = m_write_seq;
+    
+    // Keep some margin with the slot being written
+    if (write_seq > (TOOLPATH_CACHE_POINTS - 8))
+        return write_seq - (TOOLPATH_CACHE_POINTS - 8);
+    
+    return 0;
+}
+
+bool ToolpathTracker::GetPoint(uint32_t seq, TOOLPATH_POINT& point)
+{
+    if (NULL == m_points || seq >= m_write_seq || seq < GetFirstAvailableSequence())
+        return false;
+    
+    point = m_points[seq & (TOOLPATH_CACHE_POINTS - 1)];
+    return true;
+}
+
+void ToolpathTracker::append_point(float x, float y)
+{
+    uint32_t seq = m_write_seq;
+    
+    m_points[seq & (TOOLPATH_CACHE_POINTS - 1)].x = x;
+    m_points[seq & (TOOLPATH_CACHE_POINTS - 1)].y = y;
+    
+    m_last_point.x = x;
+    m_last_point.y = y;
+    
+    // Publish the point once it is complete
+    m_write_seq = seq + 1;
+}
@@ -0,0 +1,118 @@
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ff_stdio.h"
+
+#include "memory_map.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+TRACE_EVENT TraceRecorder::m_events[TRACE_BUFFER_EVENTS] CCM_RAM;
+volatile uint32_t TraceRecorder::m_write_index;
+volatile bool TraceRecorder::m_enabled;
+
+void TraceRecorder::Initialize()
+{
+    // Same timebase as the profiler, may already be running
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    
+    Clear();
+}
+
+void TraceRecorder::Clear()
+{
+    m_enabled = false;
+    __DMB();
+    
+    memset((void*)m_events, 0, sizeof(m_events));
+    m_write_index = 0;
+    
+    __DMB();
+    m_enabled = true;
+}
+
+// Stops recording, so the ring is stable while dumped. Oldest event first
+void TraceRecorder::pause(uint32_t& first, uint32_t& count)
+{
+    uint32_t total;
+    
+    m_enabled = false;
+    __DMB();
+    
+    // A lower priority task preempted inside Record() may still complete its slot, let it run
+    vTaskDelay(1);
+    
+    total = m_write_index;
+    count = (total < TRACE_BUFFER_EVENTS) ? total : TRACE_BUFFER_EVENTS;
+    first = total - count;
+}
+
+void TraceRecorder::DumpText(TRACE_WRITE_FUNC write, void * context)
+{
+    uint32_t first, count, index;
+    char line[48];
+    
+    pause(first, count);
+    
+    snprintf(line, sizeof(line), "#TRACE %u %lu %lu %lu", TRACE_FILE_VERSION, (unsigned long)SystemCoreClock,
+             (unsigned long)m_write_index, (unsigned long)count);
+    write(context, line);
+    
+    for (index = 0; index < count; index++)
+    {
+        const TRACE_EVENT& event = m_events[(first + index) & (TRACE_BUFFER_EVENTS - 1)];
+        
+        snprintf(line, sizeof(line), "%08lX %02X %02X %04X", (unsigned long)event.timestamp, event.event, event.arg8, event.arg16);
+        write(context, line);
+    }
+    
+    write(context, "#END");
+    
+    m_enabled = true;
+}
+
+bool TraceRecorder::DumpToFile(const char * file_name)
+{
+    TRACE_FILE_HEADER header;
+    FF_FILE * file;
+    uint32_t first, count, start, chunk;
+    bool success = false;
+    
+    pause(first, count);
+    
+    file = ff_fopen(file_name, "w");
+    
+    if (file != NULL)
+    {
+        header.magic = TRACE_FILE_MAGIC;
+        header.version = TRACE_FILE_VERSION;
+        header.cpu_hz = SystemCoreClock;
+        header.total_events = m_write_index;
+        header.count = count;
+        
+        success = (ff_fwrite(&header, sizeof(header), 1, file) == 1) ? true : false;
+        
+        // Ring may wrap: up to two contiguous chunks
+        while (success && count > 0)
+        {
+            start = first & (TRACE_BUFFER_EVENTS - 1);
+            chunk = ((TRACE_BUFFER_EVENTS - start) < count) ? (TRACE_BUFFER_EVENTS - start) : count;
+            
+            success = (ff_fwrite(&m_events[start], sizeof(TRACE_EVENT), chunk, file) == chunk) ? true : false;
+            
+            first += chunk;
+            count -= chunk;
+        }
+        
+        if (ff_fclose(file) != 0)
+            success = false;
+    }
+    
+    m_enabled = true;
+    
+    return success;
+}
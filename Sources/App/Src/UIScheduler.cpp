@@ -0,0 +1,92 @@
+#include "UIScheduler.h"
+
+#include <stm32f4xx_hal.h>
+
+#include <algorithm>
+
+#include "lvgl.h"
+#include "driver_touch_GT9147.h"
+
+#include "PageManager.h"
+
+#include "user_tasks.h"
+#include "MachineCore.h"
+
+uint32_t UIScheduler::m_dro_sample_period_ms;
+TickType_t UIScheduler::m_last_dro_sample;
+
+TickType_t UIScheduler::m_budget_window_start;
+uint32_t UIScheduler::m_budget_used_cycles;
+uint32_t UIScheduler::m_cycles_per_ms;
+
+bool UIScheduler::m_throttled;
+
+void UIScheduler::Initialize()
+{
+    m_dro_sample_period_ms = UI_DRO_SAMPLE_PERIOD_MS;
+    m_last_dro_sample = xTaskGetTickCount();
+    
+    m_budget_window_start = xTaskGetTickCount();
+    m_budget_used_cycles = 0;
+    m_cycles_per_ms = SystemCoreClock / 1000;
+    
+    m_throttled = false;
+    
+    // Enable DWT cycle counter, used to measure the CPU time spent by the UI
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t UIScheduler::RunCycle()
+{
+    TickType_t now = xTaskGetTickCount();
+    uint32_t start_cycles, elapsed_ms, dro_period;
+    
+    // Pending touch reports are always read, LVGL gets them when the budget allows
+    lv_port_indev_GT9147_process();
+    
+    // Restart budget accounting every second
+    elapsed_ms = (now - m_budget_window_start) * portTICK_PERIOD_MS;
+    
+    if (elapsed_ms >= 1000)
+    {
+        m_budget_window_start = now;
+        m_budget_used_cycles = 0;
+        elapsed_ms = 0;
+    }
+    
+    // Budget exhausted: skip until next window
+    if (m_budget_used_cycles >= (UI_CPU_BUDGET_MS_PER_SEC * m_cycles_per_ms))
+        return (1000 - elapsed_ms);
+    
+    m_throttled = is_motion_starving();
+    
+    start_cycles = DWT->CYCCNT;
+    
+    // Sample machine position. Pages only redraw labels whose text changed
+    if (m_throttled)
+        dro_period = std::max<uint32_t>(m_dro_sample_period_ms, UI_DRO_SAMPLE_PERIOD_SLOW_MS);
+    else
+        dro_period = m_dro_sample_period_ms;
+    
+    if (((now - m_last_dro_sample) * portTICK_PERIOD_MS) >= dro_period)
+    {
+        m_last_dro_sample = now;
+        PageManager::UpdateActivePage();
+    }
+    
+    lv_task_handler();
+    
+    m_budget_used_cycles += (DWT->CYCCNT - start_cycles);
+    
+    return (m_throttled) ? UI_REFRESH_PERIOD_SLOW_MS : UI_REFRESH_PERIOD_MS;
+}
+
+// Motors running with only a few blocks left: leave the CPU to the parser/planner
+bool UIScheduler::is_motion_starving()
+{
+    if (machine->AreMotorsStillMoving() == false)
+        return false;
+    
+    return (machine->GetQueuedBlocksCount() < UI_QUEUE_LOW_WATERMARK) ? true : false;
+}
@@ -0,0 +1,297 @@
+#include "UsbCdc.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "usb_task.h"
+#include "serial_task.h"
+#include "compile_check.h"
+
+#define CDC_SET_LINE_CODING         0x20
+#define CDC_GET_LINE_CODING         0x21
+#define CDC_SET_CONTROL_LINE_STATE  0x22
+#define CDC_SEND_BREAK              0x23
+
+#define CDC_CONFIG_DESCRIPTOR_SIZE  67
+
+COMPILE_CHECK((CDC_RX_BUFFER_SIZE & (CDC_RX_BUFFER_SIZE - 1)) == 0 && (CDC_TX_BUFFER_SIZE & (CDC_TX_BUFFER_SIZE - 1)) == 0,
+              "CDC rings must be a power of 2");
+COMPILE_CHECK(SERIAL_LINE_MAX_LENGTH + CDC_DATA_PACKET_SIZE <= CDC_RX_BUFFER_SIZE, "CDC Rx ring too small for a line");
+
+UsbCdc usb_cdc;
+
+static const uint8_t device_descriptor[] =
+{
+    0x12, 0x01, 0x00, 0x02,         // Length, DEVICE, USB 2.0
+    0x02, 0x00, 0x00,               // Communications device class
+    USB_EP0_MAX_PACKET_SIZE,
+    0x83, 0x04, 0x40, 0x57,         // VID 0x0483, PID 0x5740 [ST virtual COM port]
+    0x00, 0x02,                     // Release 2.00
+    USB_STRING_MANUFACTURER, USB_STRING_PRODUCT, USB_STRING_SERIAL,
+    0x01,                           // Configurations
+};
+
+static const uint8_t config_descriptor[CDC_CONFIG_DESCRIPTOR_SIZE] =
+{
+    0x09, 0x02, CDC_CONFIG_DESCRIPTOR_SIZE, 0x00,
+    0x02, 0x01, 0x00,               // 2 interfaces, configuration 1
+    0xC0, 0x32,                     // Self powered, 100 mA
+    
+    // Interface 0: communication, abstract control model
+    0x09, 0x04, 0x00, 0x00, 0x01, 0x02, 0x02, 0x01, 0x00,
+    0x05, 0x24, 0x00, 0x10, 0x01,   // Header, CDC 1.10
+    0x05, 0x24, 0x01, 0x00, 0x01,   // Call management: data interface 1
+    0x04, 0x24, 0x02, 0x02,         // ACM: line coding & control line state
+    0x05, 0x24, 0x06, 0x00, 0x01,   // Union: master 0, slave 1
+    0x07, 0x05, CDC_CMD_EP, 0x03, CDC_CMD_PACKET_SIZE, 0x00, 0x10,
+    
+    // Interface 1: data
+    0x09, 0x04, 0x01, 0x00, 0x02, 0x0A, 0x00, 0x00, 0x00,
+    0x07, 0x05, CDC_DATA_OUT_EP, 0x02, CDC_DATA_PACKET_SIZE, 0x00, 0x00,
+    0x07, 0x05, CDC_DATA_IN_EP, 0x02, CDC_DATA_PACKET_SIZE, 0x00, 0x00,
+};
+
+UsbCdc::UsbCdc()
+{
+    // 115200 8N1 until the host sets its own
+    static const uint8_t default_line_coding[7] = { 0x00, 0xC2, 0x01, 0x00, 0x00, 0x00, 0x08 };
+    
+    memcpy(m_line_coding, default_line_coding, sizeof(m_line_coding));
+    
+    m_configured = false;
+    m_dtr = false;
+    
+    m_rx_received = 0;
+    m_rx_consumed = 0;
+    m_rx_discard = 0;
+    m_rx_armed = false;
+    
+    m_tx_written = 0;
+    m_tx_sent = 0;
+    m_tx_transfer_len = 0;
+    m_tx_busy = false;
+    m_tx_zlp = false;
+}
+
+const uint8_t * UsbCdc::GetDeviceDescriptor()
+{
+    return device_descriptor;
+}
+
+const uint8_t * UsbCdc::GetConfigDescriptor(uint16_t * length)
+{
+    *length = sizeof(config_descriptor);
+    return config_descriptor;
+}
+
+const char * UsbCdc::GetProductString()
+{
+    return "OrionPlus CNC Virtual COM Port";
+}
+
+void UsbCdc::Configure(PCD_HandleTypeDef * pcd)
+{
+    HAL_PCD_EP_Open(pcd, CDC_DATA_OUT_EP, CDC_DATA_PACKET_SIZE, EP_TYPE_BULK);
+    HAL_PCD_EP_Open(pcd, CDC_DATA_IN_EP, CDC_DATA_PACKET_SIZE, EP_TYPE_BULK);
+    HAL_PCD_EP_Open(pcd, CDC_CMD_EP, CDC_CMD_PACKET_SIZE, EP_TYPE_INTR);
+    
+    m_tx_busy = false;
+    m_tx_zlp = false;
+    m_rx_armed = false;
+    m_configured = true;
+    
+    arm_rx(pcd);
+}
+
+// Pending output dropped, partial input line discarded by the serial task
+void UsbCdc::Unconfigure(PCD_HandleTypeDef * pcd)
+{
+    m_configured = false;
+    m_dtr = false;
+    
+    HAL_PCD_EP_Close(pcd, CDC_DATA_OUT_EP);
+    HAL_PCD_EP_Close(pcd, CDC_DATA_IN_EP);
+    HAL_PCD_EP_Close(pcd, CDC_CMD_EP);
+    
+    m_tx_sent = m_tx_written;
+    m_tx_transfer_len = 0;
+    m_tx_busy = false;
+    
+    m_rx_armed = false;
+    m_rx_discard = m_rx_received;
+    
+    xTaskNotifyGive(serial_task_handle);
+}
+
+bool UsbCdc::ClassRequest(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup, uint8_t ** data, uint16_t * length)
+{
+    switch (setup.bRequest)
+    {
+        case CDC_SET_LINE_CODING:
+        case CDC_GET_LINE_CODING:
+            *data = m_line_coding;
+            *length = sizeof(m_line_coding);
+            return true;
+        
+        case CDC_SET_CONTROL_LINE_STATE:
+            m_dtr = (setup.wValue & 0x0001) ? true : false;
+            return true;
+        
+        case CDC_SEND_BREAK:
+            return true;
+        
+        default:
+            return false;
+    }
+}
+
+void UsbCdc::ControlOut(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup)
+{
+    // SET_LINE_CODING data already in m_line_coding
+}
+
+void UsbCdc::DataIn(PCD_HandleTypeDef * pcd, uint8_t epnum)
+{
+    if (epnum != (CDC_DATA_IN_EP & EP_ADDR_MSK))
+        return;
+    
+    // Transfer ending on a full packet: a zero length packet completes the host read if nothing follows
+    m_tx_zlp = (m_tx_transfer_len != 0 && (m_tx_transfer_len % CDC_DATA_PACKET_SIZE) == 0) ? true : false;
+    m_tx_sent += m_tx_transfer_len;
+    m_tx_transfer_len = 0;
+    m_tx_busy = false;
+    
+    start_tx(pcd);
+    
+    // Room in the Tx ring
+    xTaskNotifyGive(serial_task_handle);
+}
+
+void UsbCdc::DataOut(PCD_HandleTypeDef * pcd, uint8_t epnum)
+{
+    uint32_t len;
+    uint32_t index;
+    uint32_t first;
+    uint32_t i;
+    
+    if (epnum != CDC_DATA_OUT_EP)
+        return;
+    
+    len = HAL_PCD_EP_GetRxCount(pcd, CDC_DATA_OUT_EP);
+    m_rx_armed = false;
+    
+    // Overrides must not wait behind a line blocked by a full planner queue
+    for (i = 0; i < len; i++)
+    {
+        if (SerialTask_IsRealtimeCommand(m_rx_packet[i]))
+            SerialTask_HandleRealtimeCommand(m_rx_packet[i]);
+    }
+    
+    index = m_rx_received & (CDC_RX_BUFFER_SIZE - 1);
+    first = std::min(len, (uint32_t)(CDC_RX_BUFFER_SIZE - index));
+    
+    memcpy(&m_rx_ring[index], m_rx_packet, first);
+    memcpy(&m_rx_ring[0], m_rx_packet + first, len - first);
+    m_rx_received += len;
+    
+    xTaskNotifyGive(serial_task_handle);
+    
+    arm_rx(pcd);
+}
+
+void UsbCdc::Service(PCD_HandleTypeDef * pcd, uint32_t events)
+{
+    if (events & USB_NOTIFY_RX_SPACE)
+        arm_rx(pcd);
+    
+    if (events & USB_NOTIFY_TX)
+        start_tx(pcd);
+}
+
+// Serial task, the line ending at consumed was executed
+void UsbCdc::RxRelease(uint32_t consumed)
+{
+    m_rx_consumed = consumed;
+    
+    // Endpoint left NAKing for lack of room: let the USB task re-arm it
+    if (m_configured && !m_rx_armed)
+        xTaskNotify(usb_task_handle, USB_NOTIFY_RX_SPACE, eSetBits);
+}
+
+void UsbCdc::Write(const char * data, uint32_t len)
+{
+    bool end_of_line = (len != 0 && data[len - 1] == '\n') ? true : false;
+    uint32_t index;
+    uint32_t chunk;
+    
+    while (len != 0)
+    {
+        if (!m_configured || !m_dtr)
+            return;
+        
+        if ((m_tx_written - m_tx_sent) == CDC_TX_BUFFER_SIZE)
+        {
+            xTaskNotify(usb_task_handle, USB_NOTIFY_TX, eSetBits);
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CDC_TX_WAIT_POLL_MS));
+            continue;
+        }
+        
+        index = m_tx_written & (CDC_TX_BUFFER_SIZE - 1);
+        chunk = std::min(len, (uint32_t)(CDC_TX_BUFFER_SIZE - (m_tx_written - m_tx_sent)));
+        chunk = std::min(chunk, (uint32_t)(CDC_TX_BUFFER_SIZE - index));
+        
+        memcpy(&m_tx_ring[index], data, chunk);
+        data += chunk;
+        len -= chunk;
+        
+        m_tx_written += chunk;
+    }
+    
+    // Output is line based: one IN transfer per line instead of one per piece of it
+    if (end_of_line)
+        xTaskNotify(usb_task_handle, USB_NOTIFY_TX, eSetBits);
+}
+
+// OUT endpoint armed only while a whole packet fits in the ring
+void UsbCdc::arm_rx(PCD_HandleTypeDef * pcd)
+{
+    if (!m_configured || m_rx_armed)
+        return;
+    
+    if ((CDC_RX_BUFFER_SIZE - (m_rx_received - m_rx_consumed)) < CDC_DATA_PACKET_SIZE)
+        return;
+    
+    m_rx_armed = true;
+    HAL_PCD_EP_Receive(pcd, CDC_DATA_OUT_EP, m_rx_packet, CDC_DATA_PACKET_SIZE);
+}
+
+// Contiguous pending data of the Tx ring in one transfer, the HAL splits it in packets
+void UsbCdc::start_tx(PCD_HandleTypeDef * pcd)
+{
+    uint32_t pending = m_tx_written - m_tx_sent;
+    uint32_t index = m_tx_sent & (CDC_TX_BUFFER_SIZE - 1);
+    
+    if (!m_configured || m_tx_busy)
+        return;
+    
+    if (pending == 0)
+    {
+        if (m_tx_zlp)
+        {
+            m_tx_zlp = false;
+            m_tx_busy = true;
+            HAL_PCD_EP_Transmit(pcd, CDC_DATA_IN_EP, NULL, 0);
+        }
+        
+        return;
+    }
+    
+    m_tx_transfer_len = std::min(pending, (uint32_t)(CDC_TX_BUFFER_SIZE - index));
+    m_tx_busy = true;
+    
+    HAL_PCD_EP_Transmit(pcd, CDC_DATA_IN_EP, &m_tx_ring[index], m_tx_transfer_len);
+}
@@ -0,0 +1,485 @@
+#include "UsbDevice.h"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "usb_task.h"
+
+#define USB_REQUEST_TYPE_MASK       0x60
+#define USB_REQUEST_TYPE_STANDARD   0x00
+#define USB_REQUEST_TYPE_CLASS      0x20
+#define USB_REQUEST_RECIPIENT_MASK  0x1F
+#define USB_REQUEST_RECIPIENT_DEVICE    0x00
+#define USB_REQUEST_RECIPIENT_INTERFACE 0x01
+#define USB_REQUEST_RECIPIENT_ENDPOINT  0x02
+#define USB_REQUEST_DIR_IN          0x80
+
+#define USB_REQ_GET_STATUS          0x00
+#define USB_REQ_CLEAR_FEATURE       0x01
+#define USB_REQ_SET_FEATURE         0x03
+#define USB_REQ_SET_ADDRESS         0x05
+#define USB_REQ_GET_DESCRIPTOR      0x06
+#define USB_REQ_GET_CONFIGURATION   0x08
+#define USB_REQ_SET_CONFIGURATION   0x09
+#define USB_REQ_GET_INTERFACE       0x0A
+#define USB_REQ_SET_INTERFACE       0x0B
+
+#define USB_DESC_TYPE_DEVICE        0x01
+#define USB_DESC_TYPE_CONFIGURATION 0x02
+#define USB_DESC_TYPE_STRING        0x03
+
+#define USB_FEATURE_ENDPOINT_HALT   0x00
+
+#define USB_DEVICE_DESCRIPTOR_SIZE  18
+
+PCD_HandleTypeDef * UsbDevice::m_pcd;
+UsbFunction * volatile UsbDevice::m_function;
+UsbFunction * volatile UsbDevice::m_requested_function;
+volatile bool UsbDevice::m_configured;
+volatile bool UsbDevice::m_attached;
+
+USB_SETUP_PACKET UsbDevice::m_setup;
+UsbDevice::EP0_STATES UsbDevice::m_ep0_state;
+const uint8_t * UsbDevice::m_ep0_data;
+uint16_t UsbDevice::m_ep0_remaining;
+bool UsbDevice::m_ep0_zlp;
+
+uint8_t UsbDevice::m_ep0_buffer[2 + (USB_STRING_MAX_LENGTH * 2)];
+
+static const uint8_t language_id_descriptor[] = { 0x04, USB_DESC_TYPE_STRING, 0x09, 0x04 };    // English (US)
+
+void UsbDevice::Initialize(PCD_HandleTypeDef * pcd, UsbFunction * function)
+{
+    m_pcd = pcd;
+    m_function = function;
+    m_requested_function = function;
+    m_configured = false;
+    m_attached = false;
+    m_ep0_state = EP0_IDLE;
+    
+    // Not visible to the host until the cable is detected
+    HAL_PCD_Start(m_pcd);
+    HAL_PCD_DevDisconnect(m_pcd);
+}
+
+void UsbDevice::HandleInterrupt()
+{
+    HAL_PCD_IRQHandler(m_pcd);
+}
+
+void UsbDevice::Service(uint32_t events)
+{
+    if (events & USB_NOTIFY_FUNCTION)
+        switch_function();
+    
+    if (m_configured)
+        m_function->Service(m_pcd, events);
+}
+
+void UsbDevice::RequestFunction(UsbFunction * function)
+{
+    m_requested_function = function;
+    xTaskNotify(usb_task_handle, USB_NOTIFY_FUNCTION, eSetBits);
+}
+
+void UsbDevice::SetAttached(bool attached)
+{
+    if (attached == m_attached)
+        return;
+    
+    m_attached = attached;
+    
+    if (attached)
+    {
+        HAL_PCD_DevConnect(m_pcd);
+    }
+    else
+    {
+        HAL_PCD_DevDisconnect(m_pcd);
+        set_configuration(0);
+        m_ep0_state = EP0_IDLE;
+        
+        m_function->Detached(m_pcd);
+    }
+}
+
+void UsbDevice::OnReset()
+{
+    set_configuration(0);
+    
+    m_ep0_state = EP0_IDLE;
+    
+    HAL_PCD_EP_Open(m_pcd, 0x00, USB_EP0_MAX_PACKET_SIZE, EP_TYPE_CTRL);
+    HAL_PCD_EP_Open(m_pcd, 0x80, USB_EP0_MAX_PACKET_SIZE, EP_TYPE_CTRL);
+}
+
+void UsbDevice::OnSetup()
+{
+    const uint8_t * packet = (const uint8_t*)m_pcd->Setup;
+    uint8_t * data = NULL;
+    uint16_t length = 0;
+    
+    m_setup.bmRequestType = packet[0];
+    m_setup.bRequest = packet[1];
+    m_setup.wValue = (uint16_t)(packet[2] | (packet[3] << 8));
+    m_setup.wIndex = (uint16_t)(packet[4] | (packet[5] << 8));
+    m_setup.wLength = (uint16_t)(packet[6] | (packet[7] << 8));
+    
+    if ((m_setup.bmRequestType & USB_REQUEST_TYPE_MASK) == USB_REQUEST_TYPE_STANDARD)
+    {
+        standard_request();
+        return;
+    }
+    
+    if ((m_setup.bmRequestType & USB_REQUEST_TYPE_MASK) != USB_REQUEST_TYPE_CLASS ||
+        (m_setup.bmRequestType & USB_REQUEST_RECIPIENT_MASK) == USB_REQUEST_RECIPIENT_DEVICE ||
+        !m_function->ClassRequest(m_pcd, m_setup, &data, &length))
+    {
+        control_stall();
+        return;
+    }
+    
+    if (m_setup.wLength == 0)
+        control_status();
+    else if (m_setup.bmRequestType & USB_REQUEST_DIR_IN)
+        control_send(data, length);
+    else if (length >= m_setup.wLength && m_setup.wLength <= USB_EP0_MAX_PACKET_SIZE)
+        control_receive(data, m_setup.wLength);
+    else
+        control_stall();
+}
+
+void UsbDevice::OnDataIn(uint8_t epnum)
+{
+    if (epnum != 0)
+    {
+        if (m_configured)
+            m_function->DataIn(m_pcd, epnum);
+        
+        return;
+    }
+    
+    switch (m_ep0_state)
+    {
+        case EP0_DATA_IN:
+            // The HAL sends one packet per EP0 transfer
+            if (m_ep0_remaining > USB_EP0_MAX_PACKET_SIZE)
+            {
+                m_ep0_data += USB_EP0_MAX_PACKET_SIZE;
+                m_ep0_remaining -= USB_EP0_MAX_PACKET_SIZE;
+                HAL_PCD_EP_Transmit(m_pcd, 0x80, (uint8_t*)m_ep0_data, m_ep0_remaining);
+            }
+            else if (m_ep0_zlp)
+            {
+                m_ep0_zlp = false;
+                HAL_PCD_EP_Transmit(m_pcd, 0x80, NULL, 0);
+            }
+            else
+            {
+                m_ep0_state = EP0_STATUS_OUT;
+                HAL_PCD_EP_Receive(m_pcd, 0x00, NULL, 0);
+            }
+            break;
+        
+        case EP0_STATUS_IN:
+            m_ep0_state = EP0_IDLE;
+            break;
+        
+        default:
+            break;
+    }
+}
+
+void UsbDevice::OnDataOut(uint8_t epnum)
+{
+    if (epnum != 0)
+    {
+        if (m_configured)
+            m_function->DataOut(m_pcd, epnum);
+        
+        return;
+    }
+    
+    switch (m_ep0_state)
+    {
+        case EP0_DATA_OUT:
+            m_function->ControlOut(m_pcd, m_setup);
+            control_status();
+            break;
+        
+        case EP0_STATUS_OUT:
+            m_ep0_state = EP0_IDLE;
+            break;
+        
+        default:
+            break;
+    }
+}
+
+void UsbDevice::standard_request()
+{
+    uint8_t recipient = m_setup.bmRequestType & USB_REQUEST_RECIPIENT_MASK;
+    uint8_t ep_addr = (uint8_t)m_setup.wIndex;
+    PCD_EPTypeDef * ep;
+    
+    switch (m_setup.bRequest)
+    {
+        case USB_REQ_GET_DESCRIPTOR:
+            get_descriptor();
+            return;
+        
+        case USB_REQ_SET_ADDRESS:
+            // Set before the status stage on the OTG core
+            HAL_PCD_SetAddress(m_pcd, (uint8_t)(m_setup.wValue & 0x7F));
+            control_status();
+            return;
+        
+        case USB_REQ_GET_CONFIGURATION:
+            m_ep0_buffer[0] = m_configured ? 1 : 0;
+            control_send(m_ep0_buffer, 1);
+            return;
+        
+        case USB_REQ_SET_CONFIGURATION:
+            if (m_setup.wValue > 1)
+                break;
+            
+            set_configuration((uint8_t)m_setup.wValue);
+            control_status();
+            return;
+        
+        case USB_REQ_GET_INTERFACE:
+            m_ep0_buffer[0] = 0;
+            control_send(m_ep0_buffer, 1);
+            return;
+        
+        case USB_REQ_SET_INTERFACE:
+            if (m_setup.wValue != 0)
+                break;
+            
+            control_status();
+            return;
+        
+        case USB_REQ_GET_STATUS:
+            m_ep0_buffer[0] = 0;
+            m_ep0_buffer[1] = 0;
+            
+            if (recipient == USB_REQUEST_RECIPIENT_DEVICE)
+            {
+                m_ep0_buffer[0] = 0x01;     // Self powered
+            }
+            else if (recipient == USB_REQUEST_RECIPIENT_ENDPOINT)
+            {
+                ep = (ep_addr & 0x80) ? &m_pcd->IN_ep[ep_addr & EP_ADDR_MSK] : &m_pcd->OUT_ep[ep_addr & EP_ADDR_MSK];
+                m_ep0_buffer[0] = ep->is_stall ? 1 : 0;
+            }
+            
+            control_send(m_ep0_buffer, 2);
+            return;
+        
+        case USB_REQ_CLEAR_FEATURE:
+        case USB_REQ_SET_FEATURE:
+            if (recipient == USB_REQUEST_RECIPIENT_ENDPOINT && m_setup.wValue == USB_FEATURE_ENDPOINT_HALT)
+            {
+                if ((ep_addr & EP_ADDR_MSK) != 0)
+                {
+                    if (m_setup.bRequest == USB_REQ_SET_FEATURE)
+                    {
+                        HAL_PCD_EP_SetStall(m_pcd, ep_addr);
+                    }
+                    else
+                    {
+                        HAL_PCD_EP_ClrStall(m_pcd, ep_addr);
+                        
+                        if (m_configured)
+                            m_function->EndpointCleared(m_pcd, ep_addr);
+                    }
+                }
+            }
+            
+            // Remote wakeup not supported, ignored
+            control_status();
+            return;
+        
+        default:
+            break;
+    }
+    
+    control_stall();
+}
+
+void UsbDevice::get_descriptor()
+{
+    const uint8_t * descriptor = NULL;
+    uint16_t length = 0;
+    
+    switch (m_setup.wValue >> 8)
+    {
+        case USB_DESC_TYPE_DEVICE:
+            descriptor = m_function->GetDeviceDescriptor();
+            length = USB_DEVICE_DESCRIPTOR_SIZE;
+            break;
+        
+        case USB_DESC_TYPE_CONFIGURATION:
+            descriptor = m_function->GetConfigDescriptor(&length);
+            break;
+        
+        case USB_DESC_TYPE_STRING:
+            switch (m_setup.wValue & 0xFF)
+            {
+                case 0:                         descriptor = language_id_descriptor;                        break;
+                case USB_STRING_MANUFACTURER:   descriptor = string_descriptor(USB_MANUFACTURER_STRING);    break;
+                case USB_STRING_PRODUCT:        descriptor = string_descriptor(m_function->GetProductString()); break;
+                case USB_STRING_SERIAL:         descriptor = serial_number_descriptor();                    break;
+                
+                default:
+                    break;
+            }
+            
+            if (descriptor != NULL)
+                length = descriptor[0];
+            break;
+        
+        // Device qualifier & other speed: full speed only device, stalled
+        default:
+            break;
+    }
+    
+    if (descriptor == NULL)
+        control_stall();
+    else
+        control_send(descriptor, length);
+}
+
+void UsbDevice::set_configuration(uint8_t config)
+{
+    if (config == 0 && m_configured)
+    {
+        m_configured = false;
+        m_function->Unconfigure(m_pcd);
+    }
+    else if (config == 1 && !m_configured)
+    {
+        m_function->Configure(m_pcd);
+        m_configured = true;
+    }
+}
+
+// USB task. The host sees a disconnect, then enumerates the new descriptors from scratch
+void UsbDevice::switch_function()
+{
+    UsbFunction * function = m_requested_function;
+    
+    if (function == m_function)
+        return;
+    
+    HAL_PCD_DevDisconnect(m_pcd);
+    set_configuration(0);
+    m_ep0_state = EP0_IDLE;
+    
+    m_function = function;
+    
+    if (m_attached)
+    {
+        vTaskDelay(pdMS_TO_TICKS(USB_REATTACH_DELAY_MS));
+        HAL_PCD_DevConnect(m_pcd);
+    }
+}
+
+void UsbDevice::control_send(const uint8_t * data, uint16_t length)
+{
+    if (length > m_setup.wLength)
+        length = m_setup.wLength;
+    
+    // Shorter than requested and ending on a full packet: a zero length packet ends the data stage
+    m_ep0_zlp = (length != 0 && length < m_setup.wLength && (length % USB_EP0_MAX_PACKET_SIZE) == 0) ? true : false;
+    m_ep0_data = data;
+    m_ep0_remaining = length;
+    m_ep0_state = EP0_DATA_IN;
+    
+    HAL_PCD_EP_Transmit(m_pcd, 0x80, (uint8_t*)data, length);
+}
+
+void UsbDevice::control_receive(uint8_t * data, uint16_t length)
+{
+    m_ep0_state = EP0_DATA_OUT;
+    
+    HAL_PCD_EP_Receive(m_pcd, 0x00, data, length);
+}
+
+void UsbDevice::control_status()
+{
+    m_ep0_state = EP0_STATUS_IN;
+    
+    HAL_PCD_EP_Transmit(m_pcd, 0x80, NULL, 0);
+}
+
+// Cleared by the core on the next SETUP packet
+void UsbDevice::control_stall()
+{
+    m_ep0_state = EP0_IDLE;
+    
+    HAL_PCD_EP_SetStall(m_pcd, 0x80);
+    HAL_PCD_EP_SetStall(m_pcd, 0x00);
+}
+
+// ASCII to UTF-16LE
+const uint8_t * UsbDevice::string_descriptor(const char * text)
+{
+    uint32_t index = 0;
+    
+    while (text[index] != '\0' && index < USB_STRING_MAX_LENGTH)
+    {
+        m_ep0_buffer[2 + (index * 2)] = (uint8_t)text[index];
+        m_ep0_buffer[3 + (index * 2)] = 0;
+        index++;
+    }
+    
+    m_ep0_buffer[0] = (uint8_t)(2 + (index * 2));
+    m_ep0_buffer[1] = USB_DESC_TYPE_STRING;
+    
+    return m_ep0_buffer;
+}
+
+// Unique device ID, so the host keeps the same port name for the same board
+const uint8_t * UsbDevice::serial_number_descriptor()
+{
+    static const char hex_digits[] = "0123456789ABCDEF";
+    const uint32_t * uid = (const uint32_t*)UID_BASE;
+    uint32_t value = uid[0] + uid[2];
+    char text[13];
+    uint32_t index;
+    
+    for (index = 0; index < 8; index++)
+        text[index] = hex_digits[(value >> (28 - (index * 4))) & 0x0F];
+    
+    for (index = 0; index < 4; index++)
+        text[8 + index] = hex_digits[(uid[1] >> (28 - (index * 4))) & 0x0F];
+    
+    text[12] = '\0';
+    
+    return string_descriptor(text);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+void HAL_PCD_SetupStageCallback(PCD_HandleTypeDef * hpcd)
+{
+    UsbDevice::OnSetup();
+}
+
+void HAL_PCD_ResetCallback(PCD_HandleTypeDef * hpcd)
+{
+    UsbDevice::OnReset();
+}
+
+void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef * hpcd, uint8_t epnum)
+{
+    UsbDevice::OnDataIn(epnum);
+}
+
+void HAL_PCD_DataOutStageCallback(PCD_HandleTypeDef * hpcd, uint8_t epnum)
+{
+    UsbDevice::OnDataOut(epnum);
+}
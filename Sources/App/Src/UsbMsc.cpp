@@ -0,0 +1,535 @@
+#include "UsbMsc.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "memory_map.h"
+#include "disk_task.h"
+
+#define MSC_REQ_GET_MAX_LUN         0xFE
+#define MSC_REQ_RESET               0xFF
+
+#define MSC_CBW_SIGNATURE           0x43425355
+#define MSC_CSW_SIGNATURE           0x53425355
+
+#define MSC_STATUS_PASSED           0x00
+#define MSC_STATUS_FAILED           0x01
+
+#define MSC_CONFIG_DESCRIPTOR_SIZE  32
+
+// SCSI operation codes
+#define SCSI_TEST_UNIT_READY        0x00
+#define SCSI_REQUEST_SENSE          0x03
+#define SCSI_INQUIRY                0x12
+#define SCSI_MODE_SENSE6            0x1A
+#define SCSI_START_STOP_UNIT        0x1B
+#define SCSI_PREVENT_ALLOW_REMOVAL  0x1E
+#define SCSI_READ_FORMAT_CAPACITIES 0x23
+#define SCSI_READ_CAPACITY10        0x25
+#define SCSI_READ10                 0x28
+#define SCSI_WRITE10                0x2A
+#define SCSI_VERIFY10               0x2F
+#define SCSI_SYNCHRONIZE_CACHE10    0x35
+#define SCSI_MODE_SENSE10           0x5A
+
+// Sense keys and additional sense codes
+#define SCSI_SENSE_NONE             0x00
+#define SCSI_SENSE_NOT_READY        0x02
+#define SCSI_SENSE_MEDIUM_ERROR     0x03
+#define SCSI_SENSE_ILLEGAL_REQUEST  0x05
+
+#define SCSI_ASC_NONE               0x00
+#define SCSI_ASC_WRITE_FAULT        0x03
+#define SCSI_ASC_READ_ERROR         0x11
+#define SCSI_ASC_INVALID_COMMAND    0x20
+#define SCSI_ASC_LBA_OUT_OF_RANGE   0x21
+#define SCSI_ASC_INVALID_FIELD      0x24
+#define SCSI_ASC_LUN_NOT_SUPPORTED  0x25
+#define SCSI_ASC_MEDIUM_NOT_PRESENT 0x3A
+
+UsbMsc usb_msc;
+
+// Filled and drained by the CPU only (SPI polled, USB FIFO writes)
+static uint32_t media_buffer[MSC_MEDIA_BUFFER_SIZE / 4] CCM_RAM;
+
+static const uint8_t device_descriptor[] =
+{
+    0x12, 0x01, 0x00, 0x02,         // Length, DEVICE, USB 2.0
+    0x00, 0x00, 0x00,               // Class defined by the interface
+    USB_EP0_MAX_PACKET_SIZE,
+    0x83, 0x04, 0x20, 0x57,         // VID 0x0483, PID 0x5720 [ST mass storage]
+    0x00, 0x02,                     // Release 2.00
+    USB_STRING_MANUFACTURER, USB_STRING_PRODUCT, USB_STRING_SERIAL,
+    0x01,                           // Configurations
+};
+
+static const uint8_t config_descriptor[MSC_CONFIG_DESCRIPTOR_SIZE] =
+{
+    0x09, 0x02, MSC_CONFIG_DESCRIPTOR_SIZE, 0x00,
+    0x01, 0x01, 0x00,               // 1 interface, configuration 1
+    0xC0, 0x32,                     // Self powered, 100 mA
+    
+    // Interface 0: mass storage, SCSI transparent command set, bulk-only transport
+    0x09, 0x04, 0x00, 0x00, 0x02, 0x08, 0x06, 0x50, 0x00,
+    0x07, 0x05, MSC_DATA_IN_EP, 0x02, MSC_DATA_PACKET_SIZE, 0x00, 0x00,
+    0x07, 0x05, MSC_DATA_OUT_EP, 0x02, MSC_DATA_PACKET_SIZE, 0x00, 0x00,
+};
+
+static const uint8_t inquiry_data[36] =
+{
+    0x00, 0x80, 0x02, 0x02,         // Direct access, removable, SPC-2 responses
+    36 - 5, 0x00, 0x00, 0x00,
+    'O', 'r', 'i', 'o', 'n', 'P', 'l', 's',
+    'S', 'D', ' ', 'C', 'a', 'r', 'd', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+    '1', '.', '0', '0',
+};
+
+static const uint8_t mode_sense6_data[4] = { 0x03, 0x00, 0x00, 0x00 };                               // Not write protected
+static const uint8_t mode_sense10_data[8] = { 0x00, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static inline uint32_t get_le32(const uint8_t * p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void put_le32(uint8_t * p, uint32_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+static inline uint32_t get_be32(const uint8_t * p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void put_be32(uint8_t * p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+UsbMsc::UsbMsc()
+{
+    m_state = MSC_IDLE;
+    m_medium_ready = false;
+    m_max_lun = 0;
+    
+    m_tag = 0;
+    m_data_length = 0;
+    m_residue = 0;
+    m_data_in = false;
+    
+    m_lba = 0;
+    m_blocks = 0;
+    m_chunk_blocks = 0;
+    
+    m_sense_key = SCSI_SENSE_NONE;
+    m_sense_asc = SCSI_ASC_NONE;
+}
+
+const uint8_t * UsbMsc::GetDeviceDescriptor()
+{
+    return device_descriptor;
+}
+
+const uint8_t * UsbMsc::GetConfigDescriptor(uint16_t * length)
+{
+    *length = sizeof(config_descriptor);
+    return config_descriptor;
+}
+
+const char * UsbMsc::GetProductString()
+{
+    return "OrionPlus CNC SD Card";
+}
+
+void UsbMsc::Configure(PCD_HandleTypeDef * pcd)
+{
+    HAL_PCD_EP_Open(pcd, MSC_DATA_OUT_EP, MSC_DATA_PACKET_SIZE, EP_TYPE_BULK);
+    HAL_PCD_EP_Open(pcd, MSC_DATA_IN_EP, MSC_DATA_PACKET_SIZE, EP_TYPE_BULK);
+    
+    // Card initialized by the disk task before the switch
+    m_medium_ready = (SDCARD_GetSectorCount() != 0) ? true : false;
+    m_sense_key = SCSI_SENSE_NONE;
+    m_sense_asc = SCSI_ASC_NONE;
+    
+    receive_command(pcd);
+}
+
+void UsbMsc::Unconfigure(PCD_HandleTypeDef * pcd)
+{
+    HAL_PCD_EP_Close(pcd, MSC_DATA_OUT_EP);
+    HAL_PCD_EP_Close(pcd, MSC_DATA_IN_EP);
+    
+    m_state = MSC_IDLE;
+}
+
+bool UsbMsc::ClassRequest(PCD_HandleTypeDef * pcd, const USB_SETUP_PACKET& setup, uint8_t ** data, uint16_t * length)
+{
+    switch (setup.bRequest)
+    {
+        case MSC_REQ_GET_MAX_LUN:
+            *data = &m_max_lun;
+            *length = 1;
+            return true;
+        
+        // Reset recovery: the host clears both halts next
+        case MSC_REQ_RESET:
+            receive_command(pcd);
+            return true;
+        
+        default:
+            return false;
+    }
+}
+
+void UsbMsc::DataIn(PCD_HandleTypeDef * pcd, uint8_t epnum)
+{
+    if (epnum != (MSC_DATA_IN_EP & EP_ADDR_MSK))
+        return;
+    
+    switch (m_state)
+    {
+        case MSC_DATA_IN:
+            send_status(pcd, MSC_STATUS_PASSED);
+            break;
+        
+        case MSC_READ:
+            continue_read(pcd);
+            break;
+        
+        case MSC_STATUS:
+            receive_command(pcd);
+            break;
+        
+        default:
+            break;
+    }
+}
+
+void UsbMsc::DataOut(PCD_HandleTypeDef * pcd, uint8_t epnum)
+{
+    if (epnum != MSC_DATA_OUT_EP)
+        return;
+    
+    switch (m_state)
+    {
+        case MSC_IDLE:
+            if (HAL_PCD_EP_GetRxCount(pcd, MSC_DATA_OUT_EP) == MSC_CBW_SIZE && get_le32(m_cbw) == MSC_CBW_SIGNATURE)
+            {
+                process_command(pcd);
+            }
+            else
+            {
+                m_state = MSC_INVALID_COMMAND;
+                HAL_PCD_EP_SetStall(pcd, MSC_DATA_IN_EP);
+                HAL_PCD_EP_SetStall(pcd, MSC_DATA_OUT_EP);
+            }
+            break;
+        
+        case MSC_WRITE:
+            continue_write(pcd);
+            break;
+        
+        default:
+            break;
+    }
+}
+
+void UsbMsc::EndpointCleared(PCD_HandleTypeDef * pcd, uint8_t ep_addr)
+{
+    // Invalid command block: halted until the mass storage reset, whatever the host clears
+    if (m_state == MSC_INVALID_COMMAND)
+        HAL_PCD_EP_SetStall(pcd, ep_addr);
+    else if (m_state == MSC_STATUS_PENDING && ep_addr == MSC_DATA_IN_EP)
+        send_status(pcd, MSC_STATUS_FAILED);
+}
+
+// Cable removed: give the card back to the FAT mount
+void UsbMsc::Detached(PCD_HandleTypeDef * pcd)
+{
+    DiskTask_ReleaseUsbStorage();
+}
+
+void UsbMsc::receive_command(PCD_HandleTypeDef * pcd)
+{
+    m_state = MSC_IDLE;
+    
+    HAL_PCD_EP_Receive(pcd, MSC_DATA_OUT_EP, m_cbw, MSC_DATA_PACKET_SIZE);
+}
+
+void UsbMsc::process_command(PCD_HandleTypeDef * pcd)
+{
+    const uint8_t * cb = &m_cbw[15];
+    uint32_t sectors = SDCARD_GetSectorCount();
+    
+    m_tag = get_le32(&m_cbw[4]);
+    m_data_length = get_le32(&m_cbw[8]);
+    m_data_in = (m_cbw[12] & 0x80) ? true : false;
+    m_residue = m_data_length;
+    
+    if (m_cbw[13] != 0)
+    {
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LUN_NOT_SUPPORTED);
+        return;
+    }
+    
+    switch (cb[0])
+    {
+        case SCSI_TEST_UNIT_READY:
+        case SCSI_VERIFY10:
+        case SCSI_SYNCHRONIZE_CACHE10:          // Writes go through to the card
+            if (!m_medium_ready)
+                fail_command(pcd, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+            else
+                send_status(pcd, MSC_STATUS_PASSED);
+            break;
+        
+        case SCSI_REQUEST_SENSE:
+            memset(m_response, 0, 18);
+            m_response[0] = 0x70;               // Current error, fixed format
+            m_response[2] = m_sense_key;
+            m_response[7] = 18 - 8;
+            m_response[12] = m_sense_asc;
+            
+            m_sense_key = SCSI_SENSE_NONE;
+            m_sense_asc = SCSI_ASC_NONE;
+            
+            send_data(pcd, m_response, 18);
+            break;
+        
+        case SCSI_INQUIRY:
+            if (cb[1] & 0x01)
+                fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD);     // Vital product data pages
+            else
+                send_data(pcd, inquiry_data, sizeof(inquiry_data));
+            break;
+        
+        case SCSI_MODE_SENSE6:
+            send_data(pcd, mode_sense6_data, sizeof(mode_sense6_data));
+            break;
+        
+        case SCSI_MODE_SENSE10:
+            send_data(pcd, mode_sense10_data, sizeof(mode_sense10_data));
+            break;
+        
+        case SCSI_PREVENT_ALLOW_REMOVAL:
+            send_status(pcd, MSC_STATUS_PASSED);
+            break;
+        
+        case SCSI_START_STOP_UNIT:
+            // Eject [LoEj, no Start]: the host has flushed its writes, the card goes back to the FAT mount
+            if ((cb[4] & 0x03) == 0x02 && m_medium_ready)
+            {
+                m_medium_ready = false;
+                DiskTask_ReleaseUsbStorage();
+            }
+            
+            send_status(pcd, MSC_STATUS_PASSED);
+            break;
+        
+        case SCSI_READ_FORMAT_CAPACITIES:
+            if (!m_medium_ready)
+            {
+                fail_command(pcd, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+                break;
+            }
+            
+            memset(m_response, 0, 12);
+            m_response[3] = 8;                  // Capacity list length
+            put_be32(&m_response[4], sectors);
+            put_be32(&m_response[8], (0x02UL << 24) | SDCARD_SECTOR_SIZE);      // Formatted media, block length
+            
+            send_data(pcd, m_response, 12);
+            break;
+        
+        case SCSI_READ_CAPACITY10:
+            if (!m_medium_ready)
+            {
+                fail_command(pcd, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+                break;
+            }
+            
+            put_be32(&m_response[0], sectors - 1);
+            put_be32(&m_response[4], SDCARD_SECTOR_SIZE);
+            
+            send_data(pcd, m_response, 8);
+            break;
+        
+        case SCSI_READ10:
+            start_read(pcd);
+            break;
+        
+        case SCSI_WRITE10:
+            start_write(pcd);
+            break;
+        
+        default:
+            fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND);
+            break;
+    }
+}
+
+// Short response, cut to what the host asked for
+void UsbMsc::send_data(PCD_HandleTypeDef * pcd, const uint8_t * data, uint32_t length)
+{
+    if (!m_data_in || m_data_length == 0)
+    {
+        send_status(pcd, MSC_STATUS_PASSED);
+        return;
+    }
+    
+    length = std::min(length, m_data_length);
+    m_residue = m_data_length - length;
+    m_state = MSC_DATA_IN;
+    
+    HAL_PCD_EP_Transmit(pcd, MSC_DATA_IN_EP, (uint8_t*)data, length);
+}
+
+void UsbMsc::send_status(PCD_HandleTypeDef * pcd, uint8_t status)
+{
+    put_le32(&m_csw[0], MSC_CSW_SIGNATURE);
+    put_le32(&m_csw[4], m_tag);
+    put_le32(&m_csw[8], m_residue);
+    m_csw[12] = status;
+    
+    m_state = MSC_STATUS;
+    
+    HAL_PCD_EP_Transmit(pcd, MSC_DATA_IN_EP, m_csw, MSC_CSW_SIZE);
+}
+
+// Data still expected by the host: the data endpoint is halted, the status follows (IN: once cleared)
+void UsbMsc::fail_command(PCD_HandleTypeDef * pcd, uint8_t sense_key, uint8_t asc)
+{
+    m_sense_key = sense_key;
+    m_sense_asc = asc;
+    
+    if (m_residue != 0)
+    {
+        if (m_data_in)
+        {
+            m_state = MSC_STATUS_PENDING;
+            HAL_PCD_EP_SetStall(pcd, MSC_DATA_IN_EP);
+            return;
+        }
+        
+        HAL_PCD_EP_SetStall(pcd, MSC_DATA_OUT_EP);
+    }
+    
+    send_status(pcd, MSC_STATUS_FAILED);
+}
+
+void UsbMsc::start_read(PCD_HandleTypeDef * pcd)
+{
+    const uint8_t * cb = &m_cbw[15];
+    uint32_t sectors = SDCARD_GetSectorCount();
+    
+    m_lba = get_be32(&cb[2]);
+    m_blocks = ((uint32_t)cb[7] << 8) | cb[8];
+    
+    if (!m_medium_ready)
+        fail_command(pcd, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+    else if (!m_data_in || m_data_length != (m_blocks * SDCARD_SECTOR_SIZE))
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD);
+    else if (m_lba >= sectors || (sectors - m_lba) < m_blocks)
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    else
+        continue_read(pcd);
+}
+
+// Next run of sectors: one multiple block read from the card, one IN transfer to the host
+void UsbMsc::continue_read(PCD_HandleTypeDef * pcd)
+{
+    if (m_blocks == 0)
+    {
+        send_status(pcd, MSC_STATUS_PASSED);
+        return;
+    }
+    
+    m_chunk_blocks = std::min(m_blocks, (uint32_t)MSC_MEDIA_BUFFER_SECTORS);
+    
+    if (SDCARD_ReadBlocks((uint8_t*)media_buffer, m_lba, m_chunk_blocks) != SDCARD_OK)
+    {
+        fail_command(pcd, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_READ_ERROR);
+        return;
+    }
+    
+    m_lba += m_chunk_blocks;
+    m_blocks -= m_chunk_blocks;
+    m_residue -= m_chunk_blocks * SDCARD_SECTOR_SIZE;
+    m_state = MSC_READ;
+    
+    HAL_PCD_EP_Transmit(pcd, MSC_DATA_IN_EP, (uint8_t*)media_buffer, m_chunk_blocks * SDCARD_SECTOR_SIZE);
+}
+
+void UsbMsc::start_write(PCD_HandleTypeDef * pcd)
+{
+    const uint8_t * cb = &m_cbw[15];
+    uint32_t sectors = SDCARD_GetSectorCount();
+    
+    m_lba = get_be32(&cb[2]);
+    m_blocks = ((uint32_t)cb[7] << 8) | cb[8];
+    
+    if (!m_medium_ready)
+    {
+        fail_command(pcd, SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+    }
+    else if (m_data_in || m_data_length != (m_blocks * SDCARD_SECTOR_SIZE))
+    {
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD);
+    }
+    else if (m_lba >= sectors || (sectors - m_lba) < m_blocks)
+    {
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+    }
+    else if (m_blocks == 0)
+    {
+        send_status(pcd, MSC_STATUS_PASSED);
+    }
+    else
+    {
+        m_chunk_blocks = std::min(m_blocks, (uint32_t)MSC_MEDIA_BUFFER_SECTORS);
+        m_state = MSC_WRITE;
+        
+        HAL_PCD_EP_Receive(pcd, MSC_DATA_OUT_EP, (uint8_t*)media_buffer, m_chunk_blocks * SDCARD_SECTOR_SIZE);
+    }
+}
+
+// Run of sectors received: one multiple block write to the card, then the next OUT transfer
+void UsbMsc::continue_write(PCD_HandleTypeDef * pcd)
+{
+    uint32_t received = HAL_PCD_EP_GetRxCount(pcd, MSC_DATA_OUT_EP);
+    
+    m_residue -= std::min(received, m_residue);
+    
+    if (received != (m_chunk_blocks * SDCARD_SECTOR_SIZE))
+    {
+        fail_command(pcd, SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD);
+        return;
+    }
+    
+    if (SDCARD_WriteBlocks((const uint8_t*)media_buffer, m_lba, m_chunk_blocks) != SDCARD_OK)
+    {
+        fail_command(pcd, SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_FAULT);
+        return;
+    }
+    
+    m_lba += m_chunk_blocks;
+    m_blocks -= m_chunk_blocks;
+    
+    if (m_blocks == 0)
+    {
+        send_status(pcd, MSC_STATUS_PASSED);
+        return;
+    }
+    
+    m_chunk_blocks = std::min(m_blocks, (uint32_t)MSC_MEDIA_BUFFER_SECTORS);
+    
+    HAL_PCD_EP_Receive(pcd, MSC_DATA_OUT_EP, (uint8_t*)media_buffer, m_chunk_blocks * SDCARD_SECTOR_SIZE);
+}
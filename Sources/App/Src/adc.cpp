@@ -1,9 +1,14 @@
 #include <stm32f4xx_hal.h>
 #include "pins.h"
 #include "adc.h"
+#include "dma.h"
+#include "hw_timers.h"
 
 ADC_HandleTypeDef hadc1;
 
+// Written by DMA2_Stream4 in circular mode, one scan of all channels per TIM4 period
+static volatile uint16_t adc_scan_buffer[ANALOG_OVERSAMPLING][ANALOG_CHANNELS_COUNT];
+
 /* ADC1 init function */
 void Init_ADC(void)
 {
@@ -14,14 +19,14 @@ void Init_ADC(void)
     hadc1.Instance = ADC1;
     hadc1.Init.ClockPrescaler = ADC_CLOCK_SYNC_PCLK_DIV4;
     hadc1.Init.Resolution = ADC_RESOLUTION_12B;
-    hadc1.Init.ScanConvMode = DISABLE;
+    hadc1.Init.ScanConvMode = ENABLE;
     hadc1.Init.ContinuousConvMode = DISABLE;
     hadc1.Init.DiscontinuousConvMode = DISABLE;
-    hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE; // Try to use Timer4 CC4 as ext trigger
-    hadc1.Init.ExternalTrigConv = ADC_SOFTWARE_START;
+    hadc1.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING; // Timer4 CC4 starts each scan
+    hadc1.Init.ExternalTrigConv = ADC_EXTERNALTRIGCONV_T4_CC4;
     hadc1.Init.DataAlign = ADC_DATAALIGN_RIGHT;
-    hadc1.Init.NbrOfConversion = 8;
-    hadc1.Init.DMAContinuousRequests = DISABLE;
+    hadc1.Init.NbrOfConversion = ANALOG_CHANNELS_COUNT;
+    hadc1.Init.DMAContinuousRequests = ENABLE;
     hadc1.Init.EOCSelection = ADC_EOC_SEQ_CONV;
     
     HAL_ADC_Init(&hadc1);
@@ -29,9 +34,10 @@ void Init_ADC(void)
     /** Configure for the selected ADC regular channel its corresponding rank 
         in the sequencer and its sample time. */
     
-    sConfig.SamplingTime = ADC_SAMPLETIME_3CYCLES;
+    // 21 MHz ADC clock: ~60 us per scan, long sampling for high impedance sources (potentiometers)
+    sConfig.SamplingTime = ADC_SAMPLETIME_144CYCLES;
   
-    for (index = 0; index < 8; index++)
+    for (index = 0; index < ANALOG_CHANNELS_COUNT; index++)
     {
         sConfig.Channel = ADC_CHANNEL_0 + index;
         sConfig.Rank = index + 1;
@@ -40,6 +46,47 @@ void Init_ADC(void)
     }
 }
 
+// DMA and PWM timers must be already initialized. No interrupts are used: the buffer is read on demand
+void Start_ADC_Scan(void)
+{
+    HAL_ADC_Start_DMA(&hadc1, (uint32_t*)adc_scan_buffer, ANALOG_OVERSAMPLING * ANALOG_CHANNELS_COUNT);
+    
+    // Only the overrun interrupt would fire [ADC_IRQn not enabled], leave the streams quiet
+    __HAL_DMA_DISABLE_IT(&hdma_adc1, DMA_IT_TC | DMA_IT_HT | DMA_IT_TE);
+    
+    HAL_TIM_PWM_Start(&pwm3_timer_handle, TIM_CHANNEL_4);
+}
+
+uint32_t ADC_GetValue(uint32_t channel)
+{
+    uint32_t sum = 0;
+    
+    if (channel >= ANALOG_CHANNELS_COUNT)
+        return 0;
+    
+    for (uint32_t index = 0; index < ANALOG_OVERSAMPLING; index++)
+        sum += adc_scan_buffer[index][channel];
+    
+    return sum;
+}
+
+uint32_t ADC_GetValue_mV(uint32_t channel)
+{
+    return (ADC_GetValue(channel) * ANALOG_VREF_mV) / ANALOG_FULL_SCALE;
+}
+
+void ADC_GetSnapshot(uint32_t * values)
+{
+    for (uint32_t channel = 0; channel < ANALOG_CHANNELS_COUNT; channel++)
+        values[channel] = 0;
+    
+    for (uint32_t index = 0; index < ANALOG_OVERSAMPLING; index++)
+    {
+        for (uint32_t channel = 0; channel < ANALOG_CHANNELS_COUNT; channel++)
+            values[channel] += adc_scan_buffer[index][channel];
+    }
+}
+
 void HAL_ADC_MspInit(ADC_HandleTypeDef* adcHandle)
 {
     GPIO_InitTypeDef GPIO_InitStruct = {0};
@@ -49,6 +96,8 @@ void HAL_ADC_MspInit(ADC_HandleTypeDef* adcHandle)
         /* ADC1 clock enable */
         __HAL_RCC_ADC1_CLK_ENABLE();
         __HAL_RCC_GPIOA_CLK_ENABLE();
+        
+        __HAL_LINKDMA(adcHandle, DMA_Handle, hdma_adc1);
 
         /**ADC1 GPIO Configuration    
         PA0     ------> ADC1_IN0
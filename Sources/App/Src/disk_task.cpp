@@ -4,23 +4,129 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
-
+#include "ff_sddisk.h"
+#include "ff_sys.h"
 
 #include "task_settings.h"
 #include "disk_task.h"
 #include "settings_manager.h"
 
+#include "UsbDevice.h"
+#include "UsbCdc.h"
+#include "UsbMsc.h"
+
+#define DISK_MOUNT_POINT            "/"
+
 TaskHandle_t disk_task_handle;
 
+static volatile DISK_MODES disk_mode = DISK_MODE_NO_CARD;
+static FF_Disk_t * sd_disk = NULL;
+
+// Pending synchronous request
+static volatile DISK_MODES requested_mode;
+static TaskHandle_t volatile requester = NULL;
+
+// Card initialized, FAT volume mounted and added as the root directory
+static void mount_card()
+{
+    sd_disk = FF_SDDiskInit(DISK_MOUNT_POINT);
+    
+    if (sd_disk != NULL)
+        disk_mode = DISK_MODE_LOCAL;
+}
+
+static void enter_usb_storage()
+{
+    if (disk_mode != DISK_MODE_LOCAL || !UsbDevice::IsAttached())
+        return;
+    
+    // No new file opened from now on. Open files (job, statistics, trace dump) keep the volume mounted
+    FF_FS_Remove(DISK_MOUNT_POINT);
+    
+    if (FF_SDDiskUnmount(sd_disk) != pdPASS)
+    {
+        FF_FS_Add(DISK_MOUNT_POINT, sd_disk);
+        return;
+    }
+    
+    // The I/O manager goes with its sector cache, stale once the host has written to the card
+    FF_SDDiskDelete(sd_disk);
+    sd_disk = NULL;
+    
+    disk_mode = DISK_MODE_USB_STORAGE;
+    UsbDevice::RequestFunction(&usb_msc);
+}
+
+static void leave_usb_storage()
+{
+    if (disk_mode != DISK_MODE_USB_STORAGE)
+        return;
+    
+    // The card belongs to the USB task until it runs the serial port function again
+    UsbDevice::RequestFunction(&usb_cdc);
+    
+    while (UsbDevice::GetFunction() != &usb_cdc)
+        vTaskDelay(pdMS_TO_TICKS(DISK_REQUEST_POLL_MS));
+    
+    disk_mode = DISK_MODE_NO_CARD;
+    
+    // Card initialized again: it may have been swapped while exported
+    mount_card();
+}
+
 void DiskTask_Entry(void * pvParam)
 {
+    uint32_t events;
+    TaskHandle_t task;
+    
     // Initialize FAT Stack [SDCard Device]
+    mount_card();
     
     for ( ; ; )
     {
-        vTaskSuspend(NULL); 
+        events = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &events, (disk_mode == DISK_MODE_NO_CARD) ? pdMS_TO_TICKS(DISK_MOUNT_RETRY_MS) : portMAX_DELAY);
+        
+        if (disk_mode == DISK_MODE_NO_CARD)
+            mount_card();
+        
+        if (events & DISK_NOTIFY_USB_STORAGE)
+            enter_usb_storage();
+        
+        if (events & DISK_NOTIFY_LOCAL)
+            leave_usb_storage();
+        
+        task = requester;
+        
+        if ((events & (DISK_NOTIFY_USB_STORAGE | DISK_NOTIFY_LOCAL)) && task != NULL)
+        {
+            requester = NULL;
+            xTaskNotifyGive(task);
+        }
     }
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
+bool DiskTask_SetUsbStorage(bool enable)
+{
+    requested_mode = enable ? DISK_MODE_USB_STORAGE : DISK_MODE_LOCAL;
+    requester = xTaskGetCurrentTaskHandle();
+    
+    xTaskNotify(disk_task_handle, enable ? DISK_NOTIFY_USB_STORAGE : DISK_NOTIFY_LOCAL, eSetBits);
+    
+    while (requester != NULL)
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DISK_REQUEST_POLL_MS));
+    
+    return (disk_mode == requested_mode) ? true : false;
+}
+
+void DiskTask_ReleaseUsbStorage(void)
+{
+    xTaskNotify(disk_task_handle, DISK_NOTIFY_LOCAL, eSetBits);
+}
 
+DISK_MODES DiskTask_GetMode(void)
+{
+    return disk_mode;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
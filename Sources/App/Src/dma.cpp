@@ -3,17 +3,31 @@
 #include "dma.h"
 
 DMA_HandleTypeDef hdma_memtomem_dma2_stream0;
+DMA_HandleTypeDef hdma_spindle_uart_tx;
+DMA_HandleTypeDef hdma_spindle_uart_rx;
+DMA_HandleTypeDef hdma_adc1;
+DMA_HandleTypeDef hdma_debug_uart_rx;
+DMA_HandleTypeDef hdma_debug_uart_tx;
 
 /** 
   * Enable DMA controller clock
   * Configure DMA for memory to memory transfers
   *   hdma_memtomem_dma2_stream0
+  * Configure DMA for spindle USART3 (polled, no interrupts)
+  *   hdma_spindle_uart_tx  [DMA1_Stream3, Channel 4]
+  *   hdma_spindle_uart_rx  [DMA1_Stream1, Channel 4]
+  * Configure DMA for the analog inputs scan (circular, no interrupts)
+  *   hdma_adc1             [DMA2_Stream4, Channel 0]
+  * Configure DMA for the host link USART1 (Rx circular, Tx one chunk at a time)
+  *   hdma_debug_uart_rx    [DMA2_Stream2, Channel 4]
+  *   hdma_debug_uart_tx    [DMA2_Stream7, Channel 4]
   */
 void Init_DMA_Controller(void) 
 {
     /* DMA controller clock enable */
+    __HAL_RCC_DMA1_CLK_ENABLE();
     __HAL_RCC_DMA2_CLK_ENABLE();
-
+    
     /* Configure DMA request hdma_memtomem_dma2_stream0 on DMA2_Stream0 */
     hdma_memtomem_dma2_stream0.Instance = DMA2_Stream0;
     hdma_memtomem_dma2_stream0.Init.Channel = DMA_CHANNEL_0;
@@ -30,5 +44,84 @@ void Init_DMA_Controller(void)
     hdma_memtomem_dma2_stream0.Init.PeriphBurst = DMA_PBURST_SINGLE;
     
     HAL_DMA_Init(&hdma_memtomem_dma2_stream0);
+    
+    /* Display flush completion. Lower than motion & serial, handler uses no OS calls */
+    HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 7, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+    
+    /* Configure DMA request hdma_spindle_uart_tx on DMA1_Stream3 */
+    hdma_spindle_uart_tx.Instance = DMA1_Stream3;
+    hdma_spindle_uart_tx.Init.Channel = DMA_CHANNEL_4;
+    hdma_spindle_uart_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_spindle_uart_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spindle_uart_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spindle_uart_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spindle_uart_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spindle_uart_tx.Init.Mode = DMA_NORMAL;
+    hdma_spindle_uart_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_spindle_uart_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    
+    HAL_DMA_Init(&hdma_spindle_uart_tx);
+    
+    /* Configure DMA request hdma_spindle_uart_rx on DMA1_Stream1 */
+    hdma_spindle_uart_rx.Instance = DMA1_Stream1;
+    hdma_spindle_uart_rx.Init.Channel = DMA_CHANNEL_4;
+    hdma_spindle_uart_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_spindle_uart_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spindle_uart_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spindle_uart_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spindle_uart_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spindle_uart_rx.Init.Mode = DMA_NORMAL;
+    hdma_spindle_uart_rx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_spindle_uart_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    
+    HAL_DMA_Init(&hdma_spindle_uart_rx);
+    
+    /* Configure DMA request hdma_adc1 on DMA2_Stream4 */
+    hdma_adc1.Instance = DMA2_Stream4;
+    hdma_adc1.Init.Channel = DMA_CHANNEL_0;
+    hdma_adc1.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_adc1.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_adc1.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_adc1.Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+    hdma_adc1.Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+    hdma_adc1.Init.Mode = DMA_CIRCULAR;
+    hdma_adc1.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_adc1.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    
+    HAL_DMA_Init(&hdma_adc1);
+    
+    /* Configure DMA request hdma_debug_uart_rx on DMA2_Stream2 */
+    hdma_debug_uart_rx.Instance = DMA2_Stream2;
+    hdma_debug_uart_rx.Init.Channel = DMA_CHANNEL_4;
+    hdma_debug_uart_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_debug_uart_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_debug_uart_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_debug_uart_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_debug_uart_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_debug_uart_rx.Init.Mode = DMA_CIRCULAR;
+    hdma_debug_uart_rx.Init.Priority = DMA_PRIORITY_MEDIUM;
+    hdma_debug_uart_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    
+    HAL_DMA_Init(&hdma_debug_uart_rx);
+    
+    /* Configure DMA request hdma_debug_uart_tx on DMA2_Stream7 */
+    hdma_debug_uart_tx.Instance = DMA2_Stream7;
+    hdma_debug_uart_tx.Init.Channel = DMA_CHANNEL_4;
+    hdma_debug_uart_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_debug_uart_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_debug_uart_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_debug_uart_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_debug_uart_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_debug_uart_tx.Init.Mode = DMA_NORMAL;
+    hdma_debug_uart_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_debug_uart_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    
+    HAL_DMA_Init(&hdma_debug_uart_tx);
+    
+    /* Host link, same level as USART1 (handlers notify the serial task) */
+    HAL_NVIC_SetPriority(DMA2_Stream2_IRQn, 6, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, 6, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
 }
-
@@ -6,6 +6,7 @@
 #include "task.h"
 #include "event_groups.h"
 
+#include "task_settings.h"
 #include "user_tasks.h"
 #include "MachineCore.h"
 
@@ -102,11 +103,17 @@ void Init_GPIO_Pins(void)
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
     /*Configure GPIO pins : Port B */
-    GPIO_InitStruct.Pin = CTOUCH_IRQ_Pin | SPIN_AUX_Pin;    // PB1, PB12
+    GPIO_InitStruct.Pin = SPIN_AUX_Pin;                     // PB12
     GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
     GPIO_InitStruct.Pull = GPIO_PULLDOWN;
     HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+    /*Configure GPIO pin : Port B [NVIC enabled by touch driver] */
+    GPIO_InitStruct.Pin = CTOUCH_IRQ_Pin;                   // PB1 -> EXTI1
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;                   // Also selects I2C address 0xBA on reset
+    HAL_GPIO_Init(CTOUCH_IRQ_GPIO_Port, &GPIO_InitStruct);
+
     /*Configure GPIO pin : Port F */
     GPIO_InitStruct.Pin = CTOUCH_SDA_Pin;                   // PF11
     GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
@@ -141,8 +148,8 @@ void Init_GPIO_Pins(void)
     HAL_GPIO_Init(PROBE_INPUT_GPIO_Port, &GPIO_InitStruct);
 
     /*Configure GPIO pins : Port C */
-    GPIO_InitStruct.Pin = LIM_X_Pin | LIM_Y_Pin | LIM_Z_Pin;  // PC6, PC7, PC8  -> EXTI6, 7, 8
-    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Pin = LIM_X_Pin | LIM_Y_Pin | LIM_Z_Pin;  // PC6, PC7, PC8  -> EXTI6, 7, 8 [active level checked in handler]
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
     GPIO_InitStruct.Pull = GPIO_PULLDOWN;
     HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
 
@@ -169,7 +176,8 @@ void Init_GPIO_Pins(void)
     exti_pr = EXTI->PR;
     EXTI->PR = exti_pr;
     
-    HAL_NVIC_SetPriority(EXTI9_5_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+    // Same level as the step timer: never runs in the middle of a tick
+    HAL_NVIC_SetPriority(EXTI9_5_IRQn, STEP_IRQ_PRIORITY, 0);
     HAL_NVIC_EnableIRQ(EXTI9_5_IRQn); 
 }
 
@@ -178,12 +186,9 @@ void Init_GPIO_Pins(void)
 extern "C" void EXTI9_5_IRQHandler(void)
 {
     uint32_t pr_value = EXTI->PR;
-    BaseType_t high_prio_woken = pdFALSE;
     
-    high_prio_woken = machine->NotifyOfEvent(pr_value);
+    machine->NotifyOfEvent(pr_value);
     
     // Clear all pending bits
     EXTI->PR = pr_value;
-    
-    portYIELD_FROM_ISR(high_prio_woken);
 }
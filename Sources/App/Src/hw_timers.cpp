@@ -6,6 +6,8 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+#include "task_settings.h"
+
 
 TIM_HandleTypeDef step_timer_handle;
 TIM_HandleTypeDef unstep_timer_handle;
@@ -75,9 +77,9 @@ void Init_Pwm3_Timer4(void)
     TIM_OC_InitTypeDef sConfigOC = {0};
 
     pwm3_timer_handle.Instance = TIM4;
-    pwm3_timer_handle.Init.Prescaler = 0;
+    pwm3_timer_handle.Init.Prescaler = 84-1; // 84 MHz / 84 = 1 MHz
     pwm3_timer_handle.Init.CounterMode = TIM_COUNTERMODE_UP;
-    pwm3_timer_handle.Init.Period = 0;
+    pwm3_timer_handle.Init.Period = PWM3_TIMER_PERIOD - 1; // 1 kHz [PWM3 output, ADC scan trigger]
     pwm3_timer_handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
     pwm3_timer_handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
     
@@ -101,6 +103,11 @@ void Init_Pwm3_Timer4(void)
     
     HAL_TIM_PWM_ConfigChannel(&pwm3_timer_handle, &sConfigOC, TIM_CHANNEL_2);
     
+    // CH4 has no pin assigned, its compare event starts each ADC scan
+    sConfigOC.Pulse = PWM3_TIMER_PERIOD / 2;
+    
+    HAL_TIM_PWM_ConfigChannel(&pwm3_timer_handle, &sConfigOC, TIM_CHANNEL_4);
+    
     HAL_TIM_MspPostInit(&pwm3_timer_handle);
 }
 
@@ -111,9 +118,9 @@ void Init_Pwm12_Timer9(void)
     TIM_OC_InitTypeDef sConfigOC = {0};
 
     pwm12_timer_handle.Instance = TIM9;
-    pwm12_timer_handle.Init.Prescaler = 0;
+    pwm12_timer_handle.Init.Prescaler = 168 - 1; // 168 MHz / 168 = 1 MHz
     pwm12_timer_handle.Init.CounterMode = TIM_COUNTERMODE_UP;
-    pwm12_timer_handle.Init.Period = 0;
+    pwm12_timer_handle.Init.Period = PWM12_TIMER_PERIOD - 1; // 1 kHz [Spindle speed/direction]
     pwm12_timer_handle.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
     pwm12_timer_handle.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
     
@@ -175,8 +182,8 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* tim_baseHandle)
         /* TIM2 clock enable */
         __HAL_RCC_TIM2_CLK_ENABLE();
 
-        /* TIM2 interrupt Init */
-        HAL_NVIC_SetPriority(TIM2_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+        /* TIM2 interrupt Init [above the kernel: step jitter independent of task critical sections] */
+        HAL_NVIC_SetPriority(TIM2_IRQn, STEP_IRQ_PRIORITY, 0);
         HAL_NVIC_EnableIRQ(TIM2_IRQn); 
     }
     else if (tim_baseHandle->Instance == TIM4)
@@ -190,7 +197,7 @@ void HAL_TIM_Base_MspInit(TIM_HandleTypeDef* tim_baseHandle)
         __HAL_RCC_TIM6_CLK_ENABLE();
 
         /* TIM6 interrupt Init */
-        HAL_NVIC_SetPriority(TIM6_DAC_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY, 0);
+        HAL_NVIC_SetPriority(TIM6_DAC_IRQn, STEP_IRQ_PRIORITY, 0);
         HAL_NVIC_EnableIRQ(TIM6_DAC_IRQn);
     }
     else if (tim_baseHandle->Instance == TIM9)
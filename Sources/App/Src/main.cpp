@@ -35,6 +35,7 @@ int main(void)
     Init_Spindle_UART3();
     Init_Pwm3_Timer4();
     Init_Pwm12_Timer9();
+    Start_ADC_Scan();
     
     Settings_Manager::Initialize();
     
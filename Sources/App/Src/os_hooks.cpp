@@ -10,6 +10,7 @@
 
 
 /* FreeRTOS Hooks */
+// Heartbeat only, motion housekeeping runs in the motion service task [MachineCore::motion_task_entry]
 extern "C" void vApplicationIdleHook( void )
 {
     static uint32_t counter = 0;
@@ -19,9 +20,6 @@ extern "C" void vApplicationIdleHook( void )
         counter = 0;
         HAL_GPIO_TogglePin(LED_1_GPIO_Port, LED_1_Pin);
     }
-    
-    if (counter == 0)
-        machine->OnIdle();    
 }
 
 extern "C" void vApplicationTickHook( void )
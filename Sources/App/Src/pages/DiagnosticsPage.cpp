@@ -0,0 +1,107 @@
+#include "DiagnosticsPage.h"
+
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "user_tasks.h"
+#include "MachineCore.h"
+#include "MemoryPool.h"
+
+void DiagnosticsPage::Create(lv_obj_t * parent)
+{
+    uint16_t xsize, ysize;
+    lv_obj_t * title;
+    
+    m_page_handle = lv_cont_create(parent, NULL);
+    
+    xsize = lv_obj_get_width(parent);
+    ysize = lv_obj_get_height(parent);
+    
+    lv_obj_set_size(m_page_handle, xsize, ysize);
+    
+    // Profiler report [task and ISR loads, planner, queue], scrollable
+    m_report_text = (char*)pvPortMalloc(DIAG_REPORT_TEXT_SIZE);
+    m_report_text[0] = 0;
+    
+    m_report_page = lv_page_create(m_page_handle, NULL);
+    lv_obj_set_pos(m_report_page, 10, 10);
+    lv_obj_set_size(m_report_page, 460, ysize - 20);
+    
+    m_report_label = lv_label_create(m_report_page, NULL);
+    lv_label_set_static_text(m_report_label, m_report_text);
+    
+    // Queue depth, one point per profiler window
+    title = lv_label_create(m_page_handle, NULL);
+    lv_label_set_text(title, "Cola de bloques");
+    lv_obj_set_pos(title, 490, 10);
+    
+    m_queue_chart = lv_chart_create(m_page_handle, NULL);
+    lv_obj_set_pos(m_queue_chart, 490, 40);
+    lv_obj_set_size(m_queue_chart, 290, 200);
+    lv_chart_set_type(m_queue_chart, LV_CHART_TYPE_LINE);
+    lv_chart_set_point_count(m_queue_chart, PROFILER_QUEUE_HISTORY);
+    lv_chart_set_range(m_queue_chart, 0, machine->GetQueueSize());
+    lv_chart_set_div_line_count(m_queue_chart, 3, 0);
+    
+    m_queue_series = lv_chart_add_series(m_queue_chart, LV_COLOR_LIME);
+    lv_chart_init_points(m_queue_chart, m_queue_series, LV_CHART_POINT_DEF);
+    
+    // Force first update
+    m_shown_window_seq = Profiler::GetWindowSequence() - 1;
+    
+    Update();
+}
+
+void DiagnosticsPage::Destroy()
+{
+    lv_obj_del(m_page_handle);
+    vPortFree(m_report_text);
+}
+
+void DiagnosticsPage::Update()
+{
+    uint8_t depths[PROFILER_QUEUE_HISTORY];
+    uint32_t count, index;
+    
+    if (m_shown_window_seq == Profiler::GetWindowSequence())
+        return;
+    
+    m_shown_window_seq = Profiler::GetWindowSequence();
+    
+    // Same text as the $P and $M serial commands
+    m_report_len = 0;
+    m_report_text[0] = 0;
+    
+    Profiler::Report(DiagnosticsPage::append_report_line, (void*)this);
+    MemoryPools::Report(DiagnosticsPage::append_report_line, (void*)this);
+    lv_label_set_static_text(m_report_label, m_report_text);
+    
+    // Newest window at the right, missing ones are not drawn
+    count = Profiler::GetQueueHistory(depths, PROFILER_QUEUE_HISTORY);
+    
+    for (index = 0; index < PROFILER_QUEUE_HISTORY; index++)
+    {
+        if (index < (PROFILER_QUEUE_HISTORY - count))
+            m_queue_series->points[index] = LV_CHART_POINT_DEF;
+        else
+            m_queue_series->points[index] = depths[index - (PROFILER_QUEUE_HISTORY - count)];
+    }
+    
+    lv_chart_refresh(m_queue_chart);
+}
+
+void DiagnosticsPage::append_report_line(void * context, const char * text)
+{
+    DiagnosticsPage * self = (DiagnosticsPage*)context;
+    uint32_t len = strlen(text);
+    
+    // Truncate what does not fit
+    if ((self->m_report_len + len + 2) > DIAG_REPORT_TEXT_SIZE)
+        return;
+    
+    memcpy(self->m_report_text + self->m_report_len, text, len);
+    self->m_report_len += len;
+    self->m_report_text[self->m_report_len++] = '\n';
+    self->m_report_text[self->m_report_len] = 0;
+}
@@ -1,9 +1,19 @@
 #include "MainPage.h"
 
+#include <stdio.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+
+#include "user_tasks.h"
+#include "MachineCore.h"
+
+static const char axis_names[DRO_AXES_COUNT] = { 'X', 'Y', 'Z' };
 
 void MainPage::Create(lv_obj_t * parent)
 {
     uint16_t xsize, ysize;
+    uint32_t index;
     
     m_page_handle = lv_cont_create(parent, NULL);
     
@@ -11,9 +21,71 @@ void MainPage::Create(lv_obj_t * parent)
     ysize = lv_obj_get_height(parent);
     
     lv_obj_set_size(m_page_handle, xsize, ysize);
+    
+    // Create DRO labels [current position | target of last queued move]
+    m_xyz_curr_labels = (lv_obj_t**)ui_pool_alloc(sizeof(lv_obj_t*) * DRO_AXES_COUNT);
+    m_xyz_next_labels = (lv_obj_t**)ui_pool_alloc(sizeof(lv_obj_t*) * DRO_AXES_COUNT);
+    
+    for (index = 0; index < DRO_AXES_COUNT; index++)
+    {
+        m_xyz_curr_labels[index] = lv_label_create(m_page_handle, NULL);
+        
+        lv_label_set_long_mode(m_xyz_curr_labels[index], LV_LABEL_LONG_CROP);
+        lv_label_set_align(m_xyz_curr_labels[index], LV_LABEL_ALIGN_RIGHT);
+        lv_obj_set_pos(m_xyz_curr_labels[index], 20, 20 + index * 60);
+        lv_obj_set_size(m_xyz_curr_labels[index], 240, 48);
+        
+        m_xyz_next_labels[index] = lv_label_create(m_page_handle, NULL);
+        
+        lv_label_set_long_mode(m_xyz_next_labels[index], LV_LABEL_LONG_CROP);
+        lv_label_set_align(m_xyz_next_labels[index], LV_LABEL_ALIGN_RIGHT);
+        lv_obj_set_pos(m_xyz_next_labels[index], 280, 20 + index * 60);
+        lv_obj_set_size(m_xyz_next_labels[index], 240, 48);
+        
+        // Force first update
+        m_curr_label_text[index][0] = 0;
+        m_next_label_text[index][0] = 0;
+    }
+    
+    Update();
 }
 
 void MainPage::Destroy()
 {
     lv_obj_del(m_page_handle);
+    
+    ui_pool_free(m_xyz_curr_labels);
+    ui_pool_free(m_xyz_next_labels);
+}
+
+void MainPage::Update()
+{
+    float curr_pos[COORDINATE_LINEAR_AXES_COUNT];
+    float next_pos[COORDINATE_LINEAR_AXES_COUNT];
+    char text[DRO_TEXT_MAX_LEN];
+    uint32_t index;
+    
+    machine->GetCurrentPosition_mm(curr_pos);
+    machine->GetPlannedPosition_mm(next_pos);
+    
+    for (index = 0; index < DRO_AXES_COUNT; index++)
+    {
+        snprintf(text, sizeof(text), "%c %9.3f", axis_names[index], curr_pos[index]);
+        update_label(m_xyz_curr_labels[index], m_curr_label_text[index], text);
+        
+        snprintf(text, sizeof(text), "%c %9.3f", axis_names[index], next_pos[index]);
+        update_label(m_xyz_next_labels[index], m_next_label_text[index], text);
+    }
+}
+
+// Setting a label text invalidates its area, so only do it when the text changed
+void MainPage::update_label(lv_obj_t * label, char * shown_text, const char * new_text)
+{
+    if (strncmp(shown_text, new_text, DRO_TEXT_MAX_LEN) == 0)
+        return;
+    
+    strncpy(shown_text, new_text, DRO_TEXT_MAX_LEN - 1);
+    shown_text[DRO_TEXT_MAX_LEN - 1] = 0;
+    
+    lv_label_set_text(label, shown_text);
 }
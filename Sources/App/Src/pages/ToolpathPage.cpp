@@ -0,0 +1,207 @@
+#include "ToolpathPage.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "FreeRTOS.h"
+
+#include "settings_manager.h"
+#include "user_tasks.h"
+#include "MachineCore.h"
+#include "ToolpathTracker.h"
+
+#define TOOLPATH_CANVAS_BUF_SIZE    LV_CANVAS_BUF_SIZE_INDEXED_1BIT(TOOLPATH_CANVAS_SIZE, TOOLPATH_CANVAS_SIZE)
+#define TOOLPATH_CANVAS_MARGIN      4
+
+void ToolpathPage::Create(lv_obj_t * parent)
+{
+    uint16_t xsize, ysize;
+    
+    m_page_handle = lv_cont_create(parent, NULL);
+    
+    xsize = lv_obj_get_width(parent);
+    ysize = lv_obj_get_height(parent);
+    
+    lv_obj_set_size(m_page_handle, xsize, ysize);
+    
+    // 1 bit indexed canvas [background, path]: 12.8KB instead of 200KB in true color
+    m_canvas_buffer = (uint8_t*)pvPortMalloc(TOOLPATH_CANVAS_BUF_SIZE);
+    
+    // Heap exhausted: page without the toolpath, Update() does nothing
+    if (NULL == m_canvas_buffer)
+    {
+        lv_obj_t * label = lv_label_create(m_page_handle, NULL);
+        lv_label_set_text(label, "Not enough memory for the toolpath view");
+        lv_obj_align(label, NULL, LV_ALIGN_CENTER, 0, 0);
+        
+        m_canvas_handle = NULL;
+        m_position_marker = NULL;
+        return;
+    }
+    
+    m_canvas_handle = lv_canvas_create(m_page_handle, NULL);
+    lv_canvas_set_buffer(m_canvas_handle, m_canvas_buffer, TOOLPATH_CANVAS_SIZE, TOOLPATH_CANVAS_SIZE, LV_IMG_CF_INDEXED_1BIT);
+    lv_canvas_set_palette(m_canvas_handle, 0, LV_COLOR_BLACK);
+    lv_canvas_set_palette(m_canvas_handle, 1, LV_COLOR_LIME);
+    lv_obj_align(m_canvas_handle, NULL, LV_ALIGN_CENTER, 0, 0);
+    
+    // Current position marker. Moving it only invalidates its old and new areas
+    m_position_marker = lv_obj_create(m_page_handle, NULL);
+    lv_obj_set_size(m_position_marker, 7, 7);
+    lv_obj_set_style(m_position_marker, &lv_style_pretty_color);
+    
+    m_tracker_reset_count = ToolpathTracker::GetResetCount();
+    
+    setup_scale();
+    clear_canvas();
+    Update();
+}
+
+void ToolpathPage::Destroy()
+{
+    lv_obj_del(m_page_handle);
+    vPortFree(m_canvas_buffer);
+}
+
+void ToolpathPage::Update()
+{
+    TOOLPATH_POINT point;
+    lv_point_t px;
+    lv_area_t dirty;
+    float position[COORDINATE_LINEAR_AXES_COUNT];
+    uint32_t write_seq, first_seq, count = 0;
+    
+    if (NULL == m_canvas_buffer)
+        return;
+    
+    // New job started: draw again
+    if (m_tracker_reset_count != ToolpathTracker::GetResetCount())
+    {
+        m_tracker_reset_count = ToolpathTracker::GetResetCount();
+        clear_canvas();
+    }
+    
+    write_seq = ToolpathTracker::GetWriteSequence();
+    first_seq = ToolpathTracker::GetFirstAvailableSequence();
+    
+    // Points overwritten before being drawn. Continue from the oldest one available
+    if (m_drawn_seq < first_seq)
+    {
+        m_drawn_seq = first_seq;
+        m_has_last_px = false;
+    }
+    
+    dirty.x1 = dirty.y1 = LV_COORD_MAX;
+    dirty.x2 = dirty.y2 = LV_COORD_MIN;
+    
+    // Draw only the segments added since last update
+    while (m_drawn_seq < write_seq && count < TOOLPATH_MAX_SEGMENTS_PER_UPDATE)
+    {
+        if (ToolpathTracker::GetPoint(m_drawn_seq, point) == false)
+            break;
+        
+        map_point(point.x, point.y, px);
+        
+        if (m_has_last_px)
+            draw_segment(m_last_px, px, dirty);
+        else
+            draw_segment(px, px, dirty);
+        
+        m_last_px = px;
+        m_has_last_px = true;
+        
+        m_drawn_seq++;
+        count++;
+    }
+    
+    // Invalidate only the area covered by the new segments [absolute coordinates]
+    if (dirty.x1 <= dirty.x2)
+    {
+        lv_area_t canvas_coords;
+        
+        lv_obj_get_coords(m_canvas_handle, &canvas_coords);
+        dirty.x1 += canvas_coords.x1;
+        dirty.x2 += canvas_coords.x1;
+        dirty.y1 += canvas_coords.y1;
+        dirty.y2 += canvas_coords.y1;
+        
+        lv_obj_invalidate_area(m_canvas_handle, &dirty);
+    }
+    
+    // Move current position marker
+    machine->GetCurrentPosition_mm(position);
+    map_point(position[COORD_X], position[COORD_Y], px);
+    
+    lv_obj_set_pos(m_position_marker, 
+                   lv_obj_get_x(m_canvas_handle) + px.x - lv_obj_get_width(m_position_marker) / 2,
+                   lv_obj_get_y(m_canvas_handle) + px.y - lv_obj_get_height(m_position_marker) / 2);
+}
+
+// Fit the machine travel into the canvas
+void ToolpathPage::setup_scale()
+{
+    float span;
+    
+    m_origin_x = 0.0f;
+    m_origin_y = 0.0f;
+    
+    span = std::max(Settings_Manager::GetMaxTravel_mm_Axis(COORD_X), Settings_Manager::GetMaxTravel_mm_Axis(COORD_Y));
+    
+    if (span < 1.0f)
+        span = 1.0f;
+    
+    m_scale = (TOOLPATH_CANVAS_SIZE - 1 - 2 * TOOLPATH_CANVAS_MARGIN) / span;
+}
+
+void ToolpathPage::clear_canvas()
+{
+    // Pixel data starts after the 2 color palette
+    memset(m_canvas_buffer + 2 * sizeof(lv_color32_t), 0, TOOLPATH_CANVAS_BUF_SIZE - 2 * sizeof(lv_color32_t));
+    lv_obj_invalidate(m_canvas_handle);
+    
+    m_drawn_seq = ToolpathTracker::GetFirstAvailableSequence();
+    m_has_last_px = false;
+}
+
+void ToolpathPage::map_point(float x, float y, lv_point_t& px)
+{
+    int32_t px_x = TOOLPATH_CANVAS_MARGIN + (int32_t)((x - m_origin_x) * m_scale);
+    int32_t px_y = (TOOLPATH_CANVAS_SIZE - 1 - TOOLPATH_CANVAS_MARGIN) - (int32_t)((y - m_origin_y) * m_scale);   // Y axis goes up
+    
+    px.x = (lv_coord_t)std::min<int32_t>(std::max<int32_t>(px_x, 0), TOOLPATH_CANVAS_SIZE - 1);
+    px.y = (lv_coord_t)std::min<int32_t>(std::max<int32_t>(px_y, 0), TOOLPATH_CANVAS_SIZE - 1);
+}
+
+// Bresenham line straight into the canvas buffer (lv_canvas_set_px would invalidate the whole canvas)
+void ToolpathPage::draw_segment(const lv_point_t& p0, const lv_point_t& p1, lv_area_t& dirty)
+{
+    lv_img_dsc_t * img = lv_canvas_get_img(m_canvas_handle);
+    lv_color_t path_color;
+    
+    int32_t x = p0.x, y = p0.y;
+    int32_t dx = abs(p1.x - p0.x), sx = (p0.x < p1.x) ? 1 : -1;
+    int32_t dy = -abs(p1.y - p0.y), sy = (p0.y < p1.y) ? 1 : -1;
+    int32_t err = dx + dy, e2;
+    
+    path_color.full = 1;    // Palette index
+    
+    for ( ; ; )
+    {
+        lv_img_buf_set_px_color(img, x, y, path_color);
+        
+        if (x == p1.x && y == p1.y)
+            break;
+        
+        e2 = 2 * err;
+        
+        if (e2 >= dy) { err += dy; x += sx; }
+        if (e2 <= dx) { err += dx; y += sy; }
+    }
+    
+    dirty.x1 = std::min(dirty.x1, std::min(p0.x, p1.x));
+    dirty.y1 = std::min(dirty.y1, std::min(p0.y, p1.y));
+    dirty.x2 = std::max(dirty.x2, std::max(p0.x, p1.x));
+    dirty.y2 = std::max(dirty.y2, std::max(p0.y, p1.y));
+}
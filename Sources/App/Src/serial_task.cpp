@@ -6,7 +6,6 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
-#include "stream_buffer.h"
 
 #include "task_settings.h"
 #include "user_tasks.h"
@@ -14,14 +13,70 @@
 #include "settings_manager.h"
 
 #include "uart_ports.h"
+#include "dma.h"
 #include "pins.h"
 
 #include "GCodeParser.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "JobStats.h"
+#include "MemoryPool.h"
+#include "UsbCdc.h"
+#include "disk_task.h"
+#include "compile_check.h"
+
+COMPILE_CHECK((RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) == 0 && (TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0,
+              "Serial rings must be a power of 2");
+COMPILE_CHECK(SERIAL_LINE_MAX_LENGTH < RX_BUFFER_SIZE, "Serial Rx ring too small for a line");
+
+// Lines wrapping the end of the Rx ring are copied to a block of the line pool
+COMPILE_CHECK((SERIAL_LINE_MAX_LENGTH + 1) <= LINE_POOL_BLOCK_SIZE, "Line pool blocks too small for a serial line");
+
+typedef void (*SERIAL_CHANNEL_WRITE_FUNC)(const char * data, uint32_t len);
+typedef void (*SERIAL_CHANNEL_RELEASE_FUNC)(uint32_t consumed);
+
+// Host link feeding the line pipeline [USART1, USB virtual COM port]. Positions are running byte counts,
+// the ring index is the count modulo the size
+typedef struct SERIAL_CHANNEL
+{
+    uint8_t * rx_ring;
+    uint32_t rx_size;                       // Power of 2
+    volatile uint32_t * rx_received;        // Written by the producer
+    volatile uint32_t * rx_discard;         // Input up to here dropped [link reset], NULL if never
+    uint32_t rx_consumed;                   // First byte of the line being assembled
+    uint32_t rx_scanned;                    // Searched for the end of line up to here
+    SERIAL_CHANNEL_WRITE_FUNC write;
+    SERIAL_CHANNEL_RELEASE_FUNC release;    // Room made in the ring [flow control], NULL if none
+}SERIAL_CHANNEL;
+
+typedef enum SERIAL_CHANNEL_IDS
+{
+    SERIAL_CHANNEL_UART,
+    SERIAL_CHANNEL_USB,
+    
+    SERIAL_CHANNEL_COUNT
+}SERIAL_CHANNEL_IDS;
 
 TaskHandle_t serial_task_handle;
 
-static StreamBufferHandle_t     rx_buffer;
-static StreamBufferHandle_t     tx_buffer; 
+static SERIAL_CHANNEL           channels[SERIAL_CHANNEL_COUNT];
+static char *                   wrap_buffer;
+
+// Written by DMA [SRAM]
+static uint8_t                  rx_ring[RX_BUFFER_SIZE];
+static volatile uint32_t        rx_received;        // Scanned for real-time commands by the Rx interrupts
+
+static uint8_t                  tx_ring[TX_BUFFER_SIZE];
+static uint32_t                 tx_written;
+static volatile uint32_t        tx_sent;            // Start of the transfer in progress
+static volatile uint32_t        tx_transfer_len;    // 0: Tx DMA idle
+
+static BaseType_t               isr_task_woken;
+
+static void rx_dma_event(DMA_HandleTypeDef * hdma);
+static void rx_dma_error(DMA_HandleTypeDef * hdma);
+static void tx_dma_complete(DMA_HandleTypeDef * hdma);
+static void tx_dma_error(DMA_HandleTypeDef * hdma);
 
 //const char* lines[] = 
 //{ 
@@ -49,135 +104,443 @@ static const char * fake_settings = \
     "$120=10\r\n$121=10\r\n$122=10\r\n" \
     "$130=360\r\n$131=360\r\n$132=200\r\n";
 
+// Next contiguous chunk of the Tx ring, if the DMA is idle. Tx interrupt or critical section
+static void start_tx_transfer()
+{
+    uint32_t pending = tx_written - tx_sent;
+    uint32_t index = tx_sent & (TX_BUFFER_SIZE - 1);
+    uint32_t len;
+    
+    if (tx_transfer_len != 0 || pending == 0)
+        return;
+    
+    len = std::min(pending, (uint32_t)(TX_BUFFER_SIZE - index));
+    tx_transfer_len = len;
+    
+    HAL_DMA_Start_IT(&hdma_debug_uart_tx, (uint32_t)&tx_ring[index], (uint32_t)&debug_uart_handle.Instance->DR, len);
+}
 
-void SerialTask_Entry(void * pvParam)
+// Copies to the Tx ring, waits for room if it is full [serial task only]
+static void uart_write(const char * data, uint32_t len)
 {
-    char ch;
-    char prev_ch;
-    char * line_buffer;
-    uint32_t ch_counter = 0;
-    bool allow_processing = false;   
+    uint32_t index;
+    uint32_t chunk;
     
-    // Create Tx & Rx stream buffers
-    rx_buffer = xStreamBufferCreate(RX_BUFFER_SIZE, 1);
-    tx_buffer = xStreamBufferCreate(TX_BUFFER_SIZE, 1);
-    line_buffer = (char*)pvPortMalloc(RX_BUFFER_SIZE + 1);
+    while (len != 0)
+    {
+        while ((tx_written - tx_sent) == TX_BUFFER_SIZE)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SERIAL_TX_WAIT_POLL_MS));
+        
+        index = tx_written & (TX_BUFFER_SIZE - 1);
+        chunk = std::min(len, (uint32_t)(TX_BUFFER_SIZE - (tx_written - tx_sent)));
+        chunk = std::min(chunk, (uint32_t)(TX_BUFFER_SIZE - index));
+        
+        memcpy(&tx_ring[index], data, chunk);
+        data += chunk;
+        len -= chunk;
+        
+        taskENTER_CRITICAL();
+        tx_written += chunk;
+        start_tx_transfer();
+        taskEXIT_CRITICAL();
+    }
+}
+
+static void usb_write(const char * data, uint32_t len)
+{
+    usb_cdc.Write(data, len);
+}
+
+static void usb_release(uint32_t consumed)
+{
+    usb_cdc.RxRelease(consumed);
+}
+
+// Context: channel the line came from
+static void send_report_line(void * context, const char * text)
+{
+    SERIAL_CHANNEL * channel = (SERIAL_CHANNEL*)context;
     
-    if (rx_buffer == NULL || tx_buffer == NULL || line_buffer == NULL)
+    channel->write(text, strlen(text));
+    channel->write("\r\n", 2);
+}
+
+// System commands ($H: homing cycle, $X: unlock alarm, $P: profiling report, $PR: reset profiling
+// counters, $T: event trace dump, $TS: event trace dump to the SD card, $TC: clear event trace, $J:
+// last job statistics, $M: memory pools and heap usage, $U: SD card exported as USB mass storage, $UE:
+// SD card back to the controller) are run here, any other line goes to the G-code parser
+static int execute_line(SERIAL_CHANNEL * channel, char * line)
+{
+    static uint32_t reported_job_seq = 0;
+    int result;
+    
+    if (line[0] == '$' && (line[1] == 'H' || line[1] == 'h') && line[2] == '\0')
+        return machine->HomeAxes();
+    
+    if (line[0] == '$' && (line[1] == 'X' || line[1] == 'x') && line[2] == '\0')
+        return machine->Unlock();
+    
+    if (line[0] == '$' && (line[1] == 'P' || line[1] == 'p') && line[2] == '\0')
     {
-        configASSERT(0);
+        Profiler::Report(send_report_line, channel);
+        return GCODE_OK;
+    }
+    
+    if (line[0] == '$' && (line[1] == 'P' || line[1] == 'p') && (line[2] == 'R' || line[2] == 'r') && line[3] == '\0')
+    {
+        Profiler::Reset();
+        return GCODE_OK;
     }
     
-    /* USART1 interrupt Init */
-    __HAL_UART_ENABLE_IT(&debug_uart_handle, UART_IT_RXNE);
+    if (line[0] == '$' && (line[1] == 'T' || line[1] == 't') && line[2] == '\0')
+    {
+        TraceRecorder::DumpText(send_report_line, channel);
+        return GCODE_OK;
+    }
     
-    prev_ch = 0;
+    if (line[0] == '$' && (line[1] == 'T' || line[1] == 't') && (line[2] == 'S' || line[2] == 's') && line[3] == '\0')
+        return TraceRecorder::DumpToFile(TRACE_DUMP_FILE_NAME) ? GCODE_OK : GCODE_ERROR_FILE_WRITE;
     
-    for ( ; ; )
+    if (line[0] == '$' && (line[1] == 'T' || line[1] == 't') && (line[2] == 'C' || line[2] == 'c') && line[3] == '\0')
+    {
+        TraceRecorder::Clear();
+        return GCODE_OK;
+    }
+    
+    if (line[0] == '$' && (line[1] == 'M' || line[1] == 'm') && line[2] == '\0')
+    {
+        MemoryPools::Report(send_report_line, channel);
+        return GCODE_OK;
+    }
+    
+    if (line[0] == '$' && (line[1] == 'J' || line[1] == 'j') && line[2] == '\0')
+    {
+        JobStats::Report(send_report_line, channel);
+        return GCODE_OK;
+    }
+    
+    if (line[0] == '$' && (line[1] == 'U' || line[1] == 'u') && line[2] == '\0')
+        return DiskTask_SetUsbStorage(true) ? GCODE_OK : GCODE_ERROR_DISK_UNAVAILABLE;
+    
+    if (line[0] == '$' && (line[1] == 'U' || line[1] == 'u') && (line[2] == 'E' || line[2] == 'e') && line[3] == '\0')
+        return DiskTask_SetUsbStorage(false) ? GCODE_OK : GCODE_ERROR_DISK_UNAVAILABLE;
+    
+    result = machine->ParseGCodeLine(line);
+    
+    // M2/M30 completed a job: its statistics go before the response
+    if (JobStats::GetJobSequence() != reported_job_seq)
+    {
+        reported_job_seq = JobStats::GetJobSequence();
+        JobStats::Report(send_report_line, channel);
+    }
+    
+    return result;
+}
+
+// Backspaces applied and real-time commands (already handled by the interrupts) removed, in place
+static char * clean_line(char * line)
+{
+    char * src = line;
+    char * dst = line;
+    
+    while (*src != '\0')
     {
-        // Try to receive data from serial stream
-        if (1 == xStreamBufferReceive(rx_buffer, (void*)&ch, 1, portMAX_DELAY))
+        if (*src == '\b')
         {
-            if (ch_counter < (RX_BUFFER_SIZE + 1))
-            {
-                // We still have space available in the line buffer
-                if (ch == '\n')
-                {
-                    // End of line. Check for previous \r
-                    if (prev_ch == '\r')
-                        ch_counter--;
-                    
-                    line_buffer[ch_counter] = '\0';
-                    
-                    // Reset counter and call to process line 
-                    // Not allow the modification of line_buffer during processing
-                    ch_counter = 0;
-                    prev_ch = 0;    // ???
-                    
-                    allow_processing = true;                    
-                }
-                else if (ch == '\b')
-                {
-                    // Backspace support
-                    if (ch_counter > 0)
-                        ch_counter--;
-                }
-                else
-                {
-                    line_buffer[ch_counter++] = ch;
-                    prev_ch = ch;
-                }
-            }
-            else
-            {
-                // There is no more space available. Send the line 'as is'. 
-                line_buffer[RX_BUFFER_SIZE] = '\0';
-                allow_processing = true;
-            }
+            if (dst > line)
+                dst--;
         }
-
-        if (allow_processing == true)
+        else if (!SerialTask_IsRealtimeCommand((uint8_t)*src))
         {
-            const char* msg = machine->GetGCodeErrorText(machine->ParseGCodeLine(line_buffer));
-            size_t len;
-            
-            // Send back response
-            len = strlen(line_buffer);
-            
-            if (len != 0)
-            {            
-                xStreamBufferSend(tx_buffer, (const void*)line_buffer, len, portMAX_DELAY);
-                xStreamBufferSend(tx_buffer, (const void*)(" >> "), 4, portMAX_DELAY);
-            }
-            
-            xStreamBufferSend(tx_buffer, (const void*)msg, strlen(msg), portMAX_DELAY);
-            xStreamBufferSend(tx_buffer, (const void*)("\r\n"), 2, portMAX_DELAY);
-            __HAL_UART_ENABLE_IT(&debug_uart_handle, UART_IT_TXE);
-
-            allow_processing = false;            
+            *dst++ = *src;
         }
+        
+        src++;
     }
+    
+    // \r\n line ending
+    if (dst > line && *(dst - 1) == '\r')
+        dst--;
+    
+    *dst = '\0';
+    
+    return line;
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
+// Line of len bytes starting at rx_consumed. Parsed in place in the ring, the end of line replaced by the
+// terminator, unless it wraps the end of the ring or has no end of line (too long)
+static char * take_line(SERIAL_CHANNEL * channel, uint32_t len, bool end_of_line)
+{
+    uint32_t index = channel->rx_consumed & (channel->rx_size - 1);
+    uint32_t first;
+    
+    if (end_of_line && (index + len) < channel->rx_size)
+    {
+        channel->rx_ring[index + len] = '\0';
+        return clean_line((char*)&channel->rx_ring[index]);
+    }
+    
+    first = std::min(len, channel->rx_size - index);
+    memcpy(wrap_buffer, &channel->rx_ring[index], first);
+    memcpy(wrap_buffer + first, &channel->rx_ring[0], len - first);
+    wrap_buffer[len] = '\0';
+    
+    return clean_line(wrap_buffer);
+}
 
-extern "C" void USART1_IRQHandler(void)
+// Response goes back on the channel the line came from
+static void process_line(SERIAL_CHANNEL * channel, char * line)
+{
+    const char* msg = machine->GetGCodeErrorText(execute_line(channel, line));
+    size_t len;
+    
+    // Send back response
+    len = strlen(line);
+    
+    if (len != 0)
+    {
+        channel->write(line, len);
+        channel->write(" >> ", 4);
+    }
+    
+    channel->write(msg, strlen(msg));
+    channel->write("\r\n", 2);
+}
+
+static void consume_line(SERIAL_CHANNEL * channel)
+{
+    channel->rx_consumed = channel->rx_scanned;
+    
+    if (channel->release != NULL)
+        channel->release(channel->rx_consumed);
+}
+
+// Executes the next complete line of the channel, if any. false: all received data scanned, nothing to do
+static bool service_channel(SERIAL_CHANNEL * channel)
 {
+    uint32_t received = *channel->rx_received;
+    uint32_t len;
     char ch;
-    BaseType_t highPrioWokenRx = pdFALSE;
-    BaseType_t highPrioWokenTx = pdFALSE;
-    BaseType_t highPrioWokenLine = pdFALSE;
     
-    // Check if rx'd something
-    if (__HAL_UART_GET_FLAG(&debug_uart_handle, UART_FLAG_RXNE))
+    // Link reset, partial line dropped
+    if (channel->rx_discard != NULL && (int32_t)(*channel->rx_discard - channel->rx_consumed) > 0)
+    {
+        channel->rx_scanned = *channel->rx_discard;
+        consume_line(channel);
+    }
+    
+    // The host sent more than the ring holds before the line was executed, input lost
+    if ((received - channel->rx_consumed) > channel->rx_size)
+    {
+        channel->rx_scanned = received;
+        consume_line(channel);
+        send_report_line(channel, "[SERIAL] Rx overrun, input discarded");
+        return true;
+    }
+    
+    while (channel->rx_scanned != received)
     {
-        // Rx Interrupt
-        ch = (char)debug_uart_handle.Instance->DR;
+        ch = channel->rx_ring[channel->rx_scanned & (channel->rx_size - 1)];
+        channel->rx_scanned++;
+        len = channel->rx_scanned - channel->rx_consumed;
         
-        if (0 == xStreamBufferSendFromISR(rx_buffer, (const void*)&ch, 1, &highPrioWokenRx))
+        if (ch == '\n')
         {
-           __nop();
+            process_line(channel, take_line(channel, len - 1, true));
+            consume_line(channel);
+            return true;
         }
+        
+        if (len >= SERIAL_LINE_MAX_LENGTH)
+        {
+            // There is no more space available. Send the line 'as is'
+            process_line(channel, take_line(channel, len, false));
+            consume_line(channel);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+static void init_channel(SERIAL_CHANNEL * channel, uint8_t * ring, uint32_t size, volatile uint32_t * received,
+                         volatile uint32_t * discard, SERIAL_CHANNEL_WRITE_FUNC write, SERIAL_CHANNEL_RELEASE_FUNC release)
+{
+    channel->rx_ring = ring;
+    channel->rx_size = size;
+    channel->rx_received = received;
+    channel->rx_discard = discard;
+    channel->rx_consumed = *received;
+    channel->rx_scanned = *received;
+    channel->write = write;
+    channel->release = release;
+}
+
+void SerialTask_Entry(void * pvParam)
+{
+    uint32_t index;
+    bool busy;
+    
+    wrap_buffer = (char*)line_pool_alloc();
+    
+    if (wrap_buffer == NULL)
+    {
+        configASSERT(0);
+    }
+    
+    rx_received = 0;
+    tx_written = 0;
+    tx_sent = 0;
+    tx_transfer_len = 0;
+    
+    init_channel(&channels[SERIAL_CHANNEL_UART], rx_ring, RX_BUFFER_SIZE, &rx_received, NULL, uart_write, NULL);
+    init_channel(&channels[SERIAL_CHANNEL_USB], usb_cdc.GetRxRing(), CDC_RX_BUFFER_SIZE, usb_cdc.GetRxReceived(),
+                 usb_cdc.GetRxDiscard(), usb_write, usb_release);
+    
+    hdma_debug_uart_rx.XferHalfCpltCallback = rx_dma_event;
+    hdma_debug_uart_rx.XferCpltCallback = rx_dma_event;
+    hdma_debug_uart_rx.XferErrorCallback = rx_dma_error;
+    hdma_debug_uart_tx.XferCpltCallback = tx_dma_complete;
+    hdma_debug_uart_tx.XferErrorCallback = tx_dma_error;
+    
+    /* USART1 Rx: circular DMA, woken by the idle line and the half/full ring events */
+    SET_BIT(debug_uart_handle.Instance->CR3, USART_CR3_DMAR | USART_CR3_DMAT);
+    HAL_DMA_Start_IT(&hdma_debug_uart_rx, (uint32_t)&debug_uart_handle.Instance->DR, (uint32_t)rx_ring, RX_BUFFER_SIZE);
+    
+    __HAL_UART_CLEAR_IDLEFLAG(&debug_uart_handle);
+    __HAL_UART_ENABLE_IT(&debug_uart_handle, UART_IT_IDLE);
+    
+    // One line per channel in turn, so a streaming link does not starve the other one
+    for ( ; ; )
+    {
+        busy = false;
+        
+        for (index = 0; index < SERIAL_CHANNEL_COUNT; index++)
+        {
+            if (service_channel(&channels[index]))
+                busy = true;
+        }
+        
+        if (busy == false)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Called from the Rx interrupts and the USB task
+void SerialTask_HandleRealtimeCommand(uint8_t cmd)
+{
+    switch (cmd)
+    {
+        case RT_CMD_FEED_OVR_RESET:         machine->SetFeedOverride(100);      break;
+        case RT_CMD_FEED_OVR_COARSE_PLUS:   machine->AdjustFeedOverride(10);    break;
+        case RT_CMD_FEED_OVR_COARSE_MINUS:  machine->AdjustFeedOverride(-10);   break;
+        case RT_CMD_FEED_OVR_FINE_PLUS:     machine->AdjustFeedOverride(1);     break;
+        case RT_CMD_FEED_OVR_FINE_MINUS:    machine->AdjustFeedOverride(-1);    break;
+        case RT_CMD_RAPID_OVR_RESET:        machine->SetRapidOverride(100);     break;
+        case RT_CMD_RAPID_OVR_MEDIUM:       machine->SetRapidOverride(50);      break;
+        case RT_CMD_RAPID_OVR_LOW:          machine->SetRapidOverride(25);      break;
+        case RT_CMD_SPINDLE_OVR_RESET:      machine->SetSpindleOverride(100);   break;
+        case RT_CMD_SPINDLE_OVR_COARSE_PLUS:    machine->AdjustSpindleOverride(10);     break;
+        case RT_CMD_SPINDLE_OVR_COARSE_MINUS:   machine->AdjustSpindleOverride(-10);    break;
+        case RT_CMD_SPINDLE_OVR_FINE_PLUS:      machine->AdjustSpindleOverride(1);      break;
+        case RT_CMD_SPINDLE_OVR_FINE_MINUS:     machine->AdjustSpindleOverride(-1);     break;
+        
+        default:
+            break;
+    }
+}
+
+// New bytes in the Rx ring, up to the DMA position. Real-time commands are handled here, they must not
+// wait behind a line blocked by a full planner queue [Rx interrupts]
+static void scan_rx_ring()
+{
+    uint32_t position = (RX_BUFFER_SIZE - __HAL_DMA_GET_COUNTER(&hdma_debug_uart_rx)) & (RX_BUFFER_SIZE - 1);
+    uint32_t index = rx_received & (RX_BUFFER_SIZE - 1);
+    uint32_t count = 0;
+    
+    while (index != position)
+    {
+        if (SerialTask_IsRealtimeCommand(rx_ring[index]))
+            SerialTask_HandleRealtimeCommand(rx_ring[index]);
+        
+        index = (index + 1) & (RX_BUFFER_SIZE - 1);
+        count++;
     }
     
-    if ( (__HAL_UART_GET_FLAG(&debug_uart_handle, UART_FLAG_TXE)) && 
-         ((debug_uart_handle.Instance->CR1 & USART_CR1_TXEIE) == USART_CR1_TXEIE))
+    if (count != 0)
     {
-        // Tx Interrupt
-        /* The interrupt was caused by the THR becoming empty.  Are there any
-		more characters to transmit? */
-        if (xStreamBufferReceiveFromISR( tx_buffer, (void*) &ch, 1, &highPrioWokenTx) != pdFALSE)
-		{
-			/* A character was retrieved from the queue so can be sent to the
-			THR now. */
-            debug_uart_handle.Instance->DR = ch;
-		}
-		else
-		{
-            // Disable if no more data
-            __HAL_UART_DISABLE_IT(&debug_uart_handle, UART_IT_TXE);
-		}
+        rx_received += count;
+        vTaskNotifyGiveFromISR(serial_task_handle, &isr_task_woken);
     }
+}
+
+static void rx_dma_event(DMA_HandleTypeDef * hdma)
+{
+    scan_rx_ring();
+}
 
-    portYIELD_FROM_ISR(highPrioWokenRx || highPrioWokenTx || highPrioWokenLine);   
+// Transfer error: the stream was stopped, restart it where it was
+static void rx_dma_error(DMA_HandleTypeDef * hdma)
+{
+    if (hdma->State == HAL_DMA_STATE_READY)
+        HAL_DMA_Start_IT(hdma, (uint32_t)&debug_uart_handle.Instance->DR, (uint32_t)rx_ring, RX_BUFFER_SIZE);
+}
+
+static void tx_dma_complete(DMA_HandleTypeDef * hdma)
+{
+    tx_sent += tx_transfer_len;
+    tx_transfer_len = 0;
+    
+    start_tx_transfer();
+    vTaskNotifyGiveFromISR(serial_task_handle, &isr_task_woken);
+}
+
+// Transfer error: the chunk is dropped
+static void tx_dma_error(DMA_HandleTypeDef * hdma)
+{
+    if (hdma->State == HAL_DMA_STATE_READY && tx_transfer_len != 0)
+        tx_dma_complete(hdma);
+}
+
+// Idle line after a burst of bytes [end of line, real-time command]
+extern "C" void USART1_IRQHandler(void)
+{
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
+    isr_task_woken = pdFALSE;
+    
+    if (__HAL_UART_GET_FLAG(&debug_uart_handle, UART_FLAG_IDLE))
+    {
+        __HAL_UART_CLEAR_IDLEFLAG(&debug_uart_handle);
+        scan_rx_ring();
+    }
+    
+    Profiler::IsrExit(PROFILER_ISR_SERIAL, start_cycles);
+    portYIELD_FROM_ISR(isr_task_woken);
+}
+
+// Rx ring half & full
+extern "C" void DMA2_Stream2_IRQHandler(void)
+{
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
+    isr_task_woken = pdFALSE;
+    HAL_DMA_IRQHandler(&hdma_debug_uart_rx);
+    
+    Profiler::IsrExit(PROFILER_ISR_SERIAL, start_cycles);
+    portYIELD_FROM_ISR(isr_task_woken);
+}
+
+// Tx chunk sent
+extern "C" void DMA2_Stream7_IRQHandler(void)
+{
+    uint32_t start_cycles = Profiler::IsrEnter();
+    
+    isr_task_woken = pdFALSE;
+    HAL_DMA_IRQHandler(&hdma_debug_uart_tx);
+    
+    Profiler::IsrExit(PROFILER_ISR_SERIAL, start_cycles);
+    portYIELD_FROM_ISR(isr_task_woken);
 }
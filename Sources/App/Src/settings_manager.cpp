@@ -2,10 +2,17 @@
 
 #include <string.h>
 
+#include <algorithm>
+
 #include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+
+#include "task_settings.h"
 
 #include "spi_ports.h"
 #include "settings_manager.h"
+#include "TraceRecorder.h"
 
 
 static CRC_HandleTypeDef   CrcHandle;
@@ -18,6 +25,16 @@ void HAL_CRC_MspInit(CRC_HandleTypeDef *hcrc)
 // Define m_data as a static member of Settings_Manager class
 SETTINGS_DATA* Settings_Manager::m_data;
 
+SETTINGS_DATA* Settings_Manager::m_flash_shadow;
+SETTINGS_DATA* Settings_Manager::m_write_image;
+
+TaskHandle_t Settings_Manager::m_writer_task;
+EventGroupHandle_t Settings_Manager::m_writer_events;
+
+volatile uint32_t Settings_Manager::m_requested_gen;
+volatile uint32_t Settings_Manager::m_completed_gen;
+
+
 void Settings_Manager::Initialize()
 {
     CrcHandle.Instance = CRC;
@@ -28,87 +45,192 @@ void Settings_Manager::Initialize()
     if (Load() != 0)
     {
         // Error loading settings. Already returned to defaults. 
+        // Scheduler is not running yet, so this save is done synchronously
         Save();
     }
 }
 
+void Settings_Manager::StartWriterTask()
+{
+    if (NULL == m_writer_task)
+    {
+        m_writer_events = xEventGroupCreate();
+        xEventGroupSetBits(m_writer_events, SETTINGS_WRITER_IDLE_BIT);
+        
+        xTaskCreate(WriterTask_Entry, "SETTINGS", SETTINGS_TASK_STACK_SIZE, NULL, SETTINGS_TASK_PRIORITY, &m_writer_task);
+    }
+}
+
 int Settings_Manager::Load()
 {
-    SETTINGS_DATA * pData;
     uint32_t read_data_crc;    
     
-    pData = (SETTINGS_DATA*)pvPortMalloc(SETTINGS_DATA_SIZE_BYTES);
+    // Read straight into the flash shadow, so it always mirrors the flash contents
+    // (even when they are not valid settings)
+    W25QXX_Read((uint8_t*)m_flash_shadow, SETTINGS_DATA_START_ADDRESS, SETTINGS_DATA_SIZE_BYTES);
+    
+    // Calculate read data CRC and check against retrieved value
+    read_data_crc = HAL_CRC_Calculate(&CrcHandle, (uint32_t*)m_flash_shadow, SETTINGS_DATA_SIZE_WORDS_NO_CRC);
     
-    if (pData != NULL)
+    if ((read_data_crc != m_flash_shadow->settings_crc) ||
+       (m_flash_shadow->settings_header != SETTINGS_HEADER_VALUE)) 
     {
-        // Try to read data from flash memory
-        W25QXX_Read((uint8_t*)pData, SETTINGS_DATA_START_ADDRESS, SETTINGS_DATA_SIZE_BYTES);
-        
-        // Calculate read data CRC and check against retrieved value
-        read_data_crc = HAL_CRC_Calculate(&CrcHandle, (uint32_t*)pData, SETTINGS_DATA_SIZE_WORDS_NO_CRC);
+        // Mismatch, return to defaults and exit with error
+        ResetToDefaults();
+        return 1;
+    }
+    
+    // Check other values for inconsistencies (not implemented yet)
+    
+    // Copy data to settings and exit successfully
+    memcpy((void*)m_data, (const void*)m_flash_shadow, SETTINGS_DATA_SIZE_BYTES);
+    return 0;
+}
+
+// Request the current settings to be stored. Once the writer task is running this
+// returns immediately; several requests issued before the writer gets to run are
+// merged in a single flash update. Use Flush() when the data must be on flash.
+void Settings_Manager::Save()
+{
+    if (NULL == m_writer_task)
+    {
+        memcpy(m_write_image, m_data, SETTINGS_DATA_SIZE_BYTES);
+        Internal_WriteImage(m_write_image);
+        m_data->settings_crc = m_write_image->settings_crc;
+        return;
+    }
+    
+    // Generation increment and idle bit clear must be seen together by the writer
+    vTaskSuspendAll();
+    m_requested_gen++;
+    xEventGroupClearBits(m_writer_events, SETTINGS_WRITER_IDLE_BIT);
+    xTaskResumeAll();
+    
+    xTaskNotifyGive(m_writer_task);
+}
+
+// Request a save and wait until it (and any earlier pending one) has reached flash.
+// Returns false on timeout or if the written data could not be verified.
+bool Settings_Manager::Flush(uint32_t timeout_ms)
+{
+    EventBits_t bits;
+    bool success;
+    
+    if (NULL == m_writer_task)
+    {
+        memcpy(m_write_image, m_data, SETTINGS_DATA_SIZE_BYTES);
+        success = Internal_WriteImage(m_write_image);
+        m_data->settings_crc = m_write_image->settings_crc;
+        return success;
+    }
+    
+    Save();
+    
+    // The idle bit is only set once the completed generation reaches the requested one
+    bits = xEventGroupWaitBits(m_writer_events, SETTINGS_WRITER_IDLE_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout_ms));
+    
+    if ((bits & SETTINGS_WRITER_IDLE_BIT) == 0)
+        return false;
+    
+    return ((bits & SETTINGS_WRITER_ERROR_BIT) == 0) ? true : false;
+}
+
+void Settings_Manager::WriterTask_Entry(void * pvParam)
+{
+    uint32_t target_gen;
+    bool success;
+    
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
         
-        if ((read_data_crc != pData->settings_crc) ||
-           (pData->settings_header != SETTINGS_HEADER_VALUE)) 
-        {
-            // Mismatch, release memory and return error
-            vPortFree((void*)pData);
-            ResetToDefaults();
-            return 1;
-        }
+        // Take a consistent copy of the settings, along with the request generation it covers
+        vTaskSuspendAll();
+        target_gen = m_requested_gen;
+        memcpy(m_write_image, m_data, SETTINGS_DATA_SIZE_BYTES);
+        xTaskResumeAll();
         
-        // Check other values for inconsistencies (not implemented yet)
+        TraceRecorder::Record(TRACE_EVENT_FLASH_WRITE_BEGIN);
+        success = Internal_WriteImage(m_write_image);
+        TraceRecorder::Record(TRACE_EVENT_FLASH_WRITE_END, 0, success ? 1 : 0);
         
-        // Copy data to settings
-        memcpy((void*)m_data, (const void*)pData, SETTINGS_DATA_SIZE_BYTES);
+        vTaskSuspendAll();
+        m_data->settings_crc = m_write_image->settings_crc;
+        m_completed_gen = target_gen;
         
-        // Release memory
-        vPortFree((void*)pData);
+        if (success)
+            xEventGroupClearBits(m_writer_events, SETTINGS_WRITER_ERROR_BIT);
+        else
+            xEventGroupSetBits(m_writer_events, SETTINGS_WRITER_ERROR_BIT);
         
-        // and exit successfully
-        return 0;        
+        // If new requests arrived meanwhile, a notification is already pending for them
+        if (m_completed_gen == m_requested_gen)
+            xEventGroupSetBits(m_writer_events, SETTINGS_WRITER_IDLE_BIT);
+        xTaskResumeAll();
     }
-    
-    // In any other case, return error.
-    ResetToDefaults();
-    return 1;
 }
 
-void Settings_Manager::Save()
+// Write image to flash using the shadow to find the pages that changed. Pages
+// that only need bits cleared are programmed in place; otherwise the sector
+// (4K, holds the whole image) is erased and every page is programmed again.
+bool Settings_Manager::Internal_WriteImage(SETTINGS_DATA * image)
 {
-    const uint32_t FLASH_PAGE_SIZE = 256;
+    uint32_t dirty_pages = 0;
+    bool needs_erase = false;
+    
+    uint32_t page, offset, len, i;
+    uint8_t * new_data = (uint8_t*)image;
+    uint8_t * old_data = (uint8_t*)m_flash_shadow;
     
-    uint32_t bytes_to_write;
-    uint32_t new_crc = HAL_CRC_Calculate(&CrcHandle, (uint32_t*)m_data, SETTINGS_DATA_SIZE_WORDS_NO_CRC);
-    uint32_t addr = SETTINGS_DATA_START_ADDRESS;
-    uint32_t total_len = SETTINGS_DATA_SIZE_BYTES;
-    uint8_t * data_ptr = (uint8_t*)(m_data);
+    image->settings_crc = HAL_CRC_Calculate(&CrcHandle, (uint32_t*)image, SETTINGS_DATA_SIZE_WORDS_NO_CRC);
     
-    // Only if something changed then update flash    
-    if (new_crc != m_data->settings_crc)
+    for (page = 0; page < SETTINGS_FLASH_PAGE_COUNT; page++)
     {
-        // Update settings CRC, erase sector (4K) and write settings to flash
-        m_data->settings_crc = new_crc;
+        offset = page * SETTINGS_FLASH_PAGE_SIZE;
+        len = std::min<uint32_t>(SETTINGS_FLASH_PAGE_SIZE, SETTINGS_DATA_SIZE_BYTES - offset);
+        
+        if (memcmp(&new_data[offset], &old_data[offset], len) == 0)
+            continue;
+        
+        dirty_pages |= (1 << page);
+        
+        // NOR flash programming can only turn ones into zeroes
+        for (i = 0; i < len; i++)
+        {
+            if ((old_data[offset + i] & new_data[offset + i]) != new_data[offset + i])
+            {
+                needs_erase = true;
+                break;
+            }
+        }
+    }
+    
+    // Nothing changed since the last write
+    if (0 == dirty_pages)
+        return true;
     
-        // Erase sector
+    if (needs_erase)
+    {
         W25QXX_Erase_Sector(SETTINGS_DATA_START_ADDRESS);
+        dirty_pages = (1 << SETTINGS_FLASH_PAGE_COUNT) - 1;
+    }
+    
+    for (page = 0; page < SETTINGS_FLASH_PAGE_COUNT; page++)
+    {
+        if ((dirty_pages & (1 << page)) == 0)
+            continue;
         
-        while (total_len != 0)
-        {    
-            // Restrict data count to max page size
-            if (total_len > FLASH_PAGE_SIZE)
-                bytes_to_write = FLASH_PAGE_SIZE;
-            else
-                bytes_to_write = total_len;
-            
-            // Write data page (up to 256 bytes)
-            W25QXX_Write_Page(data_ptr, addr, bytes_to_write);
-            
-            // Update address, data pointer & remaining length
-            total_len -= bytes_to_write;
-            addr += bytes_to_write;
-            data_ptr += bytes_to_write;
-        }
+        offset = page * SETTINGS_FLASH_PAGE_SIZE;
+        len = std::min<uint32_t>(SETTINGS_FLASH_PAGE_SIZE, SETTINGS_DATA_SIZE_BYTES - offset);
+        
+        // Write data page (up to 256 bytes)
+        W25QXX_Write_Page(&new_data[offset], SETTINGS_DATA_START_ADDRESS + offset, len);
     }
+    
+    // Read back into the shadow, so it keeps mirroring the flash contents, and verify
+    W25QXX_Read((uint8_t*)m_flash_shadow, SETTINGS_DATA_START_ADDRESS, SETTINGS_DATA_SIZE_BYTES);
+    
+    return (memcmp(m_flash_shadow, image, SETTINGS_DATA_SIZE_BYTES) == 0) ? true : false;
 }
 
 void Settings_Manager::ResetToDefaults()
@@ -131,6 +253,7 @@ void Settings_Manager::ResetToDefaults()
     m_data->homing_data.home_feed_rate_mm_sec = 7.50f; // 450 mm/min -> 450/60 mm/sec = 7.5
     m_data->homing_data.home_debounce_ms = 5;
     m_data->homing_data.home_pull_off_distance_mm = 1.0f;
+    m_data->homing_data.home_cycle_axes = 0x00000304;   // Z first, then X and Y together
     
     // Microstep = 1/4; 4mm/rev; 4*200 steps/rev => 800/4 = 200 steps/mm
     m_data->steps_per_mm_axes[0] = 200.0f;
@@ -157,6 +280,24 @@ void Settings_Manager::ResetToDefaults()
     m_data->spindle_min_rpm = 0.0f;
     m_data->spindle_max_rpm = 10000.0f;
     
+    m_data->spindle_data.interface = SPINDLE_INTERFACE_PWM;
+    m_data->spindle_data.modbus_address = 1;
+    m_data->spindle_data.at_speed_tolerance_pct = 10;
+    m_data->spindle_data.use_aux_at_speed_input = 0;
+    m_data->spindle_data.laser_mode = 0;
+    m_data->spindle_data.spin_up_delay_ms = 3000;
+    m_data->spindle_data.at_speed_timeout_ms = 10000;
+    m_data->spindle_data.rpm_per_hz = 60.0f;       // 2 pole motor, 24000 rpm at 400 Hz
+    m_data->spindle_data.rated_current_A = 0.0f;   // Load not read from the VFD
+    
+    m_data->analog_data.feed_override_knob = 0;
+    m_data->analog_data.spindle_load_input = 0;
+    m_data->analog_data.spindle_load_full_scale_mV = 3300;
+    m_data->analog_data.adaptive_feed = 0;
+    m_data->analog_data.adaptive_load_high_pct = 90;
+    m_data->analog_data.adaptive_load_low_pct = 75;
+    m_data->analog_data.adaptive_min_feed_pct = 30;
+    
     m_data->bit_settings.Bits.soft_limits_enabled = true;
     m_data->bit_settings.Bits.soft_limit_x_enable = true;
     m_data->bit_settings.Bits.soft_limit_y_enable = true;
@@ -234,6 +375,31 @@ void Settings_Manager::SetHomingData(const HOMING_SETUP_DATA& updated_data)
     m_data->homing_data.home_feed_rate_mm_sec = updated_data.home_feed_rate_mm_sec;
     m_data->homing_data.home_debounce_ms = updated_data.home_debounce_ms;
     m_data->homing_data.home_pull_off_distance_mm = updated_data.home_pull_off_distance_mm;
+    m_data->homing_data.home_cycle_axes = updated_data.home_cycle_axes;
+}
+
+void Settings_Manager::SetSpindleData(const SPINDLE_SETUP_DATA& updated_data)
+{
+    m_data->spindle_data.interface = updated_data.interface;
+    m_data->spindle_data.modbus_address = updated_data.modbus_address;
+    m_data->spindle_data.at_speed_tolerance_pct = updated_data.at_speed_tolerance_pct;
+    m_data->spindle_data.use_aux_at_speed_input = updated_data.use_aux_at_speed_input;
+    m_data->spindle_data.laser_mode = updated_data.laser_mode;
+    m_data->spindle_data.spin_up_delay_ms = updated_data.spin_up_delay_ms;
+    m_data->spindle_data.at_speed_timeout_ms = updated_data.at_speed_timeout_ms;
+    m_data->spindle_data.rpm_per_hz = updated_data.rpm_per_hz;
+    m_data->spindle_data.rated_current_A = updated_data.rated_current_A;
+}
+
+void Settings_Manager::SetAnalogInputsData(const ANALOG_INPUTS_SETUP_DATA& updated_data)
+{
+    m_data->analog_data.feed_override_knob = updated_data.feed_override_knob;
+    m_data->analog_data.spindle_load_input = updated_data.spindle_load_input;
+    m_data->analog_data.spindle_load_full_scale_mV = updated_data.spindle_load_full_scale_mV;
+    m_data->analog_data.adaptive_feed = updated_data.adaptive_feed;
+    m_data->analog_data.adaptive_load_high_pct = updated_data.adaptive_load_high_pct;
+    m_data->analog_data.adaptive_load_low_pct = updated_data.adaptive_load_low_pct;
+    m_data->analog_data.adaptive_min_feed_pct = updated_data.adaptive_min_feed_pct;
 }
 
 void Settings_Manager::Internal_AllocMemory(void)
@@ -243,5 +409,17 @@ void Settings_Manager::Internal_AllocMemory(void)
         m_data = (SETTINGS_DATA*)pvPortMalloc(SETTINGS_DATA_SIZE_BYTES);
         memset(m_data, 0, SETTINGS_DATA_SIZE_BYTES);
     }
+    
+    if (NULL == m_flash_shadow)
+    {
+        m_flash_shadow = (SETTINGS_DATA*)pvPortMalloc(SETTINGS_DATA_SIZE_BYTES);
+        memset(m_flash_shadow, 0xFF, SETTINGS_DATA_SIZE_BYTES);
+    }
+    
+    if (NULL == m_write_image)
+    {
+        m_write_image = (SETTINGS_DATA*)pvPortMalloc(SETTINGS_DATA_SIZE_BYTES);
+        memset(m_write_image, 0, SETTINGS_DATA_SIZE_BYTES);
+    }
 }
 
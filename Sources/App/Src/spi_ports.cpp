@@ -1,4 +1,8 @@
 #include <stm32f4xx_hal.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include "pins.h"
 #include "spi_ports.h"
 
@@ -48,13 +52,13 @@ void Init_SDCard_SPI3(void)
 void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
 {
     GPIO_InitTypeDef GPIO_InitStruct = {0};
-  
+    
     if (spiHandle->Instance == SPI1)
     {
         /* SPI1 clock enable */
         __HAL_RCC_SPI1_CLK_ENABLE();
         __HAL_RCC_GPIOB_CLK_ENABLE();
-
+        
         /**SPI1 GPIO Configuration    
         PB3     ------> SPI1_SCK
         PB4     ------> SPI1_MISO
@@ -73,7 +77,7 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
         /* SPI3 clock enable */
         __HAL_RCC_SPI3_CLK_ENABLE();
         __HAL_RCC_GPIOC_CLK_ENABLE();
-    
+        
         /**SPI3 GPIO Configuration    
         PC10     ------> SPI3_SCK
         PC11     ------> SPI3_MISO
@@ -84,7 +88,7 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
         GPIO_InitStruct.Pull = GPIO_NOPULL;
         GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
         GPIO_InitStruct.Alternate = GPIO_AF6_SPI3;
-
+        
         HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
     }
 }
@@ -116,7 +120,7 @@ void HAL_SPI_MspInit(SPI_HandleTypeDef* spiHandle)
 uint8_t W25QXX_ReadSR(void)
 {
 	uint8_t buf[2];
-	
+
     // Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
@@ -124,7 +128,7 @@ uint8_t W25QXX_ReadSR(void)
     buf[1] = 0xFF;
     
     HAL_SPI_TransmitReceive(&hspi1, buf, buf, 2, FLASH_TIMEOUT_MAX);
-	
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
 	return buf[1];
@@ -136,12 +140,12 @@ void W25QXX_Write_SR(uint8_t sr)
     
     buf[0] = W25X_WriteStatusReg;
     buf[1] = 0xFF;
-    
+
 	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
-    
+
 	HAL_SPI_TransmitReceive(&hspi1, buf, buf, 2, FLASH_TIMEOUT_MAX);
-	
+
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
 }
@@ -149,7 +153,7 @@ void W25QXX_Write_SR(uint8_t sr)
 uint16_t W25QXX_ReadID(void)
 {
     uint8_t buf[6];
-	
+    
     // Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
@@ -161,22 +165,22 @@ uint16_t W25QXX_ReadID(void)
     buf[5] = 0xFF;
     
     HAL_SPI_TransmitReceive(&hspi1, buf, buf, 6, FLASH_TIMEOUT_MAX);
-	
+
 	// Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
-    
+
 	return ((uint16_t)(buf[4])) << 8 | buf[5];
 }
 
 void W25QXX_Write_Enable(void)   
 {
     uint8_t buf = W25X_WriteEnable;
-    
+
 	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
     HAL_SPI_Transmit(&hspi1, &buf, 1, FLASH_TIMEOUT_MAX);
-	
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
 } 
@@ -184,12 +188,12 @@ void W25QXX_Write_Enable(void)
 void W25QXX_Write_Disable(void)   
 {  
 	uint8_t buf = W25X_WriteDisable;
-    
+
 	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
     HAL_SPI_Transmit(&hspi1, &buf, 1, FLASH_TIMEOUT_MAX);
-	
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
 } 		
@@ -197,21 +201,21 @@ void W25QXX_Write_Disable(void)
 void W25QXX_Read(uint8_t * pBuffer,uint32_t ReadAddr, uint16_t NumByteToRead)   
 {
     uint8_t buf[4];
-
+    
     buf[0] = W25X_ReadData;
     buf[1] = (uint8_t)((ReadAddr)>>16);
     buf[2] = (uint8_t)((ReadAddr)>>8);
     buf[3] = (uint8_t)(ReadAddr);
-
+    
     // Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
-
+    
     // Send command + address
     HAL_SPI_Transmit(&hspi1, buf, 4, FLASH_TIMEOUT_MAX);
     
     // Then, receive all requested data
     HAL_SPI_Receive(&hspi1, pBuffer, NumByteToRead, FLASH_TIMEOUT_MAX);
-    
+
 	// Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
 }
@@ -219,17 +223,17 @@ void W25QXX_Read(uint8_t * pBuffer,uint32_t ReadAddr, uint16_t NumByteToRead)
 void W25QXX_Write_Page(uint8_t * pBuffer, uint32_t WriteAddr, uint16_t NumByteToWrite)
 {
  	uint8_t buf[4];
-    
+ 
     buf[0] = W25X_PageProgram;
     buf[1] = (uint8_t)((WriteAddr) >> 16);
     buf[2] = (uint8_t)((WriteAddr) >> 8);
     buf[3] = (uint8_t)(WriteAddr);
     
     W25QXX_Write_Enable();                  //Set WEL bit
-	
+    
     // Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
-
+    
     // Send command
     HAL_SPI_Transmit(&hspi1, buf, 4, FLASH_TIMEOUT_MAX);
     
@@ -238,7 +242,7 @@ void W25QXX_Write_Page(uint8_t * pBuffer, uint32_t WriteAddr, uint16_t NumByteTo
     
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
-    
+
 	W25QXX_Wait_Busy();
 }
 
@@ -249,24 +253,24 @@ void W25QXX_Erase_Chip(void)
     
     W25QXX_Write_Enable();                  //Set WEL bit
     W25QXX_Wait_Busy();
-    
+  
   	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
     HAL_SPI_Transmit(&hspi1, &buf, 1, FLASH_TIMEOUT_MAX);
-
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
-    
+
 	W25QXX_Wait_Busy();
 }
 
 void W25QXX_Erase_Sector(uint32_t Dst_Addr)   
 {  
     uint8_t buf[4];
-    
+ 
  	Dst_Addr *= 4096;
-    
+ 
     buf[0] = W25X_SectorErase;
     buf[1] = (uint8_t)((Dst_Addr)>>16);
     buf[2] = (uint8_t)((Dst_Addr)>>8);
@@ -274,7 +278,7 @@ void W25QXX_Erase_Sector(uint32_t Dst_Addr)
     
     W25QXX_Write_Enable();                  //Set WEL bit
     W25QXX_Wait_Busy();   
-  	
+    
     // Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
@@ -291,36 +295,467 @@ static void W25QXX_Wait_Busy(void)
 {   
 	while((W25QXX_ReadSR() & 0x01) == 0x01)
     {
+        // Erase takes tens of ms. Once the scheduler runs, let other tasks work meanwhile
+        if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+            vTaskDelay(1);
     }
 }
 
 void W25QXX_PowerDown(void)   
 { 
     uint8_t buf = W25X_PowerDown;
-        
+  
   	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
     HAL_SPI_Transmit(&hspi1, &buf, 1, FLASH_TIMEOUT_MAX);
-
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
-	
+    
     HAL_Delay(1);
 }   
 
 void W25QXX_WakeUp(void)   
 {  
   	uint8_t buf = W25X_ReleasePowerDown;
-        
+  
   	// Select Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_RESET);
     
     HAL_SPI_Transmit(&hspi1, &buf, 1, FLASH_TIMEOUT_MAX);
-
+    
     // Deselect Flash Memory
     HAL_GPIO_WritePin(FLASH_CS_GPIO_Port, FLASH_CS_Pin, GPIO_PIN_SET);
-	
+    
     HAL_Delay(1);
 }   
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//                              SD Card Functions [SPI mode]                                     //
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define SD_CMD0                 0       // GO_IDLE_STATE
+#define SD_CMD1                 1       // SEND_OP_COND [MMC]
+#define SD_CMD8                 8       // SEND_IF_COND
+#define SD_CMD9                 9       // SEND_CSD
+#define SD_CMD12                12      // STOP_TRANSMISSION
+#define SD_CMD16                16      // SET_BLOCKLEN
+#define SD_CMD17                17      // READ_SINGLE_BLOCK
+#define SD_CMD18                18      // READ_MULTIPLE_BLOCK
+#define SD_CMD24                24      // WRITE_BLOCK
+#define SD_CMD25                25      // WRITE_MULTIPLE_BLOCK
+#define SD_CMD55                55      // APP_CMD
+#define SD_CMD58                58      // READ_OCR
+#define SD_ACMD                 0x80    // Application command flag: CMD55 sent first
+#define SD_ACMD23               (SD_ACMD | 23)  // SET_WR_BLK_ERASE_COUNT
+#define SD_ACMD41               (SD_ACMD | 41)  // SD_SEND_OP_COND
+
+#define SD_R1_IDLE              0x01
+#define SD_TOKEN_START_BLOCK    0xFE
+#define SD_TOKEN_START_MULTI    0xFC
+#define SD_TOKEN_STOP_TRAN      0xFD
+#define SD_DATA_ACCEPTED        0x05
+
+#define SD_INIT_TIMEOUT         1000    // ms
+#define SD_READ_TIMEOUT         200     // ms
+#define SD_WRITE_TIMEOUT        500     // ms
+
+// APB1 = 42 MHz. Identification at <= 400 kHz, then 21 MHz [default speed cards: 25 MHz]
+#define SD_CLOCK_SLOW           SPI_BAUDRATEPRESCALER_128
+#define SD_CLOCK_FAST           SPI_BAUDRATEPRESCALER_2
+
+static bool sd_block_addressing = false;    // SDHC/SDXC: sector numbers, older cards: byte addresses
+static bool sd_sdc = false;                 // SD card [not MMC]: ACMD23 before multiple block writes
+static uint32_t sd_sector_count = 0;
+
+static void sd_set_clock(uint32_t prescaler)
+{
+    __HAL_SPI_DISABLE(&hspi3);
+    MODIFY_REG(hspi3.Instance->CR1, SPI_CR1_BR, prescaler);
+    __HAL_SPI_ENABLE(&hspi3);
+}
+
+static inline uint8_t sd_exchange(uint8_t data)
+{
+    SPI_TypeDef * spi = hspi3.Instance;
+    
+    spi->DR = data;
+    while ((spi->SR & SPI_SR_RXNE) == 0);
+    
+    return (uint8_t)spi->DR;
+}
+
+// Data blocks go straight between the card and the caller buffer, no HAL call per byte
+static void sd_receive(uint8_t * buffer, uint32_t len)
+{
+    SPI_TypeDef * spi = hspi3.Instance;
+    
+    while (len--)
+    {
+        spi->DR = 0xFF;
+        while ((spi->SR & SPI_SR_RXNE) == 0);
+        *buffer++ = (uint8_t)spi->DR;
+    }
+}
+
+static void sd_send(const uint8_t * buffer, uint32_t len)
+{
+    SPI_TypeDef * spi = hspi3.Instance;
+    
+    while (len--)
+    {
+        spi->DR = *buffer++;
+        while ((spi->SR & SPI_SR_RXNE) == 0);
+        (void)spi->DR;
+    }
+}
+
+// Card releases MISO [0xFF] once it is done programming
+static bool sd_wait_ready(uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+    
+    while (sd_exchange(0xFF) != 0xFF)
+    {
+        if ((HAL_GetTick() - start) >= timeout_ms)
+            return false;
+        
+        // Programming a block takes up to hundreds of ms: after the first tick, let other tasks run
+        if ((HAL_GetTick() - start) > 1 && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+            vTaskDelay(1);
+    }
+    
+    return true;
+}
+
+static void sd_deselect(void)
+{
+    HAL_GPIO_WritePin(SDCARD_CS_GPIO_Port, SDCARD_CS_Pin, GPIO_PIN_SET);
+    
+    // Extra clock: the card releases MISO
+    sd_exchange(0xFF);
+}
+
+static bool sd_select(void)
+{
+    HAL_GPIO_WritePin(SDCARD_CS_GPIO_Port, SDCARD_CS_Pin, GPIO_PIN_RESET);
+    sd_exchange(0xFF);
+    
+    if (sd_wait_ready(SD_WRITE_TIMEOUT))
+        return true;
+    
+    sd_deselect();
+    return false;
+}
+
+// Returns the R1 response [0x80: no response]. The card stays selected
+static uint8_t sd_command(uint8_t cmd, uint32_t arg)
+{
+    uint8_t frame[6];
+    uint8_t r1;
+    uint32_t retries;
+    
+    if (cmd & SD_ACMD)
+    {
+        cmd &= ~SD_ACMD;
+        r1 = sd_command(SD_CMD55, 0);
+        
+        if (r1 > SD_R1_IDLE)
+            return r1;
+    }
+    
+    // STOP_TRANSMISSION is sent in the middle of a read, the card is not ready
+    if (cmd != SD_CMD12)
+    {
+        sd_deselect();
+        
+        if (!sd_select())
+            return 0xFF;
+    }
+    
+    frame[0] = 0x40 | cmd;
+    frame[1] = (uint8_t)(arg >> 24);
+    frame[2] = (uint8_t)(arg >> 16);
+    frame[3] = (uint8_t)(arg >> 8);
+    frame[4] = (uint8_t)arg;
+    
+    // CRC only checked before the card enters SPI mode
+    if (cmd == SD_CMD0)
+        frame[5] = 0x95;
+    else if (cmd == SD_CMD8)
+        frame[5] = 0x87;
+    else
+        frame[5] = 0x01;
+    
+    sd_send(frame, sizeof(frame));
+    
+    // Stuff byte
+    if (cmd == SD_CMD12)
+        sd_exchange(0xFF);
+    
+    retries = 10;
+    
+    do
+    {
+        r1 = sd_exchange(0xFF);
+    }
+    while ((r1 & 0x80) && --retries);
+    
+    return r1;
+}
+
+static bool sd_receive_block(uint8_t * buffer, uint32_t len)
+{
+    uint32_t start = HAL_GetTick();
+    uint8_t token;
+    
+    do
+    {
+        token = sd_exchange(0xFF);
+    }
+    while (token == 0xFF && (HAL_GetTick() - start) < SD_READ_TIMEOUT);
+    
+    if (token != SD_TOKEN_START_BLOCK)
+        return false;
+    
+    sd_receive(buffer, len);
+    
+    // CRC [not checked in SPI mode]
+    sd_exchange(0xFF);
+    sd_exchange(0xFF);
+    
+    return true;
+}
+
+static bool sd_send_block(const uint8_t * buffer, uint8_t token)
+{
+    if (!sd_wait_ready(SD_WRITE_TIMEOUT))
+        return false;
+    
+    sd_exchange(token);
+    
+    if (token == SD_TOKEN_STOP_TRAN)
+        return true;
+    
+    sd_send(buffer, SDCARD_SECTOR_SIZE);
+    sd_exchange(0xFF);
+    sd_exchange(0xFF);
+    
+    return ((sd_exchange(0xFF) & 0x1F) == SD_DATA_ACCEPTED) ? true : false;
+}
+
+static uint32_t sd_read_sector_count(void)
+{
+    uint8_t csd[16];
+    uint32_t c_size;
+    uint32_t shift;
+    
+    if (sd_command(SD_CMD9, 0) != 0 || !sd_receive_block(csd, sizeof(csd)))
+        return 0;
+    
+    // CSD 2.0 [SDHC/SDXC]: capacity = (C_SIZE + 1) * 512 KB
+    if ((csd[0] >> 6) == 1)
+    {
+        c_size = ((uint32_t)(csd[7] & 0x3F) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+        return (c_size + 1) << 10;
+    }
+    
+    // CSD 1.0: (C_SIZE + 1) << (C_SIZE_MULT + 2) blocks of READ_BL_LEN bytes
+    c_size = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+    shift = (csd[5] & 0x0F) + (((csd[9] & 0x03) << 1) | (csd[10] >> 7)) + 2 - 9;
+    
+    return (c_size + 1) << shift;
+}
+
+SDCARD_RESULTS SDCARD_Init(void)
+{
+    uint8_t response[4];
+    uint32_t start;
+    uint8_t cmd;
+    uint32_t i;
+    
+    sd_sector_count = 0;
+    sd_block_addressing = false;
+    sd_sdc = false;
+    
+    sd_set_clock(SD_CLOCK_SLOW);
+    
+    // At least 74 clocks with CS high
+    HAL_GPIO_WritePin(SDCARD_CS_GPIO_Port, SDCARD_CS_Pin, GPIO_PIN_SET);
+    
+    for (i = 0; i < 10; i++)
+        sd_exchange(0xFF);
+    
+    if (sd_command(SD_CMD0, 0) != SD_R1_IDLE)
+    {
+        sd_deselect();
+        return SDCARD_ERROR_NO_CARD;
+    }
+    
+    start = HAL_GetTick();
+    
+    if (sd_command(SD_CMD8, 0x1AA) == SD_R1_IDLE)
+    {
+        // SD v2: voltage range echoed, then leave the idle state announcing high capacity support
+        sd_receive(response, sizeof(response));
+        
+        if (response[2] != 0x01 || response[3] != 0xAA)
+        {
+            sd_deselect();
+            return SDCARD_ERROR_COMMAND;
+        }
+        
+        while (sd_command(SD_ACMD41, 1UL << 30) != 0)
+        {
+            if ((HAL_GetTick() - start) >= SD_INIT_TIMEOUT)
+            {
+                sd_deselect();
+                return SDCARD_ERROR_TIMEOUT;
+            }
+        }
+        
+        if (sd_command(SD_CMD58, 0) != 0)
+        {
+            sd_deselect();
+            return SDCARD_ERROR_COMMAND;
+        }
+        
+        sd_receive(response, sizeof(response));
+        sd_block_addressing = (response[0] & 0x40) ? true : false;
+        sd_sdc = true;
+    }
+    else
+    {
+        // SD v1 or MMC
+        if (sd_command(SD_ACMD41, 0) <= SD_R1_IDLE)
+        {
+            cmd = SD_ACMD41;
+            sd_sdc = true;
+        }
+        else
+        {
+            cmd = SD_CMD1;
+        }
+        
+        while (sd_command(cmd, 0) != 0)
+        {
+            if ((HAL_GetTick() - start) >= SD_INIT_TIMEOUT)
+            {
+                sd_deselect();
+                return SDCARD_ERROR_TIMEOUT;
+            }
+        }
+        
+        if (sd_command(SD_CMD16, SDCARD_SECTOR_SIZE) != 0)
+        {
+            sd_deselect();
+            return SDCARD_ERROR_COMMAND;
+        }
+    }
+    
+    sd_set_clock(SD_CLOCK_FAST);
+    
+    sd_sector_count = sd_read_sector_count();
+    sd_deselect();
+    
+    return (sd_sector_count != 0) ? SDCARD_OK : SDCARD_ERROR_DATA;
+}
+
+uint32_t SDCARD_GetSectorCount(void)
+{
+    return sd_sector_count;
+}
+
+// Several sectors: one READ_MULTIPLE_BLOCK command for the whole run
+SDCARD_RESULTS SDCARD_ReadBlocks(uint8_t * pBuffer, uint32_t sector, uint32_t count)
+{
+    SDCARD_RESULTS result = SDCARD_OK;
+    bool multiple = (count > 1) ? true : false;
+    
+    if (sd_sector_count == 0)
+        return SDCARD_ERROR_NO_CARD;
+    
+    if (count == 0 || sector >= sd_sector_count || (sd_sector_count - sector) < count)
+        return SDCARD_ERROR_RANGE;
+    
+    if (sd_command(multiple ? SD_CMD18 : SD_CMD17, sd_block_addressing ? sector : (sector * SDCARD_SECTOR_SIZE)) != 0)
+    {
+        sd_deselect();
+        return SDCARD_ERROR_COMMAND;
+    }
+    
+    while (count != 0)
+    {
+        if (!sd_receive_block(pBuffer, SDCARD_SECTOR_SIZE))
+        {
+            result = SDCARD_ERROR_DATA;
+            break;
+        }
+        
+        pBuffer += SDCARD_SECTOR_SIZE;
+        count--;
+    }
+    
+    if (multiple)
+        sd_command(SD_CMD12, 0);
+    
+    sd_deselect();
+    return result;
+}
+
+// Several sectors: blocks pre-erased [ACMD23] and streamed with one WRITE_MULTIPLE_BLOCK command
+SDCARD_RESULTS SDCARD_WriteBlocks(const uint8_t * pBuffer, uint32_t sector, uint32_t count)
+{
+    SDCARD_RESULTS result = SDCARD_OK;
+    uint32_t address = sd_block_addressing ? sector : (sector * SDCARD_SECTOR_SIZE);
+    
+    if (sd_sector_count == 0)
+        return SDCARD_ERROR_NO_CARD;
+    
+    if (count == 0 || sector >= sd_sector_count || (sd_sector_count - sector) < count)
+        return SDCARD_ERROR_RANGE;
+    
+    if (count == 1)
+    {
+        if (sd_command(SD_CMD24, address) != 0)
+            result = SDCARD_ERROR_COMMAND;
+        else if (!sd_send_block(pBuffer, SD_TOKEN_START_BLOCK))
+            result = SDCARD_ERROR_DATA;
+    }
+    else
+    {
+        if (sd_sdc)
+            sd_command(SD_ACMD23, count);
+        
+        if (sd_command(SD_CMD25, address) != 0)
+        {
+            result = SDCARD_ERROR_COMMAND;
+        }
+        else
+        {
+            while (count != 0)
+            {
+                if (!sd_send_block(pBuffer, SD_TOKEN_START_MULTI))
+                {
+                    result = SDCARD_ERROR_DATA;
+                    break;
+                }
+                
+                pBuffer += SDCARD_SECTOR_SIZE;
+                count--;
+            }
+            
+            if (!sd_send_block(NULL, SD_TOKEN_STOP_TRAN) && result == SDCARD_OK)
+                result = SDCARD_ERROR_DATA;
+        }
+    }
+    
+    // Last block programmed before the card is released
+    if (result == SDCARD_OK && !sd_wait_ready(SD_WRITE_TIMEOUT))
+        result = SDCARD_ERROR_TIMEOUT;
+    
+    sd_deselect();
+    return result;
+}
@@ -9,7 +9,7 @@ UART_HandleTypeDef spindle_uart_handle;
 void Init_Debug_UART1(void)
 {
     debug_uart_handle.Instance = USART1;
-    debug_uart_handle.Init.BaudRate = 115200;
+    debug_uart_handle.Init.BaudRate = DEBUG_UART_BAUDRATE;
     debug_uart_handle.Init.WordLength = UART_WORDLENGTH_8B;
     debug_uart_handle.Init.StopBits = UART_STOPBITS_1;
     debug_uart_handle.Init.Parity = UART_PARITY_NONE;
@@ -24,8 +24,8 @@ void Init_Debug_UART1(void)
 void Init_Spindle_UART3(void)
 {
     spindle_uart_handle.Instance = USART3;
-    spindle_uart_handle.Init.BaudRate = 115200;
-    spindle_uart_handle.Init.WordLength = UART_WORDLENGTH_9B;
+    spindle_uart_handle.Init.BaudRate = SPINDLE_UART_BAUDRATE;
+    spindle_uart_handle.Init.WordLength = UART_WORDLENGTH_9B;     // 8 data bits + parity
     spindle_uart_handle.Init.StopBits = UART_STOPBITS_1;
     spindle_uart_handle.Init.Parity = UART_PARITY_EVEN;
     spindle_uart_handle.Init.Mode = UART_MODE_TX_RX;
@@ -22,6 +22,7 @@
 
 #include "ControlBar.h"
 #include "PageManager.h"
+#include "UIScheduler.h"
 
 #include "DataConverter.h"
 
@@ -63,11 +64,16 @@ void UI_MainTask_Entry(void * pvParam)
     
     control_bar->Create(lv_scr_act());
     page_manager->Initialize(lv_scr_act());
+    
+    UIScheduler::Initialize();
+    
+    // Touch interrupts wake up this task before the refresh period ends
+    lv_port_indev_GT9147_set_notify_task(xTaskGetCurrentTaskHandle());
         
     for ( ; ; )
     {
-        lv_task_handler();
-        vTaskDelay(50);
+        // Refresh rate and CPU usage are limited by the scheduler
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(UIScheduler::RunCycle()));
     }
 }
 
@@ -4,35 +4,104 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
-
-
 #include "task_settings.h"
 #include "usb_task.h"
 #include "settings_manager.h"
+#include "pins.h"
+
+#include "UsbDevice.h"
+#include "UsbCdc.h"
 
 TaskHandle_t usb_task_handle;
 
+static PCD_HandleTypeDef usb_pcd_handle;
+
+static void init_usb_device()
+{
+    usb_pcd_handle.Instance = USB_OTG_FS;
+    usb_pcd_handle.Init.dev_endpoints = 4;
+    usb_pcd_handle.Init.speed = PCD_SPEED_FULL;
+    usb_pcd_handle.Init.dma_enable = DISABLE;
+    usb_pcd_handle.Init.ep0_mps = DEP0CTL_MPS_64;
+    usb_pcd_handle.Init.phy_itface = PCD_PHY_EMBEDDED;
+    usb_pcd_handle.Init.Sof_enable = DISABLE;
+    usb_pcd_handle.Init.low_power_enable = DISABLE;
+    usb_pcd_handle.Init.lpm_enable = DISABLE;
+    usb_pcd_handle.Init.vbus_sensing_enable = DISABLE;     // PA9 is USART1 Tx, PD3 senses the cable
+    usb_pcd_handle.Init.use_dedicated_ep1 = DISABLE;
+    
+    HAL_PCD_Init(&usb_pcd_handle);
+    
+    // 320 words of FIFO RAM: Rx shared, Tx per IN endpoint [EP0, data, CDC notifications]
+    HAL_PCDEx_SetRxFiFo(&usb_pcd_handle, 0x80);
+    HAL_PCDEx_SetTxFiFo(&usb_pcd_handle, 0, 0x40);
+    HAL_PCDEx_SetTxFiFo(&usb_pcd_handle, 1, 0x60);
+    HAL_PCDEx_SetTxFiFo(&usb_pcd_handle, 2, 0x20);
+}
+
 void USBTask_Entry(void * pvParam)
 {
+    uint32_t events;
+    
     // Initialize USB Stack [CDC Device]
+    init_usb_device();
+    UsbDevice::Initialize(&usb_pcd_handle, &usb_cdc);
     
     // Wait for USB events (signaled from Interrupt to Task Notification)
     for ( ; ; )
     {
-         if (ulTaskNotifyTake(pdTRUE, portMAX_DELAY)!= 0)
-         {
-             NVIC_EnableIRQ(OTG_FS_IRQn);
-         }
+        events = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &events, pdMS_TO_TICKS(USB_CABLE_POLL_MS));
+        
+        UsbDevice::SetAttached(HAL_GPIO_ReadPin(USB_CONN_DETECT_GPIO_Port, USB_CONN_DETECT_Pin) == GPIO_PIN_SET);
+        
+        if (events & USB_NOTIFY_IRQ)
+        {
+            UsbDevice::HandleInterrupt();
+            NVIC_EnableIRQ(OTG_FS_IRQn);
+        }
+        
+        if (events & ~USB_NOTIFY_IRQ)
+            UsbDevice::Service(events);
+    }
+}
+
+void HAL_PCD_MspInit(PCD_HandleTypeDef * pcdHandle)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    
+    if (pcdHandle->Instance == USB_OTG_FS)
+    {
+        __HAL_RCC_GPIOA_CLK_ENABLE();
+        
+        /**USB_OTG_FS GPIO Configuration    
+        PA11     ------> USB_OTG_FS_DM
+        PA12     ------> USB_OTG_FS_DP 
+        */
+        GPIO_InitStruct.Pin = USB_D_MINUS_Pin | USB_D_PLUS_Pin;
+        GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+        GPIO_InitStruct.Pull = GPIO_NOPULL;
+        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+        GPIO_InitStruct.Alternate = GPIO_AF10_OTG_FS;
+        
+        HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+        
+        /* USB_OTG_FS clock enable [48 MHz from PLLQ] */
+        __HAL_RCC_USB_OTG_FS_CLK_ENABLE();
+        
+        /* Serviced by the USB task, the handler only notifies it */
+        HAL_NVIC_SetPriority(OTG_FS_IRQn, 6, 0);
+        HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
     }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-void OTG_FS_IRQHandler(void)
+extern "C" void OTG_FS_IRQHandler(void)
 {
     BaseType_t high_prio_task_woken = pdFALSE;
     
-    xTaskNotifyFromISR(usb_task_handle, 1, eSetBits, &high_prio_task_woken);
+    xTaskNotifyFromISR(usb_task_handle, USB_NOTIFY_IRQ, eSetBits, &high_prio_task_woken);
     NVIC_DisableIRQ(OTG_FS_IRQn);
     
     portYIELD_FROM_ISR(high_prio_task_woken);
@@ -29,12 +29,14 @@ void Init_UserTasks_and_Objects(void)
     
     machine->Initialize();   
     
+    Settings_Manager::StartWriterTask();
+    
 //  xTaskCreate(UI_BootTask_Entry, "UIBOOT", UI_BOOT_TASK_STACK_SIZE, NULL, UI_BOOT_TASK_PRIORITY, NULL);
-//  xTaskCreate(USBTask_Entry, "USBTASK", USB_TASK_STACK_SIZE, NULL, USB_TASK_PRIORITY, &usb_task_handle);
-//  xTaskCreate(DiskTask_Entry, "DSKTASK", DISK_TASK_STACK_SIZE, NULL, DISK_TASK_PRIORITY, &disk_task_handle);
 
     xTaskCreate(GCodeParsingTask_Entry, "GCODE", GCODE_TASK_STACK_SIZE, (void*)machine, GCODE_TASK_PRIORITY, &gcode_task_handle);
     xTaskCreate(SerialTask_Entry, "SERIAL", SERIAL_TASK_STACK_SIZE, (void*)machine, SERIAL_TASK_PRIORITY, &serial_task_handle);
+    xTaskCreate(USBTask_Entry, "USBTASK", USB_TASK_STACK_SIZE, NULL, USB_TASK_PRIORITY, &usb_task_handle);
+    xTaskCreate(DiskTask_Entry, "DSKTASK", DISK_TASK_STACK_SIZE, NULL, DISK_TASK_PRIORITY, &disk_task_handle);
     
     vTaskStartScheduler();
 }
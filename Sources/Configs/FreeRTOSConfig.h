@@ -58,7 +58,7 @@
 #define configMINIMAL_STACK_SIZE		( ( unsigned short ) 128 )
 #define configTOTAL_HEAP_SIZE			( ( size_t ) ( 1024 * 44 ) )
 #define configMAX_TASK_NAME_LEN			( 8 )
-#define configUSE_TRACE_FACILITY		0
+#define configUSE_TRACE_FACILITY		1
 #define configUSE_16_BIT_TICKS			0
 #define configIDLE_SHOULD_YIELD			1
 #define configUSE_MUTEXES				1
@@ -68,7 +68,12 @@
 #define configUSE_MALLOC_FAILED_HOOK	1
 #define configUSE_APPLICATION_TASK_TAG	0
 #define configUSE_COUNTING_SEMAPHORES	1
-#define configGENERATE_RUN_TIME_STATS	0
+#define configGENERATE_RUN_TIME_STATS	1
+
+/* Run time stats clock: DWT cycle counter (see Profiler). Registers accessed directly, CMSIS
+headers are not included here */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()	{ ( *( ( volatile uint32_t * ) 0xE000EDFC ) ) |= ( 1UL << 24 ); ( *( ( volatile uint32_t * ) 0xE0001000 ) ) |= 1UL; }
+#define portGET_RUN_TIME_COUNTER_VALUE()		( *( ( volatile uint32_t * ) 0xE0001004 ) )
 
 #define configAPPLICATION_ALLOCATED_HEAP    0
 
@@ -93,6 +98,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelay				1
 #define INCLUDE_uxTaskGetStackHighWaterMark 0
 #define INCLUDE_xTimerPendFunctionCall  1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
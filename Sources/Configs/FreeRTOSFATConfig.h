@@ -243,13 +243,16 @@ parameter). */
 #define	ffconfigMKDIR_RECURSIVE	 0
 
 /* Set to a function that will be used for all dynamic memory allocations.
-Setting to pvPortMalloc() will use the same memory allocator as FreeRTOS. */
-#define ffconfigMALLOC( size )	pvPortMalloc( size )
+Setting to pvPortMalloc() will use the same memory allocator as FreeRTOS.
+Sector buffers come from the FAT sector pool (SRAM, reachable by the SD DMA),
+anything else from the FreeRTOS heap. */
+#include "memory_map.h"
+#define ffconfigMALLOC( size )	fat_pool_alloc( size )
 
 /* Set to a function that matches the above allocator defined with
 ffconfigMALLOC.  Setting to vPortFree() will use the same memory free
 function as	FreeRTOS. */
-#define ffconfigFREE( ptr )  vPortFree( ptr )
+#define ffconfigFREE( ptr )  fat_pool_free( ptr )
 
 /* Set to 1 to calculate the free size and volume size as a 64-bit number.
 
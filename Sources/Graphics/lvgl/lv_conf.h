@@ -80,9 +80,9 @@ typedef int16_t lv_coord_t;
 /* Automatically defrag. on free. Defrag. means joining the adjacent free cells. */
 #  define LV_MEM_AUTO_DEFRAG  1
 #else       /*LV_MEM_CUSTOM*/
-#  define LV_MEM_CUSTOM_INCLUDE "FreeRTOS.h"   /*Header for the dynamic memory function*/
-#  define LV_MEM_CUSTOM_ALLOC   pvPortMalloc       /*Wrapper to malloc*/
-#  define LV_MEM_CUSTOM_FREE    vPortFree         /*Wrapper to free*/
+#  define LV_MEM_CUSTOM_INCLUDE "memory_map.h"   /*Header for the dynamic memory function*/
+#  define LV_MEM_CUSTOM_ALLOC   ui_pool_alloc      /*Wrapper to malloc*/
+#  define LV_MEM_CUSTOM_FREE    ui_pool_free       /*Wrapper to free*/
 #endif     /*LV_MEM_CUSTOM*/
 
 /* Garbage Collector settings
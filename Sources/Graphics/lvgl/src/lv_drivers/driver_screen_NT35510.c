@@ -14,8 +14,21 @@ static void NT35510_SetBacklight(uint8_t percent);
 static void NT35510_SetViewPort(uint16_t x, uint16_t y, uint16_t cx, uint16_t cy);
 static void NT35510_WriteData_Increment(uint16_t * data, uint32_t nr_bytes);
 static void NT35510_WriteData_No_Increment(uint16_t data, uint32_t nr_bytes);
+static void NT35510_StartWriteData_Increment(uint16_t * data, uint32_t nr_bytes);
 
 static void disp_flush(lv_disp_drv_t * disp_drv, const lv_area_t * area, lv_color_t * color_p);
+static void disp_flush_dma_done(DMA_HandleTypeDef * hdma);
+
+/* Two partial buffers: LittlevGL renders into one while DMA sends the other one to the display */
+#define DISP_BUFFER_LINES       10
+#define DISP_BUFFER_PIXELS      (LV_HOR_RES_MAX * DISP_BUFFER_LINES)
+
+static lv_disp_buf_t display_buffer_desc;
+static lv_color_t display_buffer_memory_1[DISP_BUFFER_PIXELS];
+static lv_color_t display_buffer_memory_2[DISP_BUFFER_PIXELS];
+
+/* Driver whose buffer is being transferred, released from the DMA complete interrupt */
+static lv_disp_drv_t * volatile flushing_disp_drv = NULL;
 
 static const uint16_t nt35510_config_table[] =
 {
@@ -236,6 +249,24 @@ void NT35510_WriteData_Increment(uint16_t * data, uint32_t nr_bytes)
 	HAL_DMA_PollForTransfer(&hdma_memtomem_dma2_stream0, HAL_DMA_FULL_TRANSFER, 1000);
 }
 
+/* Start the transfer of a pixel block and return without waiting (DISP_BUFFER_PIXELS max).
+ * Completion is reported through hdma_memtomem_dma2_stream0 callbacks */
+static void NT35510_StartWriteData_Increment(uint16_t * data, uint32_t nr_bytes)
+{
+	//if memory increment disabled?
+    if ((hdma_memtomem_dma2_stream0.Instance->CR & DMA_PINC_ENABLE) == DMA_PINC_DISABLE)
+    {
+        // First, disable stream to be able to modify settings
+        __HAL_DMA_DISABLE(&hdma_memtomem_dma2_stream0);
+
+        // Enable source memory addr incr (periph inc)
+        hdma_memtomem_dma2_stream0.Instance->CR |= DMA_PINC_ENABLE;
+    }
+
+    // start dma transfer, completion/error interrupts enabled
+    HAL_DMA_Start_IT(&hdma_memtomem_dma2_stream0, (uint32_t)data, (uint32_t)&LCD->RAM, nr_bytes);
+}
+
 void NT35510_WriteData_No_Increment(uint16_t data, uint32_t nr_bytes)
 {
 	// if memory increment enabled?
@@ -305,30 +336,25 @@ void NT35510_SetViewPort(uint16_t x, uint16_t y, uint16_t cx, uint16_t cy)
 
 void lv_port_disp_NT35510_init(void)
 {
-    static lv_disp_buf_t * display_buffer_desc = NULL;
-    static lv_color_t * display_buffer_memory = NULL;
-    
     /*-------------------------
      * Initialize your display
      * -----------------------*/
     NT35510_Initialize();
 
+    /* Flush is completed from the DMA interrupt */
+    hdma_memtomem_dma2_stream0.XferCpltCallback = disp_flush_dma_done;
+    hdma_memtomem_dma2_stream0.XferErrorCallback = disp_flush_dma_done;
+
     /*-----------------------------
      * Create a buffer for drawing
      *----------------------------*/
 
     /* LittlevGL requires a buffer where it draws the objects. The buffer's has to be greater than 1 display row
      *
-     * There are three buffering configurations:
-     * 1. Create ONE buffer with some rows: 
-     *      LittlevGL will draw the display's content here and writes it to your display
+     * Two buffers with some rows are used: LittlevGL draws the display's content to one buffer
+     * while the other one is being sent to the display by DMA (full screen buffers don't fit in RAM)
      */
-    // Allocate buffer memory
-    display_buffer_desc = (lv_disp_buf_t*)pvPortMalloc(sizeof(lv_disp_buf_t));    
-    display_buffer_memory = (lv_color_t*)pvPortMalloc(sizeof(lv_color_t) * LV_HOR_RES_MAX * 15);
-
-    // Initialize buffer descriptor
-    lv_disp_buf_init(display_buffer_desc, display_buffer_memory, NULL, LV_HOR_RES_MAX * 15);   /*Initialize the display buffer*/
+    lv_disp_buf_init(&display_buffer_desc, display_buffer_memory_1, display_buffer_memory_2, DISP_BUFFER_PIXELS);
 
     
     /*-----------------------------------
@@ -348,7 +374,7 @@ void lv_port_disp_NT35510_init(void)
     display_driver_instance.flush_cb = disp_flush;
 
     /*Set a display buffer*/
-    display_driver_instance.buffer = display_buffer_desc;
+    display_driver_instance.buffer = &display_buffer_desc;
 
 #if LV_USE_GPU
     /*Optionally add functions to access the GPU. (Only in buffered mode, LV_VDB_SIZE != 0)*/
@@ -374,11 +400,26 @@ static void disp_flush(lv_disp_drv_t * disp_drv, const lv_area_t * area, lv_colo
     uint32_t byte_cnt = (area->x2 - area->x1 + 1) * (area->y2 - area->y1 + 1);
     
     NT35510_SetViewPort(area->x1, area->y1, (area->x2 - area->x1)+1, (area->y2 - area->y1)+1);
-    NT35510_WriteData_Increment((uint16_t*)color_p, byte_cnt);
     
+    /* lv_disp_flush_ready is called when the transfer ends (disp_flush_dma_done) */
+    flushing_disp_drv = disp_drv;
+    NT35510_StartWriteData_Increment((uint16_t*)color_p, byte_cnt);
+}
 
+static void disp_flush_dma_done(DMA_HandleTypeDef * hdma)
+{
+    lv_disp_drv_t * disp_drv = flushing_disp_drv;
+    
+    flushing_disp_drv = NULL;
+    
     /* IMPORTANT!!!
      * Inform the graphics library that you are ready with the flushing*/
-    lv_disp_flush_ready(disp_drv);
+    if (disp_drv != NULL)
+        lv_disp_flush_ready(disp_drv);
+}
+
+void DMA2_Stream0_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_memtomem_dma2_stream0);
 }
 
@@ -21,18 +21,28 @@
  *      DEFINES
  *********************/
 
+#define TOUCH_RING_SIZE             8       /* Power of 2 */
+#define TOUCH_RELEASE_TIMEOUT_MS    100     /* Release assumed if reports stop while pressed */
+
 /**********************
  *      TYPEDEFS
  **********************/
 
+typedef struct
+{
+    lv_coord_t x;
+    lv_coord_t y;
+    lv_indev_state_t state;
+}touch_event_t;
+
 /**********************
  *  STATIC PROTOTYPES
  **********************/
 
 static void touchpad_init(void);
 static bool touchpad_read(lv_indev_drv_t * indev_drv, lv_indev_data_t * data);
-static bool touchpad_is_pressed(void);
-static void touchpad_get_xy(lv_coord_t * x, lv_coord_t * y);
+static uint8_t touchpad_read_report(touch_event_t * event);
+static void touchpad_push_event(const touch_event_t * event);
 
 static void clear_status_reg_GT9147(void);
 
@@ -40,6 +50,20 @@ static void clear_status_reg_GT9147(void);
  *  STATIC VARIABLES
  **********************/
 
+static lv_indev_t * touch_indev;
+
+/* Set from EXTI1 (controller INT line), consumed by the UI task */
+static volatile uint8_t touch_irq_pending;
+static TaskHandle_t touch_notify_task;
+
+/* Events waiting for LVGL. Written and read only from the UI task */
+static touch_event_t touch_ring[TOUCH_RING_SIZE];
+static uint8_t touch_ring_head;
+static uint8_t touch_ring_tail;
+
+static touch_event_t touch_last_event;
+static TickType_t touch_last_report_tick;
+
 /**********************
  *      MACROS
  **********************/
@@ -64,7 +88,64 @@ void lv_port_indev_GT9147_init(void)
     input_device_driver.type = LV_INDEV_TYPE_POINTER;
     input_device_driver.read_cb = touchpad_read;
 
-    lv_indev_t * mydev = lv_indev_drv_register(&input_device_driver);
+    touch_indev = lv_indev_drv_register(&input_device_driver);
+    
+    /* Touch data is only read after the controller signals a new report.
+       First read also clears any report left from before the reset */
+    touch_irq_pending = 1;
+    
+    __HAL_GPIO_EXTI_CLEAR_IT(CTOUCH_IRQ_Pin);
+    HAL_NVIC_SetPriority(EXTI1_IRQn, 7, 0);
+    HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+}
+
+/* Task woken up on each touch interrupt (normally the UI task) */
+void lv_port_indev_GT9147_set_notify_task(TaskHandle_t task)
+{
+    touch_notify_task = task;
+}
+
+/* Called from the UI task. Reads the controller only if it raised its INT line */
+void lv_port_indev_GT9147_process(void)
+{
+    touch_event_t event;
+    
+    if (touch_irq_pending != 0)
+    {
+        touch_irq_pending = 0;
+        
+        if (touchpad_read_report(&event) != 0)
+        {
+            touch_last_report_tick = xTaskGetTickCount();
+            touchpad_push_event(&event);
+        }
+        
+        /* Report consumed, controller can raise a new one */
+        clear_status_reg_GT9147();
+    }
+    else if ((touch_last_event.state == LV_INDEV_STATE_PR) && 
+             ((xTaskGetTickCount() - touch_last_report_tick) > pdMS_TO_TICKS(TOUCH_RELEASE_TIMEOUT_MS)))
+    {
+        /* Release report was lost */
+        event = touch_last_event;
+        event.state = LV_INDEV_STATE_REL;
+        touchpad_push_event(&event);
+    }
+}
+
+/* Controller INT line (PB1). Defer the I2C transfer to task level */
+void EXTI1_IRQHandler(void)
+{
+    BaseType_t high_prio_woken = pdFALSE;
+    
+    __HAL_GPIO_EXTI_CLEAR_IT(CTOUCH_IRQ_Pin);
+    
+    touch_irq_pending = 1;
+    
+    if (touch_notify_task != NULL)
+        vTaskNotifyGiveFromISR(touch_notify_task, &high_prio_woken);
+    
+    portYIELD_FROM_ISR(high_prio_woken);
 }
 
 /**********************
@@ -128,6 +209,8 @@ void lv_port_indev_GT9147_init(void)
 #define GT9147_STATUS_BUF_VALID_MASK    0x80
 #define GT9147_STATUS_TP_COUNT_MASK     0x0F
 
+#define GT9147_MAX_TOUCH_POINTS         5
+
 
 static uint8_t soft_i2c_send_byte(uint8_t tx);
 static uint8_t soft_i2c_recv_byte(uint8_t final_byte);
@@ -167,91 +250,107 @@ static void touchpad_init(void)
 /* Will be called by the library to read the touchpad */
 static bool touchpad_read(lv_indev_drv_t * indev_drv, lv_indev_data_t * data)
 {
-    static lv_coord_t last_x = 0;
-    static lv_coord_t last_y = 0;
-
-    /*Save the pressed coordinates and the state*/
-    if(touchpad_is_pressed())
-    {
-        touchpad_get_xy(&last_y, &last_x);
-        data->state = LV_INDEV_STATE_PR;
-        
-        last_y = 480 - last_y;
-    }
-    else
+    static touch_event_t current = { 0, 0, LV_INDEV_STATE_REL };
+    
+    /* Nothing new: keep reporting the last state */
+    if (touch_ring_tail != touch_ring_head)
     {
-        data->state = LV_INDEV_STATE_REL;
+        current = touch_ring[touch_ring_tail];
+        touch_ring_tail = (touch_ring_tail + 1) & (TOUCH_RING_SIZE - 1);
     }
     
-    // Always clear status register
-    clear_status_reg_GT9147();
-
-    /* Set the last pressed coordinates */
-    data->point.x = last_x;
-    data->point.y = last_y;
+    data->point.x = current.x;
+    data->point.y = current.y;
+    data->state = current.state;
 
-    /*Return `false` because we are not buffering and no more data to read*/
-    return false;
+    /*Return `true` while there are buffered events, so LVGL reads them all*/
+    return (touch_ring_tail != touch_ring_head);
 }
 
-/*Return true is the touchpad is pressed*/
-static bool touchpad_is_pressed(void)
+/* Add an event to the ring. If full, consecutive presses are merged into the last one */
+static void touchpad_push_event(const touch_event_t * event)
 {
-    uint8_t status_reg = 0;
-
-    /* Try to read Reg_814E */
-    if (soft_i2c_start(GT9147_I2C_WRITE_ADDR) != 0)
+    uint8_t next_head = (touch_ring_head + 1) & (TOUCH_RING_SIZE - 1);
+    uint8_t last = (touch_ring_head - 1) & (TOUCH_RING_SIZE - 1);
+    
+    if (next_head == touch_ring_tail)
     {
-        /* Send register address (0x814E) */
-        soft_i2c_send_byte(GT9147_STATUS_REG_HIGH);
-        soft_i2c_send_byte(GT9147_STATUS_REG_LOW);
-
-        /* Send read address after a restart */
-        soft_i2c_restart(GT9147_I2C_READ_ADDR);
-
-        /* Read register value */
-        status_reg = soft_i2c_recv_byte(1);
-
-        /* Send a stop */
-        soft_i2c_stop();
-
-        if ((status_reg > 0x80) && (status_reg < 0x86))
+        if ((event->state == LV_INDEV_STATE_PR) && (touch_ring[last].state == LV_INDEV_STATE_PR))
         {
-            /* update mouse data */
-            return true;
+            /* Only the latest position of a drag matters */
+            touch_ring[last] = *event;
+        }
+        else
+        {
+            /* Drop oldest, state changes must not be lost */
+            touch_ring_tail = (touch_ring_tail + 1) & (TOUCH_RING_SIZE - 1);
+            touch_ring[touch_ring_head] = *event;
+            touch_ring_head = next_head;
         }
     }
-
-    return false;
+    else
+    {
+        touch_ring[touch_ring_head] = *event;
+        touch_ring_head = next_head;
+    }
+    
+    touch_last_event = *event;
+    
+    /* Let LVGL read the new data in the next handler call */
+    if (touch_indev != NULL)
+        lv_task_ready(touch_indev->driver.read_task);
 }
 
-/*Get the x and y coordinates if the touchpad is pressed*/
-static void touchpad_get_xy(lv_coord_t * px, lv_coord_t * py)
+/* Read status and first touch point in a single transfer. Returns 0 if no valid report */
+static uint8_t touchpad_read_report(touch_event_t * event)
 {
-    uint8_t data_buf[4];
+    /* 0x814E .. 0x8153 [status, track_id, x1_low, x1_high, y1_low, y1_high] */
+    uint8_t data_buf[6];
     uint8_t index;
+    lv_coord_t raw_x, raw_y;
 
-    /* 0x8150 .. 0x8155 [x1_low, x1_high, y1_l, y1_h, pt1_size_l, pt1_size_h] */
-    if (soft_i2c_start(GT9147_I2C_WRITE_ADDR) != 0)
+    if (soft_i2c_start(GT9147_I2C_WRITE_ADDR) == 0)
     {
-        /* Send register addr */
-        soft_i2c_send_byte(0x81); // High addr
-        soft_i2c_send_byte(0x50); // Low addr
-
-        /* Send a restart for a read operation */
-        soft_i2c_restart(GT9147_I2C_READ_ADDR);
+        soft_i2c_stop();
+        return 0;
+    }
+    
+    /* Send register address (0x814E) */
+    soft_i2c_send_byte(GT9147_STATUS_REG_HIGH);
+    soft_i2c_send_byte(GT9147_STATUS_REG_LOW);
 
-        /* and read upto 6 bytes */
-        for (index = 0; index < sizeof(data_buf); index++)
-            data_buf[index] = soft_i2c_recv_byte((index == (sizeof(data_buf)-1)) ? 1 : 0);
+    /* Send a restart for a read operation */
+    soft_i2c_restart(GT9147_I2C_READ_ADDR);
 
-        /* Send stop bit */
-        soft_i2c_stop();
+    for (index = 0; index < sizeof(data_buf); index++)
+        data_buf[index] = soft_i2c_recv_byte((index == (sizeof(data_buf)-1)) ? 1 : 0);
 
-        /* Update data fields of mouse parameter */
-        *px = (data_buf[0] | (data_buf[1] << 8));
-        *py = (data_buf[2] | (data_buf[3] << 8));
+    /* Send stop bit */
+    soft_i2c_stop();
+    
+    if ((data_buf[0] & GT9147_STATUS_BUF_VALID_MASK) == 0)
+        return 0;
+    
+    /* Multi-point reports are coalesced into the first point. No points is a release */
+    if ((data_buf[0] & GT9147_STATUS_TP_COUNT_MASK) == 0)
+    {
+        *event = touch_last_event;
+        event->state = LV_INDEV_STATE_REL;
+        return 1;
     }
+    
+    if ((data_buf[0] & GT9147_STATUS_TP_COUNT_MASK) > GT9147_MAX_TOUCH_POINTS)
+        return 0;
+    
+    raw_x = (data_buf[2] | (data_buf[3] << 8));
+    raw_y = (data_buf[4] | (data_buf[5] << 8));
+    
+    /* Panel is rotated */
+    event->x = raw_y;
+    event->y = 480 - raw_x;
+    event->state = LV_INDEV_STATE_PR;
+    
+    return 1;
 }
 
 static void clear_status_reg_GT9147(void)
@@ -18,6 +18,9 @@ extern "C" {
  *********************/
 #include "lvgl.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 /*********************
  *      DEFINES
  *********************/
@@ -30,6 +33,8 @@ extern "C" {
  * GLOBAL PROTOTYPES
  **********************/
 void lv_port_indev_GT9147_init(void);
+void lv_port_indev_GT9147_set_notify_task(TaskHandle_t task);
+void lv_port_indev_GT9147_process(void);
     
 /**********************
  *      MACROS
@@ -43,6 +43,9 @@
 /* ST HAL includes. */
 #include "stm32f4xx_hal.h"
 
+/* SD card driver [SPI3]. */
+#include "spi_ports.h"
+
 /* Misc definitions. */
 #define sdSIGNATURE 			0x41404342UL
 #define sdHUNDRED_64_BIT		( 100ull )
@@ -184,69 +187,22 @@ int32_t lReturnCode = FF_ERR_IOMAN_OUT_OF_BOUNDS_READ | FF_ERRFLAG;
 		( ulSectorNumber < pxDisk->ulNumberOfSectors ) &&
 		( ( pxDisk->ulNumberOfSectors - ulSectorNumber ) >= ulSectorCount ) )
 	{
-	uint64_t ullReadAddr;
-//	HAL_SD_ErrorTypedef sd_result;
-
-		ullReadAddr = 512ull * ( uint64_t ) ulSectorNumber;
-
-		#if( SDIO_USES_DMA == 0 )
-		{
-			//sd_result = HAL_SD_ReadBlocks( &xSDHandle, (uint32_t *) pucBuffer, ullReadAddr, 512ul, ulSectorCount );
-		}
-		#else
-		{
-			if( ( ( ( size_t )pucBuffer ) & ( sizeof( size_t ) - 1 ) ) == 0 )
-			{
-				/* The buffer is word-aligned, call DMA read directly. */
-				sd_result = HAL_SD_ReadBlocks_DMA( &xSDHandle, (uint32_t *) pucBuffer, ullReadAddr, 512ul, ulSectorCount);
-				if( sd_result == SD_OK )
-				{
-					sd_result = HAL_SD_CheckReadOperation( &xSDHandle, sdMAX_TIME_TICKS );
-				}
-			}
-			else
-			{
-			uint32_t ulSector;
-			uint8_t *pucDMABuffer = ffconfigMALLOC( 512ul );
-
-				/* The buffer is NOT word-aligned, copy first to an aligned buffer. */
-				if( pucDMABuffer != NULL )
-				{
-					sd_result = SD_OK;
-					for( ulSector = 0; ulSector < ulSectorCount; ulSector++ )
-					{
-						ullReadAddr = 512ull * ( ( uint64_t ) ulSectorNumber + ( uint64_t ) ulSector );
-						sd_result = HAL_SD_ReadBlocks_DMA( &xSDHandle, ( uint32_t * )pucDMABuffer, ullReadAddr, 512ul, 1 );
+	SDCARD_RESULTS xResult;
 
-						if( sd_result == SD_OK )
-						{
-							sd_result = HAL_SD_CheckReadOperation( &xSDHandle, sdMAX_TIME_TICKS );
-							if( sd_result != SD_OK )
-							{
-								break;
-							}
-							memcpy( pucBuffer + 512ul * ulSector, pucDMABuffer, 512ul );
-						}
-					}
-					ffconfigFREE( pucDMABuffer );
-				}
-				else
-				{
-					sd_result = SD_INVALID_PARAMETER;
-				}
-			}
-		}
-		#endif	/* SDIO_USES_DMA */
+		/* The card is on SPI: no DMA alignment constraint, several sectors are
+		read with a single multiple block command. */
+		xResult = SDCARD_ReadBlocks( pucBuffer, ulSectorNumber, ulSectorCount );
 
-		//if( sd_result == SD_OK )
+		if( xResult == SDCARD_OK )
 		{
 			lReturnCode = 0L;
 		}
-		//else
-		//{
+		else
+		{
 			/* Some error occurred. */
-		//	FF_PRINTF( "prvFFRead: %lu: %u (%s)\n", ulSectorNumber, sd_result, prvSDCodePrintable( sd_result ) );
-		//}
+			lReturnCode = FF_ERR_DEVICE_DRIVER_FAILED | FF_ERRFLAG;
+			FF_PRINTF( "prvFFRead: %lu: %u\n", ulSectorNumber, xResult );
+		}
 	}
 	else
 	{
@@ -274,68 +230,20 @@ int32_t lReturnCode = FF_ERR_IOMAN_OUT_OF_BOUNDS_READ | FF_ERRFLAG;
 		( ulSectorNumber < pxDisk->ulNumberOfSectors ) &&
 		( ( pxDisk->ulNumberOfSectors - ulSectorNumber ) >= ulSectorCount ) )
 	{
-		//HAL_SD_ErrorTypedef sd_result;
-		uint64_t ullWriteAddr;
-		ullWriteAddr = 512ull * ulSectorNumber;
-
-		#if( SDIO_USES_DMA == 0 )
-		{
-			//sd_result = HAL_SD_WriteBlocks( &xSDHandle, ( uint32_t * )pucBuffer, ullWriteAddr, 512ul, ulSectorCount );
-		}
-		#else
-		{
-			if( ( ( ( size_t )pucBuffer ) & ( sizeof( size_t ) - 1 ) ) == 0 )
-			{
-				/* The buffer is word-aligned, call DMA reawrite directly. */
-				sd_result = HAL_SD_WriteBlocks_DMA( &xSDHandle, ( uint32_t * )pucBuffer, ullWriteAddr, 512ul, ulSectorCount );
-				if( sd_result == SD_OK )
-				{
-					sd_result = HAL_SD_CheckWriteOperation( &xSDHandle, sdMAX_TIME_TICKS );
-				}
-			}
-			else
-			{
-			uint32_t ulSector;
-			uint8_t *pucDMABuffer = ffconfigMALLOC( 512ul );
+	SDCARD_RESULTS xResult;
 
-				/* The buffer is NOT word-aligned, read to an aligned buffer and then
-				copy the data to the user provided buffer. */
-				if( pucDMABuffer != NULL )
-				{
-					sd_result = SD_OK;
-					for( ulSector = 0; ulSector < ulSectorCount; ulSector++ )
-					{
-						memcpy( pucDMABuffer, pucBuffer + 512ul * ulSector, 512ul );
-						ullWriteAddr = 512ull * ( ulSectorNumber + ulSector );
-						sd_result = HAL_SD_WriteBlocks_DMA( &xSDHandle, ( uint32_t * )pucDMABuffer, ullWriteAddr, 512ul, 1 );
-						if( sd_result == SD_OK )
-						{
-							sd_result = HAL_SD_CheckWriteOperation( &xSDHandle, sdMAX_TIME_TICKS );
-							if( sd_result != SD_OK )
-							{
-								break;
-							}
-						}
-					}
-					ffconfigFREE( pucDMABuffer );
-				}
-				else
-				{
-					sd_result = SD_INVALID_PARAMETER;
-				}
-			}
-		}
-		#endif	/* SDIO_USES_DMA */
+		xResult = SDCARD_WriteBlocks( pucBuffer, ulSectorNumber, ulSectorCount );
 
-		//if( sd_result == SD_OK )
+		if( xResult == SDCARD_OK )
 		{
 			/* No errors. */
 			lReturnCode = 0L;
 		}
-		//else
-		//{
-		//	FF_PRINTF( "prvFFWrite: %lu: %u (%s)\n", ulSectorNumber, sd_result, prvSDCodePrintable( sd_result ) );
-		//}
+		else
+		{
+			lReturnCode = FF_ERR_DEVICE_DRIVER_FAILED | FF_ERRFLAG;
+			FF_PRINTF( "prvFFWrite: %lu: %u\n", ulSectorNumber, xResult );
+		}
 	}
 	else
 	{
@@ -430,7 +338,7 @@ FF_Disk_t *pxDisk;
 			/* Initialise the created disk structure. */
 			memset( pxDisk, '\0', sizeof( *pxDisk ) );
 
-			pxDisk->ulNumberOfSectors = (1024 * 2 * 2048); // (1024*1024*2048)/512; // xSDCardInfo.CardCapacity / 512;
+			pxDisk->ulNumberOfSectors = SDCARD_GetSectorCount();
 
 			if( xPlusFATMutex == NULL )
 			{
@@ -537,16 +445,17 @@ BaseType_t xReturn = pdPASS;
 
 	if( ( pxDisk != NULL ) && ( pxDisk->xStatus.bIsMounted != pdFALSE ) )
 	{
-		pxDisk->xStatus.bIsMounted = pdFALSE;
 		xFFError = FF_Unmount( pxDisk );
 
 		if( FF_isERR( xFFError ) )
 		{
+			/* Files still open: the partition stays mounted. */
 			FF_PRINTF( "FF_SDDiskUnmount: rc %08x\n", ( unsigned )xFFError );
 			xReturn = pdFAIL;
 		}
 		else
 		{
+			pxDisk->xStatus.bIsMounted = pdFALSE;
 			FF_PRINTF( "Drive unmounted\n" );
 		}
 	}
@@ -623,7 +532,7 @@ BaseType_t FF_SDDiskDelete( FF_Disk_t *pxDisk )
 			FF_DeleteIOManager( pxDisk->pxIOManager );
 		}
 
-		vPortFree( pxDisk );
+		ffconfigFREE( pxDisk );
 	}
 	return 1;
 }
@@ -815,30 +724,16 @@ static BaseType_t prvSDMMCInit( BaseType_t xDriveNumber )
 	/* When starting up, skip debouncing of the Card Detect signal. */
 	xCardDetect.bLastPresent = pdTRUE;
 	xCardDetect.bStableSignal = pdTRUE;
-	/* Initialise the SDIO device and read the card parameters. */
-	//SD_state = HAL_SD_Init( &xSDHandle, &xSDCardInfo );
-	#if( BUS_4BITS != 0 )
-    {
-		if( SD_state == SD_OK )
-		{
-			HAL_SD_ErrorTypedef rc;
+	/* Initialise the card [SPI mode] and read its capacity. */
+	if( SDCARD_Init() != SDCARD_OK )
+	{
+		FF_PRINTF( "SD card initialisation failed\n" );
+		return 0;
+	}
 
-			xSDHandle.Init.BusWide = SDIO_BUS_WIDE_4B;
-			rc = HAL_SD_WideBusOperation_Config(&xSDHandle, SDIO_BUS_WIDE_4B);
-			if( rc != SD_OK )
-			{
-				FF_PRINTF( "HAL_SD_WideBus: %d: %s\n", rc, prvSDCodePrintable( ( uint32_t )rc ) );
-			}
-		}
-    }
-	#endif
-//    FF_PRINTF( "HAL_SD_Init: %d: %s type: %s Capacity: %lu MB\n",
-//        SD_state,
-//        prvSDCodePrintable( ( uint32_t )SD_state ),
-//        xSDHandle.CardType == HIGH_CAPACITY_SD_CARD ? "SDHC" : "SD",
-//        xSDCardInfo.CardCapacity / ( 1024 * 1024 ) );
+	FF_PRINTF( "SD card: %lu MB\n", SDCARD_GetSectorCount() / sdSECTORS_PER_MB );
 
-	return /*SD_state == SD_OK ? */ 1 /*: 0*/;
+	return 1;
 }
 /*-----------------------------------------------------------*/
 
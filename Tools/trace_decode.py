@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+"""
+Decoder for the OrionPlus event trace (TraceRecorder).
+
+Accepts either:
+  - a serial capture of the $T command (lines between '#TRACE' and '#END', anything else ignored)
+  - the binary file written by the $TS command (trace.bin on the SD card)
+
+Prints a timeline with one column per lane and flags the gaps where the step ticker had no block to
+run while a job was in progress (BLOCK_FINISH followed by a late BLOCK_START), with the events seen
+in between as the likely cause.
+
+Usage: trace_decode.py <capture.txt | trace.bin> [--stall-us 1000] [--stalls-only]
+"""
+
+import argparse
+import struct
+import sys
+
+FILE_MAGIC = 0x4352544F
+HEADER_FORMAT = '<5I'
+EVENT_FORMAT = '<IBBH'
+
+# Same order as TRACE_EVENT_IDS in TraceRecorder.h: (name, lane)
+EVENTS = [
+    ('NONE',              'SYSTEM'),
+    ('BLOCK_START',       'ISR'),
+    ('BLOCK_FINISH',      'ISR'),
+    ('BLOCK_LOCKED',      'ISR'),
+    ('QUEUE_EMPTY',       'ISR'),
+    ('ISR_OVERRUN',       'ISR'),
+    ('QUEUE_RELEASE',     'QUEUE'),
+    ('QUEUE_FULL',        'QUEUE'),
+    ('QUEUE_SPACE',       'QUEUE'),
+    ('APPEND_ENTER',      'PLANNER'),
+    ('APPEND_EXIT',       'PLANNER'),
+    ('REPLAN_BEGIN',      'PLANNER'),
+    ('REPLAN_END',        'PLANNER'),
+    ('FEED_HOLD',         'SYSTEM'),
+    ('ALARM',             'SYSTEM'),
+    ('FLASH_WRITE_BEGIN', 'SYSTEM'),
+    ('FLASH_WRITE_END',   'SYSTEM'),
+]
+
+LANES = ['ISR', 'QUEUE', 'PLANNER', 'SYSTEM']
+LANE_WIDTH = 24
+
+HOLD_STAGES = {0: 'requested', 1: 'stopped', 2: 'resumed'}
+REPLAN_KINDS = {0: 'hold', 1: 'override'}
+
+
+def load_binary(data):
+    magic, version, cpu_hz, total, count = struct.unpack_from(HEADER_FORMAT, data, 0)
+
+    if magic != FILE_MAGIC:
+        raise ValueError('not a trace file (bad magic)')
+
+    offset = struct.calcsize(HEADER_FORMAT)
+    size = struct.calcsize(EVENT_FORMAT)
+    events = []
+
+    for index in range(count):
+        if offset + size > len(data):
+            break
+        events.append(struct.unpack_from(EVENT_FORMAT, data, offset))
+        offset += size
+
+    return version, cpu_hz, total, events
+
+
+def load_text(text):
+    header = None
+    events = []
+
+    for line in text.splitlines():
+        fields = line.strip().split()
+
+        if not fields:
+            continue
+
+        if fields[0] == '#TRACE':
+            header = [int(value) for value in fields[1:5]]
+            events = []
+            continue
+
+        if header is None:
+            continue
+
+        if fields[0] == '#END':
+            break
+
+        if len(fields) != 4:
+            continue
+
+        try:
+            events.append(tuple(int(value, 16) for value in fields))
+        except ValueError:
+            continue
+
+    if header is None:
+        raise ValueError('no #TRACE header found')
+
+    version, cpu_hz, total, _ = header
+    return version, cpu_hz, total, events
+
+
+def load(path):
+    with open(path, 'rb') as stream:
+        data = stream.read()
+
+    if len(data) >= 4 and struct.unpack_from('<I', data, 0)[0] == FILE_MAGIC:
+        return load_binary(data)
+
+    return load_text(data.decode('ascii', errors='replace'))
+
+
+def unwrap(events):
+    """Cycle counter timestamps (32 bit, wraps every ~25 s at 168 MHz) to a monotonic count.
+    Deltas are signed: events recorded by concurrent contexts may be slightly out of order."""
+    result = []
+    previous = None
+    current = 0
+
+    for timestamp, event, arg8, arg16 in events:
+        if previous is not None:
+            delta = (timestamp - previous) & 0xFFFFFFFF
+
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+
+            current += delta
+
+        previous = timestamp
+        result.append((current, event, arg8, arg16))
+
+    return result
+
+
+def describe(event, arg8, arg16):
+    name = EVENTS[event][0] if event < len(EVENTS) else 'EVENT_%02X' % event
+
+    if name in ('BLOCK_START',):
+        return '%s #%u q=%u' % (name, arg16, arg8)
+    if name in ('BLOCK_FINISH', 'BLOCK_LOCKED'):
+        return '%s #%u' % (name, arg16)
+    if name == 'QUEUE_RELEASE':
+        return '%s q=%u' % (name, arg8)
+    if name == 'APPEND_EXIT':
+        return name if arg8 else name + ' (no move)'
+    if name in ('REPLAN_BEGIN', 'REPLAN_END'):
+        return '%s %s' % (name, REPLAN_KINDS.get(arg8, arg8))
+    if name == 'FEED_HOLD':
+        return '%s %s' % (name, HOLD_STAGES.get(arg8, arg8))
+    if name == 'ALARM':
+        return '%s 0x%04X' % (name, arg16)
+    if name == 'FLASH_WRITE_END':
+        return name if arg8 else name + ' FAILED'
+    if name == 'ISR_OVERRUN':
+        return '%s cnt=%u' % (name, arg16)
+
+    return name
+
+
+def lane_of(event):
+    return EVENTS[event][1] if event < len(EVENTS) else 'SYSTEM'
+
+
+def find_stalls(events, cycles_per_us, stall_us):
+    """Gaps between the end of a block and the start of the next one, while motion was expected to go on"""
+    stalls = []
+    finish = None
+    causes = set()
+
+    for time, event, arg8, arg16 in events:
+        name = EVENTS[event][0] if event < len(EVENTS) else ''
+
+        if name == 'BLOCK_FINISH':
+            finish = time
+            causes = set()
+            continue
+
+        if finish is None:
+            continue
+
+        if name == 'BLOCK_START':
+            gap_us = (time - finish) / cycles_per_us
+
+            if gap_us >= stall_us:
+                stalls.append((finish, gap_us, sorted(causes) or ['unknown']))
+
+            finish = None
+        elif name == 'QUEUE_EMPTY':
+            causes.add('queue empty')
+        elif name == 'BLOCK_LOCKED':
+            causes.add('block locked by replan')
+        elif name == 'FLASH_WRITE_BEGIN':
+            causes.add('settings flash write')
+        elif name == 'FEED_HOLD':
+            # Intentional stop, not a stall
+            finish = None
+        elif name == 'ALARM':
+            finish = None
+
+    return stalls
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Render an OrionPlus event trace as a timeline')
+    parser.add_argument('trace', help='serial capture of $T or trace.bin written by $TS')
+    parser.add_argument('--stall-us', type=float, default=1000.0, help='block to block gap reported as a stall [us]')
+    parser.add_argument('--stalls-only', action='store_true', help='only print the stall summary')
+    args = parser.parse_args()
+
+    try:
+        version, cpu_hz, total, raw_events = load(args.trace)
+    except (OSError, ValueError, struct.error) as error:
+        sys.stderr.write('%s: %s\n' % (args.trace, error))
+        return 1
+
+    cycles_per_us = cpu_hz / 1e6 if cpu_hz else 168.0
+    events = unwrap(raw_events)
+
+    print('trace v%u, %u Hz, %u events recorded, %u in dump%s' %
+          (version, cpu_hz, total, len(events), ' (oldest overwritten)' if total > len(events) else ''))
+
+    if not args.stalls_only and events:
+        start = events[0][0]
+        previous = start
+
+        print('%12s %10s  %s' % ('time us', 'delta us', ''.join(lane.ljust(LANE_WIDTH) for lane in LANES).rstrip()))
+
+        for time, event, arg8, arg16 in events:
+            columns = [''] * len(LANES)
+            columns[LANES.index(lane_of(event))] = describe(event, arg8, arg16)
+
+            print('%12.1f %10.1f  %s' % ((time - start) / cycles_per_us, (time - previous) / cycles_per_us,
+                                         ''.join(column.ljust(LANE_WIDTH) for column in columns).rstrip()))
+            previous = time
+
+    stalls = find_stalls(events, cycles_per_us, args.stall_us)
+
+    print('')
+    print('%u stall(s) >= %.0f us' % (len(stalls), args.stall_us))
+
+    if stalls:
+        start = events[0][0]
+        summary = {}
+
+        for time, gap_us, causes in stalls:
+            print('  at %12.1f us: %10.1f us  %s' % ((time - start) / cycles_per_us, gap_us, ', '.join(causes)))
+
+            for cause in causes:
+                summary[cause] = summary.get(cause, 0) + 1
+
+        for cause in sorted(summary):
+            print('  %-24s %u' % (cause, summary[cause]))
+
+    overruns = sum(1 for event in events if event[1] < len(EVENTS) and EVENTS[event[1]][0] == 'ISR_OVERRUN')
+
+    if overruns:
+        print('%u step ISR overrun(s)' % overruns)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())